@@ -193,6 +193,28 @@ AC_DEFUN([CGPS_ENABLE_FOREIGN_CLIENT],
   AM_CONDITIONAL(FOREIGN_CLIENT, test "x$foreign" = "xtrue")
 ])
 
+dnl
+dnl Should the programs be built against the stub of libchemgps and
+dnl libsimcaq (see libcgpsstub/README)? Useful for testing and profiling
+dnl on systems without SIMCA-QP.
+dnl
+AC_DEFUN([CGPS_ENABLE_STUB_BACKEND],
+[
+  AC_ARG_ENABLE([stub], [  --enable-stub           Build against stub of libchemgps and SIMCA-QP (for testing)],
+  [ case "${enableval}" in
+      yes) stub=true ;;
+      no)  stub=false ;;
+      *) AC_MSG_ERROR(bad value ${enableval} for --enable-stub) ;;
+    esac
+  ], [stub=false])
+  if test "x$stub" = "xtrue"; then
+    AC_CHECK_LIB([m], [sqrt])
+    AC_SUBST(SIMCAQ_LIBDIR, ['${abs_top_builddir}/libcgpsstub'])
+    AC_SUBST(SIMCAQ_INCDIR, ['${abs_top_srcdir}/libcgpsstub'])
+  fi
+  AM_CONDITIONAL(STUB_BACKEND, test "x$stub" = "xtrue")
+])
+
 dnl
 dnl Should the utilities be built?
 dnl
@@ -430,3 +452,24 @@ AC_DEFUN([CGPS_CHECK_THREADING],
       ])
   fi
 ])
+
+dnl
+dnl Check for lz4 and zstd (stream compression of the CGPSP protocol). The
+dnl compressed streams requires fopencookie(). The libraries are added to
+dnl LIBS as the compression is used by most programs.
+dnl
+AC_DEFUN([CGPS_CHECK_COMPRESSION],
+[
+  AC_ARG_WITH([lz4], [  --without-lz4           Don't use lz4 for stream compression],
+  [ cgps_use_lz4=${withval} ], [ cgps_use_lz4=yes ])
+  AC_ARG_WITH([zstd], [  --without-zstd          Don't use zstd for stream compression],
+  [ cgps_use_zstd=${withval} ], [ cgps_use_zstd=yes ])
+
+  AC_CHECK_FUNCS([fopencookie], [], [cgps_use_lz4=no; cgps_use_zstd=no])
+  if test "x$cgps_use_lz4" != "xno"; then
+    AC_CHECK_HEADER([lz4frame.h], [AC_CHECK_LIB([lz4], [LZ4F_compressBegin])])
+  fi
+  if test "x$cgps_use_zstd" != "xno"; then
+    AC_CHECK_HEADER([zstd.h], [AC_CHECK_LIB([zstd], [ZSTD_compressStream2])])
+  fi
+])
@@ -0,0 +1,319 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Load balanced requests (more than one daemon endpoint). The request is
+ * run through libcgpsclt that spreads requests over the endpoints and
+ * fails over to another endpoint on errors.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#include "cgpssqp.h"
+#include "cgpsclt.h"
+#include "libcgpsclt.h"
+#include "datafile.h"
+
+/*
+ * Append comma separated list of endpoints to endpoint string. TCP
+ * endpoints without port gets the port number appended and UNIX socket
+ * paths are prefixed with unix:.
+ */
+static char * balance_append(char *endpoints, const char *list, int local, uint16_t port)
+{
+	const char *curr, *next;
+	size_t used = endpoints ? strlen(endpoints) : 0;
+
+	for(curr = list; curr; curr = next) {
+		size_t len, i;
+		int colons = 0;
+		char *ptr;
+
+		if((next = strchr(curr, ','))) {
+			len = next++ - curr;
+		} else {
+			len = strlen(curr);
+		}
+		if(!len) {
+			continue;
+		}
+		for(i = 0; i < len; ++i) {
+			if(curr[i] == ':') {
+				++colons;
+			}
+		}
+		if(!(ptr = realloc(endpoints, used + len + 16))) {
+			die("failed alloc memory");
+		}
+		endpoints = ptr;
+		ptr += used;
+		if(used) {
+			*ptr++ = ',';
+		}
+		if(local) {
+			sprintf(ptr, "unix:%.*s", (int)len, curr);
+		} else if(curr[0] == '[') {
+			if(curr[len - 1] == ']') {
+				sprintf(ptr, "%.*s:%u", (int)len, curr, port);
+			} else {
+				sprintf(ptr, "%.*s", (int)len, curr);
+			}
+		} else if(colons == 0) {
+			sprintf(ptr, "%.*s:%u", (int)len, curr, port);
+		} else if(colons == 1) {
+			sprintf(ptr, "%.*s", (int)len, curr);
+		} else {
+			sprintf(ptr, "[%.*s]:%u", (int)len, curr, port);
+		}
+		used = strlen(endpoints);
+	}
+	return endpoints;
+}
+
+/*
+ * Build the endpoint list from the --host and --sock options. Returns NULL
+ * if only a single endpoint was requested (unless in parallel mode).
+ */
+char * balance_endpoints(struct options *popt)
+{
+	char *endpoints = NULL;
+	int num = 0;
+
+	if(popt->ipaddr) {
+		num += 1 + (strchr(popt->ipaddr, ',') != NULL);
+	}
+	if(popt->unaddr) {
+		num += 1 + (strchr(popt->unaddr, ',') != NULL);
+	}
+	if(num < 2 && !popt->parallel) {
+		return NULL;
+	}
+	if(!num) {
+		return balance_append(NULL, CGPSD_DEFAULT_SOCK, 1, 0);
+	}
+
+	if(popt->unaddr) {
+		endpoints = balance_append(endpoints, popt->unaddr, 1, 0);
+	}
+	if(popt->ipaddr) {
+		endpoints = balance_append(endpoints, popt->ipaddr, 0, popt->port ? popt->port : CGPSD_DEFAULT_PORT);
+	}
+	return endpoints;
+}
+
+/*
+ * Returns the colon separated list of result names (the Predict: option).
+ */
+char * balance_result(struct options *popt)
+{
+	const struct cgps_result_entry *entry;
+	size_t length = 1;
+	char *result;
+
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(cgps_result_isset(popt->cgps->result, entry->value)) {
+			length += strlen(entry->name) + 1;
+		}
+	}
+	if(!(result = malloc(length))) {
+		die("failed alloc memory");
+	}
+	*result = '\0';
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(cgps_result_isset(popt->cgps->result, entry->value)) {
+			if(*result) {
+				strcat(result, ":");
+			}
+			strcat(result, entry->name);
+		}
+	}
+	return result;
+}
+
+/*
+ * Read input data from file, memory buffer or stdin. The returned buffer
+ * should be freed unless its popt->data. Descriptor files (.cgpsx) are
+ * formatted as text.
+ */
+char * balance_read_data(struct options *popt, size_t *size)
+{
+	struct cgps_datafile *file;
+	struct stat st;
+	FILE *fs = stdin;
+	char *buff = NULL, *ptr;
+	size_t capacity = 0, bytes;
+
+	if(popt->data) {
+		if(stat(popt->data, &st) != 0) {
+			*size = strlen(popt->data);
+			return popt->data;
+		}
+		if(cgps_datafile_check(popt->data)) {
+			if(!(file = cgps_datafile_open(popt->data))) {
+				return NULL;
+			}
+			if(!(fs = open_memstream(&buff, size))) {
+				logerr("failed open memory stream");
+				cgps_datafile_close(file);
+				return NULL;
+			}
+			if(cgps_datafile_text(file, 0, file->rows, NULL, 0, fs) < 0) {
+				logerr("failed format data file %s", popt->data);
+			}
+			fclose(fs);
+			cgps_datafile_close(file);
+			return buff;
+		}
+		if(!(fs = fopen(popt->data, "r"))) {
+			logerr("failed open data file %s", popt->data);
+			return NULL;
+		}
+	} else {
+		loginfo("waiting for raw data input on stdin (ctrl+d to send)");
+	}
+
+	*size = 0;
+	do {
+		if(*size == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			if(!(ptr = realloc(buff, capacity))) {
+				die("failed alloc memory");
+			}
+			buff = ptr;
+		}
+		bytes = fread(buff + *size, 1, capacity - *size, fs);
+		*size += bytes;
+	} while(bytes);
+
+	if(ferror(fs)) {
+		logerr("failed read input data");
+		free(buff);
+		buff = NULL;
+	}
+	if(fs != stdin) {
+		fclose(fs);
+	}
+	return buff;
+}
+
+/*
+ * Open worker pool with workers threads against popt->endpoints.
+ */
+struct cgpsclt_pool * balance_open(struct options *popt, int workers)
+{
+	struct cgpsclt_pool *pool;
+
+	debug("opening pool for endpoints %s (%d workers)", popt->endpoints, workers);
+	if(!(pool = cgpsclt_pool_open(popt->endpoints, workers))) {
+		logerr("failed open worker pool (%s)", popt->endpoints);
+		return NULL;
+	}
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_TIMEOUT, popt->timeout * 1000);
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_RETRIES, CGPSCLT_RETRY_LIMIT);
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_RETRY_SLEEP, 1000);
+	return pool;
+}
+
+/*
+ * Make request using the daemons in popt->endpoints.
+ */
+int balance_request(struct options *popt)
+{
+	struct cgpsclt_pool *pool;
+	struct cgpsclt_request *req;
+	FILE *fsout = stdout;
+	char *data, *result;
+	const char *output;
+	size_t size, length;
+	int status;
+
+	if(!(data = balance_read_data(popt, &size))) {
+		return -1;
+	}
+	if(!(pool = balance_open(popt, 1))) {
+		if(data != popt->data) {
+			free(data);
+		}
+		return -1;
+	}
+
+	result = balance_result(popt);
+	if(!(req = cgpsclt_submit(pool, result,
+				  popt->cgps->format == CGPS_OUTPUT_FORMAT_PLAIN ? CGPSCLT_FORMAT_PLAIN : CGPSCLT_FORMAT_XML,
+				  data, size, NULL, NULL))) {
+		logerr("failed submit request");
+		status = CGPSCLT_STATUS_FAILED;
+	} else {
+		status = cgpsclt_wait(req);
+	}
+
+	if(status == CGPSCLT_STATUS_SUCCESS) {
+		if(popt->output && !(fsout = fopen(popt->output, "w"))) {
+			logerr("failed open output file %s", popt->output);
+			status = CGPSCLT_STATUS_FAILED;
+		} else {
+			output = cgpsclt_output(req, &length);
+			if(!popt->quiet) {
+				fwrite(output, 1, length, fsout);
+			}
+			if(fsout != stdout) {
+				fclose(fsout);
+			}
+		}
+	} else if(req) {
+		errno = 0;
+		logerr("request failed: %s", cgpsclt_error(req));
+	}
+
+	if(req) {
+		cgpsclt_release(req);
+	}
+	cgpsclt_pool_close(pool);
+	if(data != popt->data) {
+		free(data);
+	}
+	free(result);
+
+	return status == CGPSCLT_STATUS_SUCCESS ? 0 : -1;
+}
@@ -32,10 +32,28 @@ int init_socket(struct options *popt);
 int request(struct options *popt, struct client *peer);
 int client_connect(struct options *popt);
 
+struct cgpsclt_pool;
+
+char * balance_endpoints(struct options *popt);
+char * balance_result(struct options *popt);
+char * balance_read_data(struct options *popt, size_t *size);
+struct cgpsclt_pool * balance_open(struct options *popt, int workers);
+int balance_request(struct options *popt);
+
+int parallel_request(struct options *popt);
+
+int schema_send(struct options *popt, struct client *peer, unsigned long long fingerprint);
+
+int download_result(int sock, int out, int binary);
+ssize_t download_read_request(int sock, char **buff, size_t *size);
+
 #define CGPSCLT_CONN_FAILED -1    /* permanent connection error */
 #define CGPSCLT_CONN_SUCCESS 0    /* successful connected */
 #define CGPSCLT_CONN_RETRY   1    /* temporary connection error (retry) */
 
+#define CGPSCLT_PARALLEL_DEFAULT 4      /* concurrent requests (batch mode) */
+#define CGPSCLT_CHUNK_ROWS_DEFAULT 1000 /* rows in each request (batch mode) */
+
 #if ! defined(CGPSCLT_EXTERN)
 
 # define CGPSCLT_RETRY_LIMIT 12   /* number of connect/request retries */
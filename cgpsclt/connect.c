@@ -29,6 +29,11 @@
 # include "config.h"
 #endif
 
+#include <stdio.h>
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
 #include "cgpssqp.h"
 #include "cgpsclt.h"
 
@@ -79,6 +84,7 @@ int client_connect(struct options *popt)
 		return -1;
 	}
 	
+	memset(&peer, 0, sizeof(struct client));
 	peer.sock = popt->unsock ? popt->unsock : popt->ipsock;
 	peer.opts = popt;
 	
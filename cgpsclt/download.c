@@ -0,0 +1,511 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Download of the prediction result. The result is read direct from the
+ * socket (not thru the socket stream) and moved to the output file with
+ * splice(), thru a pipe unless the output is a pipe itself. The result is
+ * never copied to user space, except for peeking at the text result for
+ * the result lines preceding the result of each model. Outputs that can't 
+ * be spliced to (i.e. a terminal) are written in large read/write blocks.
+ * 
+ * The socket stream must not have buffered input when the download is
+ * started. This holds once the input data has been sent, as the daemon
+ * don't send anything while waiting for input data.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#endif
+
+#include "cgpssqp.h"
+#include "cgpsclt.h"
+#include "binary.h"
+
+#define DOWNLOAD_BUFFER  65536        /* max bytes moved in each call */
+#define DOWNLOAD_RESULT  "Result:\n"  /* result line preceding each model */
+#define DOWNLOAD_RESLEN  8
+
+struct download
+{
+	int sock;             /* peer socket */
+	int out;              /* output descriptor (-1 if discarded) */
+	int null;             /* out is opened /dev/null */
+	int pipe[2];          /* splice pipe (-1 if out is a pipe) */
+	int splice;           /* move data with splice() */
+	char buff[DOWNLOAD_BUFFER];
+};
+
+/*
+ * Write size bytes from buff to output.
+ */
+static int download_write(struct download *dl, const char *buff, size_t size)
+{
+	ssize_t bytes;
+	
+	while(size && dl->out >= 0) {
+		if((bytes = write(dl->out, buff, size)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed write result");
+			return -1;
+		}
+		buff += bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
+/*
+ * Receive size bytes from socket to buff. Returns number of bytes received
+ * (less than size on end of stream) or -1 on failure.
+ */
+static ssize_t download_recv(struct download *dl, char *buff, size_t size)
+{
+	size_t used = 0;
+	ssize_t bytes;
+	
+	while(used < size) {
+		if((bytes = recv(dl->sock, buff + used, size - used, MSG_WAITALL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if(bytes == 0) {
+			break;
+		}
+		used += bytes;
+	}
+	return used;
+}
+
+#ifdef HAVE_SPLICE
+/*
+ * Move bytes from the splice pipe to output. Falls back on copying the pipe
+ * content if splice to output is not supported.
+ */
+static int download_drain(struct download *dl, size_t bytes)
+{
+	ssize_t moved;
+	
+	while(bytes) {
+		if(dl->splice) {
+			moved = splice(dl->pipe[0], NULL, dl->out, NULL, bytes, SPLICE_F_MOVE | SPLICE_F_MORE);
+		} else {
+			moved = read(dl->pipe[0], dl->buff, bytes);
+		}
+		if(moved < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(dl->splice && errno == EINVAL) {
+				debug("output don't support splice, using read/write");
+				dl->splice = 0;
+				continue;
+			}
+			logerr("failed write result");
+			return -1;
+		}
+		if(!dl->splice && download_write(dl, dl->buff, moved) < 0) {
+			return -1;
+		}
+		bytes -= moved;
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Move at most bytes of result from socket to output. Returns number of 
+ * bytes moved (0 on end of stream) or -1 on failure.
+ */
+static ssize_t download_chunk(struct download *dl, size_t bytes)
+{
+	ssize_t moved;
+	
+	if(bytes > DOWNLOAD_BUFFER) {
+		bytes = DOWNLOAD_BUFFER;
+	}
+#ifdef HAVE_SPLICE
+	if(dl->splice) {
+		moved = splice(dl->sock, NULL, dl->pipe[1] < 0 ? dl->out : dl->pipe[1], NULL, bytes, SPLICE_F_MOVE | SPLICE_F_MORE);
+		if(moved > 0 && dl->pipe[1] >= 0 && download_drain(dl, moved) < 0) {
+			return -1;
+		}
+		if(moved >= 0 || errno != EINVAL) {
+			return moved;
+		}
+		debug("socket or output don't support splice, using read/write");
+		dl->splice = 0;
+	}
+#endif
+	if((moved = read(dl->sock, dl->buff, bytes)) > 0 && download_write(dl, dl->buff, moved) < 0) {
+		return -1;
+	}
+	return moved;
+}
+
+/*
+ * Move bytes of result from socket to output. Returns number of bytes moved
+ * (less than bytes on end of stream) or -1 on failure.
+ */
+static ssize_t download_move(struct download *dl, size_t bytes)
+{
+	size_t moved = 0;
+	ssize_t size;
+	
+	while(moved < bytes) {
+		if((size = download_chunk(dl, bytes - moved)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if(size == 0) {
+			break;
+		}
+		moved += size;
+	}
+	return moved;
+}
+
+/*
+ * Returns the offset of the first result line in buff (size bytes) or -1
+ * if not found. The bol argument tells if buff starts at beginning of a
+ * line. The partial argument is set to the offset of the line ending buff
+ * if it might be the start of a result line, otherwise to size.
+ */
+static ssize_t download_find(const char *buff, size_t size, int bol, size_t *partial)
+{
+	const char *ptr, *end = buff + size;
+	size_t left;
+	
+	*partial = size;
+	if(!(ptr = bol ? buff : memchr(buff, '\n', size))) {
+		return -1;
+	}
+	if(!bol) {
+		++ptr;
+	}
+	
+	while(ptr && ptr < end) {
+		left = end - ptr;
+		if(left >= DOWNLOAD_RESLEN) {
+			if(memcmp(ptr, DOWNLOAD_RESULT, DOWNLOAD_RESLEN) == 0) {
+				return ptr - buff;
+			}
+		} else if(memcmp(ptr, DOWNLOAD_RESULT, left) == 0) {
+			*partial = ptr - buff;
+			return -1;
+		}
+		if((ptr = memchr(ptr, '\n', end - ptr))) {
+			++ptr;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Handle a line at start of socket being the start of a result line, but
+ * not yet fully received. The line is read (not peeked) until known if its
+ * a result line or not.
+ */
+static int download_split(struct download *dl, int *bol)
+{
+	char line[DOWNLOAD_RESLEN], *ptr;
+	size_t used = 0, start;
+	ssize_t bytes;
+	
+	while(1) {
+		if((bytes = download_recv(dl, line + used, DOWNLOAD_RESLEN - used)) < 0) {
+			logerr("failed read result");
+			return -1;
+		}
+		used += bytes;
+		if(used < DOWNLOAD_RESLEN) {
+			*bol = used && line[used - 1] == '\n';
+			return download_write(dl, line, used);
+		}
+		if(memcmp(line, DOWNLOAD_RESULT, DOWNLOAD_RESLEN) == 0) {
+			*bol = 1;
+			return 0;
+		}
+		
+		/*
+		 * Keep the last line if it might be the start of a result line.
+		 */
+		for(ptr = line + used - 1; ptr > line && ptr[-1] != '\n'; --ptr) {
+			;
+		}
+		start = ptr - line;
+		if(start == 0 || memcmp(ptr, DOWNLOAD_RESULT, used - start) != 0) {
+			*bol = line[used - 1] == '\n';
+			return download_write(dl, line, used);
+		}
+		if(download_write(dl, line, start) < 0) {
+			return -1;
+		}
+		memmove(line, ptr, used - start);
+		used -= start;
+	}
+}
+
+/*
+ * Move the text result (plain or XML) to output, dropping the result line
+ * preceding the result of each model. 
+ */
+static int download_text(struct download *dl)
+{
+	char line[DOWNLOAD_RESLEN];
+	size_t partial;
+	ssize_t bytes, found;
+	int bol = 1;
+	
+	while((bytes = recv(dl->sock, dl->buff, sizeof(dl->buff), MSG_PEEK)) != 0) {
+		if(bytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed read result");
+			return -1;
+		}
+		if((found = download_find(dl->buff, bytes, bol, &partial)) >= 0) {
+			if(download_move(dl, found) != found || 
+			   download_recv(dl, line, DOWNLOAD_RESLEN) != DOWNLOAD_RESLEN) {
+				logerr("failed read result");
+				return -1;
+			}
+			bol = 1;
+		} else if(partial) {
+			bol = dl->buff[partial - 1] == '\n';
+			if(download_move(dl, partial) != (ssize_t)partial) {
+				logerr("failed read result");
+				return -1;
+			}
+		} else if(download_split(dl, &bol) < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Move the binary result blocks to output. The header of each block is
+ * read to get the size of the result arrays, that are moved in one go.
+ * Each block is preceded by a result line.
+ */
+static int download_binary(struct download *dl)
+{
+	char head[CGPS_BINARY_HEADER + CGPS_BINARY_RESULTS * CGPS_BINARY_ENTRY];
+	uint64_t bytes;
+	uint32_t num;
+	size_t size;
+	ssize_t used;
+	char *ptr;
+	
+	while(1) {
+		if(download_recv(dl, head, CGPS_BINARY_HEADER) != CGPS_BINARY_HEADER) {
+			logerr("failed read binary result header");
+			return -1;
+		}
+		if(cgps_binary_check(head, &num) < 0) {
+			return -1;
+		}
+		size = CGPS_BINARY_HEADER + num * CGPS_BINARY_ENTRY;
+		if(download_recv(dl, head + CGPS_BINARY_HEADER, size - CGPS_BINARY_HEADER) != (ssize_t)(size - CGPS_BINARY_HEADER)) {
+			logerr("failed read binary result entries");
+			return -1;
+		}
+		if(download_write(dl, head, size) < 0) {
+			return -1;
+		}
+		bytes = cgps_binary_length(head, num);
+		if(download_move(dl, bytes) != (ssize_t)bytes) {
+			logerr("failed read binary result");
+			return -1;
+		}
+		
+		if((used = download_recv(dl, head, DOWNLOAD_RESLEN)) == 0) {
+			return 0;
+		}
+		if(used != DOWNLOAD_RESLEN || memcmp(head, DOWNLOAD_RESULT, DOWNLOAD_RESLEN) != 0) {
+			ptr = used > 0 ? memchr(head, '\n', used) : NULL;
+			errno = 0;
+			logerr("protocol error (%.*s unexpected)", (int)(ptr ? ptr - head : (used > 0 ? used : 0)), head);
+			return -1;
+		}
+	}
+}
+
+/*
+ * Move the rest of the stream to output without looking at it.
+ */
+static int download_discard(struct download *dl)
+{
+	ssize_t bytes;
+	
+	while((bytes = download_chunk(dl, DOWNLOAD_BUFFER)) != 0) {
+		if(bytes < 0 && errno != EINTR) {
+			logerr("failed read result");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Setup the download to output. Splice is used for regular files and pipes
+ * (and /dev/null when discarding the result).
+ */
+static void download_open(struct download *dl, int sock, int out)
+{
+	dl->sock = sock;
+	dl->out = out;
+	dl->null = 0;
+	dl->pipe[0] = dl->pipe[1] = -1;
+	dl->splice = 0;
+	
+	if(out < 0 && (dl->out = open("/dev/null", O_WRONLY)) >= 0) {
+		dl->null = 1;
+	}
+#ifdef HAVE_SPLICE
+	if(dl->out >= 0) {
+		struct stat st;
+		
+		if(fstat(dl->out, &st) == 0) {
+			if(S_ISFIFO(st.st_mode)) {
+				dl->splice = 1;
+			} else if(S_ISREG(st.st_mode) || dl->null) {
+				dl->splice = pipe(dl->pipe) == 0;
+			}
+		}
+	}
+#endif
+	debug("downloading result %s", dl->splice ? "using splice" : "using read/write");
+}
+
+static void download_close(struct download *dl)
+{
+	if(dl->pipe[0] != -1) {
+		close(dl->pipe[0]);
+		close(dl->pipe[1]);
+	}
+	if(dl->null) {
+		close(dl->out);
+	}
+}
+
+int download_result(int sock, int out, int binary)
+{
+	struct download *dl;
+	int result;
+	
+	if(!(dl = malloc(sizeof(struct download)))) {
+		die("failed alloc memory");
+	}
+	download_open(dl, sock, out);
+	if(out < 0) {
+		result = download_discard(dl);
+	} else if(binary) {
+		result = download_binary(dl);
+	} else {
+		result = download_text(dl);
+	}
+	download_close(dl);
+	free(dl);
+	
+	return result;
+}
+
+ssize_t download_read_request(int sock, char **buff, size_t *size)
+{
+	size_t used = 0;
+	ssize_t bytes;
+	char *ptr;
+	
+	while(1) {
+		if(*size - used < 2) {
+			if(!(ptr = realloc(*buff, *size ? *size * 2 : 128))) {
+				die("failed alloc memory");
+			}
+			*buff = ptr;
+			*size = *size ? *size * 2 : 128;
+		}
+		if((bytes = recv(sock, *buff + used, *size - used - 1, MSG_PEEK)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if(bytes == 0) {
+			return -1;
+		}
+		/*
+		 * Consume the line if peeked in full, otherwise all peeked data.
+		 */
+		if((ptr = memchr(*buff + used, '\n', bytes))) {
+			bytes = ptr - (*buff + used) + 1;
+		}
+		if(recv(sock, *buff + used, bytes, 0) != bytes) {
+			return -1;
+		}
+		used += bytes;
+		if(ptr) {
+			break;
+		}
+	}
+	(*buff)[used - 1] = '\0';
+	if(opts->debug > 1) {
+		debug("got %d bytes from peer", (int)used);
+	}
+	return used;
+}
@@ -53,6 +53,10 @@ static void exit_handler(void)
 			free(opts->proj);
 			opts->proj = NULL;
 		}
+		if(opts->endpoints) {
+			free(opts->endpoints);
+			opts->endpoints = NULL;
+		}
 		if(opts->ipaddr) {
 			shutdown(opts->ipsock, SHUT_RDWR);
 			if(opts->ipaddr != CGPSD_DEFAULT_ADDR) {
@@ -102,6 +106,19 @@ int main(int argc, char **argv)
 		die("failed ignoring broken pipe signal (SIGPIPE)");
 	}
 
+	if(opts->parallel) {
+		if(parallel_request(opts) < 0) {
+			exit(1);
+		}
+		return 0;
+	}
+	if(opts->endpoints) {
+		if(balance_request(opts) < 0) {
+			exit(1);
+		}
+		return 0;
+	}
+
 	for(retry = 1; retry <= CGPSCLT_LOOP_COUNT; ++retry) {
 		if(client_connect(opts) == 0) {
 			break;
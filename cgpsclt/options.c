@@ -49,6 +49,8 @@
 
 #include "cgpssqp.h"
 #include "cgpsclt.h"
+#include "neighbor.h"
+#include "compress.h"
 
 static void usage(const char *prog, const char *section)
 {
@@ -60,10 +62,17 @@ static void usage(const char *prog, const char *section)
 		printf("  -s, --sock[=path]:  Connect to UNIX socket [%s]\n", CGPSD_DEFAULT_SOCK);
 		printf("  -H, --host=addr:    Connect to host (IP or hostname)\n");
 		printf("  -p, --port=num:     Connect on port [%d]\n", CGPSD_DEFAULT_PORT);
+		printf("  -t, --timeout=sec:  Socket I/O timeout (load balanced only) [0]\n");
+		printf("  -P, --parallel=num: Number of concurrent requests (batch mode) [%d]\n", CGPSCLT_PARALLEL_DEFAULT);
+		printf("  -c, --chunk-rows=num: Number of rows in each request (batch mode) [%d]\n", CGPSCLT_CHUNK_ROWS_DEFAULT);
 		printf("  -i, --data=path:    Raw data input file (default=stdin)\n");
+		printf("  -S, --schema:       Send only used columns in project order\n");
+		printf("  -k, --neighbors=num: Find num nearest references of each row (see -R in cgpsd)\n");
 		printf("  -o, --output=path:  Write result to output file (default=stdout)\n");
 		printf("  -r, --result=str:   Colon separated list of results to show (see -h result)\n");
-		printf("  -f, --format=str:   Set ouput format (either plain or xml)\n");
+		printf("  -f, --format=str:   Set ouput format (either plain, xml or binary)\n");
+		printf("  -z, --compress=str: Compress the stream (either lz4 or zstd)\n");
+		printf("  -q, --quiet:        Discard the result (for benchmarking)\n");
 		printf("  -4, --ipv4:         Only use IPv4\n");
 		printf("  -6, --ipv6:         Only use IPv6\n");		
 #if ! defined(NDEBUG)
@@ -73,6 +82,12 @@ static void usage(const char *prog, const char *section)
 		printf("  -h, --help:         This help\n");
 		printf("  -V, --version:      Print version info to stdout\n");
 		printf("\n");
+		printf("The --sock and --host options accepts a comma separated list of endpoints\n");
+		printf("(i.e. -H host1,host2:9402). Requests are then load balanced over all daemons.\n");
+		printf("\n");
+		printf("Batch mode (--parallel or --chunk-rows) splits input data in chunks that are\n");
+		printf("predicted concurrently. The result is merged in original row order.\n");
+		printf("\n");
 		printf("This application is part of the ChemGPS project.\n");
 		printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
 	} else if(strcmp(section, "result") == 0) {
@@ -122,10 +137,17 @@ void parse_options(int argc, char **argv, struct options *popt)
 		{ "sock",    2, 0, 's' },
 		{ "host",    1, 0, 'H' },
 		{ "port",    1, 0, 'p' },
+		{ "timeout", 1, 0, 't' },
+		{ "parallel", 1, 0, 'P' },
+		{ "chunk-rows", 1, 0, 'c' },
                 { "data",    1, 0, 'i' },
+		{ "schema",  0, 0, 'S' },
+		{ "neighbors", 1, 0, 'k' },
                 { "output",  1, 0, 'o' },
 		{ "result",  1, 0, 'r' },
 		{ "format",  1, 0, 'f' }, 
+		{ "compress", 1, 0, 'z' },
+		{ "quiet",   0, 0, 'q' },
 #if ! defined(NDEBUG)
 		{ "debug",   0, 0, 'd' },
 #endif
@@ -135,7 +157,7 @@ void parse_options(int argc, char **argv, struct options *popt)
 	};
 	int optindex, c;
 
-	while((c = getopt_long(argc, argv, "46df:h::i:o:p:H:r:s:vV", options, &optindex)) != -1) {
+	while((c = getopt_long(argc, argv, "46c:df:h::i:k:o:p:qH:P:r:s:St:vVz:", options, &optindex)) != -1) {
 		switch(c) {
 		case '4':
 			popt->family = AF_INET;
@@ -143,6 +165,12 @@ void parse_options(int argc, char **argv, struct options *popt)
 		case '6':
 			popt->family = AF_INET6;
 			break;
+		case 'c':
+			popt->chunkrows = atoi(optarg);
+			if(popt->chunkrows <= 0) {
+				die("number of rows %s is invalid", optarg);
+			}
+			break;
 #if ! defined(NDEBUG)
 		case 'd':
 			popt->debug++;
@@ -153,6 +181,9 @@ void parse_options(int argc, char **argv, struct options *popt)
 				popt->cgps->format = CGPS_OUTPUT_FORMAT_PLAIN;
 			} else if(strcmp("xml", optarg) == 0) {
 				popt->cgps->format = CGPS_OUTPUT_FORMAT_XML;
+			} else if(strcmp("binary", optarg) == 0) {
+				popt->cgps->format = CGPS_OUTPUT_FORMAT_PLAIN;
+				popt->binary = 1;
 			} else {
 				die("unknown format '%s' argument for option -f", optarg);
 			}
@@ -196,6 +227,15 @@ void parse_options(int argc, char **argv, struct options *popt)
 				die("failed convert port number %s", optarg);
 			}
 			break;
+		case 'P':
+			popt->parallel = atoi(optarg);
+			if(popt->parallel <= 0) {
+				die("number of requests %s is invalid", optarg);
+			}
+			break;
+		case 'q':
+			popt->quiet = 1;
+			break;
 		case 'r':
 			popt->cgps->result = cgps_get_predict_mask(optarg);
 			break;
@@ -211,12 +251,32 @@ void parse_options(int argc, char **argv, struct options *popt)
 				popt->unaddr = (char *)CGPSD_DEFAULT_SOCK;
 			}
 			break;
+		case 'k':
+			popt->neighbors = atoi(optarg);
+			if(popt->neighbors < 1 || popt->neighbors > CGPS_NEIGHBORS_MAX) {
+				die("number of neighbors should be between 1 and %d", CGPS_NEIGHBORS_MAX);
+			}
+			break;
+		case 'S':
+			popt->schema = 1;
+			break;
+		case 't':
+			popt->timeout = atoi(optarg);
+			if(popt->timeout < 0) {
+				die("timeout %s is invalid", optarg);
+			}
+			break;
 		case 'v':
 			popt->verbose++;
 			break;
 		case 'V':
 			version(popt->prog);
 			exit(0);
+		case 'z':
+			if((popt->compress = cgps_compress_value(optarg)) < 0) {
+				die("compression method '%s' is unknown or not supported by this build", optarg);
+			}
+			break;
 		case '?':
 			exit(1);
 		}
@@ -225,9 +285,30 @@ void parse_options(int argc, char **argv, struct options *popt)
 	/*
 	 * Check arguments and set defaults.
 	 */
-	if(popt->ipaddr && popt->unaddr) {
+	if(popt->parallel || popt->chunkrows) {
+		if(!popt->parallel) {
+			popt->parallel = CGPSCLT_PARALLEL_DEFAULT;
+		}
+		if(!popt->chunkrows) {
+			popt->chunkrows = CGPSCLT_CHUNK_ROWS_DEFAULT;
+		}
+	}
+	popt->endpoints = balance_endpoints(popt);
+	if(popt->ipaddr && popt->unaddr && !popt->endpoints) {
 		die("both TCP and UNIX connection requested");
 	}
+	if(popt->neighbors && popt->endpoints) {
+		die("nearest neighbors (-k) is only supported against a single daemon");
+	}
+	if(popt->binary && popt->endpoints) {
+		die("binary format is only supported against a single daemon");
+	}
+	if(popt->binary && popt->neighbors) {
+		die("nearest neighbors (-k) is not supported in binary format");
+	}
+	if(popt->compress && popt->endpoints) {
+		die("stream compression (-z) is only supported against a single daemon");
+	}
 	if(popt->ipaddr) {
 		if(!popt->port) {
 			popt->port = CGPSD_DEFAULT_PORT;
@@ -236,7 +317,7 @@ void parse_options(int argc, char **argv, struct options *popt)
 			popt->family = AF_UNSPEC;
 		}
 	}			  
-	if(popt->unaddr) {
+	if(popt->unaddr && !popt->endpoints) {
 		struct stat st;
 #ifdef HAVE_STAT_EMPTY_STRING_BUG
 		if(strlen(popt->unaddr) == 0) {
@@ -260,15 +341,32 @@ void parse_options(int argc, char **argv, struct options *popt)
 	if(popt->debug) {
 		debug("---------------------------------------------");
 		debug("options:");
-		if(popt->unaddr) {
+		if(popt->endpoints) {
+			debug("  load balance over %s", popt->endpoints);
+		} else if(popt->unaddr) {
 			debug("  connect to unix socket = %s", popt->unaddr);
 		}
-		if(popt->ipaddr) {
+		if(popt->ipaddr && !popt->endpoints) {
 			debug("  connect to %s on port %d", popt->ipaddr, popt->port);
 		}
+		if(popt->parallel) {
+			debug("  batch mode: %d concurrent requests, %d rows each", popt->parallel, popt->chunkrows);
+		}
 		if(popt->output) {
 			debug("  saving result to %s", popt->output);
 		}
+		if(popt->schema) {
+			debug("  sending data in project schema");
+		}
+		if(popt->neighbors) {
+			debug("  requesting %d nearest neighbors", popt->neighbors);
+		}
+		if(popt->binary) {
+			debug("  requesting result in binary format");
+		}
+		if(popt->compress) {
+			debug("  requesting %s compressed stream", cgps_compress_name(popt->compress));
+		}
 		debug("  flags: debug = %s, verbose = %s", 
 		      (popt->debug   ? "yes" : "no"), 
 		      (popt->verbose ? "yes" : "no"));
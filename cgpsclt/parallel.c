@@ -0,0 +1,395 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Parallel batch mode. The input data is split in chunks of rows that are
+ * predicted concurrently (using a worker pool) and the results are
+ * merged in original row order.
+ *
+ * The result of each chunk is a sequence of row blocks (one for each model
+ * and result) separated by structure lines (headers or XML tags) that are
+ * the same for all chunks. Rows in the first block are written as soon as
+ * all chunks before it are finished, while the remaining blocks (the tail)
+ * are spilled to a temporary file and merged from it when all chunks are 
+ * finished. For the usual single model and result predictions, the output
+ * is thus streamed and the tails are empty. Otherwise, the results held 
+ * in memory are bounded by the window of outstanding chunks, not by the
+ * number of chunks.
+ *
+ * Chunks of a columnar descriptor file (.cgpsx) are formatted directly
+ * from the row groups they cover, the file is never read as a whole.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <ctype.h>
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#include "cgpssqp.h"
+#include "cgpsclt.h"
+#include "libcgpsclt.h"
+#include "datafile.h"
+
+/*
+ * The input data split in chunks, either text or descriptor file.
+ */
+struct parallel_input
+{
+	const char *curr;     /* next row (text) */
+	const char *end;      /* end of text */
+	const char *header;   /* header line (text) */
+	size_t hlen;          /* length of header */
+	struct cgps_datafile *file;  /* descriptor file */
+	uint64_t row;         /* next row (descriptor file) */
+};
+
+/*
+ * State for the result merge.
+ */
+struct parallel_merge
+{
+	FILE *out;            /* output stream */
+	int format;           /* output format */
+	FILE *spill;          /* kept result (after first row block) */
+	size_t spilled;       /* bytes written to spill file */
+	size_t *tails;        /* offset of each tail in spill file */
+	int ntails;           /* number of tails */
+	int size;             /* size of tails array */
+};
+
+/*
+ * Check if line is a row in the result (opposed to a header).
+ */
+static int parallel_is_row(const char *line, const char *end, int format)
+{
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		while(line < end && isspace((unsigned char)*line)) {
+			++line;
+		}
+		return end - line > 5 && strncmp(line, "<row>", 5) == 0;
+	}
+	if(end > line && end[-1] == '\r') {
+		--end;
+	}
+	return end > line && end[-1] != ':';
+}
+
+/*
+ * Skip lines that are rows (or not rows) while writing them to out (if
+ * non-NULL). Returns pointer to first line not skipped.
+ */
+static const char * parallel_skip(const char *curr, int rows, int format, FILE *out)
+{
+	const char *end;
+
+	while(*curr) {
+		if(!(end = strchr(curr, '\n'))) {
+			end = curr + strlen(curr);
+		}
+		if(parallel_is_row(curr, end, format) != rows) {
+			break;
+		}
+		if(*end) {
+			++end;
+		}
+		if(out) {
+			fwrite(curr, 1, end - curr, out);
+		}
+		curr = end;
+	}
+	return curr;
+}
+
+/*
+ * Add result of next chunk (in order) to merge. The tail is appended to 
+ * the spill file (including the terminating NUL).
+ */
+static void parallel_merge_add(struct parallel_merge *pm, const char *output, int quiet)
+{
+	const char *curr;
+	size_t *tails, len;
+
+	curr = parallel_skip(output, 0, pm->format, pm->ntails || quiet ? NULL : pm->out);
+	curr = parallel_skip(curr, 1, pm->format, quiet ? NULL : pm->out);
+
+	if(pm->ntails == pm->size) {
+		pm->size = pm->size ? pm->size * 2 : 64;
+		if(!(tails = realloc(pm->tails, pm->size * sizeof(size_t)))) {
+			die("failed alloc memory");
+		}
+		pm->tails = tails;
+	}
+	if(!pm->spill && !(pm->spill = tmpfile())) {
+		die("failed create temporary file");
+	}
+	len = strlen(curr) + 1;
+	if(fwrite(curr, 1, len, pm->spill) != len) {
+		die("failed write temporary file");
+	}
+	pm->tails[pm->ntails++] = pm->spilled;
+	pm->spilled += len;
+	fflush(pm->out);
+}
+
+/*
+ * Merge the remaining row blocks from all chunks. The structure lines are
+ * taken from the first chunk.
+ */
+static void parallel_merge_finish(struct parallel_merge *pm, int quiet)
+{
+	const char **curr;
+	char *map;
+	int i;
+
+	if(!pm->ntails) {
+		return;
+	}
+	if(fflush(pm->spill) != 0) {
+		die("failed write temporary file");
+	}
+	if((map = mmap(NULL, pm->spilled, PROT_READ, MAP_SHARED, fileno(pm->spill), 0)) == MAP_FAILED) {
+		die("failed map temporary file");
+	}
+	if(!(curr = malloc(pm->ntails * sizeof(char *)))) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < pm->ntails; ++i) {
+		curr[i] = map + pm->tails[i];
+	}
+	while(*curr[0]) {
+		for(i = 0; i < pm->ntails; ++i) {
+			curr[i] = parallel_skip(curr[i], 0, pm->format, i || quiet ? NULL : pm->out);
+		}
+		for(i = 0; i < pm->ntails; ++i) {
+			curr[i] = parallel_skip(curr[i], 1, pm->format, quiet ? NULL : pm->out);
+		}
+	}
+	free(curr);
+	munmap(map, pm->spilled);
+}
+
+static void parallel_merge_free(struct parallel_merge *pm)
+{
+	if(pm->spill) {
+		fclose(pm->spill);
+	}
+	free(pm->tails);
+}
+
+/*
+ * Returns true if input has more rows.
+ */
+static int parallel_more(const struct parallel_input *in)
+{
+	return in->file ? in->row < in->file->rows : in->curr < in->end;
+}
+
+/*
+ * Submit next chunk of at most popt->chunkrows rows of input. The header 
+ * (if any) is prepended to each chunk. Returns the request or NULL on
+ * failure.
+ */
+static struct cgpsclt_request * parallel_submit(struct options *popt, struct cgpsclt_pool *pool,
+						const char *result, struct parallel_input *in)
+{
+	struct cgpsclt_request *req;
+	const char *start = in->curr, *next;
+	char *chunk = NULL;
+	size_t size;
+	uint64_t rows;
+	FILE *fs;
+
+	if(in->file) {
+		rows = in->file->rows - in->row < (uint64_t)popt->chunkrows ? in->file->rows - in->row : (uint64_t)popt->chunkrows;
+		if(!(fs = open_memstream(&chunk, &size))) {
+			logerr("failed open memory stream");
+			return NULL;
+		}
+		cgps_datafile_text(in->file, in->row, rows, NULL, 0, fs);
+		fclose(fs);
+		in->row += rows;
+	} else {
+		for(rows = 0; rows < (uint64_t)popt->chunkrows && in->curr < in->end; ++rows) {
+			if((next = memchr(in->curr, '\n', in->end - in->curr))) {
+				in->curr = next + 1;
+			} else {
+				in->curr = in->end;
+			}
+		}
+		size = in->hlen + (in->curr - start);
+		if(in->hlen) {
+			if(!(chunk = malloc(size))) {
+				die("failed alloc memory");
+			}
+			memcpy(chunk, in->header, in->hlen);
+			memcpy(chunk + in->hlen, start, in->curr - start);
+		}
+	}
+
+	req = cgpsclt_submit(pool, result,
+			     popt->cgps->format == CGPS_OUTPUT_FORMAT_PLAIN ? CGPSCLT_FORMAT_PLAIN : CGPSCLT_FORMAT_XML,
+			     chunk ? chunk : start, size, NULL, NULL);
+	if(!req) {
+		logerr("failed submit request");
+	}
+	free(chunk);
+	return req;
+}
+
+/*
+ * Make prediction in parallel using popt->parallel concurrent requests.
+ */
+int parallel_request(struct options *popt)
+{
+	struct cgpsclt_pool *pool;
+	struct cgpsclt_request **window;
+	struct parallel_merge pm;
+	struct parallel_input in;
+	struct stat st;
+	char *data = NULL, *result;
+	size_t size;
+	int slots, head = 0, used = 0, chunks = 0, failed = 0;
+
+	memset(&in, 0, sizeof(struct parallel_input));
+	if(popt->data && stat(popt->data, &st) == 0 && cgps_datafile_check(popt->data)) {
+		if(!(in.file = cgps_datafile_open(popt->data))) {
+			return -1;
+		}
+		debug("splitting descriptor file %s (%llu rows)", popt->data, (unsigned long long)in.file->rows);
+	} else {
+		if(!(data = balance_read_data(popt, &size))) {
+			return -1;
+		}
+		in.curr = data;
+		in.end = data + size;
+		while(in.end > in.curr && isspace((unsigned char)in.end[-1])) {
+			--in.end;
+		}
+
+		/*
+		 * The header line is sent with each chunk.
+		 */
+		if(in.curr < in.end && !isdigit((unsigned char)*in.curr) && *in.curr != '-') {
+			debug("header detected in data file");
+			in.header = in.curr;
+			if((in.curr = memchr(in.curr, '\n', in.end - in.curr))) {
+				++in.curr;
+			} else {
+				in.curr = in.end;
+			}
+			in.hlen = in.curr - in.header;
+		}
+	}
+
+	if(!(pool = balance_open(popt, popt->parallel))) {
+		if(data != popt->data) {
+			free(data);
+		}
+		cgps_datafile_close(in.file);
+		return -1;
+	}
+
+	/*
+	 * Keep twice the number of workers queued so that workers are 
+	 * busy while waiting for a slow chunk.
+	 */
+	slots = popt->parallel * 2;
+	if(!(window = calloc(slots, sizeof(struct cgpsclt_request *)))) {
+		die("failed alloc memory");
+	}
+
+	memset(&pm, 0, sizeof(struct parallel_merge));
+	pm.format = popt->cgps->format;
+	pm.out = stdout;
+	if(popt->output && !(pm.out = fopen(popt->output, "w"))) {
+		logerr("failed open output file %s", popt->output);
+		failed = 1;
+	}
+
+	result = balance_result(popt);
+	while(!failed && (parallel_more(&in) || used)) {
+		while(parallel_more(&in) && used < slots) {
+			if(!(window[(head + used) % slots] = parallel_submit(popt, pool, result, &in))) {
+				failed = 1;
+				break;
+			}
+			++used;
+		}
+		if(!used) {
+			break;
+		}
+		if(cgpsclt_wait(window[head]) != CGPSCLT_STATUS_SUCCESS) {
+			errno = 0;
+			logerr("request failed (chunk %d): %s", chunks + 1, cgpsclt_error(window[head]));
+			failed = 1;
+		} else {
+			debug("finished chunk %d", chunks + 1);
+			parallel_merge_add(&pm, cgpsclt_output(window[head], NULL), popt->quiet);
+		}
+		cgpsclt_release(window[head]);
+		head = (head + 1) % slots;
+		--used;
+		++chunks;
+	}
+	while(used--) {
+		cgpsclt_release(window[head]);
+		head = (head + 1) % slots;
+	}
+	cgpsclt_pool_close(pool);
+
+	if(!failed) {
+		parallel_merge_finish(&pm, popt->quiet);
+		debug("merged result of %d chunks", chunks);
+	}
+	if(pm.out && pm.out != stdout) {
+		fclose(pm.out);
+	}
+
+	parallel_merge_free(&pm);
+	free(window);
+	free(result);
+	if(data != popt->data) {
+		free(data);
+	}
+	cgps_datafile_close(in.file);
+	return failed ? -1 : 0;
+}
@@ -49,14 +49,25 @@
 
 #include "cgpssqp.h"
 #include "cgpsclt.h"
+#include "datafile.h"
+#include "binary.h"
+#include "compress.h"
 
 static void cleanup_request(struct client *peer, char *buff, FILE *outs)
 {
 	if(peer) {
+		if(peer->compress && opts->verbose) {
+			loginfo("sent %llu bytes as %llu, received %llu bytes as %llu (%s)",
+				(unsigned long long)peer->compress->rawout, (unsigned long long)peer->compress->wireout,
+				(unsigned long long)peer->compress->rawin, (unsigned long long)peer->compress->wirein,
+				cgps_compress_name(peer->compress->method));
+		}
 		if(peer->ss) {
 			fclose(peer->ss);
 			debug("closed socket stream");
 		}
+		peer->ss = NULL;
+		peer->compress = NULL;
 	}
 	if(buff) {
 		free(buff);
@@ -67,18 +78,102 @@ static void cleanup_request(struct client *peer, char *buff, FILE *outs)
 }
 
 /*
- * Send data from file.
+ * Read and discard the result.
+ */
+static void request_discard(FILE *in)
+{
+	char buff[65536];
+	
+	while(fread(buff, 1, sizeof(buff), in) > 0) {
+		;
+	}
+}
+
+/*
+ * Returns true if the server greeting announces protocol version 1.1 or
+ * later (accepting chunked input data).
+ */
+static int request_chunked_offered(const char *greeting)
+{
+	int major, minor;
+	
+	if(sscanf(greeting, "CGPSP %d.%d", &major, &minor) != 2) {
+		return 0;
+	}
+	return major > 1 || (major == 1 && minor >= 1);
+}
+
+/*
+ * Send data read from descriptor fd in chunks (Load: chunked). Each chunk
+ * is sent as soon as it's read, without buffering all data or counting
+ * the lines first.
  */
-static int request_send_file(const char *file, struct client *peer)
+static int request_send_chunked(int fd, struct client *peer)
+{
+	char buff[CGPSP_CHUNK_SIZE];
+	unsigned long long total = 0;
+	ssize_t bytes;
+	
+	fprintf(peer->ss, "Load: chunked\n");
+	while((bytes = read(fd, buff, sizeof(buff))) != 0) {
+		if(bytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed read input data");
+			return -1;
+		}
+		fprintf(peer->ss, "%ld\n", (long)bytes);
+		fwrite(buff, 1, bytes, peer->ss);
+		if(fflush(peer->ss) != 0) {
+			return -1;
+		}
+		total += bytes;
+	}
+	fprintf(peer->ss, "0\n");
+	fflush(peer->ss);
+	
+	debug("sent %llu bytes of chunked input data", total);
+	return 0;
+}
+
+/*
+ * Send data from file. The data is sent chunked if supported by the server,
+ * otherwise the lines are counted before sending.
+ */
+static int request_send_file(const char *file, struct client *peer, int chunked)
 {	
+	struct cgps_datafile *data;
+	char buff[65536], *ptr;
+	size_t bytes;
 	FILE *fs;
-	int c, lines = 0, header = 0;
+	int c, lines = 0, header = 0, result;
+	
+	if(cgps_datafile_check(file)) {
+		if(!(data = cgps_datafile_open(file))) {
+			return -1;
+		}
+		debug("sending data from descriptor file %s (rows=%llu)", file, (unsigned long long)data->rows);
+		fprintf(peer->ss, "Load: %llu\n", (unsigned long long)data->rows);
+		cgps_datafile_text(data, 0, data->rows, NULL, 0, peer->ss);
+		fprintf(peer->ss, "\n");
+		fflush(peer->ss);
+		cgps_datafile_close(data);
+		return 0;
+	}
 	
 	fs = fopen(file, "r");
 	if(!fs) {
 		return -1;
 	}
 	
+	if(chunked) {
+		debug("sending data from file %s (chunked)", file);
+		result = request_send_chunked(fileno(fs), peer);
+		fclose(fs);
+		return result;
+	}
+	
 	c = getc(fs);
 	if(!isdigit(c) && c != '-') {
 		debug("header detected in data file");
@@ -86,8 +181,8 @@ static int request_send_file(const char *file, struct client *peer)
 	}
 	ungetc(c, fs);
 	
-	while((c = getc(fs)) != EOF) {
-		if(c == '\n') {
+	while((bytes = fread(buff, 1, sizeof(buff), fs)) > 0) {
+		for(ptr = buff; (ptr = memchr(ptr, '\n', buff + bytes - ptr)); ++ptr) {
 			++lines;
 		}
 	}
@@ -96,8 +191,8 @@ static int request_send_file(const char *file, struct client *peer)
 	debug("sending data from file %s (lines=%d)", file, lines - header);	
 	
 	fprintf(peer->ss, "Load: %d\n", lines - header);
-	while((c = getc(fs)) != EOF) {
-		fprintf(peer->ss, "%c", c);
+	while((bytes = fread(buff, 1, sizeof(buff), fs)) > 0) {
+		fwrite(buff, 1, bytes, peer->ss);
 	}
 	fprintf(peer->ss, "\n");
 	fflush(peer->ss);
@@ -108,15 +203,88 @@ static int request_send_file(const char *file, struct client *peer)
 }
 
 /*
- * Send data from stdin.
+ * Copy the result from peer to out (if non-NULL), dropping the result 
+ * lines preceding the result of each model. The result is copied in 
+ * blocks of complete lines.
+ */
+static void request_copy_result(FILE *in, FILE *out)
+{
+	char *buff, *ptr, *line, *next, *end;
+	size_t size = 65536, used = 0, bytes;
+
+	if(!(buff = malloc(size))) {
+		die("failed alloc memory");
+	}
+	while((bytes = fread(buff + used, 1, size - used, in)) > 0) {
+		used += bytes;
+		end = buff + used;
+		for(ptr = line = buff; (next = memchr(line, '\n', end - line)); line = next + 1) {
+			if(next - line == 7 && memcmp(line, "Result:", 7) == 0) {
+				if(out) {
+					fwrite(ptr, 1, line - ptr, out);
+				}
+				ptr = next + 1;
+			}
+		}
+		if(out) {
+			fwrite(ptr, 1, line - ptr, out);
+		}
+		used = end - line;
+		memmove(buff, line, used);
+		if(used == size) {
+			size *= 2;
+			if(!(ptr = realloc(buff, size))) {
+				die("failed alloc memory");
+			}
+			buff = ptr;
+		}
+	}
+	if(out && used) {
+		fwrite(buff, 1, used, out);
+	}
+	free(buff);
+}
+
+/*
+ * Copy the binary result blocks from peer to out (if non-NULL). The block
+ * of each model is preceded by a result line. Returns -1 on failure.
+ */
+static int request_copy_binary(FILE *in, FILE *out)
+{
+	char line[128];
+
+	do {
+		if(cgps_binary_copy(in, out) < 0) {
+			return -1;
+		}
+		if(!fgets(line, sizeof(line), in)) {
+			return 0;
+		}
+	} while(strcmp(line, "Result:\n") == 0);
+
+	line[strcspn(line, "\n")] = '\0';
+	errno = 0;
+	logerr("protocol error (%s unexpected)", line);
+	return -1;
+}
+
+/*
+ * Send data from stdin. The data is streamed in chunks if supported by the
+ * server, otherwise all data is buffered for counting the lines first.
  */
-static int request_send_stdin(struct client *peer)
+static int request_send_stdin(struct client *peer, int chunked)
 {
 	FILE *out;
 	char *inb = NULL, *outb = NULL;
 	size_t insize = 0, outsize = 0;
 	int lines = 0, header = 0;
 	
+	if(chunked) {
+		loginfo("waiting for raw data input on stdin (ctrl+d to finish)");
+		debug("sending data from stdin (chunked)");
+		return request_send_chunked(fileno(stdin), peer);
+	}
+	
 	loginfo("waiting for raw data input on stdin (ctrl+d to send)");
 	
 	out = open_memstream(&outb, &outsize);
@@ -169,6 +337,54 @@ static int request_send_buffer(const char *buffer, struct client *peer)
 	return 0;
 }
 
+/*
+ * Request a compressed stream (if offered by the server) and switch the 
+ * socket stream once acknowledged. Falls back on an uncompressed stream 
+ * if not offered.
+ */
+static int request_compress(struct options *popt, struct client *peer, int offered)
+{
+	const char *name = cgps_compress_name(popt->compress);
+	struct request_option req;
+	char *buff = NULL;
+	size_t size = 0;
+	FILE *ss;
+	int fd;
+
+	if(!offered) {
+		logwarn("compression method %s not offered by server, using uncompressed stream", name);
+		return 0;
+	}
+	debug("requesting %s compressed stream", name);
+	if(fprintf(peer->ss, "Compress: %s\n", name) < 0 || fflush(peer->ss) != 0) {
+		return -1;
+	}
+	if(read_request(&buff, &size, peer->ss) < 0) {
+		free(buff);
+		return -1;
+	}
+	debug("received: '%s'", buff);
+	if(split_request_option(buff, &req) != CGPSP_PROTO_COMPRESS || !req.value || strcmp(req.value, name) != 0) {
+		logerr("protocol error (expected compress response, got %s)", buff);
+		free(buff);
+		return -1;
+	}
+	free(buff);
+	
+	if((fd = dup(peer->sock)) < 0) {
+		logerr("failed duplicate socket");
+		return -1;
+	}
+	if(!(ss = cgps_compress_open(fd, popt->compress, &peer->compress))) {
+		close(fd);
+		return -1;
+	}
+	fclose(peer->ss);
+	peer->ss = ss;
+	debug("switched to %s compressed stream", name);
+	return 0;
+}
+
 int request(struct options *popt, struct client *peer)
 {
 	const struct cgps_result_entry *entry;
@@ -177,8 +393,8 @@ int request(struct options *popt, struct client *peer)
 	FILE *fsout = stdout;
 	char *buff = NULL;
 	size_t size = 0;
-	int delim = 0, done = 0;
-	int c;
+	unsigned long long fingerprint;
+	int delim = 0, done = 0, offered = 0, direct = 0, chunked, result;
 	
 	peer->ss = fdopen(dup(peer->sock), "r+");
 	if(!peer->ss) {
@@ -199,6 +415,10 @@ int request(struct options *popt, struct client *peer)
 		return CGPSCLT_CONN_RETRY;
 	}
 	debug("received: '%s'", buff);
+	chunked = request_chunked_offered(buff);
+	if(popt->compress) {
+		offered = cgps_compress_offered(buff, popt->compress);
+	}
 
 	debug("sending greeting");
 	if(fprintf(peer->ss, "CGPSP %s (%s: client ready)\n", CGPSP_PROTO_VERSION, popt->prog) > 0) {
@@ -208,6 +428,11 @@ int request(struct options *popt, struct client *peer)
 		cleanup_request(peer, buff, fsout);
 		return CGPSCLT_CONN_RETRY;
 	}
+	if(popt->compress && request_compress(popt, peer, offered) < 0) {
+		logerr("failed negotiate stream compression");
+		cleanup_request(peer, buff, fsout);
+		return CGPSCLT_CONN_FAILED;
+	}
 	
 	debug("sending prediction request");
 	fprintf(peer->ss, "Predict: ");
@@ -236,7 +461,9 @@ int request(struct options *popt, struct client *peer)
 	}
 
 	debug("sending format request");
-	if(popt->cgps->format == CGPS_OUTPUT_FORMAT_PLAIN) {
+	if(popt->binary) {
+		fprintf(peer->ss, "Format: binary\n");
+	} else if(popt->cgps->format == CGPS_OUTPUT_FORMAT_PLAIN) {
 		fprintf(peer->ss, "Format: plain\n");
 	} else {
 		fprintf(peer->ss, "Format: xml\n");
@@ -258,7 +485,7 @@ int request(struct options *popt, struct client *peer)
 	
 	while(!done) {
 		debug("waiting for server request");
-		if(read_request(&buff, &size, peer->ss) < 0) {
+		if((direct ? download_read_request(peer->sock, &buff, &size) : read_request(&buff, &size, peer->ss)) < 0) {
 			cleanup_request(peer, buff, fsout);
 			return CGPSCLT_CONN_RETRY;
 		}
@@ -273,22 +500,59 @@ int request(struct options *popt, struct client *peer)
 		switch(req.symbol) {
 		case CGPSP_PROTO_LOAD:
 			debug("received load request");
-			if(popt->data) {
+			if(popt->neighbors) {
+				debug("requesting %d nearest neighbors", popt->neighbors);
+				if(fprintf(peer->ss, "Neighbors: %d\n", popt->neighbors) > 0) {
+					fflush(peer->ss);
+				}
+			}
+			if(popt->schema && req.value && 
+			   sscanf(req.value, "%*s %llx", &fingerprint) == 1) {
+				if(schema_send(popt, peer, fingerprint) < 0) {
+					cleanup_request(peer, buff, fsout);
+					return CGPSCLT_CONN_FAILED;
+				}
+			} else if(popt->data) {
 				if(stat(popt->data, &st) == 0) {
-					request_send_file(popt->data, peer);
+					result = request_send_file(popt->data, peer, chunked);
 				} else {
-					request_send_buffer(popt->data, peer);
+					result = request_send_buffer(popt->data, peer);
+				}
+				if(result < 0) {
+					logerr("failed send input data");
+					cleanup_request(peer, buff, fsout);
+					return CGPSCLT_CONN_FAILED;
 				}
-			} else {
-				request_send_stdin(peer);
+			} else if(request_send_stdin(peer, chunked) < 0) {
+				logerr("failed send input data");
+				cleanup_request(peer, buff, fsout);
+				return CGPSCLT_CONN_FAILED;
 			}
+			/*
+			 * Nothing is buffered in the socket stream while the daemon 
+			 * waits for input data, so the remaining requests and the 
+			 * result can be read direct from the socket (unless compressed).
+			 */
+			direct = !peer->compress;
 			break;
 		case CGPSP_PROTO_RESULT:
 			debug("received result request");
-			while((c = getc(peer->ss)) != EOF) {
-				if(!popt->quiet) {
-					fprintf(fsout, "%c", c);
+			/*
+			 * The result of each model is preceded by a result line.
+			 */
+			if(direct) {
+				fflush(fsout);
+				if(download_result(peer->sock, popt->quiet ? -1 : fileno(fsout), popt->binary) < 0) {
+					cleanup_request(peer, buff, fsout);
+					return CGPSCLT_CONN_FAILED;
 				}
+			} else if(popt->quiet) {
+				request_discard(peer->ss);
+			} else if(!popt->binary) {
+				request_copy_result(peer->ss, fsout);
+			} else if(request_copy_binary(peer->ss, fsout) < 0) {
+				cleanup_request(peer, buff, fsout);
+				return CGPSCLT_CONN_FAILED;
 			}
 			done = 1;
 			break;
@@ -0,0 +1,357 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Send input data in the project schema. The daemon advertises the
+ * fingerprint of its project schema (the variable names) in the load 
+ * request. The schema is fetched once, then the needed columns are picked
+ * from the input data (by its header) and sent in project order without
+ * header, saving the daemon from parsing unused columns and reordering.
+ * For descriptor files (.cgpsx), the columns are picked by name.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_NETINET_IN_H
+# include <netinet/in.h>
+#endif
+#include <ctype.h>
+
+#include "cgpssqp.h"
+#include "cgpsclt.h"
+#include "datafile.h"
+
+#define SCHEMA_DELIM " ,:;\t\r\n"   /* same as the daemon */
+
+/*
+ * The schema is cached for all requests made by this process.
+ */
+static struct schema
+{
+	unsigned long long fingerprint;
+	int count;            /* number of variables */
+	char **names;         /* variable names */
+} schema;
+
+/*
+ * A field in a line of input data.
+ */
+struct schema_field
+{
+	const char *str;
+	size_t len;
+};
+
+/*
+ * Split line (not nul terminated) into at most size fields. Returns the
+ * number of fields.
+ */
+static int schema_split(const char *line, const char *end, struct schema_field *fields, int size)
+{
+	int num = 0;
+
+	while(num < size) {
+		while(line < end && (*line == '\0' || strchr(SCHEMA_DELIM, *line))) {
+			++line;
+		}
+		if(line == end) {
+			break;
+		}
+		fields[num].str = line;
+		while(line < end && *line != '\0' && !strchr(SCHEMA_DELIM, *line)) {
+			++line;
+		}
+		fields[num].len = line - fields[num].str;
+		++num;
+	}
+	return num;
+}
+
+static void schema_release(void)
+{
+	int i;
+
+	for(i = 0; i < schema.count; ++i) {
+		free(schema.names[i]);
+	}
+	free(schema.names);
+	memset(&schema, 0, sizeof(struct schema));
+}
+
+/*
+ * Fetch the project schema from the daemon. The response is the schema
+ * fingerprint followed by the variable names (one per line) terminated
+ * by an empty line.
+ */
+static int schema_fetch(struct client *peer, unsigned long long fingerprint)
+{
+	struct request_option req;
+	char *buff = NULL, **names;
+	size_t size = 0;
+
+	debug("fetching schema %016llx from daemon", fingerprint);
+	schema_release();
+	
+	fprintf(peer->ss, "Schema:\n");
+	fflush(peer->ss);
+
+	if(read_request(&buff, &size, peer->ss) < 0) {
+		logerr("failed read schema");
+		free(buff);
+		return -1;
+	}
+	if(split_request_option(buff, &req) != CGPSP_PROTO_SCHEMA || !req.value ||
+	   sscanf(req.value, "%llx", &schema.fingerprint) != 1) {
+		logerr("protocol error (expected schema, got %s)", buff);
+		free(buff);
+		return -1;
+	}
+	while(read_request(&buff, &size, peer->ss) > 0 && *buff) {
+		if(!(names = realloc(schema.names, (schema.count + 1) * sizeof(char *)))) {
+			die("failed alloc memory");
+		}
+		schema.names = names;
+		if(!(schema.names[schema.count++] = strdup(buff))) {
+			die("failed alloc memory");
+		}
+	}
+	free(buff);
+
+	if(schema.fingerprint != fingerprint) {
+		logerr("daemon sent schema %016llx (expected %016llx)", schema.fingerprint, fingerprint);
+		schema_release();
+		return -1;
+	}
+	debug("fetched schema with %d variables", schema.count);
+	return 0;
+}
+
+/*
+ * Map the project variables to columns in the header line. Returns -1 if
+ * some variable is missing in the header.
+ */
+static int schema_map(const char *line, const char *end, int *columns)
+{
+	struct schema_field *fields;
+	int num, i, j;
+
+	if(!(fields = malloc((end - line + 1) * sizeof(struct schema_field)))) {
+		die("failed alloc memory");
+	}
+	num = schema_split(line, end, fields, end - line + 1);
+	for(i = 0; i < schema.count; ++i) {
+		for(j = 0; j < num; ++j) {
+			if(fields[j].len == strlen(schema.names[i]) && 
+			   strncmp(fields[j].str, schema.names[i], fields[j].len) == 0) {
+				break;
+			}
+		}
+		if(j == num) {
+			debug("variable %s is missing in input data", schema.names[i]);
+			free(fields);
+			return -1;
+		}
+		columns[i] = j;
+	}
+	free(fields);
+	return num;
+}
+
+/*
+ * Send the input data in buff unmodified.
+ */
+static void schema_send_raw(struct client *peer, const char *buff, size_t size)
+{
+	const char *curr, *end = buff + size;
+	int lines = 0, header = 0;
+
+	if(size && !isdigit(*buff) && *buff != '-') {
+		header = 1;
+	}
+	for(curr = buff; curr < end; ++curr) {
+		if(*curr == '\n') {
+			++lines;
+		}
+	}
+	if(size && end[-1] != '\n') {
+		++lines;
+	}
+	debug("sending data unmodified (lines=%d)", lines - header);
+
+	fprintf(peer->ss, "Load: %d\n", lines - header);
+	fwrite(buff, 1, size, peer->ss);
+	fprintf(peer->ss, "\n");
+	fflush(peer->ss);
+}
+
+/*
+ * Send descriptor file with the project schema. Falls back on sending all
+ * columns if the file is missing some of the variables.
+ */
+static int schema_send_datafile(struct options *popt, struct client *peer, unsigned long long fingerprint)
+{
+	struct cgps_datafile *file;
+	int *columns = NULL, i;
+
+	if(!(file = cgps_datafile_open(popt->data))) {
+		return -1;
+	}
+	if(schema.fingerprint != fingerprint || !schema.names) {
+		if(schema_fetch(peer, fingerprint) < 0) {
+			cgps_datafile_close(file);
+			return -1;
+		}
+	}
+	if(!(columns = malloc((schema.count + 1) * sizeof(int)))) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < schema.count; ++i) {
+		if((columns[i] = cgps_datafile_find(file, schema.names[i])) < 0) {
+			debug("variable %s is missing in input data", schema.names[i]);
+			break;
+		}
+	}
+	
+	if(i == schema.count) {
+		debug("sending data with schema %016llx (rows=%llu)", fingerprint, (unsigned long long)file->rows);
+		fprintf(peer->ss, "Load: %llu %016llx\n", (unsigned long long)file->rows, fingerprint);
+		cgps_datafile_text(file, 0, file->rows, columns, schema.count, peer->ss);
+	} else {
+		debug("descriptor file has no usable names, not using schema");
+		fprintf(peer->ss, "Load: %llu\n", (unsigned long long)file->rows);
+		cgps_datafile_text(file, 0, file->rows, NULL, 0, peer->ss);
+	}
+	fprintf(peer->ss, "\n");
+	fflush(peer->ss);
+	
+	free(columns);
+	cgps_datafile_close(file);
+	return 0;
+}
+
+/*
+ * Send input data with the project schema (the needed columns in project
+ * order). Falls back on sending the data unmodified if the input data
+ * has no header or if it's missing some of the variables.
+ */
+int schema_send(struct options *popt, struct client *peer, unsigned long long fingerprint)
+{
+	struct schema_field *fields;
+	const char *line, *next, *end;
+	char *buff;
+	size_t size;
+	int *columns, width, rows = 0, num, i;
+
+	if(popt->data && cgps_datafile_check(popt->data)) {
+		return schema_send_datafile(popt, peer, fingerprint);
+	}
+	if(!(buff = balance_read_data(popt, &size))) {
+		return -1;
+	}
+	end = buff + size;
+	
+	if(schema.fingerprint != fingerprint || !schema.names) {
+		if(schema_fetch(peer, fingerprint) < 0) {
+			if(buff != popt->data) {
+				free(buff);
+			}
+			return -1;
+		}
+	}
+	
+	if(!(next = memchr(buff, '\n', size))) {
+		next = end;
+	}
+	if(!(columns = malloc((schema.count + 1) * sizeof(int)))) {
+		die("failed alloc memory");
+	}
+	if(!size || isdigit(*buff) || *buff == '-' || 
+	   (width = schema_map(buff, next, columns)) < 0) {
+		debug("input data has no usable header, not using schema");
+		schema_send_raw(peer, buff, size);
+		free(columns);
+		if(buff != popt->data) {
+			free(buff);
+		}
+		return 0;
+	}
+
+	if(!(fields = malloc((width + 1) * sizeof(struct schema_field)))) {
+		die("failed alloc memory");
+	}
+	for(line = next; line < end; line = next + 1) {
+		if(!(next = memchr(line, '\n', end - line))) {
+			next = end;
+		}
+		if(schema_split(line, next, fields, 1)) {
+			++rows;
+		}
+	}
+	debug("sending data with schema %016llx (lines=%d)", fingerprint, rows);
+	
+	fprintf(peer->ss, "Load: %d %016llx\n", rows, fingerprint);
+	if(!(next = memchr(buff, '\n', size))) {
+		next = end;
+	}
+	for(line = next; line < end; line = next + 1) {
+		if(!(next = memchr(line, '\n', end - line))) {
+			next = end;
+		}
+		if(!(num = schema_split(line, next, fields, width))) {
+			continue;
+		}
+		for(i = 0; i < schema.count; ++i) {
+			if(i) {
+				putc(' ', peer->ss);
+			}
+			if(columns[i] < num) {
+				fwrite(fields[columns[i]].str, 1, fields[columns[i]].len, peer->ss);
+			} else {
+				putc('0', peer->ss);
+			}
+		}
+		putc('\n', peer->ss);
+	}
+	fprintf(peer->ss, "\n");
+	fflush(peer->ss);
+
+	free(fields);
+	free(columns);
+	if(buff != popt->data) {
+		free(buff);
+	}
+	return 0;
+}
@@ -40,11 +40,36 @@
 
 #define cgpsd_done(state) (((state) & CGPSD_STATE_CLOSING))
 
+/*
+ * Request phases marked by process_request(). Each mark charges the time
+ * since the previous mark to the phase that just ended. The marks are 
+ * compiled away unless CGPSD_PHASE_TIMING is defined, in which case the
+ * program linking client.c must provide cgpsd_phase_mark() (see the
+ * in-process benchmark in utils/cgpsbench).
+ */
+#define CGPSD_PHASE_START    0   /* peer dequeued (restarts clock) */
+#define CGPSD_PHASE_GREETING 1   /* greetings exchanged */
+#define CGPSD_PHASE_OPTIONS  2   /* predict and format options parsed */
+#define CGPSD_PHASE_LOAD     3   /* input data loaded and parsed */
+#define CGPSD_PHASE_PREDICT  4   /* predictions made */
+#define CGPSD_PHASE_RESULT   5   /* results written */
+#define CGPSD_PHASE_COUNT    6
+
+#ifdef CGPSD_PHASE_TIMING
+void cgpsd_phase_mark(const struct client *peer, int phase);
+# define cgpsd_phase(peer, phase) cgpsd_phase_mark((peer), (phase))
+#else
+# define cgpsd_phase(peer, phase)
+#endif
+
 void service(struct options *popt);
 void * process_request(void *peer);
 int init_socket(struct options *popt);
 void close_socket(struct options *popt);
 void setup_signals(struct options *popt);
 void restore_signals(struct options *popt);
+int init_trace(struct options *popt);
+void write_trace(struct options *popt, const struct cgps_trace_record *rec);
+void close_trace(struct options *popt);
 
 #endif /* __CGPSD_H__ */
@@ -58,6 +58,13 @@
 #include "cgpsd.h"
 #include "dllist.h"
 #include "worker.h"
+#include "trace.h"
+#include "native.h"
+#include "neighbor.h"
+#include "store.h"
+#include "binary.h"
+#include "compress.h"
+#include "writer.h"
 
 /*
  * This function cleanup after the peer has been served.
@@ -67,6 +74,12 @@ static void cleanup_request(struct workers *threads, struct client **peer, char
 	if(*peer) {
 		int avail;
 		
+		if((*peer)->compress) {
+			debug("compressed %llu bytes to %llu, decompressed %llu bytes from %llu (%s)",
+			      (unsigned long long)(*peer)->compress->rawout, (unsigned long long)(*peer)->compress->wireout,
+			      (unsigned long long)(*peer)->compress->rawin, (unsigned long long)(*peer)->compress->wirein,
+			      cgps_compress_name((*peer)->compress->method));
+		}
 		if((*peer)->ss) {
 			fclose((*peer)->ss);
 			debug("closed socket stream");
@@ -130,13 +143,198 @@ static void cleanup_request(struct workers *threads, struct client **peer, char
 
 #define process_close_peer(threads, peer, msg) { \
 	if(msg) { \
-		if(fprintf((peer)->ss, "error: %s", (msg)) > 0) { \
+		if(fprintf((peer)->ss, "error: %s\n", (msg)) > 0) { \
 			fflush((peer)->ss); \
 		} \
 	} \
 	process_next_peer(threads, peer); \
 }
 
+#ifdef CGPSD_PHASE_TIMING
+/*
+ * Wraps the cached data loader to charge the load (and parse) of input
+ * data to its own phase, instead of the predict calling it.
+ */
+static int phase_predict_data(struct cgps_project *proj, void *params, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type)
+{
+	struct cgps_predict_cache *cache = (struct cgps_predict_cache *)params;
+	int result;
+	
+	cgpsd_phase(cache->loader, CGPSD_PHASE_PREDICT);
+	result = cgps_predict_data_cached(proj, params, fmx, smx, names, type);
+	cgpsd_phase(cache->loader, CGPSD_PHASE_LOAD);
+	return result;
+}
+#endif
+
+/*
+ * Returns true if model index should be predicted by the native engine.
+ */
+static int native_enabled(const struct client *peer, int index, const struct cgps_options *cgps)
+{
+	const struct cgps_native *native = peer->opts->engine;
+	
+	return native && native->mode == CGPS_NATIVE_ON && 
+		cgps_native_supported(native, index, cgps->result);
+}
+
+/*
+ * Returns true if all models can be predicted by the native engine. The 
+ * project is not loaded when serving a compiled model.
+ */
+static int native_compiled(const struct client *peer, const struct cgps_options *cgps)
+{
+	int i;
+
+	for(i = 1; i <= peer->proj->models; ++i) {
+		if(!native_enabled(peer, i, cgps)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * Predict model index using the native engine and send the result to
+ * peer. The prediction mutex is not needed.
+ */
+static int native_predict(struct client *peer, int index, struct cgps_predict_cache *cache, const struct cgps_options *cgps)
+{
+	if(cache->state != CGPS_PREDICT_CACHE_LOADED) {
+		logerr("no input data for native prediction");
+		return -1;
+	}
+	debug("predicting model %d natively", index);
+	if(fprintf(peer->ss, "Result:\n") > 0) {
+		fflush(peer->ss);
+	}
+	if(errno == EPIPE) {
+		logerr("socket closed by peer");
+		peer->broken = 1;
+		return -1;
+	}
+	if(cgps_native_result(peer->opts->engine, index, &cache->input, cgps->result, 
+			      peer->binary ? CGPS_OUTPUT_FORMAT_BINARY : cgps->format, peer->ss) < 0) {
+		logerr("failed native predict");
+		peer->broken = errno == EPIPE;
+		return -1;
+	}
+	fflush(peer->ss);
+	if(errno == EPIPE) {
+		logerr("socket closed by peer");
+		peer->broken = 1;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Send the result of model index from the prediction store. The input data
+ * is loaded direct and the row hashes are computed on first call for the 
+ * request. Returns -1 unless all rows was found in the store.
+ */
+static int store_predict(struct client *peer, int index, struct cgps_predict_cache *cache, const struct cgps_options *cgps, uint64_t **rows)
+{
+	char *buff;
+	size_t size;
+
+	if(cgps_predict_cache_load(cache, &peer->opts->results->names) < 0) {
+		return -1;
+	}
+	if(!*rows) {
+		*rows = cgps_store_rows(&cache->input);
+	}
+	if(!*rows || cgps_store_lookup(peer->opts->results, index, *rows, cache->input.rows,
+			     cgps->result, cgps->format, &buff, &size) < 0) {
+		return -1;
+	}
+	debug("sending result of model %d from prediction store", index);
+	if(fprintf(peer->ss, "Result:\n") > 0) {
+		if(peer->binary) {
+			cgps_binary_encode(buff, size, index, cgps->result, peer->ss);
+		} else {
+			fwrite(buff, 1, size, peer->ss);
+		}
+		fflush(peer->ss);
+	}
+	if(errno == EPIPE) {
+		logerr("socket closed by peer");
+		peer->broken = 1;
+	}
+	free(buff);
+	return 0;
+}
+
+/*
+ * Compare the SIMCA-QP result (in buff) of model index with the result
+ * from the native engine.
+ */
+static void native_verify(struct client *peer, int index, struct cgps_predict_cache *cache, const struct cgps_options *cgps, const char *buff)
+{
+	const struct cgps_native *native = peer->opts->engine;
+	char *result = NULL;
+	size_t size = 0;
+	FILE *out;
+	int diff;
+	
+	if(!native || native->mode != CGPS_NATIVE_VERIFY || 
+	   !cgps_native_supported(native, index, cgps->result) ||
+	   cache->state != CGPS_PREDICT_CACHE_LOADED) {
+		return;
+	}
+	if(!(out = open_memstream(&result, &size))) {
+		logerr("failed open memory stream");
+		return;
+	}
+	diff = cgps_native_result(native, index, &cache->input, cgps->result, cgps->format, out);
+	fclose(out);
+	
+	if(diff == 0) {
+		diff = cgps_native_compare(result, buff);
+	}
+	if(diff < 0) {
+		logwarn("native result of model %d don't match SIMCA-QP", index);
+	} else if(diff > 0) {
+		logwarn("native result of model %d has %d values differing from SIMCA-QP", index, diff);
+	} else {
+		debug("native result of model %d match SIMCA-QP", index);
+	}
+	free(result);
+}
+
+/*
+ * Acknowledge the compression method requested by peer and switch the
+ * socket stream to a compressed stream. The peer waits for the ack before
+ * sending compressed data, so there is no buffered input to carry over.
+ */
+static int compress_peer(struct client *peer, const char *name)
+{
+	FILE *ss;
+	int method, fd;
+
+	if(!name || (method = cgps_compress_value(name)) < 0) {
+		errno = 0;
+		logerr("protocol error (unsupported compression method %s)", name ? name : "(null)");
+		return -1;
+	}
+	if(fprintf(peer->ss, "Compress: %s\n", name) < 0 || fflush(peer->ss) != 0) {
+		logerr("failed send compress response");
+		return -1;
+	}
+	if((fd = dup(peer->sock)) < 0) {
+		logerr("failed duplicate socket");
+		return -1;
+	}
+	if(!(ss = cgps_compress_open(fd, method, &peer->compress))) {
+		close(fd);
+		return -1;
+	}
+	fclose(peer->ss);
+	peer->ss = ss;
+	debug("switched to %s compressed stream", name);
+	return 0;
+}
+
 /*
  * Process a peer request. The params argument should have been allocated on
  * the heap and point to a client struct. The void * argument is required as
@@ -176,9 +374,18 @@ void * process_request(void *param)
 			struct cgps_project proj;
 			struct cgps_predict pred;
 			struct cgps_result res;
-			int model, i;
+			struct cgps_predict_cache cache;
+			struct cgps_trace_record trace;
+			int model, i, status;
+			int verify = peer->opts->engine && peer->opts->native == CGPS_NATIVE_VERIFY;
+			int capture;
+			uint64_t *rows = NULL;
+			char *result = NULL;
+			size_t length = 0;
+			FILE *out;
 
 			debug("dequeued socket %d", peer->sock);
+			cgpsd_phase(peer, CGPSD_PHASE_START);
 
 			peer->ss = fdopen(dup(peer->sock), "r+");
 			if(!peer->ss) {
@@ -189,9 +396,13 @@ void * process_request(void *param)
 			debug("opened socket stream");
 			
 			debug("sending greeting");
-			if(fprintf(peer->ss, "CGPSP %s (%s: server ready)\n", CGPSP_PROTO_VERSION, opts->prog) > 0) {
-				fflush(peer->ss);
+			if(*cgps_compress_methods()) {
+				fprintf(peer->ss, "CGPSP %s (%s: server ready) compress: %s\n", 
+					CGPSP_PROTO_VERSION, opts->prog, cgps_compress_methods());
+			} else {
+				fprintf(peer->ss, "CGPSP %s (%s: server ready)\n", CGPSP_PROTO_VERSION, opts->prog);
 			}
+			fflush(peer->ss);
 			if(errno == EPIPE) {
 				logerr("socket closed by peer");
 				process_next_peer(threads, peer);
@@ -202,12 +413,18 @@ void * process_request(void *param)
 				process_next_peer(threads, peer);
 			}
 			debug("received: '%s'", buff);
+			cgpsd_phase(peer, CGPSD_PHASE_GREETING);
 
 			debug("copying global libchemgps options");
 			cgps = *peer->opts->cgps;
 			debug("copying project");
 			proj = *peer->proj;
 			proj.opts = &cgps;
+#ifdef CGPSD_PHASE_TIMING
+			cgps.indata = phase_predict_data;
+#else
+			cgps.indata = cgps_predict_data_cached;
+#endif
 						
 			debug("receiving predict request");
 			if(read_request(&buff, &size, peer->ss) < 0) {
@@ -218,11 +435,33 @@ void * process_request(void *param)
 				logerr("failed read client option (%s)", buff);
 				process_close_peer(threads, peer, "unknown option");
 			}
+			if(req.symbol == CGPSP_PROTO_COMPRESS) {
+				if(compress_peer(peer, req.value) < 0) {
+					process_close_peer(threads, peer, "unsupported compression");
+				}
+				if(read_request(&buff, &size, peer->ss) < 0) {
+					process_next_peer(threads, peer);
+				}
+				debug("received: '%s'", buff);
+				if(split_request_option(buff, &req) == CGPSP_PROTO_LAST) {
+					logerr("failed read client option (%s)", buff);
+					process_close_peer(threads, peer, "unknown option");
+				}
+			}
 			if(req.symbol != CGPSP_PROTO_PREDICT) {
 				logerr("protocol error (expected predict option, got %s)", req.option);
 				process_close_peer(threads, peer, "expected predict");
 			}
+			if(!req.value) {
+				logerr("protocol error (missing predict argument)");
+				process_close_peer(threads, peer, "missing predict");
+			}
 			cgps.result = cgps_get_predict_mask(req.value);
+			if(peer->opts->tracefs) {
+				cgps_trace_init(&trace, peer->accepted, peer->opts->traceflags);
+				trace.result = cgps.result;
+				peer->trace = &trace;
+			}
 
 			debug("receiving format request");
 			if(read_request(&buff, &size, peer->ss) < 0) {
@@ -239,17 +478,63 @@ void * process_request(void *param)
 			}
 			if(strcmp("plain", req.value) == 0) {
 				cgps.format = CGPS_OUTPUT_FORMAT_PLAIN;
+			} else if(strcmp("binary", req.value) == 0) {
+				/*
+				 * Encoded from the plain result of libchemgps
+				 * (or direct by the native engine).
+				 */
+				cgps.format = CGPS_OUTPUT_FORMAT_PLAIN;
+				peer->binary = 1;
 			} else if(strcmp("xml", req.value) == 0) {
 				cgps.format = CGPS_OUTPUT_FORMAT_XML;
 			} else {
 				logerr("protocol error (invalid format argument, got %s)", req.value);
 				process_close_peer(threads, peer, "invalid format");
 			}
+			if(peer->trace) {
+				trace.format = peer->binary ? CGPS_OUTPUT_FORMAT_BINARY : cgps.format;
+			}
+			capture = verify || peer->opts->results || peer->binary;
+			cgpsd_phase(peer, CGPSD_PHASE_OPTIONS);
 			
+			if(!proj.handle && !native_compiled(peer, &cgps)) {
+				errno = 0;
+				logerr("result not supported by compiled model");
+				process_close_peer(threads, peer, "result not supported by compiled model");
+			}
+			
+			/*
+			 * The input data is only loaded (asked for) once and then
+			 * reused by all models.
+			 */
+			cgps_predict_cache_init(&cache, peer);
 			for(i = 1; i <= proj.models; ++i) {	
+				if(native_enabled(peer, i, &cgps)) {
+					/*
+					 * Load input data direct and bypass SIMCA-QP.
+					 */
+					cgps_predict_cache_load(&cache, &peer->opts->engine->names);
+					status = native_predict(peer, i, &cache, &cgps);
+					cgpsd_phase(peer, CGPSD_PHASE_RESULT);
+					if(status < 0 && peer->broken) {
+						break;
+					}
+					continue;
+				}
+				if(peer->opts->results && store_predict(peer, i, &cache, &cgps, &rows) == 0) {
+					/*
+					 * Served from the prediction store (without
+					 * SIMCA-QP).
+					 */
+					cgpsd_phase(peer, CGPSD_PHASE_RESULT);
+					if(peer->broken) {
+						break;
+					}
+					continue;
+				}
 				pthread_mutex_lock(&threads->predlock);
 				debug("locked mutex for prediction");
-				cgps_predict_init(&proj, &pred, peer);
+				cgps_predict_init(&proj, &pred, &cache);
 				pthread_mutex_unlock(&threads->predlock);
 				debug("unlocked mutex for prediction");
 				debug("initilized for prediction");
@@ -259,6 +544,7 @@ void * process_request(void *param)
 					pthread_mutex_unlock(&threads->predlock);
 					debug("unlocked mutex for prediction");
 					debug("predict called (index=%d, model=%d)", i, model);
+					cgpsd_phase(peer, CGPSD_PHASE_PREDICT);
 					if(cgps_result_init(&proj, &res) == 0) {
 						debug("intilized prediction result");
 						if(fprintf(peer->ss, "Result:\n") > 0) {
@@ -266,22 +552,52 @@ void * process_request(void *param)
 						}
 						if(errno == EPIPE) {
 							logerr("socket closed by peer");
+							peer->broken = 1;
 							cgps_result_cleanup(&proj, &res);
 							pthread_mutex_lock(&threads->predlock);
 							cgps_predict_cleanup(&proj, &pred);
 							pthread_mutex_unlock(&threads->predlock);
 							break;
 						}
+						if(capture && !(out = open_memstream(&result, &length))) {
+							logerr("failed open memory stream");
+							out = peer->ss;
+						} else if(!capture && !(out = cgps_writer_stream(peer->ss))) {
+							out = peer->ss;
+						}
 						pthread_mutex_lock(&threads->predlock);
 						debug("locked mutex for prediction");
-						if(cgps_result(&proj, model, &pred, &res, peer->ss) == 0) {
+						if(cgps_result(&proj, model, &pred, &res, out) == 0) {
 							debug("successful got result");
 						}
 						pthread_mutex_unlock(&threads->predlock);
 						debug("unlocked mutex for prediction");
+						if(out != peer->ss && !capture) {
+							fclose(out);
+						} else if(out != peer->ss) {
+							fclose(out);
+							native_verify(peer, i, &cache, &cgps, result);
+							if(rows) {
+								cgps_store_insert(peer->opts->results, i, rows, 
+										  cache.input.rows, 
+										  cgps.result, cgps.format, result, length);
+							}
+							if(peer->binary) {
+								cgps_binary_encode(result, length, i, cgps.result, peer->ss);
+							} else {
+								fwrite(result, 1, length, peer->ss);
+							}
+							free(result);
+							result = NULL;
+						}
 						fflush(peer->ss);
+						if(errno == EPIPE) {
+							logerr("socket closed by peer");
+							peer->broken = 1;
+						}
 						debug("cleaning up the result");
 						cgps_result_cleanup(&proj, &res);
+						cgpsd_phase(peer, CGPSD_PHASE_RESULT);
 					}
 				}
 				else {
@@ -295,7 +611,40 @@ void * process_request(void *param)
 				cgps_predict_cleanup(&proj, &pred);
 				pthread_mutex_unlock(&threads->predlock);
 				debug("unlocked mutex for prediction");
+				cgpsd_phase(peer, CGPSD_PHASE_PREDICT);
+				if(peer->broken) {
+					break;
+				}
+			}
+			if(peer->neighbors && cache.state == CGPS_PREDICT_CACHE_LOADED && !peer->broken) {
+				/*
+				 * The nearest references (in score space) of each row.
+				 */
+				if(fprintf(peer->ss, "Result:\n") > 0) {
+					fflush(peer->ss);
+				}
+				if(!peer->opts->index->native) {
+					pthread_mutex_lock(&threads->predlock);
+				}
+				status = cgps_neighbors_result(peer->opts->index, &proj, peer->opts->engine, &cache.input, 
+							       peer->neighbors, cgps.format, peer->ss);
+				if(!peer->opts->index->native) {
+					pthread_mutex_unlock(&threads->predlock);
+				}
+				if(status < 0) {
+					logerr("failed nearest neighbor search");
+				}
+				fflush(peer->ss);
+				cgpsd_phase(peer, CGPSD_PHASE_RESULT);
+			}
+			cgps_predict_cache_cleanup(&cache);
+			free(rows);
+			
+			if(peer->trace) {
+				write_trace(peer->opts, peer->trace);
+				cgps_trace_cleanup(peer->trace);
 			}
+			cgpsd_phase(peer, CGPSD_PHASE_RESULT);
 			
 			cleanup_request(threads, &peer, NULL);
 			if(!worker_waiting(threads)) {
@@ -0,0 +1,266 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#include "cgpssqp.h"
+#include "event.h"
+
+struct event_backend
+{
+	const char *name;
+	int value;
+};
+
+static const struct event_backend event_backends[] = {
+	{ "auto",   EVENT_BACKEND_AUTO },
+	{ "select", EVENT_BACKEND_SELECT },
+	{ "epoll",  EVENT_BACKEND_EPOLL },
+	{ NULL, -1 }
+};
+
+const char * event_backend_name(int backend)
+{
+	const struct event_backend *entry;
+
+	for(entry = event_backends; entry->name; ++entry) {
+		if(entry->value == backend) {
+			return entry->name;
+		}
+	}
+	return "unknown";
+}
+
+int event_backend_value(const char *name)
+{
+	const struct event_backend *entry;
+
+	for(entry = event_backends; entry->name; ++entry) {
+		if(strcmp(entry->name, name) == 0) {
+			return entry->value;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Accept all pending peers on a ready server socket until it would block
+ * or the batch is full. The server socket is non-blocking. On Linux, the
+ * accepted socket don't inherit O_NONBLOCK, so the worker threads can keep
+ * using blocking stdio on it.
+ */
+static int event_accept_ready(int server, struct event_peer *peers, int max, int *count)
+{
+	int sock;
+
+	while(*count < max) {
+		sock = accept(server, NULL, NULL);
+		if(sock < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				break;
+			}
+			if(errno == ECONNABORTED) {
+				continue;
+			}
+			return *count ? 0 : -1;
+		}
+		peers[*count].sock = sock;
+		peers[*count].server = server;
+		(*count)++;
+	}
+	return 0;
+}
+
+/*
+ * The select(2) backend.
+ */
+static int event_init_select(struct events *ev)
+{
+	int i;
+
+	FD_ZERO(&ev->sockfds);
+	for(i = 0; i < ev->nservers; ++i) {
+		debug("adding server socket to read ready set (fd = %d)", ev->servers[i]);
+		FD_SET(ev->servers[i], &ev->sockfds);
+		ev->maxsock = ev->servers[i] > ev->maxsock ? ev->servers[i] : ev->maxsock;
+	}
+	ev->backend = EVENT_BACKEND_SELECT;
+	return 0;
+}
+
+static int event_select_accept(struct events *ev, struct event_peer *peers, int max)
+{
+	fd_set readfds = ev->sockfds;
+	int i, res, count = 0;
+
+	res = select(ev->maxsock + 1, &readfds, NULL, NULL, NULL);
+	if(res < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	for(i = 0; i < ev->nservers; ++i) {
+		if(FD_ISSET(ev->servers[i], &readfds)) {
+			if(event_accept_ready(ev->servers[i], peers, max, &count) < 0) {
+				return -1;
+			}
+		}
+	}
+	return count;
+}
+
+/*
+ * The epoll(7) backend.
+ */
+static int event_init_epoll(struct events *ev)
+{
+#ifdef HAVE_SYS_EPOLL_H
+	struct epoll_event event;
+	int i;
+
+	if((ev->epfd = epoll_create(EVENT_SERVERS_MAX)) < 0) {
+		logerr("failed create epoll instance");
+		return -1;
+	}
+	for(i = 0; i < ev->nservers; ++i) {
+		memset(&event, 0, sizeof(struct epoll_event));
+		event.events = EPOLLIN;
+		event.data.fd = ev->servers[i];
+		if(epoll_ctl(ev->epfd, EPOLL_CTL_ADD, ev->servers[i], &event) < 0) {
+			logerr("failed add server socket to epoll set (fd = %d)", ev->servers[i]);
+			close(ev->epfd);
+			ev->epfd = -1;
+			return -1;
+		}
+		debug("added server socket to epoll set (fd = %d)", ev->servers[i]);
+	}
+	ev->backend = EVENT_BACKEND_EPOLL;
+	return 0;
+#else
+	if(ev) {
+		debug("epoll support not compiled in");
+	}
+	return -1;
+#endif
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static int event_epoll_accept(struct events *ev, struct event_peer *peers, int max)
+{
+	struct epoll_event events[EVENT_SERVERS_MAX];
+	int i, res, count = 0;
+
+	res = epoll_wait(ev->epfd, events, EVENT_SERVERS_MAX, -1);
+	if(res < 0) {
+		return errno == EINTR ? 0 : -1;
+	}
+	for(i = 0; i < res; ++i) {
+		if(event_accept_ready(events[i].data.fd, peers, max, &count) < 0) {
+			return -1;
+		}
+	}
+	return count;
+}
+#endif
+
+int event_init(struct events *ev, struct options *popt, int backend)
+{
+	int i, flags;
+
+	memset(ev, 0, sizeof(struct events));
+	ev->epfd = -1;
+
+	if(popt->ipsock) {
+		ev->servers[ev->nservers++] = popt->ipsock;
+	}
+	if(popt->unsock) {
+		ev->servers[ev->nservers++] = popt->unsock;
+	}
+	for(i = 0; i < ev->nservers; ++i) {
+		if((flags = fcntl(ev->servers[i], F_GETFL, 0)) < 0 ||
+		   fcntl(ev->servers[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+			logerr("failed set server socket in non-blocking mode (fd = %d)", ev->servers[i]);
+			return -1;
+		}
+	}
+
+	if(backend == EVENT_BACKEND_AUTO) {
+#if defined(HAVE_SYS_EPOLL_H)
+		backend = EVENT_BACKEND_EPOLL;
+#else
+		backend = EVENT_BACKEND_SELECT;
+#endif
+	}
+	if(backend == EVENT_BACKEND_EPOLL) {
+		if(event_init_epoll(ev) == 0) {
+			debug("using epoll for accepting peers");
+			return 0;
+		}
+	}
+	debug("using select for accepting peers");
+	return event_init_select(ev);
+}
+
+int event_accept(struct events *ev, struct event_peer *peers, int max)
+{
+	switch(ev->backend) {
+#ifdef HAVE_SYS_EPOLL_H
+	case EVENT_BACKEND_EPOLL:
+		return event_epoll_accept(ev, peers, max);
+#endif
+	default:
+		return event_select_accept(ev, peers, max);
+	}
+}
+
+void event_cleanup(struct events *ev)
+{
+	if(ev->epfd != -1) {
+		close(ev->epfd);
+		ev->epfd = -1;
+	}
+	ev->nservers = 0;
+}
@@ -0,0 +1,95 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The interface for accepting peer connections on the server sockets. The
+ * backend is selected at runtime: epoll or select as the portable fallback.
+ */
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#define EVENT_BACKEND_AUTO   0         /* best available backend */
+#define EVENT_BACKEND_SELECT 1         /* select(2) */
+#define EVENT_BACKEND_EPOLL  2         /* epoll(7) */
+
+#define EVENT_SERVERS_MAX    2         /* TCP and UNIX server socket */
+#define EVENT_ACCEPT_BATCH   32        /* max peers accepted on each wakeup */
+
+/*
+ * An accepted peer connection.
+ */
+struct event_peer
+{
+	int sock;                      /* peer socket */
+	int server;                    /* server socket it was accepted on */
+};
+
+struct events
+{
+	int backend;                   /* the active backend */
+	int servers[EVENT_SERVERS_MAX];/* server sockets */
+	int nservers;                  /* number of server sockets */
+	int maxsock;                   /* highest socket (select) */
+	fd_set sockfds;                /* server sockets set (select) */
+	int epfd;                      /* epoll instance (epoll) */
+};
+
+/*
+ * Initilize the accept event backend for the server sockets in popt. The
+ * backend argument is one of the EVENT_BACKEND_XXX defines. If the wanted
+ * backend is unavailable, then the next best is used. Returns -1 on failure.
+ */
+int event_init(struct events *ev, struct options *popt, int backend);
+
+/*
+ * Wait for peers to connect and accept up to max of them in one batch. Returns
+ * the number of accepted peers stored in peers (0 if interrupted by a signal)
+ * or -1 on failure (errno is set).
+ */
+int event_accept(struct events *ev, struct event_peer *peers, int max);
+
+/*
+ * Release resources allocated by event_init().
+ */
+void event_cleanup(struct events *ev);
+
+/*
+ * Returns name of backend (i.e. "epoll").
+ */
+const char * event_backend_name(int backend);
+
+/*
+ * Returns the backend define matching name or -1 if unknown.
+ */
+int event_backend_value(const char *name);
+
+#endif /* __EVENT_H__ */
@@ -48,6 +48,7 @@
 
 #include "cgpssqp.h"
 #include "cgpsd.h"
+#include "reorder.h"
 
 struct options *opts;
 
@@ -56,6 +57,7 @@ static void exit_handler(void)
 	if(opts) {
 		debug("cleaning up at exit...");
 		
+		cgps_reorder_cleanup();
 		if(opts->cgps) {
 			if(opts->cgps->logfile) {
 				free(opts->cgps->logfile);
@@ -68,6 +70,19 @@ static void exit_handler(void)
 			free(opts->proj);
 			opts->proj = NULL;
 		}
+		if(opts->reference) {
+			free(opts->reference);
+			opts->reference = NULL;
+		}
+		if(opts->store) {
+			free(opts->store);
+			opts->store = NULL;
+		}
+		if(opts->trace) {
+			close_trace(opts);
+			free(opts->trace);
+			opts->trace = NULL;
+		}
 		if(opts->ipaddr) {
 			if(opts->ipaddr != CGPSD_DEFAULT_ADDR) {
 				free(opts->ipaddr);
@@ -128,6 +143,9 @@ int main(int argc, char **argv)
 	if(init_socket(opts) < 0) {
 		die("failed initilize socket");
 	}
+	if(opts->trace && init_trace(opts) < 0) {
+		die("failed initilize request trace");
+	}
 	if(!opts->interactive) {
 		if(daemon(0, 0) < 0) {
 			die("failed become daemon");
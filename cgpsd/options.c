@@ -55,6 +55,9 @@
 
 #include "cgpssqp.h"
 #include "cgpsd.h"
+#include "native.h"
+#include "event.h"
+#include "trace.h"
 
 static void usage(const char *prog)
 {
@@ -67,7 +70,13 @@ static void usage(const char *prog)
 	printf("  -t, --tcp[=addr]:     Listen on TCP socket (interface address [%s])\n", CGPSD_DEFAULT_ADDR);
 	printf("  -p, --port=num:       Listen on port [%d]\n", CGPSD_DEFAULT_PORT);
 	printf("  -b, --backlog=num:    Listen queue length [%d]\n", CGPSD_QUEUE_LENGTH);
+	printf("  -E, --events=name:    Accept backend (auto, epoll or select) [auto]\n");
 	printf("  -l, --logfile=path:   Use path as simca lib log\n");
+	printf("  -T, --trace=path:     Record request trace to file (for replay by cgpsddos)\n");
+	printf("  -D, --trace-data:     Record input data in trace (default is hash only)\n");
+	printf("  -N, --native[=mode]:  Predict PCA/PLS models natively (on, off or verify) [on]\n");
+	printf("  -R, --reference=path: Reference set for nearest neighbor search (see -k in cgpsclt)\n");
+	printf("  -S, --store=path:     Persistent prediction store (reused across restarts)\n");
 	printf("  -i, --interactive:    Don't detach from controlling terminal\n");
 	printf("  -4, --ipv4:           Only use IPv4\n");
 	printf("  -6, --ipv6:           Only use IPv6\n");	
@@ -109,7 +118,13 @@ void parse_options(int argc, char **argv, struct options *popt)
 		{ "tcp",     2, 0, 't' },
 		{ "port",    1, 0, 'p' },
 		{ "backlog", 1, 0, 'b' },
+		{ "events",  1, 0, 'E' },
 		{ "logfile", 1, 0, 'l' },
+		{ "trace",   1, 0, 'T' },
+		{ "trace-data", 0, 0, 'D' },
+		{ "native",  2, 0, 'N' },
+		{ "reference", 1, 0, 'R' },
+		{ "store",   1, 0, 'S' },
 		{ "interactive", 0, 0, 'i' },
 #if ! defined(NDEBUG)
 		{ "debug",   0, 0, 'd' },
@@ -126,7 +141,7 @@ void parse_options(int argc, char **argv, struct options *popt)
 int path_max;
 #endif
 	
-	while((c = getopt_long(argc, argv, "46b:df:hil:p:qt:u:vV", options, &indexopt)) != -1) {
+	while((c = getopt_long(argc, argv, "46b:dDE:f:hil:N::p:qR:S:t:T:u:vV", options, &indexopt)) != -1) {
 		switch(c) {
                 case '4':
 			popt->family = AF_INET;
@@ -142,6 +157,14 @@ int path_max;
 			popt->debug++;
 			break;
 #endif
+		case 'D':
+			popt->traceflags |= CGPS_TRACE_PAYLOAD;
+			break;
+		case 'E':
+			if((popt->backend = event_backend_value(optarg)) < 0) {
+				die("unknown event backend %s", optarg);
+			}
+			break;
 		case 'f':
 #ifdef HAVE_REALPATH
 # if ! defined(HAVE_PATHCONF)
@@ -186,6 +209,13 @@ int path_max;
 			}
 			strcpy(popt->cgps->logfile, optarg);
 			break;
+		case 'N':
+			if(!optarg) {
+				popt->native = CGPS_NATIVE_ON;
+			} else if((popt->native = cgps_native_value(optarg)) < 0) {
+				die("unknown native mode %s", optarg);
+			}
+			break;
 		case 'p':
 #ifdef HAVE_STRTOL
 			popt->port = strtol(optarg, NULL, 10);
@@ -211,6 +241,27 @@ int path_max;
 				popt->ipaddr = (char *)CGPSD_DEFAULT_ADDR;
 			}
 			break;
+		case 'R':
+			popt->reference = malloc(strlen(optarg) + 1);
+			if(!popt->reference) {
+				die("failed alloc memory");
+			}
+			strcpy(popt->reference, optarg);
+			break;
+		case 'S':
+			popt->store = malloc(strlen(optarg) + 1);
+			if(!popt->store) {
+				die("failed alloc memory");
+			}
+			strcpy(popt->store, optarg);
+			break;
+		case 'T':
+			popt->trace = malloc(strlen(optarg) + 1);
+			if(!popt->trace) {
+				die("failed alloc memory");
+			}
+			strcpy(popt->trace, optarg);
+			break;
 		case 'u':
 			if(*optarg != '-') {
 				popt->unaddr = malloc(strlen(optarg) + 1);
@@ -278,6 +329,9 @@ int path_max;
 	if(!popt->backlog) {
 		popt->backlog = CGPSD_QUEUE_LENGTH;
 	}
+	if(popt->traceflags && !popt->trace) {
+		die("the trace data option (-D) requires a trace file (-T)");
+	}
 	
 	/*
 	 * Dump options for debugging purpose.
@@ -304,6 +358,20 @@ int path_max;
 			}
 		}
 		debug("  listen queue length = %d", popt->backlog);
+		debug("  accept event backend = %s", event_backend_name(popt->backend));
+		if(popt->native) {
+			debug("  native prediction = %s", cgps_native_name(popt->native));
+		}
+		if(popt->reference) {
+			debug("  reference set = %s", popt->reference);
+		}
+		if(popt->store) {
+			debug("  prediction store = %s", popt->store);
+		}
+		if(popt->trace) {
+			debug("  request trace = %s (%s)", popt->trace, 
+			      popt->traceflags & CGPS_TRACE_PAYLOAD ? "with data" : "hash only");
+		}
 		debug("  flags: debug = %s, verbose = %s, interactive = %s", 
 		      (popt->debug   ? "yes" : "no"), 
 		      (popt->verbose ? "yes" : "no"),
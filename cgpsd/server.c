@@ -35,9 +35,6 @@
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
-#ifdef HAVE_SYS_SELECT_H
-# include <sys/select.h>
-#endif
 #ifdef HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #endif
@@ -52,8 +49,12 @@
 
 #include "cgpssqp.h"
 #include "cgpsd.h"
+#include "native.h"
+#include "neighbor.h"
+#include "store.h"
 #include "dllist.h"
 #include "worker.h"
+#include "event.h"
 
 #if !defined(HAVE_PTHREAD_YIELD) && defined(HAVE_SCHED_YIELD)
 # if defined(HAVE_SCHED_H)
@@ -110,6 +111,62 @@ static void sleep_wait_queue(struct workers *threads)
 	}
 }
 
+/*
+ * Log peer connected on the TCP server socket.
+ */
+static void accept_tcp_peer(struct options *popt, int client)
+{
+	struct sockaddr_in sockaddr;
+	socklen_t socklen = sizeof(struct sockaddr_in);
+	
+	if(popt->quiet) {
+		return;
+	}
+#ifdef HAVE_INET_NTOA
+	if(getpeername(client, (struct sockaddr *)&sockaddr, &socklen) == 0) {
+		loginfo("accepted TCP client connection from %s on port %d", 
+			inet_ntoa(sockaddr.sin_addr), 
+			ntohs(sockaddr.sin_port));
+		return;
+	}
+#endif /* ! HAVE_INET_NTOA */
+	loginfo("accepted TCP client connection on interface %s and port %d", 
+		popt->ipaddr, popt->port);
+}
+
+/*
+ * Check credentials of peer connected on the UNIX server socket. Returns -1 
+ * if the peer has been rejected (the socket is closed).
+ */
+static int accept_unix_peer(struct workers *threads, int client)
+{
+	struct ucred cred;
+	socklen_t credlen = sizeof(struct ucred);
+	
+	if(getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0) {
+		logerr("failed get credentials of UNIX socket peer");
+		return 0;
+	}
+	
+	debug("UNIX socket peer: pid = %d, uid = %d, gid = %d",
+	      cred.pid, cred.uid, cred.gid);
+	while(1) {
+		struct passwd *pwent = getpwuid(cred.uid);
+		if(pwent) {
+			loginfo("accepted UNIX client connection from %s (uid: %d, pid: %d)", 
+				pwent->pw_name, cred.uid, cred.pid);
+			return 0;
+		} else if(errno == EMFILE || errno == ENFILE) {
+			sleep_wait_queue(threads);
+			continue;
+		} else {
+			send_error(client, "internal server error");
+			logerr("failed get password database record for uid=%d", cred.uid);
+			return -1;
+		}
+	}
+}
+
 /*
  * Start accepting connections on server socket(s).
  */
@@ -117,8 +174,8 @@ void service(struct options *popt)
 {
 	struct workers workers;	
 	struct cgps_project proj;	
-	fd_set sockfds;  /* server socket file descriptors set */
-	int maxsock = 0;
+	struct events events;
+	struct event_peer peers[EVENT_ACCEPT_BATCH];
 	
         popt->cgps->logger = cgps_syslog;
 	popt->cgps->indata = cgps_predict_data;
@@ -131,12 +188,57 @@ void service(struct options *popt)
 	popt->cgps->syslog = popt->syslog;
 	popt->cgps->batch  = 1;
 	
-	if(cgps_project_load(&proj, popt->proj, popt->cgps) == 0) {
+	if(cgps_native_compiled(popt->proj)) {
+		/*
+		 * Serve compiled model using the native engine only. 
+		 */
+		if(popt->native == CGPS_NATIVE_VERIFY) {
+			logwarn("can't verify native predictions of compiled model");
+		}
+		popt->native = CGPS_NATIVE_ON;
+		if(!(popt->engine = cgps_native_load(popt->proj, popt->native))) {
+			die("failed load compiled model %s", popt->proj);
+		}
+		memset(&proj, 0, sizeof(struct cgps_project));
+		proj.models = popt->engine->models;
+		debug("successful mapped compiled model %s", popt->proj);
+		debug("compiled model got %d models", proj.models);
+	} else if(cgps_project_load(&proj, popt->proj, popt->cgps) == 0) {
                 debug("successful loaded project %s", popt->proj);
 		debug("project got %d models", proj.models);
 	} else {
 		die("failed load project %s", popt->proj);
 	}
+	if((popt->native || popt->reference) && !popt->engine) {
+		if((popt->engine = cgps_native_open(&proj, popt->native))) {
+			debug("native prediction engine ready (%s)", cgps_native_name(popt->native));
+		} else if(popt->native) {
+			logwarn("native prediction not supported by project, using SIMCA-QP");
+		}
+	}
+	if(popt->reference) {
+		/*
+		 * The scores of raw data (references and requests) are computed
+		 * by the native engine if possible, even if not used for predict.
+		 */
+		if(!(popt->index = cgps_neighbors_open(popt->reference, &proj, popt->engine, 1))) {
+			die("failed load reference set %s", popt->reference);
+		}
+		debug("nearest neighbor index ready (%d references)", popt->index->count);
+	}
+	if(popt->store) {
+		/*
+		 * Compiled models are always predicted natively, so there is 
+		 * nothing to store.
+		 */
+		if(!proj.handle) {
+			logwarn("prediction store not used for compiled model");
+		} else if(!(popt->results = cgps_store_open(popt->store, &proj, popt->proj))) {
+			die("failed open prediction store %s", popt->store);
+		} else {
+			debug("prediction store ready (%lu results)", (unsigned long)popt->results->used);
+		}
+	}
 	
 	if(!popt->quiet && popt->verbose) {
 		if(popt->ipaddr) {
@@ -147,16 +249,11 @@ void service(struct options *popt)
 		}
 	}
 	
-	FD_ZERO(&sockfds);
-	if(popt->ipsock) {
-		debug("adding TCP server socket to read ready set (fd = %d)", popt->ipsock);
-		FD_SET(popt->ipsock, &sockfds);
-		maxsock = popt->ipsock > maxsock ? popt->ipsock : maxsock;
+	if(event_init(&events, popt, popt->backend) < 0) {
+		die("failed initilize event backend");
 	}
-	if(popt->unsock) {
-		debug("adding UNIX server socket to read ready set (fd = %d)", popt->unsock);
-		FD_SET(popt->unsock, &sockfds);
-		maxsock = popt->unsock > maxsock ? popt->unsock : maxsock;
+	if(!popt->quiet && popt->verbose) {
+		loginfo("using %s for accepting client connections", event_backend_name(events.backend));
 	}
 
 	debug("initilizing worker threads...");
@@ -177,89 +274,38 @@ void service(struct options *popt)
 	}
 	
 	while(1) {
-		fd_set readfds = sockfds;
-		int result, client = -1;
+		int i, result;
 
 		debug("waiting for client connections...");
-		result = select(maxsock + 1, &readfds, NULL, NULL, NULL);
+		result = event_accept(&events, peers, EVENT_ACCEPT_BATCH);
 		
 		if(cgpsd_done(popt->state)) {
+			for(i = 0; i < result; ++i) {
+				close(peers[i].sock);
+			}
 			break;
 		}
 		
 		if(result < 0) {
-			logerr("failed select");
+			logerr("failed accept client connection");
 			if(errno == EMFILE || errno == ENFILE) {
 				sleep_wait_queue(&workers);
 			}
-		} else {
-			debug("select returned with result = %d", result);
-			if(FD_ISSET(popt->ipsock, &readfds)) {
-				struct sockaddr_in sockaddr;
-				socklen_t socklen = sizeof(struct sockaddr_in);
-				client = accept(popt->ipsock,
-						(struct sockaddr *)&sockaddr,
-						&socklen);
-				if(client < 0) {
-					logerr("failed accept TCP client connection");
-					if(errno == EMFILE || errno == ENFILE) {
-						sleep_wait_queue(&workers);
-					}
-				} else if(!popt->quiet) {
-#ifdef HAVE_INET_NTOA
-					loginfo("accepted TCP client connection from %s on port %d", 
-						inet_ntoa(sockaddr.sin_addr), 
-						ntohs(sockaddr.sin_port));
-#else
-					loginfo("accepted TCP client connection on interface %s and port %d", 
-						popt->ipaddr, popt->port);
-#endif /* ! HAVE_INET_NTOA */
-				}
-			}
-			if(FD_ISSET(popt->unsock, &readfds)) {
-				struct sockaddr_un sockaddr;
-				socklen_t socklen = sizeof(struct sockaddr_un);
-				client = accept(popt->unsock,
-						(struct sockaddr *)&sockaddr,
-						&socklen);
-				if(client < 0) {
-					logerr("failed accept UNIX client connection");
-					if(errno == EMFILE || errno == ENFILE) {
-						sleep_wait_queue(&workers);
-					}
-				} else {
-					struct ucred cred;
-					size_t credlen = sizeof(struct ucred);
-					
-					if(getsockopt(client, SOL_SOCKET, SO_PEERCRED, &cred, &credlen) < 0) {
-						logerr("failed get credentials of UNIX socket peer");
-					} else {
-						debug("UNIX socket peer: pid = %d, uid = %d, gid = %d",
-						      cred.pid, cred.uid, cred.gid);
-						while(1) {
-							struct passwd *pwent = getpwuid(cred.uid);
-							if(pwent) {
-								loginfo("accepted UNIX client connection from %s (uid: %d, pid: %d)", 
-									pwent->pw_name, cred.uid, cred.pid);
-								break;
-							} else if(errno == EMFILE || errno == ENFILE) {
-								sleep_wait_queue(&workers);
-								continue;
-							} else {
-								send_error(client, "internal server error");
-								logerr("failed get password database record for uid=%d", cred.uid);
-								break;
-							}
-						}
-					}
-				}
-			}
+			continue;
+		}
+		
+		debug("accepted %d client connections", result);
+		for(i = 0; i < result; ++i) {
+			int client = peers[i].sock;
 			
-			if(client != -1) {
-				if(worker_enqueue(&workers, client, opts, &proj) < 0) {
-					send_error(client, "server busy");
-					logerr("failed enqueue peer");
-				}
+			if(peers[i].server == popt->ipsock) {
+				accept_tcp_peer(popt, client);
+			} else if(accept_unix_peer(&workers, client) < 0) {
+				continue;
+			}
+			if(worker_enqueue(&workers, client, opts, &proj) < 0) {
+				send_error(client, "server busy");
+				logerr("failed enqueue peer");
 			}
 		}
 	}
@@ -269,6 +315,17 @@ void service(struct options *popt)
 	debug("finish worker threads...");
 	worker_cleanup(&workers);
 	
+	debug("releasing event backend");
+	event_cleanup(&events);
+	
 	debug("closing project");
-	cgps_project_close(&proj);	
+	cgps_neighbors_close(popt->index);
+	popt->index = NULL;
+	cgps_native_close(popt->engine);
+	popt->engine = NULL;
+	cgps_store_close(popt->results);
+	popt->results = NULL;
+	if(proj.handle) {
+		cgps_project_close(&proj);
+	}
 }
@@ -0,0 +1,88 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Recording of request traces (see libcgpssqp/trace.h). The worker threads
+ * writes one record for each request served.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+
+#include "cgpssqp.h"
+#include "cgpsd.h"
+#include "trace.h"
+
+/*
+ * Open the request trace. An existing trace is appended to.
+ */
+int init_trace(struct options *popt)
+{
+	if(!(popt->tracefs = fopen(popt->trace, "a"))) {
+		logerr("failed open trace file %s", popt->trace);
+		return -1;
+	}
+	if(ftell(popt->tracefs) == 0) {
+		if(cgps_trace_write_header(popt->tracefs, popt->traceflags) < 0 ||
+		   fflush(popt->tracefs) != 0) {
+			logerr("failed write trace file header");
+			fclose(popt->tracefs);
+			popt->tracefs = NULL;
+			return -1;
+		}
+	}
+	debug("recording requests to %s (%s)", popt->trace, 
+	      popt->traceflags & CGPS_TRACE_PAYLOAD ? "with payload" : "hash only");
+	return 0;
+}
+
+/*
+ * Append record to the request trace.
+ * 
+ * NOTE: this function gets called from a worker thread.
+ */
+void write_trace(struct options *popt, const struct cgps_trace_record *rec)
+{
+	flockfile(popt->tracefs);
+	if(cgps_trace_write(popt->tracefs, rec) < 0 || fflush(popt->tracefs) != 0) {
+		logerr("failed write request to trace file %s", popt->trace);
+	}
+	funlockfile(popt->tracefs);
+}
+
+void close_trace(struct options *popt)
+{
+	if(popt->tracefs) {
+		if(fclose(popt->tracefs) != 0) {
+			logerr("failed close trace file %s", popt->trace);
+		}
+		popt->tracefs = NULL;
+	}
+}
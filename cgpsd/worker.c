@@ -42,6 +42,7 @@
 #include "cgpssqp.h"
 #include "dllist.h"
 #include "worker.h"
+#include "trace.h"
 
 /*
  * Print worker thread pool statistics (for debug).
@@ -247,6 +248,9 @@ int worker_enqueue(struct workers *threads, int sock, struct options *popt, cons
 	peer->sock = sock;
 	peer->opts = popt;
 	peer->proj = proj;
+	if(popt->tracefs) {
+		peer->accepted = cgps_trace_clock();
+	}
 	
 	pthread_mutex_lock(&threads->peerlock);
 	dllist_insert(&threads->ready, peer, DLL_INSERT_TAIL);
@@ -0,0 +1,50 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef __CGPSSTD_H__
+#define __CGPSSTD_H__
+
+/*
+ * Predict model (index) of project and write result to out. Returns -1 if
+ * the prediction failed (the plain result written so far is still output).
+ */
+int predict_model(struct cgps_project *proj, struct cgps_predict_cache *cache, int index, FILE *out);
+
+/*
+ * Predict the models of project using popt->threads threads. Each thread
+ * uses its own project instance. The results are written to out in model
+ * order. Returns -1 if any model failed.
+ */
+int predict_threads(struct options *popt, struct cgps_project *proj, struct cgps_predict_cache *cache, FILE *out);
+
+/*
+ * Predict the models of a compiled model file (see cgpsmodel) using the
+ * native engine. The project is never loaded.
+ */
+int predict_compiled(struct options *popt, struct cgps_predict_cache *cache, FILE *out);
+
+#endif /* __CGPSSTD_H__ */
@@ -39,6 +39,9 @@
 #include <chemgps.h>
 
 #include "cgpssqp.h"
+#include "cgpsstd.h"
+#include "native.h"
+#include "store.h"
 
 struct options *opts = NULL;
 
@@ -68,30 +71,36 @@ static void exit_handler(void)
 			free(opts->proj);
 			opts->proj = NULL;
 		}
+		if(opts->store) {
+			free(opts->store);
+			opts->store = NULL;
+		}
 		free(opts);
 		opts = NULL;
 	}
 }
 #endif
 
-static void make_prediction(struct options *popt)
+static int make_prediction(struct options *popt)
 {	
 	struct cgps_project proj;
-	struct cgps_predict pred;
-	struct cgps_result res;
-	int i, model;
+	struct cgps_predict_cache cache;
 	struct client data;
+	FILE *out = stdout;
+	int i, result = 0;
 	
 	memset(&data, 0, sizeof(struct client));
 	data.opts = popt;
 	data.type = CGPS_STANDALONE;
+	data.binary = popt->binary;
+	cgps_predict_cache_init(&cache, &data);
 
 	popt->cgps->logger = cgps_syslog;
-	popt->cgps->indata = cgps_predict_data;
+	popt->cgps->indata = cgps_predict_data_cached;
 	
 	if(popt->output) {
-		res.out = fopen(popt->output, "w");
-		if(!res.out) {
+		out = fopen(popt->output, "w");
+		if(!out) {
 			die("failed open output file %s", popt->output);
 		}
 	}
@@ -102,30 +111,30 @@ static void make_prediction(struct options *popt)
 	}
 	popt->cgps->syslog = popt->syslog;
 	
-	if(cgps_project_load(&proj, popt->proj, popt->cgps) == 0) {			
+	if(cgps_native_compiled(popt->proj)) {
+		debug("predicting compiled model %s", popt->proj);
+		if(popt->store) {
+			logwarn("prediction store not used for compiled model");
+		}
+		result = predict_compiled(popt, &cache, out);
+	} else if(cgps_project_load(&proj, popt->proj, popt->cgps) == 0) {			
 		debug("successful loaded project %s", popt->proj);
 		debug("project got %d models", proj.models);
-		for(i = 1; i <= proj.models; ++i) {			
-			cgps_predict_init(&proj, &pred, &data);
-			debug("initilized for prediction");
-			if((model = cgps_predict(&proj, i, &pred)) != -1) {					
-				debug("predict called (index=%d, model=%d)", i, model);
-				if(cgps_result_init(&proj, &res) == 0) {
-					debug("intilized prediction result");
-					if(cgps_result(&proj, model, &pred, &res, res.out) == 0) {
-						debug("successful got result");
-					}
-					debug("cleaning up the result");
-					cgps_result_cleanup(&proj, &res);
+		if(popt->store && !(popt->results = cgps_store_open(popt->store, &proj, popt->proj))) {
+			die("failed open prediction store %s", popt->store);
+		}
+		if(popt->threads > 1 && proj.models > 1) {
+			result = predict_threads(popt, &proj, &cache, out);
+		} else {
+			for(i = 1; i <= proj.models; ++i) {
+				if(predict_model(&proj, &cache, i, out) < 0) {
+					result = -1;
 				}
 			}
-			else {
-				logerr("failed predict");
-			}
-			debug("cleaning up after predict");
-			cgps_predict_cleanup(&proj, &pred);
 		}
 		debug("closing project");
+		cgps_store_close(popt->results);
+		popt->results = NULL;
 		cgps_project_close(&proj);
 	}
 	else {
@@ -133,9 +142,10 @@ static void make_prediction(struct options *popt)
 	}
 	
 	if(popt->output) {
-		fclose(res.out);
-		res.out = NULL;
+		fclose(out);
 	}
+	cgps_predict_cache_cleanup(&cache);
+	return result;
 }
 
 int main(int argc, char **argv)
@@ -161,7 +171,9 @@ int main(int argc, char **argv)
 	}
 #endif
 	parse_options(argc, argv, opts);	
-	make_prediction(opts);
-			
+	if(make_prediction(opts) < 0) {
+		return 1;
+	}
+	
 	return 0;
 }
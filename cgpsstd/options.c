@@ -65,8 +65,11 @@ static void usage(const char *prog, const char *section)
 		printf("  -l, --logfile=path: Use path as simca lib log\n");
 		printf("  -r, --result=str:   Colon separated list of results to show (see -h result)\n");
 		printf("  -n, --numobs=num:   Number of observations in input data (see -i option) (default=%d)\n", DEFAULT_NUMBER_OBSERVATIONS);
+		printf("  -R, --rows=first[:count]: Predict row range of cgpsx input data (see cgpsdata)\n");
 		printf("  -s, --syslog:       Use syslog(3) for application logging\n");
-		printf("  -f, --format=str:   Set ouput format (either plain or xml)\n");
+		printf("  -f, --format=str:   Set ouput format (either plain, xml or binary)\n");
+		printf("  -t, --threads=num:  Predict models concurrently using num threads (0 = all CPU's) [1]\n");
+		printf("  -S, --store=path:   Reuse results from persistent prediction store\n");
 		printf("  -b, --batch:        Enable batch job mode (suppress some messages)\n");
 #if ! defined(NDEBUG)
 		printf("  -d, --debug:        Enable debug output (allowed multiple times)\n");
@@ -125,8 +128,11 @@ void parse_options(int argc, char **argv, struct options *popt)
 		{ "logfile", 1, 0, 'l' },
 		{ "result",  1, 0, 'r' },
 		{ "numobs",  1, 0, 'n' },
+		{ "rows",    1, 0, 'R' },
 		{ "syslog",  0, 0, 's' },
 		{ "format",  1, 0, 'f' }, 
+		{ "threads", 1, 0, 't' },
+		{ "store",   1, 0, 'S' },
 		{ "batch",   0, 0, 'b' },
 #if ! defined(NDEBUG)
 		{ "debug",   0, 0, 'd' },
@@ -143,7 +149,7 @@ void parse_options(int argc, char **argv, struct options *popt)
 		exit(1);
 	}
 	
-	while((c = getopt_long(argc, argv, "bdf:h:i:l:n:o:p:r:svV", options, &optindex)) != -1) {
+	while((c = getopt_long(argc, argv, "bdf:h:i:l:n:o:p:r:R:sS:t:vV", options, &optindex)) != -1) {
 		switch(c) {
 		case 'b':
 			popt->batch = 1;
@@ -158,6 +164,9 @@ void parse_options(int argc, char **argv, struct options *popt)
 				popt->cgps->format = CGPS_OUTPUT_FORMAT_PLAIN;
 			} else if(strcmp("xml", optarg) == 0) {
 				popt->cgps->format = CGPS_OUTPUT_FORMAT_XML;
+			} else if(strcmp("binary", optarg) == 0) {
+				popt->cgps->format = CGPS_OUTPUT_FORMAT_PLAIN;
+				popt->binary = 1;
 			} else {
 				die("unknown format '%s' argument for option -f", optarg);
 			}
@@ -199,10 +208,32 @@ void parse_options(int argc, char **argv, struct options *popt)
 		case 'r':
 			popt->cgps->result = cgps_get_predict_mask(optarg);
 			break;
+		case 'R':
+			if(sscanf(optarg, "%d:%d", &popt->firstobs, &popt->numobs) < 1 ||
+			   popt->firstobs < 0 || popt->numobs < 0) {
+				die("invalid row range '%s' argument for option -R", optarg);
+			}
+			break;
 		case 's':
 			debug("enabling syslog (bye-bye console ;-))");
 			popt->syslog = 1;
 			break;
+		case 'S':
+			popt->store = malloc(strlen(optarg) + 1);
+			if(!popt->store) {
+				die("failed alloc memory");
+			}
+			strcpy(popt->store, optarg);
+			break;
+		case 't':
+			popt->threads = atoi(optarg);
+			if(popt->threads < 0) {
+				die("number of threads %s is invalid", optarg);
+			}
+			if(popt->threads == 0 && (popt->threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+				popt->threads = 1;
+			}
+			break;
 		case 'v':
 			popt->verbose++;
 			break;
@@ -282,12 +313,18 @@ void parse_options(int argc, char **argv, struct options *popt)
 		if(popt->cgps->logfile) {
 			debug("  simca lib logfile = %s", popt->cgps->logfile);
 		}
+		if(popt->threads > 1) {
+			debug("  prediction threads = %d", popt->threads);
+		}
+		if(popt->store) {
+			debug("  prediction store = %s", popt->store);
+		}
 		debug("  flags: debug = %s, use syslog = %s, verbose = %s", 
 		      (popt->debug   ? "yes" : "no"), 
 		      (popt->syslog  ? "yes" : "no"),
 		      (popt->verbose ? "yes" : "no"));
-		debug("  libchemgps: format = %d, result = %d",
-		      popt->cgps->format, popt->cgps->result);
+		debug("  libchemgps: format = %d, result = %d (binary = %s)",
+		      popt->cgps->format, popt->cgps->result, popt->binary ? "yes" : "no");
 		debug("---------------------------------------------");
 	}
 }
@@ -0,0 +1,349 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <chemgps.h>
+
+#include "cgpssqp.h"
+#include "cgpsstd.h"
+#include "native.h"
+#include "store.h"
+#include "binary.h"
+#include "writer.h"
+
+/*
+ * A worker thread. The first worker uses the project loaded by the main
+ * thread, the other loads their own instance when started.
+ */
+struct predict_worker
+{
+	struct predict_pool *pool;
+	struct cgps_project *proj;
+	struct cgps_project local;     /* own project instance */
+	pthread_t thread;
+	int number;                    /* thread number */
+	int started;
+};
+
+/*
+ * The result of one model.
+ */
+struct predict_output
+{
+	char *buff;
+	size_t size;
+	int status;                    /* 0 = pending, 1 = done, -1 = failed */
+};
+
+struct predict_pool
+{
+	pthread_mutex_t lock;
+	pthread_mutex_t load;          /* serialize project loading */
+	pthread_cond_t done;
+	struct options *popt;
+	struct cgps_predict_cache *cache;
+	struct predict_output *output; /* indexed by model */
+	int models;
+	int next;                      /* next model to predict */
+};
+
+/*
+ * Write the plain result of model index to out, encoded in the binary
+ * format if requested (result is the result mask).
+ */
+static void predict_write(const char *buff, size_t size, int index, int result, int binary, FILE *out)
+{
+	if(!binary) {
+		fwrite(buff, 1, size, out);
+	} else if(cgps_binary_encode(buff, size, index, result, out) < 0) {
+		logerr("failed encode result of model %d", index);
+	}
+}
+
+int predict_model(struct cgps_project *proj, struct cgps_predict_cache *cache, int index, FILE *out)
+{
+	struct cgps_store *store = cache->loader->opts->results;
+	struct cgps_predict pred;
+	struct cgps_result res;
+	uint64_t *rows = NULL;
+	char *buff = NULL;
+	size_t size = 0;
+	int model, count = 0, result = -1;
+	int binary = cache->loader->binary;
+
+	memset(&res, 0, sizeof(struct cgps_result));
+	res.out = out;
+
+	/*
+	 * Models served from the store don't use SIMCA-QP, so the input 
+	 * data is loaded direct.
+	 */
+	if(store && cgps_predict_cache_load(cache, &store->names) == 0) {
+		rows = cgps_store_rows(&cache->input);
+		count = cache->input.rows;
+		if(rows && cgps_store_lookup(store, index, rows, count, proj->opts->result, proj->opts->format, &buff, &size) == 0) {
+			debug("got result from prediction store (model %d)", index);
+			predict_write(buff, size, index, proj->opts->result, binary, out);
+			free(buff);
+			free(rows);
+			return 0;
+		}
+	}
+	if(cgps_predict_init(proj, &pred, cache) < 0) {
+		logerr("failed initilize prediction (model %d)", index);
+		cgps_predict_cleanup(proj, &pred);
+		free(rows);
+		return -1;
+	}
+	if((rows || binary) && !(res.out = open_memstream(&buff, &size))) {
+		logerr("failed open memory stream");
+		res.out = out;
+	} else if(!rows && !binary && !(res.out = cgps_writer_stream(out))) {
+		res.out = out;
+	}
+	if((model = cgps_predict(proj, index, &pred)) != -1) {
+		debug("predict called (index=%d, model=%d)", index, model);
+		if(cgps_result_init(proj, &res) == 0) {
+			if(cgps_result(proj, model, &pred, &res, res.out) == 0) {
+				debug("successful got result (model %d)", index);
+				result = 0;
+			}
+			cgps_result_cleanup(proj, &res);
+		}
+	} else {
+		logerr("failed predict");
+	}
+	if(res.out != out && !rows && !binary) {
+		fclose(res.out);
+	} else if(res.out != out) {
+		fclose(res.out);
+		if(result == 0 && rows) {
+			cgps_store_insert(store, index, rows, count, proj->opts->result, proj->opts->format, buff, size);
+		}
+		if(result == 0 || !binary) {
+			predict_write(buff, size, index, proj->opts->result, binary, out);
+		}
+		free(buff);
+	}
+	free(rows);
+	cgps_predict_cleanup(proj, &pred);
+	return result;
+}
+
+/*
+ * Load the project instance of worker. The library is not known to be safe
+ * for concurrent loading, so instances are loaded one at a time while the
+ * first worker is already predicting. Nothing is loaded if all models has
+ * been taken by other workers.
+ */
+static int predict_load(struct predict_worker *worker)
+{
+	struct predict_pool *pool = worker->pool;
+	int pending, result = -1;
+
+	pthread_mutex_lock(&pool->load);
+	pthread_mutex_lock(&pool->lock);
+	pending = pool->next <= pool->models;
+	pthread_mutex_unlock(&pool->lock);
+	
+	if(!pending) {
+		debug("all models taken, skip loading project (thread %d)", worker->number);
+	} else if(cgps_project_load(&worker->local, pool->popt->proj, pool->popt->cgps) == 0) {
+		debug("loaded project instance %d", worker->number);
+		worker->proj = &worker->local;
+		result = 0;
+	} else {
+		logerr("failed load project %s (thread %d)", pool->popt->proj, worker->number);
+	}
+	pthread_mutex_unlock(&pool->load);
+	return result;
+}
+
+static void * predict_thread(void *arg)
+{
+	struct predict_worker *worker = (struct predict_worker *)arg;
+	struct predict_pool *pool = worker->pool;
+	struct predict_output *output;
+	FILE *out;
+	int index, status;
+
+	if(!worker->proj && predict_load(worker) < 0) {
+		return NULL;
+	}
+	while(1) {
+		pthread_mutex_lock(&pool->lock);
+		index = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(index > pool->models) {
+			break;
+		}
+		output = &pool->output[index];
+		status = -1;
+		if(!(out = open_memstream(&output->buff, &output->size))) {
+			logerr("failed open memory stream");
+		} else {
+			if(predict_model(worker->proj, pool->cache, index, out) == 0) {
+				status = 1;
+			}
+			fclose(out);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		output->status = status;
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	if(worker->proj == &worker->local) {
+		pthread_mutex_lock(&pool->load);
+		cgps_project_close(worker->proj);
+		pthread_mutex_unlock(&pool->load);
+	}
+	return NULL;
+}
+
+int predict_threads(struct options *popt, struct cgps_project *proj, struct cgps_predict_cache *cache, FILE *out)
+{
+	struct predict_worker *workers;
+	struct predict_pool pool;
+	int i, num, error, result = 0;
+
+	num = popt->threads < proj->models ? popt->threads : proj->models;
+	debug("predicting %d models using %d threads", proj->models, num);
+
+	memset(&pool, 0, sizeof(struct predict_pool));
+	pool.popt = popt;
+	pool.cache = cache;
+	pool.models = proj->models;
+	pool.next = 1;
+	if(!(pool.output = calloc(proj->models + 1, sizeof(struct predict_output)))) {
+		die("failed alloc memory");
+	}
+	if(!(workers = calloc(num, sizeof(struct predict_worker)))) {
+		die("failed alloc memory");
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_mutex_init(&pool.load, NULL);
+	pthread_cond_init(&pool.done, NULL);
+
+	/*
+	 * The first worker starts predicting using the project loaded by the
+	 * main thread, while the others are loading their own instance.
+	 */
+	for(i = 0; i < num; ++i) {
+		workers[i].pool = &pool;
+		workers[i].number = i;
+		workers[i].proj = i == 0 ? proj : NULL;
+		if((error = pthread_create(&workers[i].thread, NULL, predict_thread, &workers[i])) != 0) {
+			errno = error;
+			logerr("failed create thread");
+			continue;
+		}
+		workers[i].started = 1;
+	}
+	if(!workers[0].started) {
+		/*
+		 * Fallback on predict in this thread.
+		 */
+		predict_thread(&workers[0]);
+	}
+
+	/*
+	 * Write results in model order as they become available. The output
+	 * of a failed model is written the same way as when predicting in
+	 * a single thread (see predict_model()).
+	 */
+	for(i = 1; i <= proj->models; ++i) {
+		pthread_mutex_lock(&pool.lock);
+		while(!pool.output[i].status) {
+			pthread_cond_wait(&pool.done, &pool.lock);
+		}
+		pthread_mutex_unlock(&pool.lock);
+		if(pool.output[i].status < 0) {
+			result = -1;
+		}
+		if(pool.output[i].buff) {
+			fwrite(pool.output[i].buff, 1, pool.output[i].size, out);
+			fflush(out);
+			free(pool.output[i].buff);
+		}
+	}
+
+	for(i = 0; i < num; ++i) {
+		if(workers[i].started) {
+			pthread_join(workers[i].thread, NULL);
+		}
+	}
+	pthread_cond_destroy(&pool.done);
+	pthread_mutex_destroy(&pool.load);
+	pthread_mutex_destroy(&pool.lock);
+	free(workers);
+	free(pool.output);
+	return result;
+}
+
+int predict_compiled(struct options *popt, struct cgps_predict_cache *cache, FILE *out)
+{
+	struct cgps_native *native;
+	int i, result = 0;
+
+	if(!(native = cgps_native_load(popt->proj, CGPS_NATIVE_ON))) {
+		return -1;
+	}
+	debug("compiled model got %d models", native->models);
+	for(i = 1; i <= native->models; ++i) {
+		if(!cgps_native_supported(native, i, popt->cgps->result)) {
+			errno = 0;
+			logerr("result not supported by compiled model (model %d)", i);
+			result = -1;
+			continue;
+		}
+		if(cgps_predict_cache_load(cache, &native->names) < 0) {
+			logerr("failed load input data");
+			result = -1;
+			break;
+		}
+		if(cgps_native_result(native, i, &cache->input, popt->cgps->result, 
+				      popt->binary ? CGPS_OUTPUT_FORMAT_BINARY : popt->cgps->format, out) < 0) {
+			logerr("failed native predict (model %d)", i);
+			result = -1;
+		}
+	}
+	cgps_native_close(native);
+	return result;
+}
@@ -0,0 +1,422 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <errno.h>
+
+#include "pool.h"
+
+/*
+ * Parse one endpoint (see cgpsclt_pool_open()).
+ */
+static int cgpsclt_endpoint_init(struct cgpsclt_endpoint *ep, const char *str, size_t len)
+{
+	const char *port = NULL;
+	size_t hlen;
+
+	memset(ep, 0, sizeof(struct cgpsclt_endpoint));
+	if(!(ep->name = malloc(len + 1))) {
+		return -1;
+	}
+	memcpy(ep->name, str, len);
+	ep->name[len] = '\0';
+
+	if(strncmp(ep->name, "unix:", 5) == 0) {
+		ep->path = strdup(ep->name + 5);
+		return ep->path ? 0 : -1;
+	}
+	if(ep->name[0] == '/' || ep->name[0] == '.') {
+		ep->path = strdup(ep->name);
+		return ep->path ? 0 : -1;
+	}
+
+	str = ep->name;
+	if(str[0] == '[') {
+		/*
+		 * IPv6 address: [addr] or [addr]:port
+		 */
+		const char *end = strchr(str, ']');
+		if(!end) {
+			errno = EINVAL;
+			return -1;
+		}
+		hlen = end - str - 1;
+		++str;
+		if(end[1] == ':') {
+			port = end + 2;
+		}
+	} else if(strchr(str, ':') != strrchr(str, ':')) {
+		/*
+		 * Unbracketed IPv6 address (no port).
+		 */
+		hlen = strlen(str);
+	} else {
+		port = strrchr(str, ':');
+		hlen = port ? (size_t)(port - str) : strlen(str);
+		if(port) {
+			++port;
+		}
+	}
+	if(!hlen || (port && (!*port || strlen(port) >= sizeof(ep->port)))) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(!(ep->host = malloc(hlen + 1))) {
+		return -1;
+	}
+	memcpy(ep->host, str, hlen);
+	ep->host[hlen] = '\0';
+
+	if(port) {
+		strcpy(ep->port, port);
+	} else {
+		snprintf(ep->port, sizeof(ep->port), "%d", CGPSCLT_DEFAULT_PORT);
+	}
+	return 0;
+}
+
+int cgpsclt_endpoint_parse(struct cgpsclt_pool *pool, const char *endpoints)
+{
+	const char *curr, *next;
+	int num = 1;
+
+	for(curr = endpoints; *curr; ++curr) {
+		if(*curr == ',') {
+			++num;
+		}
+	}
+	if(!(pool->endpoints = calloc(num, sizeof(struct cgpsclt_endpoint)))) {
+		return -1;
+	}
+
+	for(curr = endpoints; curr; curr = next) {
+		size_t len;
+
+		if((next = strchr(curr, ','))) {
+			len = next++ - curr;
+		} else {
+			len = strlen(curr);
+		}
+		if(!len) {
+			continue;
+		}
+		if(cgpsclt_endpoint_init(&pool->endpoints[pool->nendpoints++], curr, len) < 0) {
+			return -1;
+		}
+	}
+	if(!pool->nendpoints) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+void cgpsclt_endpoint_free(struct cgpsclt_pool *pool)
+{
+	int i;
+
+	for(i = 0; i < pool->nendpoints; ++i) {
+		struct cgpsclt_endpoint *ep = &pool->endpoints[i];
+		if(ep->addr) {
+			freeaddrinfo(ep->addr);
+		}
+		free(ep->name);
+		free(ep->path);
+		free(ep->host);
+	}
+	free(pool->endpoints);
+	pool->endpoints = NULL;
+	pool->nendpoints = 0;
+}
+
+/*
+ * Returns current time in ms.
+ */
+long long cgpsclt_endpoint_clock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/*
+ * The expected cost of sending one more request to endpoint.
+ */
+static double cgpsclt_endpoint_cost(const struct cgpsclt_endpoint *ep)
+{
+	return (ep->pending + 1) * (ep->latency > 0 ? ep->latency : CGPSCLT_LATENCY_INITIAL);
+}
+
+/*
+ * Select endpoint using the power of two choices: two endpoints are picked
+ * at random among those not ejected (and not the exclude endpoint that just
+ * failed) and the one with lowest cost is returned. If all endpoints are
+ * ejected, then the one whose ejection expires first is used. Should be
+ * called with the pool locked.
+ */
+struct cgpsclt_endpoint * cgpsclt_endpoint_select(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *exclude)
+{
+	struct cgpsclt_endpoint *ep, *first = NULL, *second = NULL, *best = NULL;
+	long long now;
+	int i, num = 0, pick1, pick2;
+
+	if(pool->nendpoints == 1) {
+		return pool->endpoints;
+	}
+
+	now = cgpsclt_endpoint_clock();
+	for(i = 0; i < pool->nendpoints; ++i) {
+		ep = &pool->endpoints[i];
+		if(ep == exclude) {
+			continue;
+		}
+		if(ep->eject <= now) {
+			++num;
+		} else if(!best || ep->eject < best->eject) {
+			best = ep;
+		}
+	}
+	if(!num) {
+		return best ? best : exclude;
+	}
+
+	pick1 = rand_r(&pool->seed) % num;
+	pick2 = num > 1 ? (pick1 + 1 + rand_r(&pool->seed) % (num - 1)) % num : pick1;
+
+	for(i = 0, num = 0; i < pool->nendpoints; ++i) {
+		ep = &pool->endpoints[i];
+		if(ep == exclude || ep->eject > now) {
+			continue;
+		}
+		if(num == pick1) {
+			first = ep;
+		}
+		if(num == pick2) {
+			second = ep;
+		}
+		++num;
+	}
+	return cgpsclt_endpoint_cost(second) < cgpsclt_endpoint_cost(first) ? second : first;
+}
+
+/*
+ * Update endpoint statistics after a request has been run on it. The
+ * elapsed time (ms) is added to the latency average on success, while an
+ * endpoint that failed is ejected. Should be called with the pool locked.
+ */
+void cgpsclt_endpoint_update(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *ep, int result, long long elapsed)
+{
+	ep->requests++;
+
+	switch(result) {
+	case CGPSCLT_RUN_SUCCESS:
+		if(elapsed < 1) {
+			elapsed = 1;
+		}
+		if(ep->latency > 0) {
+			ep->latency += CGPSCLT_LATENCY_DECAY * (elapsed - ep->latency);
+		} else {
+			ep->latency = elapsed;
+		}
+		ep->eject = 0;
+		break;
+	case CGPSCLT_RUN_RETRY:
+		ep->failures++;
+		if(pool->nendpoints > 1) {
+			ep->eject = cgpsclt_endpoint_clock() + pool->ejecttime;
+		}
+		break;
+	}
+}
+
+/*
+ * Connect socket with optional timeout (ms).
+ */
+static int cgpsclt_endpoint_connect_timeout(int sock, const struct sockaddr *addr, socklen_t addrlen, int timeout)
+{
+	struct pollfd pfd;
+	socklen_t errlen = sizeof(int);
+	int flags, error = 0;
+
+	if(!timeout) {
+		return connect(sock, addr, addrlen);
+	}
+
+	if((flags = fcntl(sock, F_GETFL, 0)) < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+	if(connect(sock, addr, addrlen) < 0) {
+		if(errno != EINPROGRESS) {
+			return -1;
+		}
+		pfd.fd = sock;
+		pfd.events = POLLOUT;
+		if((error = poll(&pfd, 1, timeout)) <= 0) {
+			errno = error ? errno : ETIMEDOUT;
+			return -1;
+		}
+		if(getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &errlen) < 0) {
+			return -1;
+		}
+		if(error) {
+			errno = error;
+			return -1;
+		}
+	}
+	return fcntl(sock, F_SETFL, flags);
+}
+
+/*
+ * Apply the I/O timeout on a connected socket.
+ */
+static int cgpsclt_endpoint_set_timeout(int sock, int timeout)
+{
+	struct timeval tv;
+
+	if(!timeout) {
+		return 0;
+	}
+	tv.tv_sec  = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(struct timeval)) < 0 ||
+	   setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval)) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Connect to endpoint. Returns the connected socket or -1 on failure (the
+ * error message is set in request).
+ */
+int cgpsclt_endpoint_connect(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *ep, struct cgpsclt_request *req)
+{
+	int sock = -1;
+
+	if(ep->path) {
+		struct sockaddr_un sockaddr;
+
+		if(strlen(ep->path) >= sizeof(sockaddr.sun_path)) {
+			cgpsclt_request_error(req, "socket path %s is too long", ep->path);
+			return -1;
+		}
+		memset(&sockaddr, 0, sizeof(struct sockaddr_un));
+		sockaddr.sun_family = AF_UNIX;
+		strcpy(sockaddr.sun_path, ep->path);
+
+		if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+			cgpsclt_request_error(req, "failed create UNIX socket (%s)", strerror(errno));
+			return -1;
+		}
+		if(cgpsclt_endpoint_connect_timeout(sock, (struct sockaddr *)&sockaddr, sizeof(struct sockaddr_un), pool->timeout) < 0) {
+			cgpsclt_request_error(req, "failed connect to %s (%s)", ep->name, strerror(errno));
+			close(sock);
+			return -1;
+		}
+	} else {
+		struct addrinfo hints, *addr, *next, *list;
+		int res;
+
+		/*
+		 * The address is resolved once and shared by all workers.
+		 */
+		pthread_mutex_lock(&pool->lock);
+		list = ep->addr;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(!list) {
+			memset(&hints, 0, sizeof(struct addrinfo));
+			hints.ai_family = AF_UNSPEC;
+			hints.ai_socktype = SOCK_STREAM;
+			hints.ai_flags = AI_ADDRCONFIG;
+
+			if((res = getaddrinfo(ep->host, ep->port, &hints, &addr)) != 0) {
+				cgpsclt_request_error(req, "failed resolve %s (%s)", ep->name, gai_strerror(res));
+				return -1;
+			}
+			pthread_mutex_lock(&pool->lock);
+			if(!ep->addr) {
+				ep->addr = addr;
+				addr = NULL;
+			}
+			list = ep->addr;
+			pthread_mutex_unlock(&pool->lock);
+			if(addr) {
+				freeaddrinfo(addr);
+			}
+		}
+
+		for(next = list; next; next = next->ai_next) {
+			if((sock = socket(next->ai_family, next->ai_socktype, next->ai_protocol)) < 0) {
+				continue;
+			}
+			if(cgpsclt_endpoint_connect_timeout(sock, next->ai_addr, next->ai_addrlen, pool->timeout) == 0) {
+				break;
+			}
+			close(sock);
+			sock = -1;
+		}
+		if(sock < 0) {
+			cgpsclt_request_error(req, "failed connect to %s (%s)", ep->name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if(cgpsclt_endpoint_set_timeout(sock, pool->timeout) < 0) {
+		cgpsclt_request_error(req, "failed set socket timeout (%s)", strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
@@ -0,0 +1,170 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The client library for embedding cgpsd predictions in other applications.
+ *
+ * A pool is opened against one or more daemons and owns a fixed number of
+ * workers (I/O threads), each running one request at a time on its own 
+ * connection. The daemon closes the connection to end the result, so 
+ * connections are not reused. Requests are submitted without blocking
+ * and carries their input data and output in memory. Completion is either
+ * signaled by calling a callback (from a pool thread), by queueing the
+ * request on the pools completion queue (readable on the descriptor from
+ * cgpsclt_pool_fd()) or by blocking in cgpsclt_wait().
+ *
+ * See docs/README.library for an example.
+ */
+
+#ifndef __LIBCGPSCLT_H__
+#define __LIBCGPSCLT_H__
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Output format (the Format: option).
+ */
+#define CGPSCLT_FORMAT_PLAIN 1
+#define CGPSCLT_FORMAT_XML   2
+
+/*
+ * Request status.
+ */
+#define CGPSCLT_STATUS_PENDING  0   /* queued or in progress */
+#define CGPSCLT_STATUS_SUCCESS  1   /* result is available */
+#define CGPSCLT_STATUS_FAILED   2   /* failed (see cgpsclt_error()) */
+#define CGPSCLT_STATUS_CANCELED 3   /* the pool was closed */
+
+/*
+ * Pool options for cgpsclt_pool_setopt().
+ */
+#define CGPSCLT_OPT_TIMEOUT     1   /* socket I/O timeout (ms, 0 = none) [0] */
+#define CGPSCLT_OPT_RETRIES     2   /* retry failed connects [3] */
+#define CGPSCLT_OPT_RETRY_SLEEP 3   /* sleep between retries (ms) [100] */
+#define CGPSCLT_OPT_EJECT_TIME  4   /* eject failed endpoint (ms) [30000] */
+#define CGPSCLT_OPT_FAILOVER    5   /* retry failed requests in progress [1] */
+
+struct cgpsclt_pool;
+struct cgpsclt_request;
+
+typedef void (*cgpsclt_callback)(struct cgpsclt_request *req, void *arg);
+
+/*
+ * Open a pool with workers I/O threads. The endpoints argument is a
+ * comma separated list of daemon addresses, where each entry is either an
+ * UNIX socket path (i.e. /var/run/cgpsd.sock or unix:cgpsd.sock) or a TCP
+ * address (host, host:port or [ipv6]:port). Requests are balanced over
+ * the endpoints using the power of two choices: the least loaded of two
+ * random endpoints is picked, where load is the number of outstanding
+ * requests weighted by the average latency. Endpoints failing to connect,
+ * reporting busy, timing out or dropping connections are ejected for a
+ * while. Returns NULL on failure with errno set.
+ */
+struct cgpsclt_pool * cgpsclt_pool_open(const char *endpoints, int workers);
+
+/*
+ * Set a pool option (see CGPSCLT_OPT_XXX). Returns -1 if option is unknown.
+ */
+int cgpsclt_pool_setopt(struct cgpsclt_pool *pool, int option, int value);
+
+/*
+ * Close the pool. Queued requests are canceled and in progress requests
+ * are finished before this function returns. The pool can't be used
+ * after this call, but handles of requests not yet released are still
+ * valid and must be released by the caller (the pool is freed when the
+ * last request is released).
+ */
+void cgpsclt_pool_close(struct cgpsclt_pool *pool);
+
+/*
+ * Returns a descriptor that is readable when the completion queue is not
+ * empty. Suitable for select(), poll() or epoll.
+ */
+int cgpsclt_pool_fd(struct cgpsclt_pool *pool);
+
+/*
+ * Returns next completed request from the completion queue or NULL if
+ * the queue is empty. Only requests submitted without callback are added
+ * to the completion queue. This function never blocks.
+ */
+struct cgpsclt_request * cgpsclt_pool_reap(struct cgpsclt_pool *pool);
+
+/*
+ * Submit a prediction request. The result argument is a colon separated
+ * list of prediction results (like the --result option of cgpsclt). The
+ * data (size bytes) is copied. If func is non-NULL, then it's called with
+ * arg from one of the pool threads when the request is finished. Returns
+ * NULL on failure with errno set.
+ */
+struct cgpsclt_request * cgpsclt_submit(struct cgpsclt_pool *pool,
+					const char *result, int format,
+					const char *data, size_t size,
+					cgpsclt_callback func, void *arg);
+
+/*
+ * Block until request is finished and return its status. A request
+ * waited on is removed from the completion queue.
+ */
+int cgpsclt_wait(struct cgpsclt_request *req);
+
+/*
+ * Returns the request status (CGPSCLT_STATUS_XXX).
+ */
+int cgpsclt_status(struct cgpsclt_request *req);
+
+/*
+ * Returns the prediction result of a finished request. The size argument
+ * is optional (may be NULL). The buffer is owned by the request.
+ */
+const char * cgpsclt_output(struct cgpsclt_request *req, size_t *size);
+
+/*
+ * Returns the error message of a failed request or NULL.
+ */
+const char * cgpsclt_error(struct cgpsclt_request *req);
+
+/*
+ * Returns the arg argument passed to cgpsclt_submit().
+ */
+void * cgpsclt_userdata(struct cgpsclt_request *req);
+
+/*
+ * Release the request. Must be called exactly once for every request. If
+ * called on a pending request, then the request is released as soon as
+ * it has finished (the callback is still called).
+ */
+void cgpsclt_release(struct cgpsclt_request *req);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBCGPSCLT_H__ */
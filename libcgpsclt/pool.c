@@ -0,0 +1,554 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The worker pool. Each pool thread (worker) runs one request at a time.
+ * Requests are sent on a new connection as the daemon closes the 
+ * connection to signal end of result, so the number of workers limits the
+ * number of concurrent connections.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+
+#include "pool.h"
+
+static void cgpsclt_queue_push(struct cgpsclt_queue *queue, struct cgpsclt_request *req)
+{
+	req->next = NULL;
+	if(queue->tail) {
+		queue->tail->next = req;
+	} else {
+		queue->head = req;
+	}
+	queue->tail = req;
+}
+
+static struct cgpsclt_request * cgpsclt_queue_pop(struct cgpsclt_queue *queue)
+{
+	struct cgpsclt_request *req = queue->head;
+
+	if(req) {
+		if(!(queue->head = req->next)) {
+			queue->tail = NULL;
+		}
+		req->next = NULL;
+	}
+	return req;
+}
+
+static void cgpsclt_queue_remove(struct cgpsclt_queue *queue, struct cgpsclt_request *req)
+{
+	struct cgpsclt_request *prev = NULL, *curr;
+
+	for(curr = queue->head; curr; prev = curr, curr = curr->next) {
+		if(curr == req) {
+			if(prev) {
+				prev->next = curr->next;
+			} else {
+				queue->head = curr->next;
+			}
+			if(queue->tail == curr) {
+				queue->tail = prev;
+			}
+			curr->next = NULL;
+			break;
+		}
+	}
+}
+
+static void cgpsclt_request_free(struct cgpsclt_request *req)
+{
+	free(req->result);
+	free(req->data);
+	free(req->output);
+	free(req);
+}
+
+/*
+ * Release the pool resources.
+ */
+static void cgpsclt_pool_destroy(struct cgpsclt_pool *pool)
+{
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->ready);
+	pthread_mutex_destroy(&pool->lock);
+
+	if(pool->notify[0] != -1) {
+		close(pool->notify[0]);
+		close(pool->notify[1]);
+	}
+	cgpsclt_endpoint_free(pool);
+	free(pool->threads);
+	free(pool);
+}
+
+/*
+ * Drop the reference held by a released request. Returns true if the
+ * pool has been closed and this was the last request (the pool should
+ * then be destroyed by the caller after unlocking it). Should be called
+ * with the pool locked.
+ */
+static int cgpsclt_pool_unref(struct cgpsclt_pool *pool)
+{
+	return --pool->refs == 0 && pool->closed;
+}
+
+/*
+ * Drain the notify pipe when completion queue is empty. Should be called
+ * with the pool locked.
+ */
+static void cgpsclt_pool_drain(struct cgpsclt_pool *pool)
+{
+	char buff[64];
+
+	if(!pool->completed.head) {
+		while(read(pool->notify[0], buff, sizeof(buff)) > 0) {
+			;
+		}
+	}
+}
+
+/*
+ * Remove request from completion queue. Should be called with the pool
+ * locked.
+ */
+static void cgpsclt_pool_unqueue(struct cgpsclt_pool *pool, struct cgpsclt_request *req)
+{
+	if(req->queued) {
+		cgpsclt_queue_remove(&pool->completed, req);
+		req->queued = 0;
+		cgpsclt_pool_drain(pool);
+	}
+}
+
+/*
+ * Finish the request: call the callback or add request to completion queue
+ * and wake up threads blocked in cgpsclt_wait().
+ */
+static void cgpsclt_pool_complete(struct cgpsclt_pool *pool, struct cgpsclt_request *req, int status)
+{
+	int release = 0, destroy = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	req->status = status;
+	if(req->func) {
+		req->busy = 1;
+		pthread_mutex_unlock(&pool->lock);
+		req->func(req, req->arg);
+		pthread_mutex_lock(&pool->lock);
+		req->busy = 0;
+		release = req->released;
+	} else if(req->released) {
+		release = 1;
+	} else {
+		cgpsclt_queue_push(&pool->completed, req);
+		req->queued = 1;
+		if(write(pool->notify[1], "", 1) < 0) {
+			/* EAGAIN: the pipe is full, but then it's already readable */
+		}
+	}
+	if(release) {
+		destroy = cgpsclt_pool_unref(pool);
+	}
+	pthread_cond_broadcast(&pool->done);
+	pthread_mutex_unlock(&pool->lock);
+
+	if(release) {
+		cgpsclt_request_free(req);
+	}
+	if(destroy) {
+		cgpsclt_pool_destroy(pool);
+	}
+}
+
+/*
+ * Run request, retrying on another endpoint (if any) when the endpoint
+ * failed. Requests in progress (already sent) are only retried if failover
+ * is enabled.
+ */
+static void cgpsclt_pool_process(struct cgpsclt_pool *pool, struct cgpsclt_request *req)
+{
+	struct cgpsclt_endpoint *ep = NULL;
+	long long started;
+	int attempt = 0, sock, result;
+
+	while(1) {
+		pthread_mutex_lock(&pool->lock);
+		ep = cgpsclt_endpoint_select(pool, ep);
+		ep->pending++;
+		pthread_mutex_unlock(&pool->lock);
+
+		req->sent = 0;
+		started = cgpsclt_endpoint_clock();
+		if((sock = cgpsclt_endpoint_connect(pool, ep, req)) < 0) {
+			result = CGPSCLT_RUN_RETRY;
+		} else {
+			result = cgpsclt_request_run(req, sock);
+			close(sock);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		ep->pending--;
+		cgpsclt_endpoint_update(pool, ep, result, cgpsclt_endpoint_clock() - started);
+		pthread_mutex_unlock(&pool->lock);
+
+		if(result == CGPSCLT_RUN_SUCCESS) {
+			req->error[0] = '\0';
+			break;
+		}
+		if(result != CGPSCLT_RUN_RETRY) {
+			break;
+		}
+		if(req->sent && !pool->failover) {
+			result = CGPSCLT_RUN_FAILED;
+			break;
+		}
+		if(attempt++ >= pool->retries || pool->closing) {
+			result = CGPSCLT_RUN_FAILED;
+			break;
+		}
+		req->length = 0;
+		usleep(pool->rsleep * 1000);
+	}
+
+	cgpsclt_pool_complete(pool, req, result == CGPSCLT_RUN_SUCCESS ? CGPSCLT_STATUS_SUCCESS : CGPSCLT_STATUS_FAILED);
+}
+
+static void * cgpsclt_pool_thread(void *arg)
+{
+	struct cgpsclt_pool *pool = (struct cgpsclt_pool *)arg;
+	struct cgpsclt_request *req;
+
+	pthread_mutex_lock(&pool->lock);
+	while(1) {
+		while(!pool->closing && !pool->pending.head) {
+			pthread_cond_wait(&pool->ready, &pool->lock);
+		}
+		if(pool->closing) {
+			break;
+		}
+		req = cgpsclt_queue_pop(&pool->pending);
+		pthread_mutex_unlock(&pool->lock);
+		cgpsclt_pool_process(pool, req);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+struct cgpsclt_pool * cgpsclt_pool_open(const char *endpoints, int workers)
+{
+	struct cgpsclt_pool *pool;
+	int i, flags, error;
+
+	if(!endpoints || workers < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if(!(pool = calloc(1, sizeof(struct cgpsclt_pool)))) {
+		return NULL;
+	}
+	pool->notify[0] = pool->notify[1] = -1;
+	pool->retries = CGPSCLT_DEFAULT_RETRIES;
+	pool->rsleep = CGPSCLT_DEFAULT_RETRY_SLEEP;
+	pool->ejecttime = CGPSCLT_DEFAULT_EJECT_TIME;
+	pool->failover = CGPSCLT_DEFAULT_FAILOVER;
+	pool->seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+
+	if(cgpsclt_endpoint_parse(pool, endpoints) < 0) {
+		error = errno;
+		cgpsclt_endpoint_free(pool);
+		free(pool);
+		errno = error;
+		return NULL;
+	}
+	if(pipe(pool->notify) < 0) {
+		error = errno;
+		cgpsclt_endpoint_free(pool);
+		free(pool);
+		errno = error;
+		return NULL;
+	}
+	for(i = 0; i < 2; ++i) {
+		if((flags = fcntl(pool->notify[i], F_GETFL, 0)) >= 0) {
+			fcntl(pool->notify[i], F_SETFL, flags | O_NONBLOCK);
+		}
+	}
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->ready, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	if(!(pool->threads = calloc(workers, sizeof(pthread_t)))) {
+		cgpsclt_pool_close(pool);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for(i = 0; i < workers; ++i) {
+		if((error = pthread_create(&pool->threads[i], NULL, cgpsclt_pool_thread, pool)) != 0) {
+			cgpsclt_pool_close(pool);
+			errno = error;
+			return NULL;
+		}
+		pool->workers++;
+	}
+	return pool;
+}
+
+int cgpsclt_pool_setopt(struct cgpsclt_pool *pool, int option, int value)
+{
+	if(value < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&pool->lock);
+	switch(option) {
+	case CGPSCLT_OPT_TIMEOUT:
+		pool->timeout = value;
+		break;
+	case CGPSCLT_OPT_RETRIES:
+		pool->retries = value;
+		break;
+	case CGPSCLT_OPT_RETRY_SLEEP:
+		pool->rsleep = value;
+		break;
+	case CGPSCLT_OPT_EJECT_TIME:
+		pool->ejecttime = value;
+		break;
+	case CGPSCLT_OPT_FAILOVER:
+		pool->failover = value != 0;
+		break;
+	default:
+		pthread_mutex_unlock(&pool->lock);
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+void cgpsclt_pool_close(struct cgpsclt_pool *pool)
+{
+	struct cgpsclt_request *req;
+	int i, destroy;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = 1;
+	pthread_cond_broadcast(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	for(i = 0; i < pool->workers; ++i) {
+		pthread_join(pool->threads[i], NULL);
+	}
+
+	/*
+	 * All threads has exited, cancel queued requests. Requests not yet
+	 * released keeps a reference on the pool (their handles are still
+	 * valid), the last one released destroys it.
+	 */
+	while((req = cgpsclt_queue_pop(&pool->pending))) {
+		cgpsclt_request_error(req, "request canceled");
+		cgpsclt_pool_complete(pool, req, CGPSCLT_STATUS_CANCELED);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->closed = 1;
+	destroy = pool->refs == 0;
+	pthread_mutex_unlock(&pool->lock);
+
+	if(destroy) {
+		cgpsclt_pool_destroy(pool);
+	}
+}
+
+int cgpsclt_pool_fd(struct cgpsclt_pool *pool)
+{
+	return pool->notify[0];
+}
+
+struct cgpsclt_request * cgpsclt_pool_reap(struct cgpsclt_pool *pool)
+{
+	struct cgpsclt_request *req;
+
+	pthread_mutex_lock(&pool->lock);
+	if((req = cgpsclt_queue_pop(&pool->completed))) {
+		req->queued = 0;
+	}
+	cgpsclt_pool_drain(pool);
+	pthread_mutex_unlock(&pool->lock);
+	return req;
+}
+
+struct cgpsclt_request * cgpsclt_submit(struct cgpsclt_pool *pool,
+					const char *result, int format,
+					const char *data, size_t size,
+					cgpsclt_callback func, void *arg)
+{
+	struct cgpsclt_request *req;
+	size_t i;
+
+	if(!result || !data || (format != CGPSCLT_FORMAT_PLAIN && format != CGPSCLT_FORMAT_XML)) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if(!(req = calloc(1, sizeof(struct cgpsclt_request)))) {
+		return NULL;
+	}
+	if(!(req->result = strdup(result)) || !(req->data = malloc(size + 1))) {
+		cgpsclt_request_free(req);
+		errno = ENOMEM;
+		return NULL;
+	}
+	memcpy(req->data, data, size);
+	req->data[size] = '\0';
+	req->size = size;
+	req->format = format;
+	req->func = func;
+	req->arg = arg;
+	req->pool = pool;
+	req->status = CGPSCLT_STATUS_PENDING;
+
+	/*
+	 * Count observations the same way as cgpsclt (a leading line not
+	 * starting with a number is the descriptors header).
+	 */
+	for(i = 0; i < size; ++i) {
+		if(data[i] == '\n') {
+			req->lines++;
+		}
+	}
+	if(size && data[size - 1] != '\n') {
+		req->lines++;
+	}
+	if(size && !isdigit((unsigned char)data[0]) && data[0] != '-') {
+		req->lines--;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if(pool->closing) {
+		pthread_mutex_unlock(&pool->lock);
+		cgpsclt_request_free(req);
+		errno = ESHUTDOWN;
+		return NULL;
+	}
+	cgpsclt_queue_push(&pool->pending, req);
+	pool->refs++;
+	pthread_cond_signal(&pool->ready);
+	pthread_mutex_unlock(&pool->lock);
+
+	return req;
+}
+
+int cgpsclt_wait(struct cgpsclt_request *req)
+{
+	struct cgpsclt_pool *pool = req->pool;
+	int status;
+
+	pthread_mutex_lock(&pool->lock);
+	while(req->status == CGPSCLT_STATUS_PENDING) {
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	cgpsclt_pool_unqueue(pool, req);
+	status = req->status;
+	pthread_mutex_unlock(&pool->lock);
+
+	return status;
+}
+
+int cgpsclt_status(struct cgpsclt_request *req)
+{
+	int status;
+
+	pthread_mutex_lock(&req->pool->lock);
+	status = req->status;
+	pthread_mutex_unlock(&req->pool->lock);
+
+	return status;
+}
+
+const char * cgpsclt_output(struct cgpsclt_request *req, size_t *size)
+{
+	if(size) {
+		*size = req->length;
+	}
+	return req->output ? req->output : "";
+}
+
+const char * cgpsclt_error(struct cgpsclt_request *req)
+{
+	return req->error[0] ? req->error : NULL;
+}
+
+void * cgpsclt_userdata(struct cgpsclt_request *req)
+{
+	return req->arg;
+}
+
+void cgpsclt_release(struct cgpsclt_request *req)
+{
+	struct cgpsclt_pool *pool = req->pool;
+	int release = 0, destroy = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	if(req->status == CGPSCLT_STATUS_PENDING || req->busy) {
+		req->released = 1;
+	} else {
+		cgpsclt_pool_unqueue(pool, req);
+		destroy = cgpsclt_pool_unref(pool);
+		release = 1;
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	if(release) {
+		cgpsclt_request_free(req);
+	}
+	if(destroy) {
+		cgpsclt_pool_destroy(pool);
+	}
+}
@@ -0,0 +1,153 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Internal definitions for libcgpsclt (not installed).
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+#include "libcgpsclt.h"
+
+#define CGPSCLT_PROTO_VERSION "1.0"   /* no chunked input data (Load: count) */
+#define CGPSCLT_DEFAULT_PORT  9401    /* same as CGPSD_DEFAULT_PORT */
+
+#define CGPSCLT_READ_BUFFER   8192    /* socket read buffer size */
+#define CGPSCLT_ERROR_SIZE    128     /* max length of error message */
+
+#define CGPSCLT_DEFAULT_RETRIES     3
+#define CGPSCLT_DEFAULT_RETRY_SLEEP 100
+#define CGPSCLT_DEFAULT_EJECT_TIME  30000
+#define CGPSCLT_DEFAULT_FAILOVER    1
+
+#define CGPSCLT_LATENCY_DECAY   0.3   /* weight of last sample in latency average */
+#define CGPSCLT_LATENCY_INITIAL 1.0   /* assumed latency (ms) for unused endpoint */
+
+/*
+ * Internal result of running a request on one connection. The retry
+ * code is used when the endpoint failed (connect failure, server busy,
+ * timeout or lost connection) and the request can be sent again to
+ * another endpoint.
+ */
+#define CGPSCLT_RUN_SUCCESS 0
+#define CGPSCLT_RUN_FAILED  1
+#define CGPSCLT_RUN_RETRY   2
+
+/*
+ * A daemon endpoint.
+ */
+struct cgpsclt_endpoint
+{
+	char *name;                    /* the endpoint string */
+	char *path;                    /* UNIX socket path */
+	char *host;                    /* TCP host */
+	char port[8];                  /* TCP port */
+	struct addrinfo *addr;         /* resolved TCP address (lazy) */
+	int pending;                   /* outstanding requests */
+	double latency;                /* average request latency (ms) */
+	long long eject;               /* ejected until (ms) */
+	unsigned int requests;         /* number of requests */
+	unsigned int failures;         /* number of failed requests */
+};
+
+struct cgpsclt_request
+{
+	struct cgpsclt_pool *pool;
+	struct cgpsclt_request *next;  /* queue link */
+	char *result;                  /* the Predict: option */
+	int format;                    /* the Format: option */
+	char *data;                    /* input data */
+	size_t size;                   /* input data size */
+	int lines;                     /* number of observations */
+	int sent;                      /* request has been sent */
+	char *output;                  /* result buffer */
+	size_t length;                 /* result length */
+	size_t capacity;               /* result buffer size */
+	char error[CGPSCLT_ERROR_SIZE];
+	int status;                    /* CGPSCLT_STATUS_XXX */
+	int released;                  /* release has been called */
+	int queued;                    /* in completion queue */
+	int busy;                      /* callback is running */
+	cgpsclt_callback func;
+	void *arg;
+};
+
+struct cgpsclt_queue
+{
+	struct cgpsclt_request *head;
+	struct cgpsclt_request *tail;
+};
+
+struct cgpsclt_pool
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready;          /* request submitted */
+	pthread_cond_t done;           /* request finished */
+	pthread_t *threads;
+	int workers;                   /* number of threads */
+	struct cgpsclt_endpoint *endpoints;
+	int nendpoints;
+	unsigned int seed;             /* random endpoint selection */
+	struct cgpsclt_queue pending;  /* submitted requests */
+	struct cgpsclt_queue completed;/* finished requests (no callback) */
+	int notify[2];                 /* completion queue pipe */
+	int timeout;                   /* socket I/O timeout (ms) */
+	int retries;                   /* connect retries */
+	int rsleep;                    /* retry sleep (ms) */
+	int ejecttime;                 /* eject failed endpoint (ms) */
+	int failover;                  /* retry requests in progress */
+	int refs;                      /* unreleased requests */
+	int closing;
+	int closed;                    /* released when refs drops to 0 */
+};
+
+/*
+ * Endpoints (endpoint.c).
+ */
+int cgpsclt_endpoint_parse(struct cgpsclt_pool *pool, const char *endpoints);
+void cgpsclt_endpoint_free(struct cgpsclt_pool *pool);
+struct cgpsclt_endpoint * cgpsclt_endpoint_select(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *exclude);
+void cgpsclt_endpoint_update(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *ep, int result, long long elapsed);
+long long cgpsclt_endpoint_clock(void);
+int cgpsclt_endpoint_connect(struct cgpsclt_pool *pool, struct cgpsclt_endpoint *ep, struct cgpsclt_request *req);
+
+/*
+ * Protocol (request.c).
+ */
+int cgpsclt_request_run(struct cgpsclt_request *req, int sock);
+
+/*
+ * Set error message in request.
+ */
+void cgpsclt_request_error(struct cgpsclt_request *req, const char *fmt, ...);
+
+#endif /* __POOL_H__ */
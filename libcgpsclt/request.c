@@ -0,0 +1,359 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The client side of the CGPSP protocol (see docs/README.protocol) working
+ * on a raw socket and memory buffers.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+#include <sys/uio.h>
+#include <stdarg.h>
+#include <errno.h>
+
+#include "pool.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * Buffered socket reader.
+ */
+struct cgpsclt_stream
+{
+	int sock;
+	char buff[CGPSCLT_READ_BUFFER];
+	size_t head;                   /* first unread byte */
+	size_t tail;                   /* end of buffered data */
+	char *line;                    /* current line */
+	size_t size;                   /* line buffer size */
+};
+
+void cgpsclt_request_error(struct cgpsclt_request *req, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(req->error, sizeof(req->error), fmt, ap);
+	va_end(ap);
+}
+
+/*
+ * Read next line (without newline) into ss->line. Returns line length plus
+ * one (so that empty lines are non-zero), 0 on end of file and -1 on failure.
+ */
+static ssize_t cgpsclt_stream_readline(struct cgpsclt_stream *ss)
+{
+	size_t len = 0;
+	ssize_t bytes;
+
+	while(1) {
+		char *eol;
+		size_t avail, copy;
+
+		if(ss->head == ss->tail) {
+			if((bytes = recv(ss->sock, ss->buff, sizeof(ss->buff), 0)) < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			if(bytes == 0) {
+				break;
+			}
+			ss->head = 0;
+			ss->tail = bytes;
+		}
+
+		avail = ss->tail - ss->head;
+		eol = memchr(ss->buff + ss->head, '\n', avail);
+		copy = eol ? (size_t)(eol - (ss->buff + ss->head)) : avail;
+
+		if(len + copy + 1 > ss->size) {
+			size_t size = ss->size ? ss->size : 128;
+			char *line;
+			while(size < len + copy + 1) {
+				size *= 2;
+			}
+			if(!(line = realloc(ss->line, size))) {
+				return -1;
+			}
+			ss->line = line;
+			ss->size = size;
+		}
+		memcpy(ss->line + len, ss->buff + ss->head, copy);
+		len += copy;
+		ss->head += copy;
+
+		if(eol) {
+			ss->head++;
+			ss->line[len] = '\0';
+			return len + 1;
+		}
+	}
+
+	if(ss->line) {
+		ss->line[len] = '\0';
+	}
+	return len ? (ssize_t)len + 1 : 0;
+}
+
+/*
+ * Strip the line terminator and returns line length.
+ */
+static size_t cgpsclt_stream_chomp(struct cgpsclt_stream *ss)
+{
+	size_t len = strlen(ss->line);
+
+	if(len && ss->line[len - 1] == '\r') {
+		ss->line[--len] = '\0';
+	}
+	return len;
+}
+
+/*
+ * Send all data in the I/O vector.
+ */
+static int cgpsclt_stream_sendv(int sock, struct iovec *iov, int iovcnt)
+{
+	struct msghdr msg;
+	ssize_t bytes;
+
+	while(iovcnt) {
+		memset(&msg, 0, sizeof(struct msghdr));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+
+		if((bytes = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		while(iovcnt && (size_t)bytes >= iov->iov_len) {
+			bytes -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+		if(iovcnt) {
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Append line to the result buffer.
+ */
+static int cgpsclt_request_append(struct cgpsclt_request *req, const char *line, size_t len)
+{
+	if(req->length + len + 2 > req->capacity) {
+		size_t size = req->capacity ? req->capacity : 4096;
+		char *output;
+		while(size < req->length + len + 2) {
+			size *= 2;
+		}
+		if(!(output = realloc(req->output, size))) {
+			return -1;
+		}
+		req->output = output;
+		req->capacity = size;
+	}
+	memcpy(req->output + req->length, line, len);
+	req->length += len;
+	req->output[req->length++] = '\n';
+	req->output[req->length] = '\0';
+	return 0;
+}
+
+/*
+ * Send the input data as response on a load request. The server reads one
+ * line past the last observation, so data is always followed by an empty
+ * line.
+ */
+static int cgpsclt_request_load(struct cgpsclt_request *req, int sock)
+{
+	struct iovec iov[3];
+	char head[32];
+	int cnt = 0;
+
+	snprintf(head, sizeof(head), "Load: %d\n", req->lines);
+	iov[cnt].iov_base = head;
+	iov[cnt++].iov_len = strlen(head);
+	if(req->size) {
+		iov[cnt].iov_base = req->data;
+		iov[cnt++].iov_len = req->size;
+	}
+	if(req->size && req->data[req->size - 1] != '\n') {
+		iov[cnt].iov_base = (char *)"\n\n";
+		iov[cnt++].iov_len = 2;
+	} else {
+		iov[cnt].iov_base = (char *)"\n";
+		iov[cnt++].iov_len = 1;
+	}
+	return cgpsclt_stream_sendv(sock, iov, cnt);
+}
+
+/*
+ * Read the server greeting and send our greeting and the request options.
+ */
+static int cgpsclt_request_greeting(struct cgpsclt_request *req, struct cgpsclt_stream *ss)
+{
+	struct iovec iov[1];
+	char *head;
+	ssize_t bytes;
+	size_t len;
+
+	/*
+	 * The server greeting or an error message (i.e. server busy).
+	 */
+	if((bytes = cgpsclt_stream_readline(ss)) <= 0) {
+		cgpsclt_request_error(req, "failed read greeting (%s)", bytes ? strerror(errno) : "connection closed");
+		return CGPSCLT_RUN_RETRY;
+	}
+	cgpsclt_stream_chomp(ss);
+	if(strncmp(ss->line, "error:", 6) == 0) {
+		cgpsclt_request_error(req, "server response: %s", ss->line + 7);
+		return CGPSCLT_RUN_RETRY;
+	}
+	if(strncmp(ss->line, "CGPSP ", 6) != 0) {
+		cgpsclt_request_error(req, "protocol error (unexpected greeting %s)", ss->line);
+		return CGPSCLT_RUN_FAILED;
+	}
+
+	len = strlen(req->result) + 128;
+	if(!(head = malloc(len))) {
+		cgpsclt_request_error(req, "failed alloc memory");
+		return CGPSCLT_RUN_FAILED;
+	}
+	snprintf(head, len, "CGPSP %s (libcgpsclt: client ready)\nPredict: %s\nFormat: %s\n",
+		 CGPSCLT_PROTO_VERSION, req->result,
+		 req->format == CGPSCLT_FORMAT_XML ? "xml" : "plain");
+	iov[0].iov_base = head;
+	iov[0].iov_len = strlen(head);
+	if(cgpsclt_stream_sendv(ss->sock, iov, 1) < 0) {
+		cgpsclt_request_error(req, "failed send request (%s)", strerror(errno));
+		free(head);
+		return CGPSCLT_RUN_RETRY;
+	}
+	free(head);
+	return CGPSCLT_RUN_SUCCESS;
+}
+
+/*
+ * Serve load requests and collect the result until the server closes
+ * the connection. Multi-model projects sends one load request for each
+ * model. Lost connections and timeouts are retried (failover), while
+ * errors reported by the server are final.
+ */
+static int cgpsclt_request_exchange(struct cgpsclt_request *req, struct cgpsclt_stream *ss)
+{
+	ssize_t bytes;
+	size_t len;
+	int result = 0;
+
+	while((bytes = cgpsclt_stream_readline(ss)) > 0) {
+		len = cgpsclt_stream_chomp(ss);
+		if(strncmp(ss->line, "Load:", 5) == 0) {
+			if(cgpsclt_request_load(req, ss->sock) < 0) {
+				cgpsclt_request_error(req, "failed send data (%s)", strerror(errno));
+				return CGPSCLT_RUN_RETRY;
+			}
+		} else if(strcmp(ss->line, "Result:") == 0) {
+			result = 1;
+		} else if(strncmp(ss->line, "error:", 6) == 0) {
+			cgpsclt_request_error(req, "server response: %s", ss->line + 7);
+			return CGPSCLT_RUN_FAILED;
+		} else if(result) {
+			if(cgpsclt_request_append(req, ss->line, len) < 0) {
+				cgpsclt_request_error(req, "failed alloc memory");
+				return CGPSCLT_RUN_FAILED;
+			}
+		} else {
+			cgpsclt_request_error(req, "protocol error (%s unexpected)", ss->line);
+			return CGPSCLT_RUN_FAILED;
+		}
+	}
+	if(bytes < 0) {
+		if(errno == EAGAIN || errno == EWOULDBLOCK) {
+			cgpsclt_request_error(req, "timeout waiting for server");
+		} else {
+			cgpsclt_request_error(req, "failed read result (%s)", strerror(errno));
+		}
+		return CGPSCLT_RUN_RETRY;
+	}
+	if(!result) {
+		cgpsclt_request_error(req, "connection closed without result");
+		return CGPSCLT_RUN_RETRY;
+	}
+	return CGPSCLT_RUN_SUCCESS;
+}
+
+int cgpsclt_request_run(struct cgpsclt_request *req, int sock)
+{
+	struct cgpsclt_stream *ss;
+	int status;
+
+	if(!(ss = malloc(sizeof(struct cgpsclt_stream)))) {
+		cgpsclt_request_error(req, "failed alloc memory");
+		return CGPSCLT_RUN_FAILED;
+	}
+	ss->sock = sock;
+	ss->head = ss->tail = 0;
+	ss->line = NULL;
+	ss->size = 0;
+
+	if((status = cgpsclt_request_greeting(req, ss)) == CGPSCLT_RUN_SUCCESS) {
+		req->sent = 1;
+		status = cgpsclt_request_exchange(req, ss);
+	}
+
+	free(ss->line);
+	free(ss);
+	return status;
+}
@@ -0,0 +1,316 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The binary result format (see binary.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#include "cgpssqp.h"
+#include "binary.h"
+
+#define CGPS_BINARY_COPY    65536    /* copy buffer size */
+
+static void cgps_binary_put32(char *ptr, uint32_t value)
+{
+	unsigned char *p = (unsigned char *)ptr;
+
+	p[0] = value & 0xff;
+	p[1] = (value >> 8) & 0xff;
+	p[2] = (value >> 16) & 0xff;
+	p[3] = (value >> 24) & 0xff;
+}
+
+static uint32_t cgps_binary_get32(const char *ptr)
+{
+	const unsigned char *p = (const unsigned char *)ptr;
+
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t cgps_binary_header(char *buff, int index, const struct cgps_binary_result *res, int num)
+{
+	char *ptr = buff + CGPS_BINARY_HEADER;
+	int i;
+
+	memcpy(buff, CGPS_BINARY_MAGIC, 8);
+	cgps_binary_put32(buff + 8, CGPS_BINARY_VERSION);
+	cgps_binary_put32(buff + 12, index);
+	cgps_binary_put32(buff + 16, num);
+	cgps_binary_put32(buff + 20, 0);
+
+	for(i = 0; i < num; ++i, ptr += CGPS_BINARY_ENTRY) {
+		memset(ptr, 0, CGPS_BINARY_ENTRY);
+		cgps_binary_put32(ptr, res[i].result);
+		cgps_binary_put32(ptr + 4, res[i].rows);
+		cgps_binary_put32(ptr + 8, res[i].cols);
+		strncpy(ptr + 12, res[i].name, CGPS_BINARY_NAME - 1);
+	}
+	return ptr - buff;
+}
+
+void cgps_binary_floats(char *dst, const float *src, int num)
+{
+	uint32_t value;
+	int i;
+
+	for(i = 0; i < num; ++i) {
+		memcpy(&value, src + i, sizeof(uint32_t));
+		cgps_binary_put32(dst + i * sizeof(uint32_t), value);
+	}
+}
+
+/*
+ * Returns the number of values on line (to end), or 0 if the line is not
+ * entirely made of numbers.
+ */
+static int cgps_binary_values(const char *line, const char *end)
+{
+	char *next;
+	int num = 0;
+
+	while(line < end) {
+		if(*line == ' ' || *line == '\t' || *line == '\r') {
+			++line;
+			continue;
+		}
+		strtod(line, &next);
+		if(next == line || next > end) {
+			return 0;
+		}
+		line = next;
+		++num;
+	}
+	return num;
+}
+
+/*
+ * Returns true if name is a word in text (to end).
+ */
+static int cgps_binary_named(const char *text, const char *end, const char *name)
+{
+	size_t len = strlen(name);
+	const char *ptr;
+
+	for(ptr = text; ptr + len <= end; ++ptr) {
+		if(memcmp(ptr, name, len) == 0 &&
+		   (ptr == text || !isalnum((unsigned char)ptr[-1])) &&
+		   (ptr + len == end || !isalnum((unsigned char)ptr[len]))) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the next section (a run of numeric lines) starting at curr. The 
+ * text before it is set in head and the first row in rows. The result 
+ * is the requested result (in result mask) not already done that is named
+ * in head, or the first of them (in entry list order) if none is. Returns
+ * pointer past the section or NULL on failure (or end of text).
+ */
+static const char * cgps_binary_section(const char *curr, const char *end, int result, int *done, struct cgps_binary_result *res, const char **rows)
+{
+	const struct cgps_result_entry *entry, *found = NULL;
+	const char *head = curr, *next;
+	int cols;
+
+	for(*rows = NULL; curr < end; curr = next + 1) {
+		if(!(next = memchr(curr, '\n', end - curr))) {
+			next = end;
+		}
+		cols = cgps_binary_values(curr, next);
+		if(!*rows && cols) {
+			*rows = curr;
+			res->rows = 0;
+			res->cols = cols;
+		}
+		if(*rows && !cols) {
+			break;
+		}
+		if(*rows && cols != res->cols) {
+			logerr("row %d of result section has wrong number of values", res->rows + 1);
+			return NULL;
+		}
+		if(*rows) {
+			++res->rows;
+		}
+	}
+	if(!*rows) {
+		return NULL;
+	}
+
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(result, entry->value) || 
+		   cgps_result_isset(*done, entry->value)) {
+			continue;
+		}
+		if(!found) {
+			found = entry;
+		}
+		if(cgps_binary_named(head, *rows, entry->name)) {
+			found = entry;
+			break;
+		}
+	}
+	if(!found) {
+		logerr("more result sections than requested results");
+		return NULL;
+	}
+	*done |= 1 << found->value;
+	res->result = found->value;
+	res->name = found->name;
+	return curr;
+}
+
+int cgps_binary_encode(const char *text, size_t size, int index, int result, FILE *out)
+{
+	struct cgps_binary_result res[CGPS_BINARY_RESULTS];
+	const char *rows[CGPS_BINARY_RESULTS];
+	const char *curr = text, *end = text + size, *next;
+	char header[CGPS_BINARY_HEADER + CGPS_BINARY_RESULTS * CGPS_BINARY_ENTRY];
+	char *ptr;
+	float *values;
+	int num = 0, done = 0, i, j;
+
+	memset(res, 0, sizeof(res));
+	while(curr < end) {
+		if(num == CGPS_BINARY_RESULTS) {
+			logerr("too many results in plain result");
+			return -1;
+		}
+		if(!(next = cgps_binary_section(curr, end, result, &done, &res[num], &rows[num]))) {
+			if(rows[num]) {
+				return -1;
+			}
+			break;
+		}
+		curr = next;
+		++num;
+	}
+
+	if(fwrite(header, 1, cgps_binary_header(header, index, res, num), out) == 0) {
+		return -1;
+	}
+	for(i = 0; i < num; ++i) {
+		if(!(values = malloc((res[i].rows * res[i].cols + 1) * sizeof(float)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		for(curr = rows[i], j = 0; j < res[i].rows * res[i].cols; ++j) {
+			values[j] = strtod(curr, &ptr);
+			curr = ptr;
+		}
+		cgps_binary_floats((char *)values, values, j);
+		if(j && fwrite(values, sizeof(float), j, out) != (size_t)j) {
+			free(values);
+			return -1;
+		}
+		free(values);
+	}
+	return 0;
+}
+
+int cgps_binary_check(const char *buff, uint32_t *num)
+{
+	if(memcmp(buff, CGPS_BINARY_MAGIC, 8) != 0 || cgps_binary_get32(buff + 8) != CGPS_BINARY_VERSION) {
+		errno = 0;
+		logerr("binary result has wrong magic or version");
+		return -1;
+	}
+	if((*num = cgps_binary_get32(buff + 16)) > CGPS_BINARY_RESULTS) {
+		errno = 0;
+		logerr("binary result has too many results (%u)", *num);
+		return -1;
+	}
+	return 0;
+}
+
+uint64_t cgps_binary_length(const char *buff, uint32_t num)
+{
+	uint64_t bytes = 0;
+	uint32_t i;
+	
+	for(i = 0; i < num; ++i) {
+		bytes += (uint64_t)cgps_binary_get32(buff + CGPS_BINARY_HEADER + i * CGPS_BINARY_ENTRY + 4) *
+			cgps_binary_get32(buff + CGPS_BINARY_HEADER + i * CGPS_BINARY_ENTRY + 8) * sizeof(float);
+	}
+	return bytes;
+}
+
+int cgps_binary_copy(FILE *in, FILE *out)
+{
+	char buff[CGPS_BINARY_COPY];
+	uint64_t bytes;
+	size_t size;
+	uint32_t num;
+
+	if(fread(buff, 1, CGPS_BINARY_HEADER, in) != CGPS_BINARY_HEADER) {
+		logerr("failed read binary result header");
+		return -1;
+	}
+	if(cgps_binary_check(buff, &num) < 0) {
+		return -1;
+	}
+	size = CGPS_BINARY_HEADER + num * CGPS_BINARY_ENTRY;
+	if(fread(buff + CGPS_BINARY_HEADER, CGPS_BINARY_ENTRY, num, in) != num) {
+		logerr("failed read binary result entries");
+		return -1;
+	}
+	bytes = cgps_binary_length(buff, num);
+
+	do {
+		if(out && fwrite(buff, 1, size, out) != size) {
+			logerr("failed write binary result");
+			return -1;
+		}
+		size = bytes < sizeof(buff) ? bytes : sizeof(buff);
+		if(size && fread(buff, 1, size, in) != size) {
+			logerr("failed read binary result");
+			return -1;
+		}
+		bytes -= size;
+	} while(size);
+	
+	return 0;
+}
@@ -0,0 +1,130 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Binary result format (Format: binary). Each model result is encoded as a
+ * block with a schema header followed by the result arrays. All integers
+ * and floats are little-endian, independent of the host byte order:
+ * 
+ *   header  (24 bytes)
+ *       0     8  magic (CGPS_BINARY_MAGIC)
+ *       8     4  version (CGPS_BINARY_VERSION)
+ *      12     4  model index
+ *      16     4  number of results (n)
+ *      20     4  reserved (zero)
+ *   entries (n x 32 bytes)
+ *       0     4  result (PREDICTED_XXX)
+ *       4     4  rows
+ *       8     4  columns
+ *      12    20  result name (NUL padded)
+ *   arrays  (rows x columns float32 per entry, row-major)
+ * 
+ * The arrays follows the entries in the same order. The size of a block is 
+ * known from its header and entries, so blocks are read without parsing
+ * any text.
+ * 
+ * libchemgps has no API for the result vectors, so results predicted by
+ * SIMCA-QP are encoded from its text output ("%g", 6 significant digits)
+ * and are no more precise than the plain format. The encoding is done by
+ * the server after the text has been formatted, costing more CPU than the
+ * plain format. Only results from the native engine are encoded direct
+ * from the computed floats, so the same request gives different bytes 
+ * depending on the engine.
+ * 
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __BINARY_H__
+#define __BINARY_H__
+
+#include <stdio.h>
+
+#ifndef CGPS_OUTPUT_FORMAT_BINARY
+# define CGPS_OUTPUT_FORMAT_BINARY 3
+#endif
+
+#define CGPS_BINARY_MAGIC   "CGPSRSLT"
+#define CGPS_BINARY_VERSION 1
+#define CGPS_BINARY_HEADER  24       /* size of block header */
+#define CGPS_BINARY_ENTRY   32       /* size of result entry */
+#define CGPS_BINARY_NAME    20       /* size of result name */
+#define CGPS_BINARY_RESULTS 64       /* max results in block */
+
+/*
+ * Dimension of one result array.
+ */
+struct cgps_binary_result
+{
+	int result;           /* PREDICTED_XXX */
+	const char *name;     /* result name */
+	int rows;
+	int cols;
+};
+
+/*
+ * Encode the header and entries of num results for model index in buff
+ * (CGPS_BINARY_HEADER + num * CGPS_BINARY_ENTRY bytes). Returns number of
+ * bytes encoded.
+ */
+size_t cgps_binary_header(char *buff, int index, const struct cgps_binary_result *res, int num);
+
+/*
+ * Encode num floats from src as little-endian in dst. The dst buffer might
+ * be the same memory as src.
+ */
+void cgps_binary_floats(char *dst, const float *src, int num);
+
+/*
+ * Encode the plain format result of model index (size bytes in text, as 
+ * written by libchemgps) to out. The result arrays are the runs of lines 
+ * made of numbers only. Each is taken as the requested result (from the
+ * result mask) named in the text before it, or the next requested result
+ * in entry list order if none is named. Results skipped by libchemgps are
+ * allowed.
+ * Returns -1 on failure.
+ */
+int cgps_binary_encode(const char *text, size_t size, int index, int result, FILE *out);
+
+/*
+ * Check the block header in buff (CGPS_BINARY_HEADER bytes) and set num 
+ * to the number of results. Returns -1 if the header is malformed.
+ */
+int cgps_binary_check(const char *buff, uint32_t *num);
+
+/*
+ * Returns the size of the result arrays following the header and num
+ * entries in buff.
+ */
+uint64_t cgps_binary_length(const char *buff, uint32_t num);
+
+/*
+ * Copy one block from in to out (skipped if out is NULL). Returns 0 if a 
+ * block was copied and -1 on failure (malformed block or I/O error).
+ */
+int cgps_binary_copy(FILE *in, FILE *out);
+
+#endif /* __BINARY_H__ */
@@ -0,0 +1,689 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Calibration of native models thru libchemgps (see native.h).
+ *
+ * The model parameters are solved from SIMCA-QP predictions of probe
+ * observations: the center c and c +/- h(j) along each variable j. The
+ * predicted scores are an affine function t = A * x + b of the raw data,
+ * where A is the loadings times the scaling D, so A and b follows from the
+ * central differences. Hotelling's T2 is the sum of t(a)^2 / eigen(a) and
+ * the predicted responses are an affine function of the scores, both are
+ * solved by least squares over the probes.
+ *
+ * The squared distance to model of a PCA model is the quadratic form
+ * k * (x - m)' * D * (I - P' * P) * D * (x - m), with P the orthonormal
+ * loadings and m the centering. Its second differences gives the diagonal
+ * k * (D(j)^2 - n(j)), where n(j) is the sum of A(a,j)^2. Together with the
+ * orthonormality of P (sum of n(j) / D(j)^2 equals the number of components)
+ * this gives k and D, then m follows from the first differences and b.
+ *
+ * The probes are centered on the estimated centering and the solve is
+ * repeated, so the distance to model is solved near its minimum. Each
+ * result is then validated by predicting random observations both ways,
+ * results not matching SIMCA-QP (i.e. PLS distance to model or transformed
+ * variables) are left to SIMCA-QP.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <math.h>
+
+#include "cgpssqp.h"
+#include "native.h"
+
+#define CGPS_CALIBRATE_PASSES  3     /* solve passes at the center */
+#define CGPS_CALIBRATE_SAMPLES 64    /* observations for validation */
+#define CGPS_CALIBRATE_RANGE   3.0   /* validation range (in steps) */
+#define CGPS_CALIBRATE_SEED    4711  /* validation random seed */
+
+struct cgps_calibrate
+{
+	struct cgps_project *proj;
+	int index;            /* model index */
+	int vars;             /* number of variables */
+	int comps;            /* number of components */
+	double *center;       /* probe center (per variable) */
+	double *step;         /* probe step (per variable) */
+	double *amap;         /* score map A (comps x vars) */
+	double *bmap;         /* score offset b (per component) */
+	float *tps;           /* predicted scores of probes */
+	struct cgps_input probe;  /* probe observations */
+};
+
+/*
+ * Solve m * x = v (n x n) in place by Gaussian elimination, the solution
+ * is stored in v. Returns -1 if m is singular.
+ */
+static int cgps_calibrate_solve(double *m, double *v, int n)
+{
+	double max = 0.0, tmp, f;
+	int i, j, k, p;
+
+	for(i = 0; i < n * n; ++i) {
+		if(fabs(m[i]) > max) {
+			max = fabs(m[i]);
+		}
+	}
+	for(k = 0; k < n; ++k) {
+		for(p = k, i = k + 1; i < n; ++i) {
+			if(fabs(m[i * n + k]) > fabs(m[p * n + k])) {
+				p = i;
+			}
+		}
+		if(fabs(m[p * n + k]) <= 1.0e-12 * max) {
+			return -1;
+		}
+		if(p != k) {
+			for(j = 0; j < n; ++j) {
+				tmp = m[k * n + j];
+				m[k * n + j] = m[p * n + j];
+				m[p * n + j] = tmp;
+			}
+			tmp = v[k];
+			v[k] = v[p];
+			v[p] = tmp;
+		}
+		for(i = k + 1; i < n; ++i) {
+			f = m[i * n + k] / m[k * n + k];
+			for(j = k; j < n; ++j) {
+				m[i * n + j] -= f * m[k * n + j];
+			}
+			v[i] -= f * v[k];
+		}
+	}
+	for(k = n - 1; k >= 0; --k) {
+		for(j = k + 1; j < n; ++j) {
+			v[k] -= m[k * n + j] * v[j];
+		}
+		v[k] /= m[k * n + k];
+	}
+	return 0;
+}
+
+/*
+ * Least squares fit of y = x * coef (x is rows x cols, coef has cols
+ * values). Returns -1 if x is rank deficient.
+ */
+static int cgps_calibrate_fit(const double *x, const double *y, int rows, int cols, double *coef)
+{
+	double *m;
+	int i, j, r, status;
+
+	if(!(m = malloc((cols * cols + 1) * sizeof(double)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	for(i = 0; i < cols; ++i) {
+		for(coef[i] = 0.0, r = 0; r < rows; ++r) {
+			coef[i] += x[r * cols + i] * y[r];
+		}
+		for(j = 0; j < cols; ++j) {
+			for(m[i * cols + j] = 0.0, r = 0; r < rows; ++r) {
+				m[i * cols + j] += x[r * cols + i] * x[r * cols + j];
+			}
+		}
+	}
+	status = cgps_calibrate_solve(m, coef, cols);
+	free(m);
+	return status;
+}
+
+/*
+ * Store the least norm solution of A * (x / scale) = -b in x (the variables
+ * are scaled by scale if not NULL).
+ */
+static int cgps_calibrate_center(const struct cgps_calibrate *cal, const double *scale, double *x)
+{
+	double *m, *v;
+	int a, c, j, status = -1;
+
+	m = malloc((cal->comps * cal->comps + 1) * sizeof(double));
+	v = malloc((cal->comps + 1) * sizeof(double));
+	if(!m || !v) {
+		logerr("failed alloc memory");
+		free(m);
+		free(v);
+		return -1;
+	}
+	for(a = 0; a < cal->comps; ++a) {
+		for(c = 0; c < cal->comps; ++c) {
+			for(m[a * cal->comps + c] = 0.0, j = 0; j < cal->vars; ++j) {
+				m[a * cal->comps + c] += cal->amap[a * cal->vars + j] * cal->amap[c * cal->vars + j] /
+					(scale ? scale[j] * scale[j] : 1.0);
+			}
+		}
+		v[a] = -cal->bmap[a];
+	}
+	if(cgps_calibrate_solve(m, v, cal->comps) == 0) {
+		for(j = 0; j < cal->vars; ++j) {
+			for(x[j] = 0.0, a = 0; a < cal->comps; ++a) {
+				x[j] += cal->amap[a * cal->vars + j] * v[a];
+			}
+			if(scale) {
+				x[j] /= scale[j] * scale[j];
+			}
+		}
+		status = 0;
+	}
+	free(m);
+	free(v);
+	return status;
+}
+
+/*
+ * Returns value of variable j in probe observation i.
+ */
+static double cgps_calibrate_value(const struct cgps_calibrate *cal, int i, int j)
+{
+	return cal->probe.values[(size_t)i * cal->vars + j];
+}
+
+/*
+ * Predict the probes around the center and solve the score map (A and b).
+ */
+static int cgps_calibrate_scores(struct cgps_calibrate *cal)
+{
+	double dx;
+	int a, i, j, cols;
+
+	for(i = 0; i < cal->probe.rows; ++i) {
+		for(j = 0; j < cal->vars; ++j) {
+			cal->probe.values[(size_t)i * cal->vars + j] = cal->center[j];
+		}
+	}
+	for(j = 0; j < cal->vars; ++j) {
+		cal->probe.values[(size_t)(2 * j + 1) * cal->vars + j] = cal->center[j] + cal->step[j];
+		cal->probe.values[(size_t)(2 * j + 2) * cal->vars + j] = cal->center[j] - cal->step[j];
+	}
+
+	free(cal->tps);
+	if(!(cal->tps = cgps_predict_values(cal->proj, cal->index, &cal->probe, PREDICTED_TPS, &cols))) {
+		debug("failed predict scores of model %d", cal->index);
+		return -1;
+	}
+	if(!cal->amap) {
+		cal->comps = cols;
+		cal->amap = malloc((cols * cal->vars + 1) * sizeof(double));
+		cal->bmap = malloc((cols + 1) * sizeof(double));
+		if(!cal->amap || !cal->bmap) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+	} else if(cols != cal->comps) {
+		return -1;
+	}
+
+	for(a = 0; a < cal->comps; ++a) {
+		cal->bmap[a] = cal->tps[a];
+		for(j = 0; j < cal->vars; ++j) {
+			dx = cgps_calibrate_value(cal, 2 * j + 1, j) - cgps_calibrate_value(cal, 2 * j + 2, j);
+			cal->amap[a * cal->vars + j] = dx != 0.0 ?
+				(cal->tps[(2 * j + 1) * cal->comps + a] - cal->tps[(2 * j + 2) * cal->comps + a]) / dx : 0.0;
+			cal->bmap[a] -= cal->amap[a * cal->vars + j] * cgps_calibrate_value(cal, 0, j);
+		}
+	}
+	return 0;
+}
+
+/*
+ * Solve the score variances from Hotelling's T2 of the probes.
+ */
+static void cgps_calibrate_t2(struct cgps_calibrate *cal, struct cgps_native_model *model)
+{
+	double *x, *w;
+	float *t2;
+	int rows = cal->probe.rows, a, r, cols;
+
+	for(a = 0; a < model->comps; ++a) {
+		model->eigen[a] = 1.0f;
+	}
+	if(!(t2 = cgps_predict_values(cal->proj, cal->index, &cal->probe, PREDICTED_T2_RANGE_PS, &cols))) {
+		return;
+	}
+	x = malloc((rows * model->comps + 1) * sizeof(double));
+	w = malloc((rows + model->comps + 1) * sizeof(double));
+	if(!x || !w) {
+		logerr("failed alloc memory");
+	} else if(cols == 1) {
+		for(r = 0; r < rows; ++r) {
+			for(a = 0; a < model->comps; ++a) {
+				x[r * model->comps + a] = cal->tps[r * model->comps + a] * cal->tps[r * model->comps + a];
+			}
+			w[model->comps + r] = t2[r];
+		}
+		if(cgps_calibrate_fit(x, w + model->comps, rows, model->comps, w) == 0) {
+			for(a = 0; a < model->comps && w[a] > 0.0; ++a);
+			if(a == model->comps) {
+				for(a = 0; a < model->comps; ++a) {
+					model->eigen[a] = 1.0 / w[a];
+				}
+				cgps_result_setopt(model->results, PREDICTED_T2_RANGE_PS);
+			}
+		}
+	}
+	free(x);
+	free(w);
+	free(t2);
+}
+
+/*
+ * Solve the y-loadings and intercepts from the predicted responses of the
+ * probes (PLS models).
+ */
+static int cgps_calibrate_ypred(struct cgps_calibrate *cal, struct cgps_native_model *model)
+{
+	double *x, *y, *coef;
+	float *ypred;
+	int rows = cal->probe.rows, comps = model->comps, a, k, r, cols;
+
+	free(model->yload);
+	free(model->ymean);
+	model->yload = NULL;
+	model->ymean = NULL;
+	model->ycols = 0;
+
+	if((ypred = cgps_predict_values(cal->proj, cal->index, &cal->probe, PREDICTED_Y_PRED_PS, &cols))) {
+		model->ycols = cols;
+	}
+	model->yload = malloc((comps * model->ycols + 1) * sizeof(float));
+	model->ymean = malloc((model->ycols + 1) * sizeof(float));
+	x = malloc((rows * (comps + 1) + 1) * sizeof(double));
+	y = malloc((rows + 1) * sizeof(double));
+	coef = malloc((comps + 2) * sizeof(double));
+	if(!model->yload || !model->ymean || !x || !y || !coef) {
+		logerr("failed alloc memory");
+		free(ypred);
+		free(x);
+		free(y);
+		free(coef);
+		return -1;
+	}
+	for(r = 0; r < rows; ++r) {
+		for(a = 0; a < comps; ++a) {
+			x[r * (comps + 1) + a] = cal->tps[r * comps + a];
+		}
+		x[r * (comps + 1) + comps] = 1.0;
+	}
+	for(k = 0; k < model->ycols; ++k) {
+		for(r = 0; r < rows; ++r) {
+			y[r] = ypred[r * model->ycols + k];
+		}
+		if(cgps_calibrate_fit(x, y, rows, comps + 1, coef) < 0) {
+			break;
+		}
+		for(a = 0; a < comps; ++a) {
+			model->yload[a * model->ycols + k] = coef[a];
+		}
+		model->ymean[k] = coef[comps];
+	}
+	if(model->ycols && k == model->ycols) {
+		cgps_result_setopt(model->results, PREDICTED_Y_PRED_PS);
+	}
+	free(ypred);
+	free(x);
+	free(y);
+	free(coef);
+	return 0;
+}
+
+/*
+ * Solve the scaling, centering and loadings from the distance to model of
+ * the probes. The scaling is stored in scale and centering in mean. Returns
+ * the DModX factor or -1 if not solved.
+ */
+static double cgps_calibrate_dmodx(struct cgps_calibrate *cal, double *scale, double *mean)
+{
+	double *q, *g, *n, *y, *p;
+	double hp, hm, f0, fp, fm, lo = 1.0e-30, hi = 1.0e30, k = -1.0, sum;
+	float *dmodx;
+	int vars = cal->vars, comps = cal->comps, a, i, j, cols, used = 0;
+
+	if(!(dmodx = cgps_predict_values(cal->proj, cal->index, &cal->probe, PREDICTED_DMOD_X_PS, &cols))) {
+		return -1.0;
+	}
+	q = malloc((vars + 1) * sizeof(double));
+	g = malloc((vars + 1) * sizeof(double));
+	n = malloc((vars + 1) * sizeof(double));
+	y = malloc((vars + 1) * sizeof(double));
+	p = malloc((comps + 1) * sizeof(double));
+	if(!q || !g || !n || !y || !p) {
+		logerr("failed alloc memory");
+		goto cleanup;
+	}
+	if(cols != 1) {
+		goto cleanup;
+	}
+
+	/*
+	 * The first and second differences of f = DModX^2 along each variable.
+	 */
+	f0 = (double)dmodx[0] * dmodx[0];
+	for(j = 0; j < vars; ++j) {
+		fp = (double)dmodx[2 * j + 1] * dmodx[2 * j + 1] - f0;
+		fm = (double)dmodx[2 * j + 2] * dmodx[2 * j + 2] - f0;
+		hp = cgps_calibrate_value(cal, 2 * j + 1, j) - cgps_calibrate_value(cal, 0, j);
+		hm = cgps_calibrate_value(cal, 0, j) - cgps_calibrate_value(cal, 2 * j + 2, j);
+		q[j] = (hm * fp + hp * fm) / (hp * hm * (hp + hm));
+		g[j] = (fp - q[j] * hp * hp) / hp;
+		if(q[j] < 0.0) {
+			q[j] = 0.0;
+		}
+		for(n[j] = 0.0, a = 0; a < comps; ++a) {
+			n[j] += cal->amap[a * vars + j] * cal->amap[a * vars + j];
+		}
+		if(n[j] > 0.0) {
+			++used;
+		}
+	}
+	if(used <= comps) {
+		goto cleanup;
+	}
+
+	/*
+	 * Solve k so that the loadings are orthonormal (the sum is increasing
+	 * in k), bisect on log scale.
+	 */
+	for(i = 0; i < 200 && hi / lo > 1.0 + 1.0e-12; ++i) {
+		k = sqrt(lo * hi);
+		for(sum = 0.0, j = 0; j < vars; ++j) {
+			if(n[j] > 0.0) {
+				sum += n[j] / (q[j] / k + n[j]);
+			}
+		}
+		if(sum < comps) {
+			lo = k;
+		} else {
+			hi = k;
+		}
+	}
+	for(j = 0; j < vars; ++j) {
+		scale[j] = sqrt(q[j] / k + n[j]);
+	}
+
+	/*
+	 * The centering in scaled space (y = D * m) is the component along
+	 * the loadings (from b) plus the residual part (from the gradient).
+	 */
+	for(j = 0; j < vars; ++j) {
+		y[j] = scale[j] > 0.0 ? scale[j] * cgps_calibrate_value(cal, 0, j) - g[j] / (2.0 * k * scale[j]) : 0.0;
+	}
+	for(a = 0; a < comps; ++a) {
+		for(p[a] = 0.0, j = 0; j < vars; ++j) {
+			if(scale[j] > 0.0) {
+				p[a] += cal->amap[a * vars + j] / scale[j] * y[j];
+			}
+		}
+	}
+	for(j = 0; j < vars; ++j) {
+		if(scale[j] > 0.0) {
+			for(a = 0; a < comps; ++a) {
+				y[j] -= cal->amap[a * vars + j] / scale[j] * (p[a] + cal->bmap[a]);
+			}
+			mean[j] = y[j] / scale[j];
+		} else {
+			mean[j] = cgps_calibrate_value(cal, 0, j);
+		}
+	}
+
+cleanup:
+	free(dmodx);
+	free(q);
+	free(g);
+	free(n);
+	free(y);
+	free(p);
+	return k;
+}
+
+/*
+ * Solve all model parameters at the current center.
+ */
+static struct cgps_native_model * cgps_calibrate_model(struct cgps_calibrate *cal)
+{
+	struct cgps_native_model *model;
+	double *scale, *mean, k;
+	int a, j, vars = cal->vars;
+
+	if(cgps_calibrate_scores(cal) < 0) {
+		return NULL;
+	}
+	if(!(model = malloc(sizeof(struct cgps_native_model)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	memset(model, 0, sizeof(struct cgps_native_model));
+	model->vars   = vars;
+	model->comps  = cal->comps;
+	model->mean   = malloc((vars + 1) * sizeof(float));
+	model->scale  = malloc((vars + 1) * sizeof(float));
+	model->weight = malloc((cal->comps * vars + 1) * sizeof(float));
+	model->load   = malloc((cal->comps * vars + 1) * sizeof(float));
+	model->eigen  = malloc((cal->comps + 1) * sizeof(float));
+	scale = malloc((vars + 1) * sizeof(double));
+	mean  = malloc((vars + 1) * sizeof(double));
+	if(!model->mean || !model->scale || !model->weight || !model->load ||
+	   !model->eigen || !scale || !mean) {
+		logerr("failed alloc memory");
+		cgps_native_model_free(model);
+		model = NULL;
+		goto cleanup;
+	}
+	cgps_result_setopt(model->results, PREDICTED_TPS);
+
+	if((k = cgps_calibrate_dmodx(cal, scale, mean)) >= 0.0) {
+		model->dfactor = k;
+		cgps_result_setopt(model->results, PREDICTED_DMOD_X_PS);
+	} else {
+		/*
+		 * Unscaled, centered on the least norm solution.
+		 */
+		for(j = 0; j < vars; ++j) {
+			scale[j] = 1.0;
+		}
+		if(cgps_calibrate_center(cal, NULL, mean) < 0) {
+			cgps_native_model_free(model);
+			model = NULL;
+			goto cleanup;
+		}
+	}
+	for(j = 0; j < vars; ++j) {
+		model->mean[j] = mean[j];
+		model->scale[j] = scale[j];
+		for(a = 0; a < cal->comps; ++a) {
+			model->load[a * vars + j] = scale[j] > 0.0 ? cal->amap[a * vars + j] / scale[j] : 0.0;
+		}
+	}
+	memcpy(model->weight, model->load, cal->comps * vars * sizeof(float));
+
+	cgps_calibrate_t2(cal, model);
+	if(cgps_calibrate_ypred(cal, model) < 0) {
+		cgps_native_model_free(model);
+		model = NULL;
+	}
+
+cleanup:
+	free(scale);
+	free(mean);
+	return model;
+}
+
+/*
+ * Returns a pseudo random number in [0, 1).
+ */
+static double cgps_calibrate_random(unsigned long *seed)
+{
+	*seed = (*seed * 1103515245UL + 12345UL) & 0x7fffffffUL;
+	return (double)*seed / 0x80000000UL;
+}
+
+/*
+ * Predict random observations both thru SIMCA-QP and natively. Results
+ * differing more than CGPS_NATIVE_TOLERANCE (relative to the largest value
+ * in each column) are removed from the model results.
+ */
+static void cgps_calibrate_validate(struct cgps_calibrate *cal, struct cgps_native_model *model)
+{
+	const struct cgps_result_entry *entry;
+	struct cgps_input input;
+	unsigned long seed = CGPS_CALIBRATE_SEED;
+	float *simcaq, *native;
+	double scale;
+	int i, j, cols, ncols, diff;
+
+	input.rows = input.capacity = CGPS_CALIBRATE_SAMPLES;
+	input.cols = cal->vars;
+	if(!(input.values = malloc(((size_t)input.rows * input.cols + 1) * sizeof(float)))) {
+		logerr("failed alloc memory");
+		model->results = 0;
+		return;
+	}
+	for(i = 0; i < input.rows; ++i) {
+		for(j = 0; j < input.cols; ++j) {
+			input.values[(size_t)i * input.cols + j] = model->mean[j] + cal->step[j] *
+				CGPS_CALIBRATE_RANGE * (2.0 * cgps_calibrate_random(&seed) - 1.0);
+		}
+	}
+
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(model->results, entry->value)) {
+			continue;
+		}
+		simcaq = cgps_predict_values(cal->proj, cal->index, &input, entry->value, &cols);
+		native = cgps_native_values(model, &input, entry->value, &ncols);
+		diff = -1;
+		if(simcaq && native && cols == ncols) {
+			for(diff = 0, j = 0; j < cols; ++j) {
+				for(scale = 0.0, i = 0; i < input.rows; ++i) {
+					if(fabs(simcaq[i * cols + j]) > scale) {
+						scale = fabs(simcaq[i * cols + j]);
+					}
+				}
+				for(i = 0; i < input.rows; ++i) {
+					if(fabs(native[i * cols + j] - simcaq[i * cols + j]) > CGPS_NATIVE_TOLERANCE * scale) {
+						++diff;
+					}
+				}
+			}
+		}
+		if(diff != 0) {
+			debug("result %s of model %d don't match SIMCA-QP (%d values differs)", entry->name, cal->index, diff);
+			model->results &= ~(1 << entry->value);
+		}
+		free(simcaq);
+		free(native);
+	}
+	free(input.values);
+}
+
+struct cgps_native_model * cgps_native_calibrate(struct cgps_project *proj, int index, SQX_StringVector *names)
+{
+	struct cgps_calibrate cal;
+	struct cgps_native_model *model = NULL;
+	double norm, max = 0.0;
+	int a, j, pass;
+
+	memset(&cal, 0, sizeof(struct cgps_calibrate));
+	cal.proj = proj;
+	cal.index = index;
+	cal.vars = SQX_GetNumStringsInVector(names);
+	cal.probe.rows = cal.probe.capacity = 2 * cal.vars + 1;
+	cal.probe.cols = cal.vars;
+	cal.probe.values = malloc(((size_t)cal.probe.rows * cal.vars + 1) * sizeof(float));
+	cal.center = malloc((cal.vars + 1) * sizeof(double));
+	cal.step = malloc((cal.vars + 1) * sizeof(double));
+	if(!cal.probe.values || !cal.center || !cal.step) {
+		logerr("failed alloc memory");
+		goto cleanup;
+	}
+
+	/*
+	 * Unit probes at origin gives the scale of each variable, then center
+	 * the probes on the model.
+	 */
+	for(j = 0; j < cal.vars; ++j) {
+		cal.center[j] = 0.0;
+		cal.step[j] = 1.0;
+	}
+	if(cgps_calibrate_scores(&cal) < 0) {
+		goto cleanup;
+	}
+	for(j = 0; j < cal.vars; ++j) {
+		for(norm = 0.0, a = 0; a < cal.comps; ++a) {
+			norm += cal.amap[a * cal.vars + j] * cal.amap[a * cal.vars + j];
+		}
+		if((cal.step[j] = sqrt(norm)) > max) {
+			max = cal.step[j];
+		}
+	}
+	if(max == 0.0 || cgps_calibrate_center(&cal, NULL, cal.center) < 0) {
+		debug("scores of model %d don't depend on input data", index);
+		goto cleanup;
+	}
+	for(j = 0; j < cal.vars; ++j) {
+		cal.step[j] = 1.0 / (cal.step[j] > 1.0e-3 * max ? cal.step[j] : 1.0e-3 * max);
+	}
+
+	for(pass = 0; pass < CGPS_CALIBRATE_PASSES; ++pass) {
+		cgps_native_model_free(model);
+		if(!(model = cgps_calibrate_model(&cal))) {
+			goto cleanup;
+		}
+		for(j = 0; j < cal.vars; ++j) {
+			cal.center[j] = model->mean[j];
+		}
+	}
+
+	cgps_calibrate_validate(&cal, model);
+	if(!cgps_result_isset(model->results, PREDICTED_TPS)) {
+		debug("model %d can't be predicted natively", index);
+		cgps_native_model_free(model);
+		model = NULL;
+	} else {
+		debug("model %d is predicted natively (variables=%d, components=%d, responses=%d, results=0x%x)",
+		      index, model->vars, model->comps, model->ycols, model->results);
+	}
+
+cleanup:
+	free(cal.probe.values);
+	free(cal.center);
+	free(cal.step);
+	free(cal.amap);
+	free(cal.bmap);
+	free(cal.tps);
+	return model;
+}
@@ -41,6 +41,9 @@
 # include <stdint.h>
 #endif
 #include <errno.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
 #include <chemgps.h>
 
 extern char cgpsd_default_sock[];
@@ -55,7 +58,8 @@ enum CGPS_APPLICATION { CGPS_APP_UNKNOWN, CGPS_STANDALONE, CGPS_DAEMON, CGPS_CLI
 #define CGPS_RESOLVE_RETRIES 5
 #define CGPS_RESOLVE_TIMEOUT 2
 
-#define CGPSP_PROTO_VERSION "1.0"
+#define CGPSP_PROTO_VERSION "1.1"   /* 1.1: chunked input data (Load: chunked) */
+#define CGPSP_CHUNK_SIZE    65536   /* size of chunks sent by clients */
 #define CGPSP_PROTO_CR      0x13
 #define CGPSP_PROTO_LF      0x10
 #define CGPSP_PROTO_NEWLINE htons(CGPSP_PROTO_CR << 8 | CGPSP_PROTO_LF)
@@ -76,9 +80,19 @@ enum CGPSP_PROTO_VALUES {
 	CGPSP_PROTO_QUIT,        /* quit (cgpsddos only) */
 	CGPSP_PROTO_ERROR,       /* error message */
 	CGPSP_PROTO_COUNT,       /* iterations (cgpsddos only) */	
+	CGPSP_PROTO_RATE,        /* arrival rate (cgpsddos only) */
+	CGPSP_PROTO_HISTOGRAM,   /* latency histogram (cgpsddos only) */
+	CGPSP_PROTO_REPLAY,      /* replay trace (cgpsddos only) */
+	CGPSP_PROTO_SCHEMA,      /* project variable names */
+	CGPSP_PROTO_NEIGHBORS,   /* nearest neighbor search */
+	CGPSP_PROTO_COMPRESS,    /* stream compression */
 	CGPSP_PROTO_LAST	
 };
 
+struct cgps_native;
+struct cgps_neighbors;
+struct cgps_store;
+
 struct options
 {
 	/*
@@ -98,26 +112,49 @@ struct options
 	struct cgps_options *cgps;
 	unsigned int count;   /* repeate prediction count times */
 	unsigned int noretry; /* immediate return on failure */
+	int threads;          /* prediction threads (standalone) */
 	/*
 	 * Client and server options:
 	 */
 	char *data;           /* input data */
 	char *output;         /* output file */
 	int numobs;           /* number of observations */
+	int firstobs;         /* first observation in input data (cgpsx) */
 	int daemon;           /* running as daemon */
 	int interactive;      /* don't detach from controlling terminal */
 	char *unaddr;         /* unix socket */
 	char *ipaddr;         /* ipv4/ipv6 addr */
+	char *endpoints;      /* load balanced daemons */
+	int timeout;          /* socket I/O timeout (sec) */
+	int parallel;         /* concurrent requests (batch mode) */
+	int chunkrows;        /* rows in each request (batch mode) */
+	int schema;           /* send data in project schema (client) */
+	int neighbors;        /* nearest neighbors per row (client) */
+	int binary;           /* binary result format (see binary.h) */
+	int compress;         /* stream compression (CGPS_COMPRESS_XXX) */
 	uint16_t port;        /* port number */
 	int ipsock;           /* TCP socket */
 	int unsock;           /* UNIX socket */
 	int family;           /* address family (ipv4 or ipv6) */
 	int backlog;          /* listen queue length */
+	int backend;          /* accept event backend */
+	char *trace;          /* request trace file (daemon) */
+	int traceflags;       /* CGPS_TRACE_XXX flags */
+	FILE *tracefs;        /* open request trace */
+	int native;           /* native prediction (CGPS_NATIVE_XXX) */
+	struct cgps_native *engine;  /* native prediction engine (daemon) */
+	char *reference;      /* reference set for neighbor search (daemon) */
+	struct cgps_neighbors *index;  /* nearest neighbor index (daemon) */
+	char *store;          /* prediction store file */
+	struct cgps_store *results;  /* open prediction store */
 	int state;            /* daemon state */
 	struct sigaction *newact; /* new signal action */
 	struct sigaction *oldact; /* old signal action */	
 };
 
+struct cgps_trace_record;
+struct cgps_compress;
+
 /*
  * Peer connection endpoint.
  */
@@ -128,6 +165,13 @@ struct client
 	int sock;             /* client socket */
 	int type;             /* application type */
 	FILE *ss;             /* socket stream */
+	uint64_t accepted;    /* accept time (us since the epoch) */
+	struct cgps_trace_record *trace;  /* traced request (or NULL) */
+	int neighbors;        /* nearest neighbors requested by peer */
+	int binary;           /* binary result format requested by peer */
+	struct cgps_compress *compress;  /* compressed socket stream (or NULL) */
+	int numobs;           /* number of observations loaded */
+	int broken;           /* socket closed by peer (EPIPE) */
 };
 
 /*
@@ -140,6 +184,42 @@ struct request_option
 	int symbol;
 };
 
+/*
+ * Input data loaded for prediction (row major). 
+ */
+struct cgps_input
+{
+	float *values;        /* capacity x cols values */
+	int rows;             /* number of observations */
+	int cols;             /* number of variables */
+	int capacity;         /* number of allocated rows */
+};
+
+/*
+ * Input data cached for all models predicted in one request. The data is
+ * loaded (and the peer asked for it) only by the first model initilized
+ * for prediction, then copied to the prediction matrix of all other
+ * models. Pass the cache as data argument to cgps_predict_init() and use
+ * cgps_predict_data_cached() as indata callback.
+ * 
+ * The data is kept as plain values (not in a SQX matrix). The native engine,
+ * neighbor search and prediction store works on these, so they never calls
+ * into SIMCA-QP and can run without holding the prediction mutex.
+ */
+struct cgps_predict_cache
+{
+	struct client *loader;
+	struct cgps_input input;  /* loaded input data */
+	int state;            /* CGPS_PREDICT_CACHE_XXX */
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+#define CGPS_PREDICT_CACHE_EMPTY   0   /* not yet loaded */
+#define CGPS_PREDICT_CACHE_LOADED  1   /* successful loaded */
+#define CGPS_PREDICT_CACHE_FAILED -1   /* failed load input data */
+
 /*
  * Forward declare:
  */
@@ -235,6 +315,41 @@ int cgps_get_predict_mask(const char *results);
  */
 void cgps_syslog(void *popt, int errcode, int level, const char *file, unsigned int line, const char *fmt, ...);
 int cgps_predict_data(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type);
+int cgps_predict_data_cached(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type);
+
+/*
+ * Initilize and release the input data cache.
+ */
+void cgps_predict_cache_init(struct cgps_predict_cache *cache, struct client *loader);
+void cgps_predict_cache_cleanup(struct cgps_predict_cache *cache);
+
+/*
+ * Load input data to the cache direct (without libchemgps). Used by the
+ * native engine and the prediction store, the names are the quantitative 
+ * variable names. No SQX matrix is used (names is only read).
+ */
+int cgps_predict_cache_load(struct cgps_predict_cache *cache, SQX_StringVector *names);
+
+/*
+ * Get the quantitative variable names of the project (to be used with
+ * cgps_predict_cache_load). The names vector should be zero initilized
+ * and is released by SQX_ClearStringVector(). Returns -1 on failure.
+ * 
+ * The shared project options are not modified, but libchemgps is called
+ * so the caller must serialize it with other predictions on proj (i.e. by
+ * holding the lock used for cgps_predict_init()).
+ */
+int cgps_predict_names(struct cgps_project *proj, SQX_StringVector *names);
+
+/*
+ * Predict the input data (project variables in project order) using model
+ * index and return the values of one result (PREDICTED_XXX) read back from
+ * the plain text output of cgps_result(). The values are returned as a
+ * rows x cols array (free when done), the number of values in each row is
+ * stored in cols. Returns NULL if the result is not predicted for the model
+ * or on failure. Same locking as for cgps_predict_names().
+ */
+float * cgps_predict_values(struct cgps_project *proj, int index, const struct cgps_input *input, int result, int *cols);
 
 /*
  * Read one line from socket stream to buffer.
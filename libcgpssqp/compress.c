@@ -0,0 +1,607 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Stream compression of the CGPSP protocol (see compress.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_LIBLZ4
+# include <lz4frame.h>
+#endif
+#ifdef HAVE_LIBZSTD
+# include <zstd.h>
+#endif
+
+#include "cgpssqp.h"
+#include "compress.h"
+
+struct cgps_compress_method
+{
+	const char *name;
+	int value;
+};
+
+static const struct cgps_compress_method compress_methods[] = {
+#ifdef HAVE_LIBLZ4
+	{ "lz4",  CGPS_COMPRESS_LZ4 },
+#endif
+#ifdef HAVE_LIBZSTD
+	{ "zstd", CGPS_COMPRESS_ZSTD },
+#endif
+	{ NULL, CGPS_COMPRESS_NONE }
+};
+
+const char * cgps_compress_name(int method)
+{
+	switch(method) {
+	case CGPS_COMPRESS_LZ4:
+		return "lz4";
+	case CGPS_COMPRESS_ZSTD:
+		return "zstd";
+	default:
+		return "none";
+	}
+}
+
+int cgps_compress_value(const char *name)
+{
+	const struct cgps_compress_method *method;
+
+	for(method = compress_methods; method->name; ++method) {
+		if(strcmp(method->name, name) == 0) {
+			return method->value;
+		}
+	}
+	return -1;
+}
+
+const char * cgps_compress_methods(void)
+{
+#if defined(HAVE_LIBLZ4) && defined(HAVE_LIBZSTD)
+	return "lz4,zstd";
+#elif defined(HAVE_LIBLZ4)
+	return "lz4";
+#elif defined(HAVE_LIBZSTD)
+	return "zstd";
+#else
+	return "";
+#endif
+}
+
+int cgps_compress_offered(const char *greeting, int method)
+{
+	const char *name = cgps_compress_name(method);
+	const char *curr;
+	size_t len = strlen(name);
+
+	if(!(curr = strstr(greeting, ") compress: "))) {
+		return 0;
+	}
+	for(curr += 12; *curr; curr += strcspn(curr, ",")) {
+		if(*curr == ',') {
+			++curr;
+		}
+		if(strncmp(curr, name, len) == 0 && (curr[len] == ',' || curr[len] == '\0')) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#ifdef CGPS_HAVE_COMPRESS
+
+#ifdef HAVE_LIBLZ4
+/*
+ * The lz4 frames are flushed on each update (autoFlush).
+ */
+static void cgps_compress_lz4_prefs(LZ4F_preferences_t *prefs)
+{
+	memset(prefs, 0, sizeof(LZ4F_preferences_t));
+	prefs->frameInfo.blockSizeID = LZ4F_max64KB;
+	prefs->autoFlush = 1;
+}
+#endif
+
+struct cgps_compress * cgps_compress_new(int method)
+{
+	struct cgps_compress *comp;
+
+	if(!(comp = malloc(sizeof(struct cgps_compress)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	memset(comp, 0, sizeof(struct cgps_compress));
+	comp->method = method;
+	comp->fd = -1;
+
+	switch(method) {
+#ifdef HAVE_LIBLZ4
+	case CGPS_COMPRESS_LZ4:
+		if(LZ4F_isError(LZ4F_createCompressionContext((LZ4F_cctx **)&comp->cctx, LZ4F_VERSION)) ||
+		   LZ4F_isError(LZ4F_createDecompressionContext((LZ4F_dctx **)&comp->dctx, LZ4F_VERSION))) {
+			errno = 0;
+			logerr("failed create lz4 context");
+			cgps_compress_free(comp);
+			return NULL;
+		}
+		break;
+#endif
+#ifdef HAVE_LIBZSTD
+	case CGPS_COMPRESS_ZSTD:
+		if(!(comp->cctx = ZSTD_createCCtx()) || !(comp->dctx = ZSTD_createDCtx())) {
+			errno = 0;
+			logerr("failed create zstd context");
+			cgps_compress_free(comp);
+			return NULL;
+		}
+		ZSTD_CCtx_setParameter(comp->cctx, ZSTD_c_compressionLevel, CGPS_COMPRESS_LEVEL);
+		break;
+#endif
+	default:
+		errno = 0;
+		logerr("compression method %d is not supported", method);
+		free(comp);
+		return NULL;
+	}
+	return comp;
+}
+
+void cgps_compress_free(struct cgps_compress *comp)
+{
+	switch(comp->method) {
+#ifdef HAVE_LIBLZ4
+	case CGPS_COMPRESS_LZ4:
+		if(comp->cctx) {
+			LZ4F_freeCompressionContext(comp->cctx);
+		}
+		if(comp->dctx) {
+			LZ4F_freeDecompressionContext(comp->dctx);
+		}
+		break;
+#endif
+#ifdef HAVE_LIBZSTD
+	case CGPS_COMPRESS_ZSTD:
+		ZSTD_freeCCtx(comp->cctx);
+		ZSTD_freeDCtx(comp->dctx);
+		break;
+#endif
+	}
+	free(comp->obuf);
+	free(comp->ibuf);
+	free(comp);
+}
+
+/*
+ * Make room for at least size bytes of compressed output.
+ */
+static int cgps_compress_reserve(struct cgps_compress *comp, size_t size)
+{
+	char *buff;
+
+	if(comp->osize < size) {
+		if(!(buff = realloc(comp->obuf, size))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		comp->obuf = buff;
+		comp->osize = size;
+	}
+	return 0;
+}
+
+#ifdef HAVE_LIBZSTD
+/*
+ * Run the zstd compressor on src until the operation (flush or end) is 
+ * completed. Returns number of bytes output or -1 on failure.
+ */
+static ssize_t cgps_compress_zstd(struct cgps_compress *comp, const char *src, size_t len, ZSTD_EndDirective op)
+{
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+	size_t res;
+
+	if(cgps_compress_reserve(comp, ZSTD_compressBound(len) + ZSTD_CStreamOutSize()) < 0) {
+		return -1;
+	}
+	in.src = src;
+	in.size = len;
+	in.pos = 0;
+	out.dst = comp->obuf;
+	out.size = comp->osize;
+	out.pos = 0;
+
+	do {
+		if(out.pos == out.size) {
+			if(cgps_compress_reserve(comp, comp->osize * 2) < 0) {
+				return -1;
+			}
+			out.dst = comp->obuf;
+			out.size = comp->osize;
+		}
+		res = ZSTD_compressStream2(comp->cctx, &out, &in, op);
+		if(ZSTD_isError(res)) {
+			errno = 0;
+			logerr("failed compress stream (%s)", ZSTD_getErrorName(res));
+			return -1;
+		}
+	} while(res != 0 || in.pos < in.size);
+
+	return out.pos;
+}
+#endif
+
+const char * cgps_compress_encode(struct cgps_compress *comp, const char *src, size_t len, size_t *size)
+{
+	ssize_t bytes = -1;
+#ifdef HAVE_LIBLZ4
+	LZ4F_preferences_t prefs;
+	size_t res;
+#endif
+
+	switch(comp->method) {
+#ifdef HAVE_LIBLZ4
+	case CGPS_COMPRESS_LZ4:
+		cgps_compress_lz4_prefs(&prefs);
+		if(cgps_compress_reserve(comp, LZ4F_compressBound(len, &prefs) + LZ4F_HEADER_SIZE_MAX) < 0) {
+			return NULL;
+		}
+		bytes = 0;
+		if(!comp->started) {
+			res = LZ4F_compressBegin(comp->cctx, comp->obuf, comp->osize, &prefs);
+			if(LZ4F_isError(res)) {
+				errno = 0;
+				logerr("failed begin lz4 frame (%s)", LZ4F_getErrorName(res));
+				return NULL;
+			}
+			bytes += res;
+			comp->started = 1;
+		}
+		res = LZ4F_compressUpdate(comp->cctx, comp->obuf + bytes, comp->osize - bytes, src, len, NULL);
+		if(LZ4F_isError(res)) {
+			errno = 0;
+			logerr("failed compress stream (%s)", LZ4F_getErrorName(res));
+			return NULL;
+		}
+		bytes += res;
+		break;
+#endif
+#ifdef HAVE_LIBZSTD
+	case CGPS_COMPRESS_ZSTD:
+		bytes = cgps_compress_zstd(comp, src, len, ZSTD_e_flush);
+		break;
+#endif
+	}
+	if(bytes < 0) {
+		return NULL;
+	}
+	comp->rawout += len;
+	comp->wireout += bytes;
+	*size = bytes;
+	return comp->obuf;
+}
+
+const char * cgps_compress_end(struct cgps_compress *comp, size_t *size)
+{
+	ssize_t bytes = 0;
+#ifdef HAVE_LIBLZ4
+	LZ4F_preferences_t prefs;
+	size_t res;
+#endif
+
+	switch(comp->method) {
+#ifdef HAVE_LIBLZ4
+	case CGPS_COMPRESS_LZ4:
+		if(!comp->started) {
+			break;
+		}
+		cgps_compress_lz4_prefs(&prefs);
+		if(cgps_compress_reserve(comp, LZ4F_compressBound(0, &prefs)) < 0) {
+			return NULL;
+		}
+		res = LZ4F_compressEnd(comp->cctx, comp->obuf, comp->osize, NULL);
+		if(LZ4F_isError(res)) {
+			errno = 0;
+			logerr("failed end lz4 frame (%s)", LZ4F_getErrorName(res));
+			return NULL;
+		}
+		bytes = res;
+		comp->started = 0;
+		break;
+#endif
+#ifdef HAVE_LIBZSTD
+	case CGPS_COMPRESS_ZSTD:
+		if((bytes = cgps_compress_zstd(comp, NULL, 0, ZSTD_e_end)) < 0) {
+			return NULL;
+		}
+		break;
+#endif
+	}
+	comp->wireout += bytes;
+	*size = bytes;
+	return comp->obuf ? comp->obuf : "";
+}
+
+ssize_t cgps_compress_decode(struct cgps_compress *comp, const char *src, size_t len, size_t *used, char *dst, size_t size)
+{
+	size_t consumed = 0, produced = 0, res = 0;
+#ifdef HAVE_LIBZSTD
+	ZSTD_inBuffer in;
+	ZSTD_outBuffer out;
+#endif
+#ifdef HAVE_LIBLZ4
+	size_t srclen, dstlen;
+#endif
+
+	/*
+	 * The decoders stops at frame and block boundaries, continue
+	 * until no more progress is made.
+	 */
+	do {
+		switch(comp->method) {
+#ifdef HAVE_LIBLZ4
+		case CGPS_COMPRESS_LZ4:
+			srclen = len - consumed;
+			dstlen = size - produced;
+			res = LZ4F_decompress(comp->dctx, dst + produced, &dstlen, src + consumed, &srclen, NULL);
+			if(LZ4F_isError(res)) {
+				errno = 0;
+				logerr("failed decompress stream (%s)", LZ4F_getErrorName(res));
+				return -1;
+			}
+			res = srclen + dstlen;
+			consumed += srclen;
+			produced += dstlen;
+			break;
+#endif
+#ifdef HAVE_LIBZSTD
+		case CGPS_COMPRESS_ZSTD:
+			in.src = src;
+			in.size = len;
+			in.pos = consumed;
+			out.dst = dst;
+			out.size = size;
+			out.pos = produced;
+			res = ZSTD_decompressStream(comp->dctx, &out, &in);
+			if(ZSTD_isError(res)) {
+				errno = 0;
+				logerr("failed decompress stream (%s)", ZSTD_getErrorName(res));
+				return -1;
+			}
+			res = in.pos - consumed + out.pos - produced;
+			consumed = in.pos;
+			produced = out.pos;
+			break;
+#endif
+		default:
+			return -1;
+		}
+	} while(res && produced < size && (consumed < len || comp->method == CGPS_COMPRESS_ZSTD));
+
+	comp->pending = produced == size;
+	comp->rawin += produced;
+	comp->wirein += consumed;
+	*used = consumed;
+	return produced;
+}
+
+int cgps_compress_send(struct cgps_compress *comp, const char *buff, size_t len)
+{
+	const char *data;
+	size_t size, chunk;
+	ssize_t bytes;
+
+	while(len) {
+		chunk = len < CGPS_COMPRESS_BUFFER ? len : CGPS_COMPRESS_BUFFER;
+		if(!(data = cgps_compress_encode(comp, buff, chunk, &size))) {
+			errno = EPROTO;
+			return -1;
+		}
+		while(size) {
+			if((bytes = write(comp->fd, data, size)) < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return -1;
+			}
+			data += bytes;
+			size -= bytes;
+		}
+		buff += chunk;
+		len -= chunk;
+	}
+	return 0;
+}
+
+static ssize_t cgps_compress_read(void *cookie, char *buff, size_t size)
+{
+	struct cgps_compress *comp = cookie;
+	ssize_t bytes;
+	size_t used;
+
+	while(1) {
+		if(comp->ihead < comp->itail || comp->pending) {
+			bytes = cgps_compress_decode(comp, comp->ibuf + comp->ihead, comp->itail - comp->ihead, &used, buff, size);
+			if(bytes < 0) {
+				errno = EPROTO;
+				return -1;
+			}
+			comp->ihead += used;
+			if(bytes > 0) {
+				return bytes;
+			}
+		}
+		if(comp->ihead == comp->itail) {
+			comp->ihead = comp->itail = 0;
+		} else if(comp->itail == CGPS_COMPRESS_BUFFER) {
+			memmove(comp->ibuf, comp->ibuf + comp->ihead, comp->itail - comp->ihead);
+			comp->itail -= comp->ihead;
+			comp->ihead = 0;
+		}
+		do {
+			bytes = read(comp->fd, comp->ibuf + comp->itail, CGPS_COMPRESS_BUFFER - comp->itail);
+		} while(bytes < 0 && errno == EINTR);
+		if(bytes <= 0) {
+			return bytes;
+		}
+		comp->itail += bytes;
+	}
+}
+
+static ssize_t cgps_compress_write(void *cookie, const char *buff, size_t size)
+{
+	if(cgps_compress_send(cookie, buff, size) < 0) {
+		return 0;
+	}
+	return size;
+}
+
+static int cgps_compress_close(void *cookie)
+{
+	struct cgps_compress *comp = cookie;
+	const char *data;
+	size_t size;
+	int result = 0;
+
+	if((data = cgps_compress_end(comp, &size)) && size) {
+		if(write(comp->fd, data, size) < 0) {
+			result = -1;
+		}
+	}
+	if(close(comp->fd) < 0) {
+		result = -1;
+	}
+	cgps_compress_free(comp);
+	return result;
+}
+
+FILE * cgps_compress_open(int fd, int method, struct cgps_compress **comp)
+{
+	cookie_io_functions_t funcs;
+	struct cgps_compress *cookie;
+	FILE *fs;
+
+	if(!(cookie = cgps_compress_new(method))) {
+		return NULL;
+	}
+	if(!(cookie->ibuf = malloc(CGPS_COMPRESS_BUFFER))) {
+		logerr("failed alloc memory");
+		cgps_compress_free(cookie);
+		return NULL;
+	}
+	cookie->fd = fd;
+
+	memset(&funcs, 0, sizeof(cookie_io_functions_t));
+	funcs.read = cgps_compress_read;
+	funcs.write = cgps_compress_write;
+	funcs.close = cgps_compress_close;
+	if(!(fs = fopencookie(cookie, "r+", funcs))) {
+		logerr("failed open compressed stream");
+		cgps_compress_free(cookie);
+		return NULL;
+	}
+	setvbuf(fs, NULL, _IOFBF, CGPS_COMPRESS_BUFFER);
+	if(comp) {
+		*comp = cookie;
+	}
+	return fs;
+}
+
+#else  /* ! CGPS_HAVE_COMPRESS */
+
+struct cgps_compress * cgps_compress_new(int method)
+{
+	errno = 0;
+	logerr("compression method %d is not supported", method);
+	return NULL;
+}
+
+void cgps_compress_free(struct cgps_compress *comp)
+{
+	free(comp);
+}
+
+const char * cgps_compress_encode(struct cgps_compress *comp, const char *src, size_t len, size_t *size)
+{
+	if(comp && src && len && size) {
+		logerr("compression not supported");
+	}
+	return NULL;
+}
+
+const char * cgps_compress_end(struct cgps_compress *comp, size_t *size)
+{
+	if(comp && size) {
+		logerr("compression not supported");
+	}
+	return NULL;
+}
+
+ssize_t cgps_compress_decode(struct cgps_compress *comp, const char *src, size_t len, size_t *used, char *dst, size_t size)
+{
+	if(comp && src && len && used && dst && size) {
+		logerr("compression not supported");
+	}
+	return -1;
+}
+
+int cgps_compress_send(struct cgps_compress *comp, const char *buff, size_t len)
+{
+	if(comp && buff && len) {
+		logerr("compression not supported");
+	}
+	return -1;
+}
+
+FILE * cgps_compress_open(int fd, int method, struct cgps_compress **comp)
+{
+	errno = 0;
+	logerr("compression method %d is not supported (socket %d)", method, fd);
+	if(comp) {
+		*comp = NULL;
+	}
+	return NULL;
+}
+
+#endif /* CGPS_HAVE_COMPRESS */
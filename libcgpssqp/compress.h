@@ -0,0 +1,152 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Stream compression of the CGPSP protocol. The server offers the methods
+ * it supports in its greeting and the client picks one. Once negotiated,
+ * all following bytes in both directions are compressed in streaming 
+ * frames (see docs/README.protocol):
+ * 
+ *   (S -> C)  CGPSP 1.1 (cgpsd: server ready) compress: lz4,zstd
+ *   (C -> S)  CGPSP 1.1 (cgpsclt: client ready)
+ *   (C -> S)  compress: zstd
+ *   (S -> C)  compress: zstd
+ * 
+ * Each write (stream flush) is compressed and flushed as a block that the
+ * peer can decompress without waiting for more data. The frame is ended
+ * when the stream is closed.
+ * 
+ * The compressor can be used on a stdio stream (cgps_compress_open) or on
+ * memory buffers (cgps_compress_encode and cgps_compress_decode) by event
+ * driven code. The methods are only available if built with liblz4 or
+ * libzstd (CGPS_HAVE_COMPRESS defined). Otherwise, no method is offered
+ * and the compressor functions fails.
+ * 
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include <stdio.h>
+
+#if defined(HAVE_LIBLZ4) || defined(HAVE_LIBZSTD)
+# define CGPS_HAVE_COMPRESS 1
+#endif
+
+#define CGPS_COMPRESS_NONE 0
+#define CGPS_COMPRESS_LZ4  1         /* lz4 frame (speed) */
+#define CGPS_COMPRESS_ZSTD 2         /* zstd frame (ratio) */
+
+#define CGPS_COMPRESS_BUFFER 65536   /* stream and input buffer size */
+#define CGPS_COMPRESS_LEVEL  3       /* zstd compression level */
+
+struct cgps_compress
+{
+	int method;           /* CGPS_COMPRESS_XXX */
+	int fd;               /* socket (stream only) */
+	void *cctx;           /* compression context */
+	void *dctx;           /* decompression context */
+	int started;          /* frame started (lz4) */
+	int pending;          /* decoder might hold buffered output */
+	char *obuf;           /* compressed output */
+	size_t osize;
+	char *ibuf;           /* compressed input (stream only) */
+	size_t ihead;
+	size_t itail;
+	uint64_t rawout;      /* bytes compressed */
+	uint64_t wireout;     /* compressed bytes produced */
+	uint64_t rawin;       /* bytes decompressed */
+	uint64_t wirein;      /* compressed bytes consumed */
+};
+
+/*
+ * Returns the name of method.
+ */
+const char * cgps_compress_name(int method);
+
+/*
+ * Returns the method of name or -1 if unknown or not supported by this
+ * build.
+ */
+int cgps_compress_value(const char *name);
+
+/*
+ * Returns comma separated list of supported methods (empty if none).
+ */
+const char * cgps_compress_methods(void);
+
+/*
+ * Returns true if method is offered in the server greeting.
+ */
+int cgps_compress_offered(const char *greeting, int method);
+
+/*
+ * Create compressor for method. Returns NULL on failure.
+ */
+struct cgps_compress * cgps_compress_new(int method);
+
+/*
+ * Release compressor (not the descriptor).
+ */
+void cgps_compress_free(struct cgps_compress *comp);
+
+/*
+ * Compress len bytes from src and flush the block. Returns the compressed
+ * bytes (size bytes), valid until next call, or NULL on failure.
+ */
+const char * cgps_compress_encode(struct cgps_compress *comp, const char *src, size_t len, size_t *size);
+
+/*
+ * End the frame. Returns the trailing bytes (size bytes, might be zero) or
+ * NULL on failure.
+ */
+const char * cgps_compress_end(struct cgps_compress *comp, size_t *size);
+
+/*
+ * Decompress input from src (len bytes) to dst (at most size bytes). The
+ * number of input bytes consumed is stored in used. Returns the number of
+ * bytes decompressed or -1 on failure. If dst was filled, then call again
+ * (even without input) as the decoder might hold more output.
+ */
+ssize_t cgps_compress_decode(struct cgps_compress *comp, const char *src, size_t len, size_t *used, char *dst, size_t size);
+
+/*
+ * Compress and write len bytes direct to the descriptor of the stream
+ * (bypassing the stdio buffer). Returns -1 on failure.
+ */
+int cgps_compress_send(struct cgps_compress *comp, const char *buff, size_t len);
+
+/*
+ * Open read/write stream compressed with method on socket fd. The stream
+ * owns the descriptor (closed by fclose). The compressor is stored in comp
+ * (if non-NULL) and is valid until the stream is closed. Returns NULL on
+ * failure.
+ */
+FILE * cgps_compress_open(int fd, int method, struct cgps_compress **comp);
+
+#endif /* __COMPRESS_H__ */
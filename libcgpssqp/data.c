@@ -30,6 +30,7 @@
 #endif
 
 #include <stdio.h>
+#include <limits.h>
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
@@ -48,6 +49,12 @@
 #define CGPS_CHECK_STRING_MATRIX 1
 
 #include "cgpssqp.h"
+#include "trace.h"
+#include "reorder.h"
+#include "native.h"
+#include "neighbor.h"
+#include "datafile.h"
+#include "compress.h"
 
 extern const char * cgps_simcaq_error(void);
 
@@ -253,73 +260,245 @@ static int cgps_predict_indata_has_molid(const char *buff)
 }
 
 /*
- * Scan indata and return a suitable reorder table.
+ * Returns the hash of the project variable names (part of the reorder 
+ * table cache key).
  */
-static int * cgps_predict_scan_indata(char *buff, int *reorder, SQX_StringVector *names, int *skip)
+static int cgps_predict_hash_names(SQX_StringVector *names, uint64_t *hash)
 {
-	int fields;
-	int columns = SQX_GetNumStringsInVector(names);
+	const char *str;
+	int i, num;
 	
-	fields  = cgps_predict_indata_count_fields(buff);
-	reorder = realloc(reorder, fields * sizeof(int));
-	if(!reorder) {
-		logerr("failed alloc memory");
-		return NULL;
+	*hash = CGPS_REORDER_HASH_INIT;
+	num = SQX_GetNumStringsInVector(names);
+	for(i = 0; i < num; ++i) {
+		if(!SQX_GetStringFromVector(names, i + 1, &str)) {
+			logerr("failed get string from vector (%s)", cgps_simcaq_error());
+			return -1;
+		}
+		if(str) {
+			*hash = cgps_reorder_hash(*hash, str, strlen(str));
+		}
+		*hash = cgps_reorder_hash(*hash, "", 1);
 	}
-	debug("allocated reorder table with %d entries", fields);
+	return 0;
+}
+
+/*
+ * Scan indata and return a suitable reorder table. The table is looked up
+ * in the reorder table cache first, and is only computed on cache misses.
+ * Release the returned table with cgps_reorder_release().
+ */
+static const struct cgps_reorder * cgps_predict_scan_indata(char *buff, SQX_StringVector *names, int *skip)
+{
+	const struct cgps_reorder *cached;
+	struct cgps_reorder *reorder;
+	const char *header = NULL;
+	uint64_t hash;
+	int fields, kind;
+	int columns = SQX_GetNumStringsInVector(names);
+	
+	fields = cgps_predict_indata_count_fields(buff);
 	
 	if(cgps_predict_indata_has_header(buff)) {
-		debug("detected descriptor header, updating reorder table");
-				
+		debug("detected descriptor header, using reorder table");
 		*skip = 1;
-		if(cgps_predict_update_reorder_table(reorder, fields, names, buff) < 0) {
-			logerr("failed create descriptors reorder table");
-			free(reorder);
-			return NULL;
-		}
+		kind = CGPS_REORDER_HEADER;
+		header = buff;
 	} else if(cgps_predict_indata_has_molid(buff)) {
 		if(fields > (columns + 1)) {
 			logerr("too many columns in input data (expected: %d, got: %d)",
 			       columns + 1, fields);
-			free(reorder);
 			return NULL;
 		}
 		debug("deteted molecule id in first field, enable index shift");
-		reorder[0] = -1;
-		cgps_predict_init_reorder_table(reorder, fields, 1);
+		kind = CGPS_REORDER_MOLID;
 	} else {
 		if(fields != columns) {
 			logerr("number of columns in input data and project don't match");
-			free(reorder);
 			return NULL;
 		}
 		debug("no headers detected, treating input data as already ordered");
-		cgps_predict_init_reorder_table(reorder, fields, 0);
+		kind = CGPS_REORDER_PLAIN;
+	}
+	
+	if(cgps_predict_hash_names(names, &hash) < 0) {
+		return NULL;
+	}
+	if((cached = cgps_reorder_find(kind, fields, hash, header))) {
+		debug("using cached reorder table with %d entries", fields);
+		return cached;
+	}
+	
+	if(!(reorder = cgps_reorder_alloc(kind, fields, hash, header))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	debug("allocated reorder table with %d entries", fields);
+	
+	switch(kind) {
+	case CGPS_REORDER_HEADER:
+		if(cgps_predict_update_reorder_table(reorder->table, fields, names, buff) < 0) {
+			logerr("failed create descriptors reorder table");
+			cgps_reorder_release(reorder);
+			return NULL;
+		}
+		break;
+	case CGPS_REORDER_MOLID:
+		reorder->table[0] = -1;
+		cgps_predict_init_reorder_table(reorder->table, fields, 1);
+		break;
+	default:
+		cgps_predict_init_reorder_table(reorder->table, fields, 0);
+		break;
+	}
+	
+	return cgps_reorder_insert(reorder);
+}
+
+/*
+ * Reader of input data loaded from a stream. For a chunked load (Load: 
+ * chunked), the input data is sent as a sequence of chunks, each one a 
+ * line with the chunk size (decimal) followed by that many bytes of data.
+ * A chunk of size 0 terminates the input. The lines of data may span 
+ * chunks. As the number of observations is not known until the input is
+ * terminated, the input grows while loading.
+ */
+struct cgps_predict_reader
+{
+	FILE *fs;             /* the input stream */
+	int chunked;          /* read chunked input data */
+	size_t left;          /* bytes left in current chunk */
+	int done;             /* terminating chunk received */
+	struct cgps_input *input;  /* loaded values */
+};
+
+/*
+ * Read the size of next chunk. Returns -1 on failure.
+ */
+static int cgps_predict_chunked_next(struct cgps_predict_reader *reader)
+{
+	char line[32], *end;
+	unsigned long size;
+	
+	if(!fgets(line, sizeof(line), reader->fs)) {
+		logerr("premature end of chunked input data");
+		return -1;
+	}
+	size = strtoul(line, &end, 10);
+	if(end == line || (*end != '\n' && *end != '\r')) {
+		line[strcspn(line, "\r\n")] = '\0';
+		logerr("invalid chunk size '%s' in input data", line);
+		return -1;
 	}
+	if(opts->verbose > 1) {
+		debug("reading chunk of %lu bytes", size);
+	}
+	reader->left = size;
+	reader->done = size == 0;
+	return 0;
+}
+
+/*
+ * Read next line from chunked input data. The semantic is the same as for
+ * getline(), the line is read to buff (realloc'ed as needed) and the line 
+ * length is returned or -1 when no more lines exist or on failure.
+ */
+static ssize_t cgps_predict_chunked_getline(char **buff, size_t *size, struct cgps_predict_reader *reader)
+{
+	size_t used = 0, length;
+	char *ptr;
+	int bytes;
 	
-	return reorder;
+	while(!reader->done) {
+		if(!reader->left) {
+			if(cgps_predict_chunked_next(reader) < 0) {
+				return -1;
+			}
+			continue;
+		}
+		if(*size - used < 2) {
+			if(!(ptr = realloc(*buff, *size ? *size * 2 : 256))) {
+				logerr("failed alloc memory");
+				return -1;
+			}
+			*buff = ptr;
+			*size = *size ? *size * 2 : 256;
+		}
+		bytes = *size - used > reader->left ? reader->left + 1 : *size - used;
+		if(!fgets(*buff + used, bytes, reader->fs)) {
+			logerr("premature end of chunked input data");
+			return -1;
+		}
+		if(!(length = strlen(*buff + used))) {
+			logerr("invalid null character in chunked input data");
+			return -1;
+		}
+		used += length;
+		reader->left -= length;
+		if((*buff)[used - 1] == '\n') {
+			break;
+		}
+	}
+	return used ? (ssize_t)used : -1;
 }
 
 /*
- * Load raw data from file stream. The stream endpoint could be a
- * file, wrapped TCP socket, pipe or stdin.
+ * Resize the input to capacity rows. The added rows are zero filled.
  */
-static int cgps_predict_load_stream(FILE *fs, int rows, int columns, SQX_FloatMatrix *matrix, SQX_StringVector *names)
+static int cgps_predict_input_alloc(struct cgps_input *input, int capacity)
 {
+	float *ptr;
+	
+	if(capacity <= input->capacity) {
+		return 0;
+	}
+	if(!(ptr = realloc(input->values, ((size_t)capacity * input->cols + 1) * sizeof(float)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	memset(ptr + (size_t)input->capacity * input->cols, 0, (size_t)(capacity - input->capacity) * input->cols * sizeof(float));
+	input->values = ptr;
+	input->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Load raw data from the stream of reader to its input (having columns 
+ * set). The stream endpoint could be a file, wrapped TCP socket, pipe or 
+ * stdin. The lines read are added to the request trace (if not NULL). If
+ * ordered is true, then the data is known to have the project schema (no
+ * header and all columns in project order) and is loaded without reorder
+ * table. For chunked input, rows is unused (all rows are loaded) and empty 
+ * lines are skipped.
+ */
+static int cgps_predict_load_stream(struct cgps_predict_reader *reader, int rows, SQX_StringVector *names, struct cgps_trace_record *trace, int ordered)
+{
+	struct cgps_input *input = reader->input;
 	char *buff = NULL;
 	size_t size = 0;
 	ssize_t bytes;
-	int total = 0;
-	int i = 0, j = 0, skip = 0;
-	int *reorder = NULL;
+	int total = 0, columns = input->cols;
+	int i = 0, j = 0, skip = 0, limit, column;
+	const struct cgps_reorder *reorder = NULL;
 
-	while(((bytes = getline(&buff, &size, fs)) != -1) && i < rows) {
+	if(reader->chunked) {
+		rows = INT_MAX;
+	} else if(cgps_predict_input_alloc(input, rows) < 0) {
+		return -1;
+	}
+	while(((bytes = reader->chunked ? cgps_predict_chunked_getline(&buff, &size, reader) : getline(&buff, &size, reader->fs)) != -1) && i < rows) {
 		size_t offset = 0;
 		size_t length = 0;
 		const char *pp;
 
-		if(!reorder) {
-			reorder = cgps_predict_scan_indata(buff, reorder, names, &skip);
+		if(reader->chunked && strspn(buff, " \t\r\n") == (size_t)bytes) {
+			continue;
+		}
+		if(trace) {
+			cgps_trace_append(trace, buff, bytes);
+		}
+		if(!reorder && !ordered) {
+			reorder = cgps_predict_scan_indata(buff, names, &skip);
 			if(!reorder) {
 				free(buff);
 				return -1;
@@ -329,19 +508,21 @@ static int cgps_predict_load_stream(FILE *fs, int rows, int columns, SQX_FloatMa
 				continue;
 			}
 		}
+		if(i >= input->capacity && cgps_predict_input_alloc(input, input->capacity ? input->capacity * 2 : 1024) < 0) {
+			cgps_reorder_release(reorder);
+			free(buff);
+			return -1;
+		}
 		
 		j = 0;
-		while((pp = cgps_predict_next_decriptor(buff, &offset, &length))) {
-			if(reorder[j] != -1) {
+		limit = ordered ? columns : reorder->fields;
+		while((pp = cgps_predict_next_decriptor(buff, &offset, &length)) && j < limit) {
+			column = ordered ? j : reorder->table[j];
+			if(column != -1) {
 				if(opts->verbose > 1) {
-					debug("saving float value %f from %d -> %d", atof(pp), j, reorder[j]);
-				}
-				if(!SQX_SetDataInFloatMatrix(matrix, i + 1, reorder[j] + 1, atof(pp))) {
-					logerr("failed add float value to matrix (%s)", cgps_simcaq_error());
-					free(reorder);
-					free(buff);
-					return -1;
+					debug("saving float value %f from %d -> %d", atof(pp), j, column);
 				}
+				input->values[(size_t)i * columns + column] = atof(pp);
 				++total;
 			} else {
 				debug("ignored value in column %d from input stream", j);
@@ -351,17 +532,26 @@ static int cgps_predict_load_stream(FILE *fs, int rows, int columns, SQX_FloatMa
 		++i;
 		
 	}
-	debug("loaded %d entries total (%d rows) from input stream to %dx%d matrix", total, i, rows, columns);
+	if(reader->chunked) {
+		debug("loaded %d entries total (%d rows) from chunked input stream", total, i);
+		input->rows = i;
+	} else {
+		debug("loaded %d entries total (%d rows) from input stream to %dx%d matrix", total, i, rows, columns);
+		input->rows = rows;
+	}
 	
 	if(buff) {
 		free(buff);
 	}
 	if(reorder) {
-		free(reorder);
+		cgps_reorder_release(reorder);
 	}
-	if(!feof(fs)) {
+	if(reader->chunked) {
+		return reader->done ? 0 : -1;
+	}
+	if(!feof(reader->fs) && fileno(reader->fs) >= 0) {
 		struct stat st;
-		if(fstat(fileno(fs), &st) < 0) {
+		if(fstat(fileno(reader->fs), &st) < 0) {
 			logerr("failed stat input stream");
 			return -1;
 		}
@@ -377,43 +567,173 @@ static int cgps_predict_load_stream(FILE *fs, int rows, int columns, SQX_FloatMa
  * Load raw data from file. Returns 0 is sucessful and -1
  * on failure.
  */
-static int cgps_predict_load_file(const char *path, int rows, int columns, SQX_FloatMatrix *matrix, SQX_StringVector *names)
+static int cgps_predict_load_file(const char *path, int rows, struct cgps_input *input, SQX_StringVector *names)
 {
-	FILE *fs;
+	struct cgps_predict_reader reader;
 	int result;
 
-	fs = fopen(path, "r");
-	if(!fs) {
+	memset(&reader, 0, sizeof(struct cgps_predict_reader));
+	reader.input = input;
+	reader.fs = fopen(path, "r");
+	if(!reader.fs) {
 		logerr("failed open file %s for reading", path);
 		return -1;
 	}
-	result = cgps_predict_load_stream(fs, rows, columns, matrix, names);
-	fclose(fs);
+	result = cgps_predict_load_stream(&reader, rows, names, NULL, 0);
+	fclose(reader.fs);
 	
 	return result;
 }
 
 /*
- * Get number of observations from socket stream.
+ * Returns the project schema if matching the variable names. The schema
+ * is set from names if not yet known.
  */
-static int cgps_predict_get_observations(struct client *loader)
+static const struct cgps_schema * cgps_predict_get_schema(SQX_StringVector *names)
+{
+	const struct cgps_schema *schema;
+	const char *str;
+	uint64_t hash;
+	size_t length = 1;
+	char *list;
+	int i, num;
+	
+	if(cgps_predict_hash_names(names, &hash) < 0) {
+		return NULL;
+	}
+	if((schema = cgps_reorder_schema())) {
+		return schema->fingerprint == hash ? schema : NULL;
+	}
+	
+	num = SQX_GetNumStringsInVector(names);
+	for(i = 0; i < num; ++i) {
+		if(SQX_GetStringFromVector(names, i + 1, &str) && str) {
+			length += strlen(str) + 1;
+		}
+	}
+	if(!(list = malloc(length))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	*list = '\0';
+	for(i = 0; i < num; ++i) {
+		if(SQX_GetStringFromVector(names, i + 1, &str) && str) {
+			if(i) {
+				strcat(list, "\n");
+			}
+			strcat(list, str);
+		}
+	}
+	schema = cgps_reorder_schema_set(hash, list, num);
+	free(list);
+	
+	if(schema) {
+		debug("project schema %016llx (%d variables)", (unsigned long long)schema->fingerprint, schema->count);
+	}
+	return schema && schema->fingerprint == hash ? schema : NULL;
+}
+
+/*
+ * Get number of observations from socket stream. The peer might ask for
+ * the schema or nearest neighbors before answering. If the peer answers 
+ * with the fingerprint of the schema, then ordered is set to true. If the
+ * peer is going to send chunked input data, then chunked is set to true
+ * (and rows to 0).
+ */
+static int cgps_predict_get_observations(struct client *loader, const struct cgps_schema *schema, int *rows, int *ordered, int *chunked)
 {
 	char *buff = NULL;
 	size_t size = 0;
 	struct request_option req;
+	unsigned long long fingerprint;
+	int numobs, k, found;
 	
-	read_request(&buff, &size, loader->ss);
-	if(split_request_option(buff, &req) == CGPSP_PROTO_LAST) {
-		free(buff);
-		logerr("failed receive number of observations");
-		return -1;
+	while(1) {
+		if(read_request(&buff, &size, loader->ss) < 0) {
+			free(buff);
+			logerr("failed receive number of observations");
+			return -1;
+		}
+		if(split_request_option(buff, &req) == CGPSP_PROTO_LAST) {
+			free(buff);
+			logerr("failed receive number of observations");
+			return -1;
+		}
+		if(req.symbol == CGPSP_PROTO_NEIGHBORS) {
+			if(!loader->opts->index) {
+				free(buff);
+				logerr("neighbors requested, but no reference set is loaded");
+				fprintf(loader->ss, "error: no reference set\n");
+				fflush(loader->ss);
+				return -1;
+			}
+			if(!req.value || (k = atoi(req.value)) < 1 || k > CGPS_NEIGHBORS_MAX) {
+				free(buff);
+				logerr("invalid number of neighbors requested (%s)", req.value ? req.value : "");
+				fprintf(loader->ss, "error: invalid number of neighbors\n");
+				fflush(loader->ss);
+				return -1;
+			}
+			if(loader->binary) {
+				free(buff);
+				logerr("neighbors requested in binary format");
+				fprintf(loader->ss, "error: neighbors not supported in binary format\n");
+				fflush(loader->ss);
+				return -1;
+			}
+			debug("peer requested %d nearest neighbors", k);
+			loader->neighbors = k;
+			continue;
+		}
+		if(req.symbol != CGPSP_PROTO_SCHEMA) {
+			break;
+		}
+		if(!schema) {
+			free(buff);
+			logerr("schema requested, but no schema is known");
+			fprintf(loader->ss, "error: no schema\n");
+			fflush(loader->ss);
+			return -1;
+		}
+		debug("sending schema %016llx to peer", (unsigned long long)schema->fingerprint);
+		fprintf(loader->ss, "Schema: %016llx\n%s\n\n", (unsigned long long)schema->fingerprint, schema->names);
+		fflush(loader->ss);
 	}
-	if(req.symbol != CGPSP_PROTO_LOAD) {
+	if(req.symbol != CGPSP_PROTO_LOAD || !req.value) {
 		free(buff);
 		logerr("expected load option, got '%s'", req.option);
 		return -1;
 	}
-	loader->opts->numobs = atoi(req.value);
+	if(strncmp(req.value, "chunked", 7) == 0) {
+		debug("peer is sending chunked input data");
+		found = sscanf(req.value + 7, "%llx", &fingerprint) == 1;
+		*chunked = 1;
+	} else {
+		found = sscanf(req.value, "%d %llx", &numobs, &fingerprint) == 2;
+	}
+	if(found) {
+		if(!schema || schema->fingerprint != fingerprint) {
+			free(buff);
+			logerr("peer data has schema %016llx (not the project schema)", fingerprint);
+			/*
+			 * The stream has buffered input data, write direct to socket.
+			 */
+			if(loader->compress) {
+				if(cgps_compress_send(loader->compress, "error: schema mismatch\n", 23) < 0) {
+					logerr("failed send schema error to peer");
+				}
+			} else if(write(loader->sock, "error: schema mismatch\n", 23) < 0) {
+				logerr("failed send schema error to peer");
+			}
+			return -1;
+		}
+		debug("peer data has the project schema (no reorder)");
+		*ordered = 1;
+	}
+	*rows = *chunked ? 0 : atoi(req.value);
+	if(loader->trace) {
+		loader->trace->rows = *rows;
+	}
 	free(buff);
 	
 	return 0;
@@ -446,7 +766,7 @@ static int cgps_predict_load_check_params(struct cgps_project *proj, struct clie
 			error = 1;
 		}
 	}
-	if(!proj->handle) {
+	if(proj && !proj->handle) {
 		logerr("Invalid project handle");
 		error = 1;
 	}
@@ -455,7 +775,7 @@ static int cgps_predict_load_check_params(struct cgps_project *proj, struct clie
 		error = 1;
 	}
 	if(error) {
-		fprintf(loader->ss, "Error: failed load data\n");
+		fprintf(loader->ss, "error: failed load data\n");
 		fflush(loader->ss);
 		return -1;		
 	}
@@ -463,63 +783,199 @@ static int cgps_predict_load_check_params(struct cgps_project *proj, struct clie
 }
 
 /*
- * Load quantitative data (raw).
+ * Load raw data from columnar descriptor file (see datafile.h). The columns
+ * are used as is if having the project schema (or being unnamed), otherwise
+ * they are mapped by name. At most rows observations are loaded (0 for all).
  */
-static int cgps_predict_load_quant_data(struct cgps_project *proj, struct client *loader, SQX_FloatMatrix *matrix, SQX_StringVector *names)
+static int cgps_predict_load_datafile(struct client *loader, int rows, struct cgps_input *input, SQX_StringVector *names)
 {
-	int num = SQX_GetNumStringsInVector(names);
+	struct cgps_datafile *file;
+	const struct cgps_schema *schema;
+	const char *str;
+	float *values;
+	uint64_t first = loader->opts->firstobs;
+	int num = input->cols;
+	int col, i, j, k, n, result = 0;
+	
+	if(!(file = cgps_datafile_open(loader->opts->data))) {
+		return -1;
+	}
+	if(first > file->rows) {
+		logerr("first observation %llu is beyond end of data (%llu rows)", 
+		       (unsigned long long)first, (unsigned long long)file->rows);
+		cgps_datafile_close(file);
+		return -1;
+	}
+	if(!rows || (uint64_t)rows > file->rows - first) {
+		rows = file->rows - first;
+	}
+	loader->numobs = rows;
+	debug("loading %d observations (from %llu) of %s", rows, (unsigned long long)first, loader->opts->data);
+	
+	if(cgps_predict_input_alloc(input, rows) < 0) {
+		cgps_datafile_close(file);
+		return -1;
+	}
+	input->rows = rows;
+	if(!(values = malloc(256 * sizeof(float)))) {
+		logerr("failed alloc memory");
+		cgps_datafile_close(file);
+		return -1;
+	}
+	schema = cgps_predict_get_schema(names);
+	if(!file->names || (schema && schema->fingerprint == file->fingerprint)) {
+		if(file->cols != num) {
+			logerr("number of columns in %s don't match project (%d != %d)", loader->opts->data, file->cols, num);
+			result = -1;
+		} else {
+			debug("data file has the project schema (no reorder)");
+		}
+	}
+	
+	for(i = 0; i < num && result == 0; ++i) {
+		col = i;
+		if(file->names && !(schema && schema->fingerprint == file->fingerprint)) {
+			if(!SQX_GetStringFromVector(names, i + 1, &str) || !str) {
+				logerr("failed get string from vector (%s)", cgps_simcaq_error());
+				result = -1;
+				break;
+			}
+			if((col = cgps_datafile_find(file, str)) < 0) {
+				logwarn("variable %s is missing in %s (using 0)", str, loader->opts->data);
+			}
+		}
+		for(j = 0; j < rows && result == 0; j += n) {
+			n = rows - j < 256 ? rows - j : 256;
+			if(col < 0) {
+				memset(values, 0, n * sizeof(float));
+			} else if(cgps_datafile_column(file, col, first + j, n, values) < 0) {
+				logerr("failed read column %d of %s", col, loader->opts->data);
+				result = -1;
+				break;
+			}
+			for(k = 0; k < n; ++k) {
+				input->values[(size_t)(j + k) * num + i] = values[k];
+			}
+		}
+	}
+	
+	free(values);
+	cgps_datafile_close(file);
+	return result;
+}
 
-	if(cgps_predict_load_check_params(proj, loader, matrix, NULL, names, CGPS_CHECK_FLOAT_MATRIX) < 0) {
-		logerr("invalid parameters to cgps_predict_load_quant_data().");
+/*
+ * Load chunked input data from peer.
+ */
+static int cgps_predict_load_chunked(struct client *loader, struct cgps_input *input, SQX_StringVector *names, int ordered)
+{
+	struct cgps_predict_reader reader;
+	
+	memset(&reader, 0, sizeof(struct cgps_predict_reader));
+	reader.fs = loader->ss;
+	reader.chunked = 1;
+	reader.input = input;
+	
+	if(cgps_predict_load_stream(&reader, 0, names, loader->trace, ordered) < 0) {
+		return -1;
+	}
+	if(!input->rows) {
+		logerr("no observations in chunked input data");
+		return -1;
+	}
+	if(cgps_predict_input_alloc(input, input->rows) < 0) {
 		return -1;
 	}
 	
+	loader->numobs = input->rows;
+	if(loader->trace) {
+		loader->trace->rows = input->rows;
+	}
+	return 0;
+}
+
+/*
+ * Load quantitative data (raw) to input. The number of observations is per
+ * request (kept in loader), the options are shared by all worker threads
+ * in the daemon and only gives the default for the standalone program.
+ */
+static int cgps_predict_load_quant_input(struct client *loader, SQX_StringVector *names, struct cgps_input *input)
+{
+	const struct cgps_schema *schema;
+	int numobs = loader->opts->numobs;
+	int ordered = 0, chunked = 0;
+
+	input->cols = SQX_GetNumStringsInVector(names);
+	
 	if(loader->ss) {
 		debug("asking peer to send prediction data (quantitative)");
-		fprintf(loader->ss, "Load: quant-data\n");
+		if((schema = cgps_predict_get_schema(names))) {
+			fprintf(loader->ss, "Load: quant-data %016llx\n", (unsigned long long)schema->fingerprint);
+		} else {
+			fprintf(loader->ss, "Load: quant-data\n");
+		}
 		fflush(loader->ss);
-		if(cgps_predict_get_observations(loader) < 0) {
+		if(cgps_predict_get_observations(loader, schema, &numobs, &ordered, &chunked) < 0) {
 			logerr("failed get number of observations from peer");
 			return -1;
 		}
+		if(chunked) {
+			if(cgps_predict_load_chunked(loader, input, names, ordered) < 0) {
+				logerr("failed load chunked raw data from socket");
+				return -1;
+			}
+			return 0;
+		}
+	}
+	
+	if(loader->opts->data && cgps_datafile_check(loader->opts->data)) {
+		if(cgps_predict_load_datafile(loader, numobs, input, names) < 0) {
+			logerr("failed load raw data from file %s", loader->opts->data);
+			return -1;
+		}
+		debug("successful loaded raw data from %s", loader->opts->data);
+		return 0;
 	}
 	
-	if(!loader->opts->numobs) {
+	if(!numobs) {
 		if(loader->opts->data) {
-			if(cgps_predict_count_observations(loader->opts->data, &loader->opts->numobs) < 0) {
+			if(cgps_predict_count_observations(loader->opts->data, &numobs) < 0) {
 				logerr("failed count number of observations in input data");
 				return -1;
 			} else {
-				debug("detected %d number of observations in input data", loader->opts->numobs);
+				debug("detected %d number of observations in input data", numobs);
 			}
 		} else {
 			logerr("unknown number of observations in input data, use -i or -n option to fix");
 			return -1;
 		}
 	} else {
-		debug("using user defined %d number of observations", loader->opts->numobs);
-	}
-	if(!SQX_InitFloatMatrix(matrix, loader->opts->numobs, num)) {
-		logerr("failed initilize float point matrix (%s)", cgps_simcaq_error());
-		return -1;
+		debug("using user defined %d number of observations", numobs);
 	}
+	loader->numobs = numobs;
 	if(loader->opts->data) {
-		if(cgps_predict_load_file(loader->opts->data, loader->opts->numobs, num, matrix, names) < 0) {
+		if(cgps_predict_load_file(loader->opts->data, numobs, input, names) < 0) {
 			logerr("failed load raw data from file %s", loader->opts->data);
 			return -1;
 		}
 		debug("successful loaded raw data from %s", loader->opts->data);
 	} else {
+		struct cgps_predict_reader reader;
+		
+		memset(&reader, 0, sizeof(struct cgps_predict_reader));
+		reader.input = input;
 		if(loader->ss) {		
-			if(cgps_predict_load_stream(loader->ss, loader->opts->numobs, num, matrix, names) < 0) {
+			reader.fs = loader->ss;
+			if(cgps_predict_load_stream(&reader, numobs, names, loader->trace, ordered) < 0) {
 				logerr("failed load raw data from socket");
 				return -1;
 			}			
 		} else {
 			if(!loader->opts->batch) {
-				loginfo("waiting for raw data input on stdin (%dx%d):", loader->opts->numobs, num);
+				loginfo("waiting for raw data input on stdin (%dx%d):", numobs, input->cols);
 			}
-			if(cgps_predict_load_stream(stdin, loader->opts->numobs, num, matrix, names) < 0) {
+			reader.fs = stdin;
+			if(cgps_predict_load_stream(&reader, numobs, names, NULL, 0) < 0) {
 				logerr("failed load raw data from stdin");
 				return -1;
 			}			
@@ -529,6 +985,43 @@ static int cgps_predict_load_quant_data(struct cgps_project *proj, struct client
 	return 0;
 }
 
+/*
+ * Copy input to float matrix dst (uninitilized).
+ */
+static int cgps_predict_input_copy(SQX_FloatMatrix *dst, const struct cgps_input *input)
+{
+	int i, j;
+
+	if(!SQX_InitFloatMatrix(dst, input->rows, input->cols)) {
+		logerr("failed initilize float point matrix (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	for(i = 0; i < input->rows; ++i) {
+		for(j = 0; j < input->cols; ++j) {
+			if(!SQX_SetDataInFloatMatrix(dst, i + 1, j + 1, input->values[(size_t)i * input->cols + j])) {
+				logerr("failed add float value to matrix (%s)", cgps_simcaq_error());
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * Load quantitative data (raw) to input and matrix.
+ */
+static int cgps_predict_load_quant_data(struct cgps_project *proj, struct client *loader, SQX_FloatMatrix *matrix, SQX_StringVector *names, struct cgps_input *input)
+{
+	if(cgps_predict_load_check_params(proj, loader, matrix, NULL, names, CGPS_CHECK_FLOAT_MATRIX) < 0) {
+		logerr("invalid parameters to cgps_predict_load_quant_data().");
+		return -1;
+	}
+	if(cgps_predict_load_quant_input(loader, names, input) < 0) {
+		return -1;
+	}
+	return cgps_predict_input_copy(matrix, input);
+}
+
 /*
  * Load qualitative data.
  */
@@ -588,7 +1081,13 @@ int cgps_predict_data(struct cgps_project *proj, void *params, SQX_FloatMatrix *
 	struct client *loader = (struct client *)params;
 	
 	if(type == CGPS_GET_QUANTITATIVE_DATA) {
-		return cgps_predict_load_quant_data(proj, loader, fmx, names);
+		struct cgps_input input;
+		int result;
+		
+		memset(&input, 0, sizeof(struct cgps_input));
+		result = cgps_predict_load_quant_data(proj, loader, fmx, names, &input);
+		free(input.values);
+		return result;
 	} else if(type == CGPS_GET_QUALITATIVE_DATA) {
 		return cgps_predict_load_qual_data(proj, loader, smx, names);
 	} else if(type == CGPS_GET_QUAL_LAGGED_DATA) {
@@ -601,3 +1100,261 @@ int cgps_predict_data(struct cgps_project *proj, void *params, SQX_FloatMatrix *
 	}
 	return 0;   /* keep GCC happy ;-) */
 }
+
+/*
+ * The input data cache.
+ */
+void cgps_predict_cache_init(struct cgps_predict_cache *cache, struct client *loader)
+{
+	memset(cache, 0, sizeof(struct cgps_predict_cache));
+	cache->loader = loader;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_init(&cache->lock, NULL);
+#endif
+}
+
+void cgps_predict_cache_cleanup(struct cgps_predict_cache *cache)
+{
+	free(cache->input.values);
+	memset(&cache->input, 0, sizeof(struct cgps_input));
+	cache->state = CGPS_PREDICT_CACHE_EMPTY;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_destroy(&cache->lock);
+#endif
+}
+
+/*
+ * The indata callback using the cache (passed in params). Only quantitative 
+ * data is cached.
+ */
+int cgps_predict_data_cached(struct cgps_project *proj, void *params, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type)
+{
+	struct cgps_predict_cache *cache = (struct cgps_predict_cache *)params;
+	int state;
+	
+	if(type != CGPS_GET_QUANTITATIVE_DATA) {
+		return cgps_predict_data(proj, cache->loader, fmx, smx, names, type);
+	}
+
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&cache->lock);
+#endif
+	if(cache->state == CGPS_PREDICT_CACHE_EMPTY) {
+		debug("loading input data (cached)");
+		if(cgps_predict_load_quant_data(proj, cache->loader, fmx, names, &cache->input) < 0) {
+			cache->state = CGPS_PREDICT_CACHE_FAILED;
+		} else {
+			cache->state = CGPS_PREDICT_CACHE_LOADED;
+		}
+#ifdef HAVE_LIBPTHREAD
+		pthread_mutex_unlock(&cache->lock);
+#endif
+		return cache->state == CGPS_PREDICT_CACHE_LOADED ? 0 : -1;
+	}
+	state = cache->state;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&cache->lock);
+#endif
+
+	if(state == CGPS_PREDICT_CACHE_FAILED) {
+		return -1;
+	}
+	debug("using cached input data");
+	return cgps_predict_input_copy(fmx, &cache->input);
+}
+
+/*
+ * Load input data to the cache without libchemgps (for the native engine
+ * and the prediction store). The names are the quantitative variable names 
+ * of the project.
+ */
+int cgps_predict_cache_load(struct cgps_predict_cache *cache, SQX_StringVector *names)
+{
+	int state;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_lock(&cache->lock);
+#endif
+	if(cache->state == CGPS_PREDICT_CACHE_EMPTY) {
+		debug("loading input data (direct)");
+		if(cgps_predict_load_quant_input(cache->loader, names, &cache->input) < 0) {
+			cache->state = CGPS_PREDICT_CACHE_FAILED;
+		} else {
+			cache->state = CGPS_PREDICT_CACHE_LOADED;
+		}
+	}
+	state = cache->state;
+#ifdef HAVE_LIBPTHREAD
+	pthread_mutex_unlock(&cache->lock);
+#endif
+	return state == CGPS_PREDICT_CACHE_LOADED ? 0 : -1;
+}
+
+/*
+ * The indata callback used for getting the variable names. No data is 
+ * loaded.
+ */
+static int cgps_predict_copy_names(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type)
+{
+	SQX_StringVector *copy = (SQX_StringVector *)data;
+	const char *str;
+	int i, num;
+
+	if(type != CGPS_GET_QUANTITATIVE_DATA) {
+		return -1;
+	}
+	num = SQX_GetNumStringsInVector(names);
+	if(!SQX_InitStringVector(copy, num)) {
+		logerr("failed initilize string vector (%s)", cgps_simcaq_error());
+		return -1;
+	}
+	for(i = 1; i <= num; ++i) {
+		if(!SQX_GetStringFromVector(names, i, &str) || 
+		   !SQX_SetStringInVector(copy, i, str)) {
+			logerr("failed copy variable names (%s)", cgps_simcaq_error());
+			return -1;
+		}
+	}
+	if(proj || fmx || smx) {}
+	return -1;
+}
+
+int cgps_predict_names(struct cgps_project *proj, SQX_StringVector *names)
+{
+	struct cgps_project copy;
+	struct cgps_options options;
+	struct cgps_predict pred;
+	
+	/*
+	 * The variable names are only passed to the indata callback. Make a 
+	 * prediction that is aborted when asking for input data. The callback
+	 * is set in a private copy of the project options, the options shared
+	 * with other threads are never modified.
+	 */
+	memcpy(&options, proj->opts, sizeof(struct cgps_options));
+	memcpy(&copy, proj, sizeof(struct cgps_project));
+	options.indata = cgps_predict_copy_names;
+	copy.opts = &options;
+	
+	cgps_predict_init(&copy, &pred, names);
+	cgps_predict_cleanup(&copy, &pred);
+	
+	return SQX_GetNumStringsInVector(names) ? 0 : -1;
+}
+
+/*
+ * The indata callback used for predicting input data direct (without a 
+ * peer). The data argument is the struct cgps_input to copy.
+ */
+static int cgps_predict_copy_input(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type)
+{
+	const struct cgps_input *input = (const struct cgps_input *)data;
+
+	if(type != CGPS_GET_QUANTITATIVE_DATA) {
+		return -1;
+	}
+	if(input->cols != SQX_GetNumStringsInVector(names)) {
+		logerr("input data has %d columns, project has %d variables", input->cols, SQX_GetNumStringsInVector(names));
+		return -1;
+	}
+	if(proj || smx) {}
+	return cgps_predict_input_copy(fmx, input);
+}
+
+/*
+ * Read the rows of values from the plain text output of cgps_result(). 
+ * Lines that are not all numbers (the result headers and separators) are
+ * skipped, so nothing else is assumed about the layout of the output.
+ */
+static float * cgps_predict_read_values(char *buff, int rows, int *cols)
+{
+	float *values = NULL;
+	char *line, *next, *curr, *end;
+	int count = 0, num, j;
+
+	for(line = buff; line && *line; line = next) {
+		if((next = strchr(line, '\n'))) {
+			*next++ = '\0';
+		}
+		for(num = 0, curr = line + strspn(line, " \t\r"); *curr; curr = end + strspn(end, " \t\r")) {
+			strtod(curr, &end);
+			if(end == curr || (*end && !strchr(" \t\r", *end))) {
+				num = 0;
+				break;
+			}
+			++num;
+		}
+		if(!num) {
+			continue;
+		}
+		if(!values) {
+			if(!(values = malloc(((size_t)rows * num + 1) * sizeof(float)))) {
+				logerr("failed alloc memory");
+				return NULL;
+			}
+			*cols = num;
+		}
+		if(num != *cols || count == rows) {
+			debug("unexpected layout of result output (row %d has %d values)", count + 1, num);
+			free(values);
+			return NULL;
+		}
+		for(j = 0, curr = line; j < num; ++j, curr = end) {
+			values[(size_t)count * num + j] = strtod(curr, &end);
+		}
+		++count;
+	}
+	if(count != rows) {
+		free(values);
+		return NULL;
+	}
+	return values;
+}
+
+float * cgps_predict_values(struct cgps_project *proj, int index, const struct cgps_input *input, int result, int *cols)
+{
+	struct cgps_project copy;
+	struct cgps_options options;
+	struct cgps_predict pred;
+	struct cgps_result res;
+	float *values = NULL;
+	char *buff = NULL;
+	size_t size = 0;
+	FILE *out;
+	int model, status = -1;
+
+	/*
+	 * Same as cgps_predict_names(), the input data and result options
+	 * are set in private copies of the project and its options.
+	 */
+	memcpy(&options, proj->opts, sizeof(struct cgps_options));
+	memcpy(&copy, proj, sizeof(struct cgps_project));
+	options.indata = cgps_predict_copy_input;
+	options.format = CGPS_OUTPUT_FORMAT_PLAIN;
+	options.result = 0;
+	cgps_result_setopt(options.result, result);
+	copy.opts = &options;
+
+	if(!(out = open_memstream(&buff, &size))) {
+		logerr("failed open memory stream");
+		return NULL;
+	}
+	memset(&res, 0, sizeof(struct cgps_result));
+	res.out = out;
+	
+	if(cgps_predict_init(&copy, &pred, (void *)input) == 0) {
+		if((model = cgps_predict(&copy, index, &pred)) != -1) {
+			if(cgps_result_init(&copy, &res) == 0) {
+				status = cgps_result(&copy, model, &pred, &res, out);
+				cgps_result_cleanup(&copy, &res);
+			}
+		}
+	}
+	cgps_predict_cleanup(&copy, &pred);
+	
+	if(fclose(out) == 0 && status == 0 && buff) {
+		values = cgps_predict_read_values(buff, input->rows, cols);
+	}
+	free(buff);
+	return values;
+}
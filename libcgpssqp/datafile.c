@@ -0,0 +1,577 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The columnar descriptor file (see datafile.h). The file is written in
+ * native byte order (checked by the byte order mark on open). All offsets
+ * are from start of file:
+ * 
+ *   header  (128 bytes, struct cgps_datafile_header)
+ *   names   (the column names, each NUL terminated)
+ *   groups  (for each row group, the column blocks aligned on 64 bytes)
+ *   ids     (for each row group, uint32 offsets of each row followed by 
+ *            the molecule IDs)
+ *   index   (struct cgps_datafile_group for each row group)
+ * 
+ * The fingerprint is the 64-bit FNV-1a hash of the NUL terminated column
+ * names, the same as the project schema fingerprint. The version is 
+ * bumped on incompatible changes of the layout.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+
+#include "cgpssqp.h"
+#include "datafile.h"
+#include "reorder.h"
+
+#define CGPS_DATAFILE_MAGIC     "CGPSDATA"
+#define CGPS_DATAFILE_VERSION   1
+#define CGPS_DATAFILE_BYTEORDER 0x01020304
+#define CGPS_DATAFILE_ALIGN     64
+
+struct cgps_datafile_header
+{
+	char magic[8];        /* CGPS_DATAFILE_MAGIC */
+	uint32_t version;     /* CGPS_DATAFILE_VERSION */
+	uint32_t byteorder;   /* CGPS_DATAFILE_BYTEORDER */
+	uint64_t rows;        /* number of rows */
+	uint32_t cols;        /* number of columns */
+	uint32_t type;        /* bytes per value */
+	uint32_t group;       /* rows per row group */
+	uint32_t groups;      /* number of row groups */
+	uint32_t molid;       /* got molecule IDs */
+	uint32_t reserved1;
+	uint64_t fingerprint; /* hash of column names (0 if unnamed) */
+	uint64_t names;       /* offset of column names */
+	uint64_t namesize;    /* size of column names */
+	uint64_t index;       /* offset of row group index */
+	uint64_t size;        /* file size */
+	uint64_t reserved[5];
+};
+
+#define cgps_datafile_aligned(size) \
+	(((size) + CGPS_DATAFILE_ALIGN - 1) & ~((uint64_t)CGPS_DATAFILE_ALIGN - 1))
+
+/*
+ * Size of each column block in a row group of rows.
+ */
+#define cgps_datafile_stride(rows, type) cgps_datafile_aligned((uint64_t)(rows) * (type))
+
+/*
+ * Returns value at row (relative to group) of column col in group.
+ */
+static double cgps_datafile_value(const struct cgps_datafile *file, const struct cgps_datafile_group *group, int col, uint32_t row)
+{
+	const char *block = file->map + group->data + col * cgps_datafile_stride(group->rows, file->type);
+
+	if(file->type == CGPS_DATAFILE_FLOAT32) {
+		return ((const float *)block)[row];
+	} else {
+		return ((const double *)block)[row];
+	}
+}
+
+int cgps_datafile_check(const char *path)
+{
+	char magic[8];
+	FILE *fs;
+	int result = 0;
+
+	if((fs = fopen(path, "r"))) {
+		result = fread(magic, 1, sizeof(magic), fs) == sizeof(magic) &&
+			memcmp(magic, CGPS_DATAFILE_MAGIC, sizeof(magic)) == 0;
+		fclose(fs);
+	}
+	return result;
+}
+
+struct cgps_datafile * cgps_datafile_open(const char *path)
+{
+	struct cgps_datafile *file;
+	const struct cgps_datafile_header *header;
+	const struct cgps_datafile_group *group;
+	const char *name, *end;
+	struct stat st;
+	void *map;
+	int fd, i;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		logerr("failed open descriptor file %s", path);
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0) {
+		logerr("failed stat descriptor file %s", path);
+		close(fd);
+		return NULL;
+	}
+	if(st.st_size < (off_t)sizeof(struct cgps_datafile_header)) {
+		errno = 0;
+		logerr("descriptor file %s is truncated", path);
+		close(fd);
+		return NULL;
+	}
+	if((map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		logerr("failed map descriptor file %s", path);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	
+	if(!(file = malloc(sizeof(struct cgps_datafile)))) {
+		die("failed alloc memory");
+	}
+	memset(file, 0, sizeof(struct cgps_datafile));
+	file->map = map;
+	file->size = st.st_size;
+
+	errno = 0;
+	header = (const struct cgps_datafile_header *)map;
+	if(memcmp(header->magic, CGPS_DATAFILE_MAGIC, sizeof(header->magic)) != 0) {
+		logerr("file %s is not a descriptor file", path);
+		goto error;
+	}
+	if(header->byteorder != CGPS_DATAFILE_BYTEORDER) {
+		logerr("descriptor file %s has wrong byte order", path);
+		goto error;
+	}
+	if(header->version != CGPS_DATAFILE_VERSION) {
+		logerr("descriptor file %s has unsupported version %u", path, header->version);
+		goto error;
+	}
+	if(header->size != file->size || 
+	   (header->type != CGPS_DATAFILE_FLOAT32 && header->type != CGPS_DATAFILE_FLOAT64) ||
+	   !header->group || header->groups != (header->rows + header->group - 1) / header->group ||
+	   header->names + header->namesize > file->size ||
+	   header->index + header->groups * sizeof(struct cgps_datafile_group) > file->size) {
+		logerr("descriptor file %s is corrupt (invalid header)", path);
+		goto error;
+	}
+	file->rows = header->rows;
+	file->cols = header->cols;
+	file->type = header->type;
+	file->group = header->group;
+	file->groups = header->groups;
+	file->molid = header->molid;
+	file->fingerprint = header->fingerprint;
+	file->index = (const struct cgps_datafile_group *)(file->map + header->index);
+
+	for(i = 0; i < file->groups; ++i) {
+		group = &file->index[i];
+		if(group->first != (uint64_t)i * file->group ||
+		   group->rows != (file->rows - group->first < (uint64_t)file->group ? file->rows - group->first : (uint64_t)file->group) ||
+		   group->data + file->cols * cgps_datafile_stride(group->rows, file->type) > file->size ||
+		   (file->molid && (!group->ids || group->ids + group->idsize > file->size ||
+				    group->idsize < (group->rows + 1) * sizeof(uint32_t)))) {
+			logerr("descriptor file %s is corrupt (row group %d)", path, i);
+			goto error;
+		}
+	}
+	
+	if(header->namesize) {
+		if(!(file->names = malloc(file->cols * sizeof(char *) + 1))) {
+			die("failed alloc memory");
+		}
+		name = file->map + header->names;
+		end = name + header->namesize;
+		for(i = 0; i < file->cols && name < end; ++i) {
+			file->names[i] = name;
+			if(!(name = memchr(name, '\0', end - name))) {
+				break;
+			}
+			++name;
+		}
+		if(i != file->cols) {
+			logerr("descriptor file %s is corrupt (column names)", path);
+			goto error;
+		}
+	}
+	return file;
+	
+ error:
+	cgps_datafile_close(file);
+	return NULL;
+}
+
+void cgps_datafile_close(struct cgps_datafile *file)
+{
+	if(file) {
+		if(file->map) {
+			munmap(file->map, file->size);
+		}
+		free(file->names);
+		free(file);
+	}
+}
+
+int cgps_datafile_find(const struct cgps_datafile *file, const char *name)
+{
+	int i;
+
+	if(file->names) {
+		for(i = 0; i < file->cols; ++i) {
+			if(strcmp(file->names[i], name) == 0) {
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+int cgps_datafile_column(const struct cgps_datafile *file, int col, uint64_t first, int count, float *values)
+{
+	const struct cgps_datafile_group *group;
+	const char *block;
+	uint64_t row;
+	int i, n;
+
+	if(col < 0 || col >= file->cols || count < 0 || first + count > file->rows) {
+		return -1;
+	}
+	while(count) {
+		group = &file->index[first / file->group];
+		row = first - group->first;
+		n = group->rows - row < (uint64_t)count ? group->rows - row : (uint64_t)count;
+		block = file->map + group->data + col * cgps_datafile_stride(group->rows, file->type);
+		if(file->type == CGPS_DATAFILE_FLOAT32) {
+			memcpy(values, (const float *)block + row, n * sizeof(float));
+		} else {
+			for(i = 0; i < n; ++i) {
+				values[i] = ((const double *)block)[row + i];
+			}
+		}
+		values += n;
+		first += n;
+		count -= n;
+	}
+	return 0;
+}
+
+const char * cgps_datafile_molid(const struct cgps_datafile *file, uint64_t row, size_t *len)
+{
+	const struct cgps_datafile_group *group;
+	const uint32_t *offsets;
+
+	if(!file->molid || row >= file->rows) {
+		return NULL;
+	}
+	group = &file->index[row / file->group];
+	row -= group->first;
+	offsets = (const uint32_t *)(file->map + group->ids);
+	if(offsets[row + 1] < offsets[row] || 
+	   (group->rows + 1) * sizeof(uint32_t) + offsets[row + 1] > group->idsize) {
+		return NULL;
+	}
+	*len = offsets[row + 1] - offsets[row];
+	return (const char *)(offsets + group->rows + 1) + offsets[row];
+}
+
+int cgps_datafile_text(const struct cgps_datafile *file, uint64_t first, uint64_t count, const int *columns, int num, FILE *out)
+{
+	const struct cgps_datafile_group *group;
+	const char *fmt = file->type == CGPS_DATAFILE_FLOAT32 ? "%.9g" : "%.17g";
+	const char *id;
+	uint64_t end = first + count;
+	size_t len;
+	uint32_t row;
+	int i;
+
+	if(first > file->rows || count > file->rows - first) {
+		return -1;
+	}
+	if(!columns) {
+		num = file->cols;
+		if(file->names) {
+			if(file->molid) {
+				fputs("ID\t", out);
+			}
+			for(i = 0; i < file->cols; ++i) {
+				if(i) {
+					putc('\t', out);
+				}
+				fputs(file->names[i], out);
+			}
+			putc('\n', out);
+		}
+	}
+	for(; first < end; ++first) {
+		group = &file->index[first / file->group];
+		row = first - group->first;
+		if(!columns && file->molid) {
+			if((id = cgps_datafile_molid(file, first, &len))) {
+				fwrite(id, 1, len, out);
+			}
+			putc('\t', out);
+		}
+		for(i = 0; i < num; ++i) {
+			if(i) {
+				putc('\t', out);
+			}
+			fprintf(out, fmt, cgps_datafile_value(file, group, columns ? columns[i] : i, row));
+		}
+		putc('\n', out);
+	}
+	return ferror(out) ? -1 : 0;
+}
+
+struct cgps_datafile_writer * cgps_datafile_create(const char *path, uint64_t rows, int cols, int type, int group, char **names, int molid)
+{
+	struct cgps_datafile_writer *writer;
+	uint64_t offset;
+	char *buff;
+	size_t len;
+	int i;
+
+	if(!(writer = malloc(sizeof(struct cgps_datafile_writer)))) {
+		die("failed alloc memory");
+	}
+	memset(writer, 0, sizeof(struct cgps_datafile_writer));
+	writer->rows = rows;
+	writer->cols = cols;
+	writer->type = type;
+	writer->group = group;
+	writer->groups = (rows + group - 1) / group;
+	writer->molid = molid;
+	if(!(writer->path = strdup(path)) || !(writer->temp = malloc(strlen(path) + 5))) {
+		die("failed alloc memory");
+	}
+	sprintf(writer->temp, "%s.tmp", path);
+	if(!(writer->index = calloc(writer->groups + 1, sizeof(struct cgps_datafile_group))) ||
+	   !(writer->ids = calloc(writer->groups + 1, sizeof(char *)))) {
+		die("failed alloc memory");
+	}
+	
+	/*
+	 * The names follows the header.
+	 */
+	writer->names = sizeof(struct cgps_datafile_header);
+	if(names) {
+		writer->fingerprint = CGPS_REORDER_HASH_INIT;
+		for(i = 0; i < cols; ++i) {
+			len = strlen(names[i]) + 1;
+			writer->fingerprint = cgps_reorder_hash(writer->fingerprint, names[i], len);
+			writer->namesize += len;
+		}
+	}
+	writer->data = cgps_datafile_aligned(writer->names + writer->namesize);
+	
+	offset = writer->data;
+	for(i = 0; i < writer->groups; ++i) {
+		writer->index[i].first = (uint64_t)i * group;
+		writer->index[i].rows = rows - writer->index[i].first < (uint64_t)group ? rows - writer->index[i].first : (uint64_t)group;
+		writer->index[i].data = offset;
+		offset += cols * cgps_datafile_stride(writer->index[i].rows, type);
+	}
+
+	if((writer->fd = open(writer->temp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		logerr("failed open %s", writer->temp);
+		writer->fd = -1;
+		cgps_datafile_finish(writer, 1);
+		return NULL;
+	}
+	if(names) {
+		if(!(buff = malloc(writer->namesize + 1))) {
+			die("failed alloc memory");
+		}
+		for(i = 0, len = 0; i < cols; ++i) {
+			strcpy(buff + len, names[i]);
+			len += strlen(names[i]) + 1;
+		}
+		if(pwrite(writer->fd, buff, writer->namesize, writer->names) != (ssize_t)writer->namesize) {
+			logerr("failed write %s", writer->temp);
+			free(buff);
+			cgps_datafile_finish(writer, 1);
+			return NULL;
+		}
+		free(buff);
+	}
+	return writer;
+}
+
+/*
+ * Write size bytes of buff at offset.
+ */
+static int cgps_datafile_pwrite(int fd, const char *buff, uint64_t size, uint64_t offset)
+{
+	ssize_t bytes;
+
+	while(size) {
+		if((bytes = pwrite(fd, buff, size, offset)) <= 0) {
+			return -1;
+		}
+		buff += bytes;
+		size -= bytes;
+		offset += bytes;
+	}
+	return 0;
+}
+
+int cgps_datafile_put(struct cgps_datafile_writer *writer, int num, const double *values, char **ids)
+{
+	struct cgps_datafile_group *group = &writer->index[num];
+	uint64_t stride = cgps_datafile_stride(group->rows, writer->type);
+	uint32_t *offsets;
+	size_t size = 0;
+	char *buff;
+	uint32_t i;
+	int j, result;
+
+	if(!(buff = calloc(writer->cols, stride))) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < group->rows; ++i) {
+		for(j = 0; j < writer->cols; ++j) {
+			if(writer->type == CGPS_DATAFILE_FLOAT32) {
+				((float *)(buff + j * stride))[i] = values[i * writer->cols + j];
+			} else {
+				((double *)(buff + j * stride))[i] = values[i * writer->cols + j];
+			}
+		}
+	}
+	if((result = cgps_datafile_pwrite(writer->fd, buff, writer->cols * stride, group->data)) < 0) {
+		logerr("failed write %s", writer->temp);
+	}
+	free(buff);
+	
+	if(writer->molid) {
+		for(i = 0; i < group->rows; ++i) {
+			size += strlen(ids[i]);
+		}
+		size += (group->rows + 1) * sizeof(uint32_t);
+		if(!(buff = malloc(size))) {
+			die("failed alloc memory");
+		}
+		offsets = (uint32_t *)buff;
+		offsets[0] = 0;
+		for(i = 0; i < group->rows; ++i) {
+			offsets[i + 1] = offsets[i] + strlen(ids[i]);
+			memcpy(buff + (group->rows + 1) * sizeof(uint32_t) + offsets[i], ids[i], offsets[i + 1] - offsets[i]);
+		}
+		group->idsize = size;
+		writer->ids[num] = buff;
+	}
+	return result;
+}
+
+int cgps_datafile_finish(struct cgps_datafile_writer *writer, int failed)
+{
+	struct cgps_datafile_header header;
+	struct cgps_datafile_group *last;
+	uint64_t offset = writer->data;
+	int i;
+
+	if(!failed && writer->groups) {
+		last = &writer->index[writer->groups - 1];
+		offset = last->data + writer->cols * cgps_datafile_stride(last->rows, writer->type);
+	}
+	for(i = 0; i < writer->groups && !failed; ++i) {
+		if(writer->molid) {
+			if(!writer->ids[i]) {
+				errno = 0;
+				logerr("row group %d of %s was never written", i, writer->temp);
+				failed = 1;
+				break;
+			}
+			writer->index[i].ids = offset;
+			if(cgps_datafile_pwrite(writer->fd, writer->ids[i], writer->index[i].idsize, offset) < 0) {
+				logerr("failed write %s", writer->temp);
+				failed = 1;
+			}
+			offset = (offset + writer->index[i].idsize + 7) & ~(uint64_t)7;
+		}
+	}
+	
+	if(!failed) {
+		memset(&header, 0, sizeof(struct cgps_datafile_header));
+		memcpy(header.magic, CGPS_DATAFILE_MAGIC, sizeof(header.magic));
+		header.version = CGPS_DATAFILE_VERSION;
+		header.byteorder = CGPS_DATAFILE_BYTEORDER;
+		header.rows = writer->rows;
+		header.cols = writer->cols;
+		header.type = writer->type;
+		header.group = writer->group;
+		header.groups = writer->groups;
+		header.molid = writer->molid;
+		header.fingerprint = writer->fingerprint;
+		header.names = writer->names;
+		header.namesize = writer->namesize;
+		header.index = cgps_datafile_aligned(offset);
+		header.size = header.index + writer->groups * sizeof(struct cgps_datafile_group);
+		
+		if(cgps_datafile_pwrite(writer->fd, (const char *)writer->index, 
+					writer->groups * sizeof(struct cgps_datafile_group), header.index) < 0 ||
+		   ftruncate(writer->fd, header.size) < 0 ||
+		   cgps_datafile_pwrite(writer->fd, (const char *)&header, sizeof(struct cgps_datafile_header), 0) < 0) {
+			logerr("failed write %s", writer->temp);
+			failed = 1;
+		}
+	}
+	if(writer->fd >= 0 && close(writer->fd) < 0) {
+		logerr("failed close %s", writer->temp);
+		failed = 1;
+	}
+	if(!failed && rename(writer->temp, writer->path) < 0) {
+		logerr("failed rename %s to %s", writer->temp, writer->path);
+		failed = 1;
+	}
+	if(failed && writer->fd >= 0) {
+		unlink(writer->temp);
+	}
+	
+	for(i = 0; i < writer->groups; ++i) {
+		free(writer->ids[i]);
+	}
+	free(writer->ids);
+	free(writer->index);
+	free(writer->temp);
+	free(writer->path);
+	free(writer);
+	return failed ? -1 : 0;
+}
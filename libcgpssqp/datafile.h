@@ -0,0 +1,160 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Columnar descriptor file (.cgpsx). The input data is converted once from
+ * text (see utils/cgpsdata) and then mapped read-only by cgpsstd and the 
+ * cgpsclt uploader, so repeated runs on the same library skips parsing the
+ * text. The rows are stored in row groups, where each column of the group
+ * is a contiguous block of float32 or float64 values (aligned on 64 bytes).
+ * The row group index makes reading a range of rows cheap.
+ * 
+ * The file has a header line of column names (and their fingerprint, that
+ * is the same as the project schema fingerprint when matching the project
+ * variables) unless converted from text without header. The molecule ID 
+ * column is optional.
+ * 
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __DATAFILE_H__
+#define __DATAFILE_H__
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#include <stdio.h>
+
+#define CGPS_DATAFILE_FLOAT32 4      /* value types (bytes) */
+#define CGPS_DATAFILE_FLOAT64 8
+#define CGPS_DATAFILE_GROUP   4096   /* default rows per row group */
+
+struct cgps_datafile_group
+{
+	uint64_t first;       /* first row */
+	uint32_t rows;        /* number of rows */
+	uint32_t idsize;      /* size of molecule IDs */
+	uint64_t data;        /* offset of column blocks */
+	uint64_t ids;         /* offset of molecule IDs (0 if none) */
+};
+
+struct cgps_datafile
+{
+	uint64_t rows;        /* number of rows */
+	int cols;             /* number of columns */
+	int type;             /* CGPS_DATAFILE_FLOATXX */
+	int group;            /* rows per row group */
+	int groups;           /* number of row groups */
+	int molid;            /* got molecule IDs */
+	uint64_t fingerprint; /* hash of column names (0 if unnamed) */
+	const char **names;   /* column names (NULL if unnamed) */
+	const struct cgps_datafile_group *index;
+	char *map;            /* mapped file */
+	size_t size;          /* size of mapping */
+};
+
+/*
+ * The converter. Row groups can be written in any order and concurrently,
+ * the file is complete when finished.
+ */
+struct cgps_datafile_writer
+{
+	char *path;           /* the file */
+	char *temp;           /* written to temporary file */
+	int fd;
+	uint64_t rows;
+	int cols;
+	int type;
+	int group;
+	int groups;
+	int molid;
+	uint64_t fingerprint;
+	uint64_t names;       /* offset of names */
+	uint64_t namesize;
+	uint64_t data;        /* offset of first row group */
+	struct cgps_datafile_group *index;
+	char **ids;           /* molecule IDs of each group (until finished) */
+};
+
+/*
+ * Returns true if file in path is a columnar descriptor file.
+ */
+int cgps_datafile_check(const char *path);
+
+/*
+ * Map the file in path. Returns NULL on failure.
+ */
+struct cgps_datafile * cgps_datafile_open(const char *path);
+
+/*
+ * Unmap and release the file.
+ */
+void cgps_datafile_close(struct cgps_datafile *file);
+
+/*
+ * Returns the index of column name or -1 if missing.
+ */
+int cgps_datafile_find(const struct cgps_datafile *file, const char *name);
+
+/*
+ * Copy count values of column col (starting at row first) to values. Returns
+ * -1 if out of range.
+ */
+int cgps_datafile_column(const struct cgps_datafile *file, int col, uint64_t first, int count, float *values);
+
+/*
+ * Returns the molecule ID of row (len bytes, not NUL terminated) or NULL.
+ */
+const char * cgps_datafile_molid(const struct cgps_datafile *file, uint64_t row, size_t *len);
+
+/*
+ * Write count rows starting at row first to out as text. If columns is 
+ * NULL, then all columns are written with molecule IDs and header line (if
+ * named). Otherwise only the num columns in columns are written (in that
+ * order, without header). Returns -1 if out of range.
+ */
+int cgps_datafile_text(const struct cgps_datafile *file, uint64_t first, uint64_t count, const int *columns, int num, FILE *out);
+
+/*
+ * Create file in path with rows and cols of type values. The names are
+ * optional (NULL). Returns NULL on failure.
+ */
+struct cgps_datafile_writer * cgps_datafile_create(const char *path, uint64_t rows, int cols, int type, int group, char **names, int molid);
+
+/*
+ * Write row group num from values (rows x cols, row major). The ids is the
+ * molecule IDs of the rows (if molid). Returns -1 on failure.
+ */
+int cgps_datafile_put(struct cgps_datafile_writer *writer, int num, const double *values, char **ids);
+
+/*
+ * Finish writing the file and release the writer. If failed is true (or on
+ * failure), then the file is removed. Returns -1 on failure.
+ */
+int cgps_datafile_finish(struct cgps_datafile_writer *writer, int failed);
+
+#endif /* __DATAFILE_H__ */
@@ -193,6 +193,12 @@ static const struct request_type request_types[] = {
 	{ "quit", CGPSP_PROTO_QUIT },
 	{ "error", CGPSP_PROTO_ERROR },
 	{ "count", CGPSP_PROTO_COUNT },
+	{ "rate", CGPSP_PROTO_RATE },
+	{ "histogram", CGPSP_PROTO_HISTOGRAM },
+	{ "replay", CGPSP_PROTO_REPLAY },
+	{ "schema", CGPSP_PROTO_SCHEMA },
+	{ "neighbors", CGPSP_PROTO_NEIGHBORS },
+	{ "compress", CGPSP_PROTO_COMPRESS },
 	{ "CGPSP \\d\\.\\d (\\w+: [a-z]+ ready)", CGPSP_PROTO_GREETING }, 
 	{ NULL, CGPSP_PROTO_LAST }
 };
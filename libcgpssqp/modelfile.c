@@ -0,0 +1,458 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The compiled model file (see native.h). The numeric content of the 
+ * native models is stored in a file that is mapped read-only by cgpsd and
+ * cgpsstd, so the model parameters are loaded instantly and shared by all
+ * processes thru the page cache.
+ * 
+ * The file is written in native byte order (checked by the byte order
+ * mark on load). All offsets are from start of file:
+ * 
+ *   header  (64 bytes, struct cgps_modelfile_header)
+ *   models  (80 bytes per model, struct cgps_modelfile_entry)
+ *   names   (the variable names, each NUL terminated)
+ *   params  (the float arrays of each model, aligned on 64 bytes)
+ * 
+ * The checksum is the 64-bit FNV-1a hash of all bytes following the 
+ * header. The version is bumped on incompatible changes of the layout.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+
+#include "cgpssqp.h"
+#include "native.h"
+#include "reorder.h"
+
+#define CGPS_MODELFILE_MAGIC     "CGPSMODL"
+#define CGPS_MODELFILE_VERSION   2
+#define CGPS_MODELFILE_BYTEORDER 0x01020304
+#define CGPS_MODELFILE_ALIGN     64
+#define CGPS_MODELFILE_ARRAYS    7
+
+struct cgps_modelfile_header
+{
+	char magic[8];        /* CGPS_MODELFILE_MAGIC */
+	uint32_t version;     /* CGPS_MODELFILE_VERSION */
+	uint32_t byteorder;   /* CGPS_MODELFILE_BYTEORDER */
+	uint32_t models;      /* number of models */
+	uint32_t vars;        /* number of variable names */
+	uint64_t size;        /* file size */
+	uint64_t checksum;    /* hash of bytes following header */
+	uint64_t names;       /* offset of variable names */
+	uint64_t namesize;    /* size of variable names */
+	uint64_t reserved;
+};
+
+/*
+ * The arrays are stored in the order mean, scale, weight, load, eigen, 
+ * yload and ymean (see struct cgps_native_model).
+ */
+struct cgps_modelfile_entry
+{
+	uint32_t vars;
+	uint32_t comps;
+	uint32_t ycols;
+	uint32_t results;
+	float dfactor;
+	uint32_t reserved;
+	uint64_t offset[CGPS_MODELFILE_ARRAYS];
+};
+
+#define cgps_modelfile_aligned(size) \
+	(((size) + CGPS_MODELFILE_ALIGN - 1) & ~((uint64_t)CGPS_MODELFILE_ALIGN - 1))
+
+/*
+ * Returns the number of floats in array num of model.
+ */
+static uint64_t cgps_modelfile_count(uint64_t vars, uint64_t comps, uint64_t ycols, int num)
+{
+	switch(num) {
+	case 0:
+	case 1:
+		return vars;
+	case 2:
+	case 3:
+		return comps * vars;
+	case 4:
+		return comps;
+	case 5:
+		return comps * ycols;
+	default:
+		return ycols;
+	}
+}
+
+static float * cgps_modelfile_array(const struct cgps_native_model *model, int num)
+{
+	switch(num) {
+	case 0:
+		return model->mean;
+	case 1:
+		return model->scale;
+	case 2:
+		return model->weight;
+	case 3:
+		return model->load;
+	case 4:
+		return model->eigen;
+	case 5:
+		return model->yload;
+	default:
+		return model->ymean;
+	}
+}
+
+/*
+ * Write size bytes of buff to path. The file is written to a temporary 
+ * file that is renamed, an existing compiled model might be mapped by
+ * running processes.
+ */
+static int cgps_modelfile_write(const char *path, const char *buff, size_t size)
+{
+	char *temp;
+	FILE *fs;
+	int error = 0;
+
+	if(!(temp = malloc(strlen(path) + 5))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	sprintf(temp, "%s.tmp", path);
+	if(!(fs = fopen(temp, "w"))) {
+		logerr("failed open %s for writing", temp);
+		free(temp);
+		return -1;
+	}
+	if(fwrite(buff, 1, size, fs) != size) {
+		logerr("failed write %s", temp);
+		error = 1;
+	}
+	if(fclose(fs) != 0 && !error) {
+		logerr("failed close %s", temp);
+		error = 1;
+	}
+	if(!error && rename(temp, path) != 0) {
+		logerr("failed rename %s to %s", temp, path);
+		error = 1;
+	}
+	if(error) {
+		unlink(temp);
+	}
+	free(temp);
+	return error ? -1 : 0;
+}
+
+int cgps_native_save(const struct cgps_native *native, const char *path)
+{
+	struct cgps_modelfile_header *header;
+	struct cgps_modelfile_entry *entry;
+	const struct cgps_native_model *model;
+	const char *str;
+	uint64_t size, names, namesize, bytes;
+	char *buff;
+	int vars = SQX_GetNumStringsInVector((SQX_StringVector *)&native->names);
+	int i, j;
+
+	/*
+	 * Compute the layout.
+	 */
+	namesize = 0;
+	for(i = 1; i <= vars; ++i) {
+		if(!SQX_GetStringFromVector((SQX_StringVector *)&native->names, i, &str)) {
+			logerr("failed get variable name %d (%s)", i, cgps_simcaq_error());
+			return -1;
+		}
+		namesize += strlen(str) + 1;
+	}
+	names = sizeof(struct cgps_modelfile_header) + native->models * sizeof(struct cgps_modelfile_entry);
+	size = cgps_modelfile_aligned(names + namesize);
+	for(i = 0; i < native->models; ++i) {
+		if(!(model = native->model[i])) {
+			logerr("model %d can't be predicted natively", i + 1);
+			return -1;
+		}
+		for(j = 0; j < CGPS_MODELFILE_ARRAYS; ++j) {
+			bytes = cgps_modelfile_count(model->vars, model->comps, model->ycols, j) * sizeof(float);
+			size += cgps_modelfile_aligned(bytes);
+		}
+	}
+	if(!(buff = calloc(1, size))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+
+	/*
+	 * Fill in names and models.
+	 */
+	header = (struct cgps_modelfile_header *)buff;
+	memcpy(header->magic, CGPS_MODELFILE_MAGIC, sizeof(header->magic));
+	header->version = CGPS_MODELFILE_VERSION;
+	header->byteorder = CGPS_MODELFILE_BYTEORDER;
+	header->models = native->models;
+	header->vars = vars;
+	header->size = size;
+	header->names = names;
+	header->namesize = namesize;
+	for(i = 1; i <= vars; ++i) {
+		SQX_GetStringFromVector((SQX_StringVector *)&native->names, i, &str);
+		strcpy(buff + names, str);
+		names += strlen(str) + 1;
+	}
+
+	size = cgps_modelfile_aligned(names);
+	entry = (struct cgps_modelfile_entry *)(header + 1);
+	for(i = 0; i < native->models; ++i, ++entry) {
+		model = native->model[i];
+		entry->vars = model->vars;
+		entry->comps = model->comps;
+		entry->ycols = model->ycols;
+		entry->results = model->results;
+		entry->dfactor = model->dfactor;
+		for(j = 0; j < CGPS_MODELFILE_ARRAYS; ++j) {
+			bytes = cgps_modelfile_count(model->vars, model->comps, model->ycols, j) * sizeof(float);
+			entry->offset[j] = size;
+			if(bytes) {
+				memcpy(buff + size, cgps_modelfile_array(model, j), bytes);
+			}
+			size += cgps_modelfile_aligned(bytes);
+		}
+	}
+	header->checksum = cgps_reorder_hash(CGPS_REORDER_HASH_INIT, buff + sizeof(struct cgps_modelfile_header), 
+					     size - sizeof(struct cgps_modelfile_header));
+
+	if(cgps_modelfile_write(path, buff, size) < 0) {
+		free(buff);
+		return -1;
+	}
+	debug("saved %d models to %s (%lu bytes)", native->models, path, (unsigned long)size);
+	free(buff);
+	return 0;
+}
+
+/*
+ * Check the header of a mapped file of size bytes.
+ */
+static int cgps_modelfile_check(const char *path, const char *buff, size_t size)
+{
+	const struct cgps_modelfile_header *header = (const struct cgps_modelfile_header *)buff;
+	uint64_t hash;
+
+	errno = 0;
+	if(size < sizeof(struct cgps_modelfile_header) || 
+	   memcmp(header->magic, CGPS_MODELFILE_MAGIC, sizeof(header->magic)) != 0) {
+		logerr("%s is not a compiled model file", path);
+		return -1;
+	}
+	if(header->byteorder != CGPS_MODELFILE_BYTEORDER) {
+		logerr("compiled model %s has wrong byte order", path);
+		return -1;
+	}
+	if(header->version != CGPS_MODELFILE_VERSION) {
+		logerr("compiled model %s has unsupported version %u (expected %d)", path, 
+		       header->version, CGPS_MODELFILE_VERSION);
+		return -1;
+	}
+	if(header->size != size) {
+		logerr("compiled model %s is truncated", path);
+		return -1;
+	}
+	hash = cgps_reorder_hash(CGPS_REORDER_HASH_INIT, buff + sizeof(struct cgps_modelfile_header), 
+				 size - sizeof(struct cgps_modelfile_header));
+	if(hash != header->checksum) {
+		logerr("compiled model %s has invalid checksum", path);
+		return -1;
+	}
+	if(!header->models || !header->vars || 
+	   header->models > (size - sizeof(struct cgps_modelfile_header)) / sizeof(struct cgps_modelfile_entry) ||
+	   header->names > size || header->namesize > size - header->names || 
+	   !header->namesize || buff[header->names + header->namesize - 1] != '\0') {
+		logerr("compiled model %s is corrupted", path);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Setup model from entry pointing into the mapping.
+ */
+static struct cgps_native_model * cgps_modelfile_model(char *buff, size_t size, const struct cgps_modelfile_entry *entry)
+{
+	struct cgps_native_model *model;
+	float **array[CGPS_MODELFILE_ARRAYS];
+	uint64_t bytes;
+	int i;
+
+	if(!(model = malloc(sizeof(struct cgps_native_model)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	model->vars = entry->vars;
+	model->comps = entry->comps;
+	model->ycols = entry->ycols;
+	model->results = entry->results;
+	model->dfactor = entry->dfactor;
+	array[0] = &model->mean;
+	array[1] = &model->scale;
+	array[2] = &model->weight;
+	array[3] = &model->load;
+	array[4] = &model->eigen;
+	array[5] = &model->yload;
+	array[6] = &model->ymean;
+	for(i = 0; i < CGPS_MODELFILE_ARRAYS; ++i) {
+		bytes = cgps_modelfile_count(entry->vars, entry->comps, entry->ycols, i) * sizeof(float);
+		if(entry->offset[i] % CGPS_MODELFILE_ALIGN || 
+		   entry->offset[i] > size || bytes > size - entry->offset[i]) {
+			free(model);
+			return NULL;
+		}
+		*array[i] = (float *)(buff + entry->offset[i]);
+	}
+	return model;
+}
+
+struct cgps_native * cgps_native_load(const char *path, int mode)
+{
+	const struct cgps_modelfile_header *header;
+	const struct cgps_modelfile_entry *entry;
+	struct cgps_native *native;
+	struct stat st;
+	const char *str;
+	char *buff;
+	int fd, i;
+
+	if((fd = open(path, O_RDONLY)) < 0) {
+		logerr("failed open compiled model %s", path);
+		return NULL;
+	}
+	if(fstat(fd, &st) < 0) {
+		logerr("failed stat compiled model %s", path);
+		close(fd);
+		return NULL;
+	}
+	if(!st.st_size || 
+	   (buff = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		logerr("failed map compiled model %s", path);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	
+	if(cgps_modelfile_check(path, buff, st.st_size) < 0) {
+		munmap(buff, st.st_size);
+		return NULL;
+	}
+	header = (const struct cgps_modelfile_header *)buff;
+	
+	if(!(native = malloc(sizeof(struct cgps_native)))) {
+		logerr("failed alloc memory");
+		munmap(buff, st.st_size);
+		return NULL;
+	}
+	memset(native, 0, sizeof(struct cgps_native));
+	native->mode = mode;
+	native->map = buff;
+	native->size = st.st_size;
+	if(!(native->model = calloc(header->models + 1, sizeof(struct cgps_native_model *)))) {
+		logerr("failed alloc memory");
+		cgps_native_close(native);
+		return NULL;
+	}
+	native->models = header->models;
+	
+	entry = (const struct cgps_modelfile_entry *)(header + 1);
+	for(i = 0; i < native->models; ++i, ++entry) {
+		if(entry->vars != header->vars || 
+		   !(native->model[i] = cgps_modelfile_model(buff, st.st_size, entry))) {
+			logerr("model %d of compiled model %s is corrupted", i + 1, path);
+			cgps_native_close(native);
+			return NULL;
+		}
+	}
+	
+	if(!SQX_InitStringVector(&native->names, header->vars)) {
+		logerr("failed initilize string vector (%s)", cgps_simcaq_error());
+		cgps_native_close(native);
+		return NULL;
+	}
+	str = buff + header->names;
+	for(i = 1; i <= (int)header->vars; ++i) {
+		if(str >= buff + header->names + header->namesize) {
+			logerr("compiled model %s has too few variable names", path);
+			cgps_native_close(native);
+			return NULL;
+		}
+		if(!SQX_SetStringInVector(&native->names, i, str)) {
+			logerr("failed set variable name (%s)", cgps_simcaq_error());
+			cgps_native_close(native);
+			return NULL;
+		}
+		str += strlen(str) + 1;
+	}
+	
+	debug("mapped compiled model %s (%d models, %u variables)", path, native->models, header->vars);
+	return native;
+}
+
+int cgps_native_compiled(const char *path)
+{
+	char magic[8];
+	FILE *fs;
+	int found = 0;
+
+	if((fs = fopen(path, "r"))) {
+		found = fread(magic, 1, sizeof(magic), fs) == sizeof(magic) && 
+			memcmp(magic, CGPS_MODELFILE_MAGIC, sizeof(magic)) == 0;
+		fclose(fs);
+	}
+	return found;
+}
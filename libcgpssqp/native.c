@@ -0,0 +1,615 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The native prediction engine (see native.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#include <ctype.h>
+#include <math.h>
+
+#include "cgpssqp.h"
+#include "native.h"
+#include "writer.h"
+#include "binary.h"
+
+/*
+ * Compile the kernels for several instruction sets and let the dynamic
+ * linker pick the best (ifunc) on GCC.
+ */
+#if defined(__GNUC__) && (__GNUC__ >= 6) && defined(__x86_64__) && defined(__linux__)
+# define CGPS_NATIVE_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+# define CGPS_NATIVE_CLONES
+#endif
+
+#define CGPS_NATIVE_RESULTS 4   /* results computed natively */
+
+struct cgps_native_mode
+{
+	const char *name;
+	int value;
+};
+
+static const struct cgps_native_mode native_modes[] = {
+	{ "off",    CGPS_NATIVE_OFF },
+	{ "on",     CGPS_NATIVE_ON },
+	{ "verify", CGPS_NATIVE_VERIFY },
+	{ NULL, 0 }
+};
+
+const char * cgps_native_name(int mode)
+{
+	const struct cgps_native_mode *entry;
+
+	for(entry = native_modes; entry->name; ++entry) {
+		if(entry->value == mode) {
+			return entry->name;
+		}
+	}
+	return "unknown";
+}
+
+int cgps_native_value(const char *name)
+{
+	const struct cgps_native_mode *entry;
+
+	for(entry = native_modes; entry->name; ++entry) {
+		if(strcmp(entry->name, name) == 0) {
+			return entry->value;
+		}
+	}
+	return -1;
+}
+
+void cgps_native_model_free(struct cgps_native_model *model)
+{
+	if(model) {
+		free(model->mean);
+		free(model->scale);
+		free(model->weight);
+		free(model->load);
+		free(model->eigen);
+		free(model->yload);
+		free(model->ymean);
+		free(model);
+	}
+}
+
+struct cgps_native * cgps_native_open(struct cgps_project *proj, int mode)
+{
+	struct cgps_native *native;
+	int i, found = 0;
+
+	if(!(native = malloc(sizeof(struct cgps_native)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	memset(native, 0, sizeof(struct cgps_native));
+	native->mode = mode;
+	native->models = proj->models;
+	if(!(native->model = calloc(proj->models + 1, sizeof(struct cgps_native_model *)))) {
+		logerr("failed alloc memory");
+		free(native);
+		return NULL;
+	}
+	if(cgps_predict_names(proj, &native->names) < 0) {
+		cgps_native_close(native);
+		return NULL;
+	}
+	for(i = 0; i < proj->models; ++i) {
+		if((native->model[i] = cgps_native_calibrate(proj, i + 1, &native->names))) {
+			++found;
+		}
+	}
+	
+	if(!found) {
+		cgps_native_close(native);
+		return NULL;
+	}
+	return native;
+}
+
+void cgps_native_close(struct cgps_native *native)
+{
+	int i;
+
+	if(native) {
+		for(i = 0; i < native->models; ++i) {
+			if(native->map) {
+				free(native->model[i]);
+			} else {
+				cgps_native_model_free(native->model[i]);
+			}
+		}
+		if(native->map) {
+			munmap(native->map, native->size);
+		}
+		SQX_ClearStringVector(&native->names);
+		free(native->model);
+		free(native);
+	}
+}
+
+/*
+ * Returns true if result is computed natively for model.
+ */
+static int cgps_native_has_result(const struct cgps_native_model *model, int result)
+{
+	switch(result) {
+	case PREDICTED_TPS:
+	case PREDICTED_T2_RANGE_PS:
+	case PREDICTED_DMOD_X_PS:
+	case PREDICTED_Y_PRED_PS:
+		return cgps_result_isset(model->results, result);
+	default:
+		return 0;
+	}
+}
+
+int cgps_native_supported(const struct cgps_native *native, int index, int result)
+{
+	const struct cgps_result_entry *entry;
+	const struct cgps_native_model *model;
+	int found = 0;
+
+	if(!native || index < 1 || index > native->models || !(model = native->model[index - 1])) {
+		return 0;
+	}
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(cgps_result_isset(result, entry->value)) {
+			if(!cgps_native_has_result(model, entry->value)) {
+				return 0;
+			}
+			++found;
+		}
+	}
+	return found;
+}
+
+/*
+ * Standardize the block x (vars x CGPS_NATIVE_BLOCK) in place and project 
+ * it on the score weights. The scores are stored in t (comps x block). The
+ * variables are processed in chunks to keep them in L1 cache while 
+ * accumulating all components.
+ */
+CGPS_NATIVE_CLONES
+static void cgps_native_scores(const struct cgps_native_model *model, float *x, float *t)
+{
+	int a, j, r, chunk, end;
+
+	for(j = 0; j < model->vars; ++j) {
+		float *z = x + j * CGPS_NATIVE_BLOCK;
+		float mean = model->mean[j];
+		float scale = model->scale[j];
+		for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+			z[r] = (z[r] - mean) * scale;
+		}
+	}
+	for(r = 0; r < model->comps * CGPS_NATIVE_BLOCK; ++r) {
+		t[r] = 0.0f;
+	}
+	for(chunk = 0; chunk < model->vars; chunk += CGPS_NATIVE_CHUNK) {
+		end = chunk + CGPS_NATIVE_CHUNK < model->vars ? chunk + CGPS_NATIVE_CHUNK : model->vars;
+		for(a = 0; a < model->comps; ++a) {
+			const float *w = model->weight + a * model->vars;
+			float *ta = t + a * CGPS_NATIVE_BLOCK;
+			for(j = chunk; j < end; ++j) {
+				const float *z = x + j * CGPS_NATIVE_BLOCK;
+				float wj = w[j];
+				for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+					ta[r] += wj * z[r];
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Compute the residual sum of squares (in ss) of the standardized block
+ * x with scores t.
+ */
+CGPS_NATIVE_CLONES
+static void cgps_native_residuals(const struct cgps_native_model *model, const float *x, const float *t, double *ss)
+{
+	float xhat[CGPS_NATIVE_BLOCK];
+	int a, j, r;
+
+	for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+		ss[r] = 0.0;
+	}
+	for(j = 0; j < model->vars; ++j) {
+		const float *z = x + j * CGPS_NATIVE_BLOCK;
+		for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+			xhat[r] = 0.0f;
+		}
+		for(a = 0; a < model->comps; ++a) {
+			const float *ta = t + a * CGPS_NATIVE_BLOCK;
+			float p = model->load[a * model->vars + j];
+			for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+				xhat[r] += ta[r] * p;
+			}
+		}
+		for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+			float e = z[r] - xhat[r];
+			ss[r] += e * e;
+		}
+	}
+}
+
+/*
+ * Compute one result row (values stored in row, number of values returned).
+ */
+static int cgps_native_result_row(const struct cgps_native_model *model, const float *t, double ss, int type, float *row)
+{
+	double sum;
+	int a, k;
+
+	switch(type) {
+	case PREDICTED_TPS:
+		memcpy(row, t, model->comps * sizeof(float));
+		return model->comps;
+	case PREDICTED_T2_RANGE_PS:
+		for(sum = 0.0, a = 0; a < model->comps; ++a) {
+			sum += t[a] * t[a] / model->eigen[a];
+		}
+		row[0] = sum;
+		return 1;
+	case PREDICTED_DMOD_X_PS:
+		row[0] = sqrt(ss * model->dfactor);
+		return 1;
+	case PREDICTED_Y_PRED_PS:
+		for(k = 0; k < model->ycols; ++k) {
+			for(sum = model->ymean[k], a = 0; a < model->comps; ++a) {
+				sum += t[a] * model->yload[a * model->ycols + k];
+			}
+			row[k] = sum;
+		}
+		return model->ycols;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Returns the number of values in each row of result type.
+ */
+static int cgps_native_result_cols(const struct cgps_native_model *model, int type)
+{
+	switch(type) {
+	case PREDICTED_TPS:
+		return model->comps;
+	case PREDICTED_Y_PRED_PS:
+		return model->ycols;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Write results in the binary format (see binary.h). The row buffer is
+ * encoded in place.
+ */
+static void cgps_native_write_binary(const struct cgps_native_model *model, int index, int rows, const float *scores, const double *ss, int result, struct cgps_writer *writer, float *row)
+{
+	const struct cgps_result_entry *entry;
+	struct cgps_binary_result res[CGPS_NATIVE_RESULTS];
+	char buff[CGPS_BINARY_HEADER + CGPS_NATIVE_RESULTS * CGPS_BINARY_ENTRY];
+	int num = 0, i, j, n;
+
+	for(entry = cgps_result_entry_list; entry->name && num < CGPS_NATIVE_RESULTS; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(result, entry->value)) {
+			continue;
+		}
+		res[num].result = entry->value;
+		res[num].name = entry->name;
+		res[num].rows = rows;
+		res[num].cols = cgps_native_result_cols(model, entry->value);
+		++num;
+	}
+	cgps_writer_write(writer, buff, cgps_binary_header(buff, index, res, num));
+	for(j = 0; j < num; ++j) {
+		for(i = 0; i < rows; ++i) {
+			n = cgps_native_result_row(model, scores + i * model->comps, ss ? ss[i] : 0.0, res[j].result, row);
+			cgps_binary_floats((char *)row, row, n);
+			cgps_writer_write(writer, (const char *)row, n * sizeof(float));
+		}
+	}
+}
+
+/*
+ * Write results in the same format as libchemgps (see writer.h) or in the
+ * binary format.
+ */
+static int cgps_native_write(const struct cgps_native_model *model, int index, int rows, const float *scores, const double *ss, int result, int format, FILE *out, float *row)
+{
+	const struct cgps_result_entry *entry;
+	struct cgps_writer writer;
+	char buff[64];
+	int i, n;
+
+	if(cgps_writer_open(&writer, out) < 0) {
+		return -1;
+	}
+	if(format == CGPS_OUTPUT_FORMAT_BINARY) {
+		cgps_native_write_binary(model, index, rows, scores, ss, result, &writer, row);
+		if(cgps_writer_close(&writer) < 0) {
+			logerr("failed write result of model %d", index);
+			return -1;
+		}
+		return 0;
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		sprintf(buff, "<model index=\"%d\">\n", index);
+		cgps_writer_puts(&writer, buff);
+	}
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(result, entry->value)) {
+			continue;
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			cgps_writer_puts(&writer, "  <result name=\"");
+			cgps_writer_puts(&writer, entry->name);
+			cgps_writer_puts(&writer, "\" desc=\"");
+			cgps_writer_puts(&writer, entry->desc);
+			cgps_writer_puts(&writer, "\">\n");
+		} else {
+			cgps_writer_puts(&writer, entry->desc);
+			cgps_writer_puts(&writer, " (");
+			cgps_writer_puts(&writer, entry->name);
+			cgps_writer_puts(&writer, "):\n");
+		}
+		for(i = 0; i < rows; ++i) {
+			n = cgps_native_result_row(model, scores + i * model->comps, ss ? ss[i] : 0.0, entry->value, row);
+			cgps_writer_row(&writer, row, n, format);
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			cgps_writer_puts(&writer, "  </result>\n");
+		} else {
+			cgps_writer_puts(&writer, "\n");
+		}
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		cgps_writer_puts(&writer, "</model>\n");
+	}
+	if(cgps_writer_close(&writer) < 0) {
+		logerr("failed write result of model %d", index);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Compute the scores (rows x comps) and optional the residual sum of 
+ * squares (per row) of the input data.
+ */
+static int cgps_native_predict(const struct cgps_native_model *model, const struct cgps_input *input, float *scores, double *ss)
+{
+	float *x, *t;
+	double block[CGPS_NATIVE_BLOCK];
+	int rows = input->rows, first, n, a, j, r;
+
+	x = malloc(model->vars * CGPS_NATIVE_BLOCK * sizeof(float));
+	t = malloc(model->comps * CGPS_NATIVE_BLOCK * sizeof(float));
+	if(!x || !t) {
+		logerr("failed alloc memory");
+		free(x);
+		free(t);
+		return -1;
+	}
+
+	for(first = 0; first < rows; first += CGPS_NATIVE_BLOCK) {
+		n = rows - first < CGPS_NATIVE_BLOCK ? rows - first : CGPS_NATIVE_BLOCK;
+		for(j = 0; j < model->vars; ++j) {
+			for(r = 0; r < CGPS_NATIVE_BLOCK; ++r) {
+				if(r < n) {
+					x[j * CGPS_NATIVE_BLOCK + r] = input->values[(size_t)(first + r) * input->cols + j];
+				} else {
+					x[j * CGPS_NATIVE_BLOCK + r] = 0.0f;
+				}
+			}
+		}
+		cgps_native_scores(model, x, t);
+		for(r = 0; r < n; ++r) {
+			for(a = 0; a < model->comps; ++a) {
+				scores[(first + r) * model->comps + a] = t[a * CGPS_NATIVE_BLOCK + r];
+			}
+		}
+		if(ss) {
+			cgps_native_residuals(model, x, t, block);
+			memcpy(ss + first, block, n * sizeof(double));
+		}
+	}
+
+	free(x);
+	free(t);
+	return 0;
+}
+
+/*
+ * Returns the model of index if the input data matches it.
+ */
+static const struct cgps_native_model * cgps_native_model_input(const struct cgps_native *native, int index, const struct cgps_input *input)
+{
+	const struct cgps_native_model *model = native->model[index - 1];
+
+	if(input->cols != model->vars) {
+		logerr("input data has %d columns, model %d has %d variables", input->cols, index, model->vars);
+		return NULL;
+	}
+	return model;
+}
+
+int cgps_native_result(const struct cgps_native *native, int index, const struct cgps_input *input, int result, int format, FILE *out)
+{
+	const struct cgps_native_model *model;
+	float *scores, *row;
+	double *ss = NULL;
+	int rows, status;
+
+	if(!cgps_native_supported(native, index, result)) {
+		logerr("model %d can't be predicted natively", index);
+		return -1;
+	}
+	if(!(model = cgps_native_model_input(native, index, input))) {
+		return -1;
+	}
+	
+	rows = input->rows;
+	scores = malloc((rows * model->comps + 1) * sizeof(float));
+	row = malloc((model->comps + model->ycols + 1) * sizeof(float));
+	if(cgps_result_isset(result, PREDICTED_DMOD_X_PS)) {
+		ss = malloc((rows + 1) * sizeof(double));
+	}
+	if(!scores || !row || (!ss && cgps_result_isset(result, PREDICTED_DMOD_X_PS))) {
+		logerr("failed alloc memory");
+		free(scores);
+		free(row);
+		free(ss);
+		return -1;
+	}
+
+	if((status = cgps_native_predict(model, input, scores, ss)) == 0) {
+		status = cgps_native_write(model, index, rows, scores, ss, result, format, out, row);
+	}
+
+	free(scores);
+	free(row);
+	free(ss);
+	return status;
+}
+
+float * cgps_native_project(const struct cgps_native *native, int index, const struct cgps_input *input)
+{
+	const struct cgps_native_model *model;
+	float *scores;
+	int rows;
+
+	if(index < 1 || index > native->models || !native->model[index - 1]) {
+		logerr("model %d can't be predicted natively", index);
+		return NULL;
+	}
+	if(!(model = cgps_native_model_input(native, index, input))) {
+		return NULL;
+	}
+	rows = input->rows;
+	if(!(scores = malloc((rows * model->comps + 1) * sizeof(float)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	if(cgps_native_predict(model, input, scores, NULL) < 0) {
+		free(scores);
+		return NULL;
+	}
+	return scores;
+}
+
+float * cgps_native_values(const struct cgps_native_model *model, const struct cgps_input *input, int result, int *cols)
+{
+	float *scores, *values;
+	double *ss;
+	int i, rows = input->rows;
+
+	if(input->cols != model->vars) {
+		logerr("input data has %d columns, model has %d variables", input->cols, model->vars);
+		return NULL;
+	}
+	*cols = cgps_native_result_cols(model, result);
+	scores = malloc(((size_t)rows * model->comps + 1) * sizeof(float));
+	values = malloc(((size_t)rows * (model->comps + model->ycols + 1) + 1) * sizeof(float));
+	ss = malloc((rows + 1) * sizeof(double));
+	if(!scores || !values || !ss) {
+		logerr("failed alloc memory");
+		free(scores);
+		free(values);
+		free(ss);
+		return NULL;
+	}
+	if(cgps_native_predict(model, input, scores, ss) == 0) {
+		for(i = 0; i < rows; ++i) {
+			cgps_native_result_row(model, scores + i * model->comps, ss[i], result, values + (size_t)i * *cols);
+		}
+	} else {
+		free(values);
+		values = NULL;
+	}
+	free(scores);
+	free(ss);
+	return values;
+}
+
+/*
+ * Returns true if c might start a number.
+ */
+static int cgps_native_isnumber(int c)
+{
+	return isdigit(c) || c == '-' || c == '+' || c == '.';
+}
+
+int cgps_native_compare(const char *native, const char *simcaq)
+{
+	const char *start = native;
+	char *end1, *end2;
+	double v1, v2, scale;
+	int diff = 0;
+
+	while(*native && *simcaq) {
+		if(cgps_native_isnumber(*native) && cgps_native_isnumber(*simcaq) &&
+		   (native == start || isspace(native[-1]) || native[-1] == '>')) {
+			v1 = strtod(native, &end1);
+			v2 = strtod(simcaq, &end2);
+			if(end1 != native && end2 != simcaq) {
+				scale = fabs(v1) > fabs(v2) ? fabs(v1) : fabs(v2);
+				if(fabs(v1 - v2) > CGPS_NATIVE_TOLERANCE * (scale > 1.0 ? scale : 1.0)) {
+					debug("native value %g differs from %g", v1, v2);
+					++diff;
+				}
+				native = end1;
+				simcaq = end2;
+				continue;
+			}
+		}
+		if(*native++ != *simcaq++) {
+			return -1;
+		}
+	}
+	return *native || *simcaq ? -1 : diff;
+}
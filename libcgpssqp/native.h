@@ -0,0 +1,163 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Native prediction engine. The parameters of PCA and PLS models are
+ * calibrated thru libchemgps once at project load (see calibrate.c), then
+ * predicted scores (tps), Hotelling's T2 (t2rangeps), distance to model 
+ * (dmodxps) and predicted responses (ypredps) are computed natively 
+ * without the (serialized) SIMCA-QP call path. Requests for other results
+ * falls back on SIMCA-QP.
+ * 
+ * libchemgps has no API for reading the weights, loadings and scaling of a
+ * model. The parameters are instead solved from SIMCA-QP predictions of 
+ * probe observations and each result is validated against SIMCA-QP before
+ * it's enabled for native prediction. The calibration is done from the 
+ * printed results, so native results agree with SIMCA-QP within about
+ * CGPS_NATIVE_TOLERANCE (relative). Use CGPS_NATIVE_VERIFY to compare all
+ * predictions.
+ * 
+ * The input data is processed in blocks of CGPS_NATIVE_BLOCK rows, packed
+ * by variable (structure of arrays) so that the kernels vectorize across 
+ * rows. The kernels are compiled for AVX-512, AVX2 and generic x86-64 and
+ * the best version is selected at runtime (on GCC).
+ * 
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __NATIVE_H__
+#define __NATIVE_H__
+
+#include <stdio.h>
+
+#define CGPS_NATIVE_OFF    0   /* always use SIMCA-QP */
+#define CGPS_NATIVE_ON     1   /* predict supported models natively */
+#define CGPS_NATIVE_VERIFY 2   /* use SIMCA-QP, but compare with native */
+
+#define CGPS_NATIVE_BLOCK 32         /* rows in each block */
+#define CGPS_NATIVE_CHUNK 256        /* variables in each chunk of block */
+#define CGPS_NATIVE_TOLERANCE 1.0e-4 /* relative tolerance (verify) */
+
+struct cgps_native_model
+{
+	int vars;             /* number of variables */
+	int comps;            /* number of components */
+	int ycols;            /* number of responses */
+	int results;          /* results computed natively (mask) */
+	float dfactor;        /* DModX factor (inverse degrees of freedom) */
+	float *mean;          /* centering (per variable) */
+	float *scale;         /* scaling weights (per variable) */
+	float *weight;        /* score weights (comps x vars) */
+	float *load;          /* loadings (comps x vars) */
+	float *eigen;         /* score variance (per component) */
+	float *yload;         /* y-loadings (comps x ycols) */
+	float *ymean;         /* response intercepts (per response) */
+};
+
+struct cgps_native
+{
+	int mode;             /* CGPS_NATIVE_XXX */
+	int models;           /* number of models */
+	struct cgps_native_model **model;  /* NULL if not supported */
+	SQX_StringVector names;  /* variable names (input data) */
+	void *map;            /* mapped compiled model (or NULL) */
+	size_t size;          /* size of mapping */
+};
+
+/*
+ * Calibrate the models of project. Returns NULL if no model can be 
+ * predicted natively. Calls libchemgps, so hold the prediction lock.
+ */
+struct cgps_native * cgps_native_open(struct cgps_project *proj, int mode);
+void cgps_native_close(struct cgps_native *native);
+
+/*
+ * Calibrate model index (one-based) of project for input data with the 
+ * variable names (see calibrate.c). Returns NULL if the model can't be 
+ * predicted natively.
+ */
+struct cgps_native_model * cgps_native_calibrate(struct cgps_project *proj, int index, SQX_StringVector *names);
+void cgps_native_model_free(struct cgps_native_model *model);
+
+/*
+ * Compute one result (PREDICTED_XXX) of model for the input data, returned
+ * as a rows x cols array (same as cgps_predict_values()). Returns NULL on
+ * failure.
+ */
+float * cgps_native_values(const struct cgps_native_model *model, const struct cgps_input *input, int result, int *cols);
+
+/*
+ * Save the native models to a compiled model file (see modelfile.c). All
+ * models of the project must be supported by the native engine.
+ */
+int cgps_native_save(const struct cgps_native *native, const char *path);
+
+/*
+ * Map a compiled model file. The model parameters are used direct from 
+ * the mapping (shared by all processes using it thru the page cache).
+ * Returns NULL on failure.
+ */
+struct cgps_native * cgps_native_load(const char *path, int mode);
+
+/*
+ * Returns true if path is a compiled model file (not a project).
+ */
+int cgps_native_compiled(const char *path);
+
+/*
+ * Returns true if all results in the result mask can be predicted 
+ * natively for model index (one-based).
+ */
+int cgps_native_supported(const struct cgps_native *native, int index, int result);
+
+/*
+ * Predict the input data using model index and write the results (in the
+ * format used by libchemgps or CGPS_OUTPUT_FORMAT_BINARY) to out.
+ */
+int cgps_native_result(const struct cgps_native *native, int index, const struct cgps_input *input, int result, int format, FILE *out);
+
+/*
+ * Compute the scores of model index for the input data, returned as a
+ * rows x comps array (free when done). Returns NULL on failure.
+ */
+float * cgps_native_project(const struct cgps_native *native, int index, const struct cgps_input *input);
+
+/*
+ * Compare the output of native and SIMCA-QP predictions. Returns the 
+ * number of values outside tolerance or -1 if the output differs in 
+ * other ways.
+ */
+int cgps_native_compare(const char *native, const char *simcaq);
+
+/*
+ * Returns the name of a native mode (off, on or verify) or its value (-1 
+ * if unknown).
+ */
+const char * cgps_native_name(int mode);
+int cgps_native_value(const char *name);
+
+#endif /* __NATIVE_H__ */
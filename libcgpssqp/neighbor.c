@@ -0,0 +1,567 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Nearest neighbor search in score space (see neighbor.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <math.h>
+
+#include "cgpssqp.h"
+#include "native.h"
+#include "neighbor.h"
+
+/*
+ * The reference set while loading.
+ */
+struct cgps_neighbors_input
+{
+	int cols;             /* values per line */
+	int count;            /* number of lines */
+	int capacity;         /* allocated lines */
+	float *values;        /* count x cols */
+	char **ids;
+	float *line;          /* values of current line */
+	int linesize;
+};
+
+/*
+ * The bounded max-heap of the k best matches (squared distance).
+ */
+struct cgps_neighbors_heap
+{
+	struct cgps_neighbor_match *match;
+	int size;
+	int k;
+};
+
+static void cgps_neighbors_input_free(struct cgps_neighbors_input *input)
+{
+	int i;
+
+	for(i = 0; i < input->count; ++i) {
+		free(input->ids[i]);
+	}
+	free(input->ids);
+	free(input->values);
+	free(input->line);
+}
+
+/*
+ * Parse one line (id and values) of the reference file.
+ */
+static int cgps_neighbors_parse(struct cgps_neighbors_input *input, char *buff, const char *path, int line)
+{
+	char *id, *ptr, *end, *save;
+	float *values;
+	char **ids;
+	double value;
+	int cols = 0;
+
+	if(!(id = strtok_r(buff, " \t\r\n", &save)) || *id == '#') {
+		return 0;
+	}
+	for(ptr = strtok_r(NULL, " \t\r\n", &save); ptr; ptr = strtok_r(NULL, " \t\r\n", &save)) {
+		value = strtod(ptr, &end);
+		if(*end || value != value) {
+			errno = 0;
+			logerr("invalid value '%s' in %s (line %d)", ptr, path, line);
+			return -1;
+		}
+		if(cols == input->linesize) {
+			input->linesize = input->linesize ? input->linesize * 2 : 64;
+			if(!(values = realloc(input->line, input->linesize * sizeof(float)))) {
+				logerr("failed alloc memory");
+				return -1;
+			}
+			input->line = values;
+		}
+		input->line[cols++] = value;
+	}
+	if(!cols || (input->cols && cols != input->cols)) {
+		errno = 0;
+		logerr("wrong number of values in %s (line %d)", path, line);
+		return -1;
+	}
+	input->cols = cols;
+	
+	if(input->count == input->capacity) {
+		input->capacity = input->capacity ? input->capacity * 2 : 1024;
+		if(!(ids = realloc(input->ids, input->capacity * sizeof(char *)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		input->ids = ids;
+		if(!(values = realloc(input->values, input->capacity * cols * sizeof(float)))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		input->values = values;
+	}
+	memcpy(input->values + input->count * cols, input->line, cols * sizeof(float));
+	if(!(input->ids[input->count] = strdup(id))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	input->count++;
+	return 0;
+}
+
+static int cgps_neighbors_read(struct cgps_neighbors_input *input, const char *path)
+{
+	FILE *fs;
+	char *buff = NULL;
+	size_t size = 0;
+	int line = 0, result = 0;
+
+	if(!(fs = fopen(path, "r"))) {
+		logerr("failed open reference file %s", path);
+		return -1;
+	}
+	while(getline(&buff, &size, fs) != -1) {
+		if(cgps_neighbors_parse(input, buff, path, ++line) < 0) {
+			result = -1;
+			break;
+		}
+	}
+	if(!result && !input->count) {
+		errno = 0;
+		logerr("no references in %s", path);
+		result = -1;
+	}
+	free(buff);
+	fclose(fs);
+	return result;
+}
+
+/*
+ * Compute the scores of model index for the input data. The scores are
+ * computed natively if supported by the engine, otherwise thru libchemgps.
+ */
+static float * cgps_neighbors_project(struct cgps_project *proj, const struct cgps_native *native, int index, const struct cgps_input *input, int *dims)
+{
+	int result = 0;
+
+	cgps_result_setopt(result, PREDICTED_TPS);
+	if(cgps_native_supported(native, index, result)) {
+		*dims = native->model[index - 1]->comps;
+		return cgps_native_project(native, index, input);
+	}
+	if(!proj || !proj->handle) {
+		logerr("model %d can't be predicted", index);
+		return NULL;
+	}
+	return cgps_predict_values(proj, index, input, PREDICTED_TPS, dims);
+}
+
+/*
+ * Returns the number of project variables (0 if unknown).
+ */
+static int cgps_neighbors_vars(struct cgps_project *proj, const struct cgps_native *native)
+{
+	SQX_StringVector names;
+	int vars = 0;
+
+	if(native) {
+		return SQX_GetNumStringsInVector((SQX_StringVector *)&native->names);
+	}
+	memset(&names, 0, sizeof(SQX_StringVector));
+	if(cgps_predict_names(proj, &names) == 0) {
+		vars = SQX_GetNumStringsInVector(&names);
+	}
+	SQX_ClearStringVector(&names);
+	return vars;
+}
+
+/*
+ * Reorder perm[lo, hi) so that its nth element is in sorted position 
+ * along dimension dim (quickselect).
+ */
+static void cgps_neighbors_select(const float *points, int dims, int dim, int *perm, int lo, int hi, int nth)
+{
+	float pivot;
+	int i, j, swap;
+
+	while(hi - lo > 1) {
+		pivot = points[perm[(lo + hi) / 2] * dims + dim];
+		for(i = lo, j = hi - 1; i <= j; ) {
+			while(points[perm[i] * dims + dim] < pivot) {
+				++i;
+			}
+			while(points[perm[j] * dims + dim] > pivot) {
+				--j;
+			}
+			if(i <= j) {
+				swap = perm[i];
+				perm[i++] = perm[j];
+				perm[j--] = swap;
+			}
+		}
+		if(nth <= j) {
+			hi = j + 1;
+		} else if(nth >= i) {
+			lo = i;
+		} else {
+			return;
+		}
+	}
+}
+
+/*
+ * Build the subtree of range [lo, hi), split along dimension of largest
+ * spread.
+ */
+static void cgps_neighbors_build(struct cgps_neighbors *nn, const float *points, int *perm, int lo, int hi)
+{
+	float min, max, spread, best = -1.0f;
+	int i, d, dim = 0, mid = (lo + hi) / 2;
+
+	if(hi - lo < 1) {
+		return;
+	}
+	for(d = 0; d < nn->dims; ++d) {
+		min = max = points[perm[lo] * nn->dims + d];
+		for(i = lo + 1; i < hi; ++i) {
+			float value = points[perm[i] * nn->dims + d];
+			if(value < min) {
+				min = value;
+			}
+			if(value > max) {
+				max = value;
+			}
+		}
+		if((spread = max - min) > best) {
+			best = spread;
+			dim = d;
+		}
+	}
+	cgps_neighbors_select(points, nn->dims, dim, perm, lo, hi, mid);
+	nn->split[mid] = dim;
+	cgps_neighbors_build(nn, points, perm, lo, mid);
+	cgps_neighbors_build(nn, points, perm, mid + 1, hi);
+}
+
+struct cgps_neighbors * cgps_neighbors_open(const char *path, struct cgps_project *proj, const struct cgps_native *native, int index)
+{
+	struct cgps_neighbors_input input;
+	struct cgps_neighbors *nn;
+	struct cgps_input data;
+	float *points;
+	int *perm, i, vars, dims, result = 0;
+
+	/*
+	 * Predict one observation to get the number of components, then the
+	 * number of values in the reference file tells if it has scores or
+	 * raw data.
+	 */
+	if(!(vars = cgps_neighbors_vars(proj, native))) {
+		logerr("failed get project variables");
+		return NULL;
+	}
+	data.rows = data.capacity = 1;
+	data.cols = vars;
+	if(!(data.values = calloc(vars + 1, sizeof(float)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	points = cgps_neighbors_project(proj, native, index, &data, &dims);
+	free(data.values);
+	if(!points) {
+		logerr("failed predict scores of model %d", index);
+		return NULL;
+	}
+	free(points);
+	if(dims > 255) {
+		logerr("model %d has too many components", index);
+		return NULL;
+	}
+
+	memset(&input, 0, sizeof(struct cgps_neighbors_input));
+	if(cgps_neighbors_read(&input, path) < 0) {
+		cgps_neighbors_input_free(&input);
+		return NULL;
+	}
+	if(input.cols == dims) {
+		debug("reference file %s has scores (%d references)", path, input.count);
+		points = input.values;
+		input.values = NULL;
+	} else if(input.cols == vars) {
+		debug("reference file %s has raw data (%d references)", path, input.count);
+		data.values = input.values;
+		data.rows = input.count;
+		data.cols = input.cols;
+		data.capacity = input.capacity;
+		if(!(points = cgps_neighbors_project(proj, native, index, &data, &dims))) {
+			cgps_neighbors_input_free(&input);
+			return NULL;
+		}
+	} else {
+		errno = 0;
+		logerr("reference file %s has %d values per line, expected %d scores or %d variables",
+		       path, input.cols, dims, vars);
+		cgps_neighbors_input_free(&input);
+		return NULL;
+	}
+
+	if(!(nn = malloc(sizeof(struct cgps_neighbors)))) {
+		logerr("failed alloc memory");
+		free(points);
+		cgps_neighbors_input_free(&input);
+		return NULL;
+	}
+	cgps_result_setopt(result, PREDICTED_TPS);
+	nn->model = index;
+	nn->native = cgps_native_supported(native, index, result);
+	nn->dims = dims;
+	nn->count = input.count;
+	nn->points = malloc((nn->count * nn->dims + 1) * sizeof(float));
+	nn->ids = malloc(nn->count * sizeof(char *));
+	nn->split = malloc(nn->count);
+	perm = malloc(nn->count * sizeof(int));
+	if(!nn->points || !nn->ids || !nn->split || !perm) {
+		logerr("failed alloc memory");
+		free(nn->points);
+		free(nn->ids);
+		free(nn->split);
+		free(nn);
+		free(perm);
+		free(points);
+		cgps_neighbors_input_free(&input);
+		return NULL;
+	}
+	
+	for(i = 0; i < nn->count; ++i) {
+		perm[i] = i;
+	}
+	cgps_neighbors_build(nn, points, perm, 0, nn->count);
+	for(i = 0; i < nn->count; ++i) {
+		memcpy(nn->points + i * nn->dims, points + perm[i] * nn->dims, nn->dims * sizeof(float));
+		nn->ids[i] = input.ids[perm[i]];
+	}
+	free(input.ids);
+	free(input.values);
+	free(input.line);
+	free(perm);
+	free(points);
+	
+	debug("built index of %d references (model %d, %d dimensions)", nn->count, index, nn->dims);
+	return nn;
+}
+
+void cgps_neighbors_close(struct cgps_neighbors *nn)
+{
+	int i;
+
+	if(nn) {
+		for(i = 0; i < nn->count; ++i) {
+			free(nn->ids[i]);
+		}
+		free(nn->ids);
+		free(nn->points);
+		free(nn->split);
+		free(nn);
+	}
+}
+
+static void cgps_neighbors_push(struct cgps_neighbors_heap *heap, int index, float dist)
+{
+	struct cgps_neighbor_match *match = heap->match, swap;
+	int i, child;
+
+	if(heap->size < heap->k) {
+		i = heap->size++;
+		match[i].index = index;
+		match[i].dist = dist;
+		while(i > 0 && match[(i - 1) / 2].dist < match[i].dist) {
+			swap = match[i];
+			match[i] = match[(i - 1) / 2];
+			match[(i - 1) / 2] = swap;
+			i = (i - 1) / 2;
+		}
+	} else if(dist < match[0].dist) {
+		match[0].index = index;
+		match[0].dist = dist;
+		for(i = 0; (child = 2 * i + 1) < heap->size; i = child) {
+			if(child + 1 < heap->size && match[child + 1].dist > match[child].dist) {
+				++child;
+			}
+			if(match[i].dist >= match[child].dist) {
+				break;
+			}
+			swap = match[i];
+			match[i] = match[child];
+			match[child] = swap;
+		}
+	}
+}
+
+static void cgps_neighbors_visit(const struct cgps_neighbors *nn, const float *query, int lo, int hi, struct cgps_neighbors_heap *heap)
+{
+	const float *point;
+	float dist = 0.0f, diff;
+	int d, mid = (lo + hi) / 2;
+
+	if(hi - lo < 1) {
+		return;
+	}
+	point = nn->points + mid * nn->dims;
+	for(d = 0; d < nn->dims; ++d) {
+		diff = query[d] - point[d];
+		dist += diff * diff;
+	}
+	cgps_neighbors_push(heap, mid, dist);
+
+	diff = query[nn->split[mid]] - point[nn->split[mid]];
+	if(diff < 0.0f) {
+		cgps_neighbors_visit(nn, query, lo, mid, heap);
+		if(heap->size < heap->k || diff * diff < heap->match[0].dist) {
+			cgps_neighbors_visit(nn, query, mid + 1, hi, heap);
+		}
+	} else {
+		cgps_neighbors_visit(nn, query, mid + 1, hi, heap);
+		if(heap->size < heap->k || diff * diff < heap->match[0].dist) {
+			cgps_neighbors_visit(nn, query, lo, mid, heap);
+		}
+	}
+}
+
+static int cgps_neighbors_compare(const void *p1, const void *p2)
+{
+	const struct cgps_neighbor_match *m1 = (const struct cgps_neighbor_match *)p1;
+	const struct cgps_neighbor_match *m2 = (const struct cgps_neighbor_match *)p2;
+
+	if(m1->dist != m2->dist) {
+		return m1->dist < m2->dist ? -1 : 1;
+	}
+	return m1->index - m2->index;
+}
+
+int cgps_neighbors_search(const struct cgps_neighbors *nn, const float *query, int k, struct cgps_neighbor_match *match)
+{
+	struct cgps_neighbors_heap heap;
+	int i;
+
+	heap.match = match;
+	heap.size = 0;
+	heap.k = k < nn->count ? k : nn->count;
+	cgps_neighbors_visit(nn, query, 0, nn->count, &heap);
+	
+	qsort(match, heap.size, sizeof(struct cgps_neighbor_match), cgps_neighbors_compare);
+	for(i = 0; i < heap.size; ++i) {
+		match[i].dist = sqrt(match[i].dist);
+	}
+	return heap.size;
+}
+
+/*
+ * Write reference ID with XML special characters escaped.
+ */
+static void cgps_neighbors_xml(const char *str, FILE *out)
+{
+	for(; *str; ++str) {
+		switch(*str) {
+		case '&':
+			fputs("&amp;", out);
+			break;
+		case '<':
+			fputs("&lt;", out);
+			break;
+		case '>':
+			fputs("&gt;", out);
+			break;
+		case '"':
+			fputs("&quot;", out);
+			break;
+		default:
+			fputc(*str, out);
+		}
+	}
+}
+
+int cgps_neighbors_result(const struct cgps_neighbors *nn, struct cgps_project *proj, const struct cgps_native *native, const struct cgps_input *input, int k, int format, FILE *out)
+{
+	struct cgps_neighbor_match match[CGPS_NEIGHBORS_MAX];
+	float *scores;
+	int rows, i, j, n, dims;
+
+	if(k < 1 || k > CGPS_NEIGHBORS_MAX) {
+		logerr("invalid number of neighbors %d", k);
+		return -1;
+	}
+	if(!(scores = cgps_neighbors_project(proj, native, nn->model, input, &dims))) {
+		return -1;
+	}
+	if(dims != nn->dims) {
+		logerr("scores has %d components, expected %d", dims, nn->dims);
+		free(scores);
+		return -1;
+	}
+	rows = input->rows;
+
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(out, "<neighbors model=\"%d\" k=\"%d\">\n", nn->model, k);
+	} else {
+		fprintf(out, "Nearest neighbors (neighbors):\n");
+	}
+	for(i = 0; i < rows; ++i) {
+		n = cgps_neighbors_search(nn, scores + i * nn->dims, k, match);
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(out, "  <row>");
+			for(j = 0; j < n; ++j) {
+				fprintf(out, "<match id=\"");
+				cgps_neighbors_xml(nn->ids[match[j].index], out);
+				fprintf(out, "\" dist=\"%g\"/>", match[j].dist);
+			}
+			fprintf(out, "</row>\n");
+		} else {
+			for(j = 0; j < n; ++j) {
+				fprintf(out, j ? "\t%s\t%g" : "%s\t%g", nn->ids[match[j].index], match[j].dist);
+			}
+			fprintf(out, "\n");
+		}
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(out, "</neighbors>\n");
+	} else {
+		fprintf(out, "\n");
+	}
+
+	free(scores);
+	return 0;
+}
@@ -0,0 +1,102 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Nearest neighbor search in score space. A reference set (compounds with
+ * known scores) is loaded at daemon startup and indexed by a kd-tree, then
+ * the k nearest reference compounds of each predicted row are looked up.
+ * The score space is low-dimensional (the number of components), where the
+ * kd-tree search is exact and visits only a few nodes.
+ * 
+ * The reference file has one compound per line, an ID followed by either
+ * its scores (one value per component) or its raw data (one value per
+ * project variable, in project order) that is predicted at load. Values
+ * are separated by whitespace. Empty lines and lines starting with '#' are 
+ * ignored:
+ * 
+ *   # id  t1  t2  t3  t4
+ *   cmp1  0.31  -1.25  2.02  0.14
+ *   cmp2  ...
+ * 
+ * The scores of raw data (references and queries) are computed by the
+ * native engine (see native.h) if it supports the model, otherwise thru
+ * libchemgps. Precomputed reference scores are used as is.
+ * 
+ * Include cgpssqp.h and native.h before this header.
+ */
+
+#ifndef __NEIGHBOR_H__
+#define __NEIGHBOR_H__
+
+#include <stdio.h>
+
+#define CGPS_NEIGHBORS_MAX 100   /* maximum neighbors per row */
+
+/*
+ * The reference set (in kd-tree order). The median of the range [lo, hi)
+ * is stored at (lo + hi) / 2, split along dimension split[(lo + hi) / 2].
+ */
+struct cgps_neighbors
+{
+	int model;            /* model index */
+	int native;           /* scores computed natively */
+	int dims;             /* number of components */
+	int count;            /* number of reference compounds */
+	float *points;        /* scores (count x dims) */
+	char **ids;           /* reference IDs */
+	unsigned char *split; /* split dimension of node */
+};
+
+struct cgps_neighbor_match
+{
+	int index;            /* index of reference */
+	float dist;           /* euclidean distance */
+};
+
+/*
+ * Load reference set from path and build the index over the scores of
+ * model index. The native engine is optional (NULL). Returns NULL on 
+ * failure.
+ */
+struct cgps_neighbors * cgps_neighbors_open(const char *path, struct cgps_project *proj, const struct cgps_native *native, int index);
+void cgps_neighbors_close(struct cgps_neighbors *nn);
+
+/*
+ * Find the k nearest references of query (dims scores). The matches are
+ * stored in match sorted on distance. Returns the number of matches.
+ */
+int cgps_neighbors_search(const struct cgps_neighbors *nn, const float *query, int k, struct cgps_neighbor_match *match);
+
+/*
+ * Find the k nearest references of each row of the input data and write
+ * them (in plain or XML format) to out. Unless nn->native is true, the 
+ * scores are predicted by libchemgps and the caller must hold the lock 
+ * used for predictions on proj.
+ */
+int cgps_neighbors_result(const struct cgps_neighbors *nn, struct cgps_project *proj, const struct cgps_native *native, const struct cgps_input *input, int k, int format, FILE *out);
+
+#endif /* __NEIGHBOR_H__ */
@@ -0,0 +1,250 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The cache of reorder tables (see reorder.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+
+#include "reorder.h"
+
+#define CGPS_REORDER_HASH_PRIME 1099511628211ULL
+
+static struct cgps_reorder *buckets[CGPS_REORDER_BUCKETS];
+static int entries;
+static struct cgps_schema *schema;
+#ifdef HAVE_LIBPTHREAD
+static pthread_rwlock_t lock = PTHREAD_RWLOCK_INITIALIZER;
+#endif
+
+uint64_t cgps_reorder_hash(uint64_t hash, const char *buff, size_t size)
+{
+	size_t i;
+	
+	for(i = 0; i < size; ++i) {
+		hash ^= (unsigned char)buff[i];
+		hash *= CGPS_REORDER_HASH_PRIME;
+	}
+	return hash;
+}
+
+static uint64_t cgps_reorder_key(int kind, int fields, uint64_t names, const char *header)
+{
+	uint64_t hash = names ^ ((uint64_t)kind << 32 | (uint32_t)fields);
+	
+	if(header) {
+		hash = cgps_reorder_hash(hash, header, strlen(header));
+	}
+	return hash;
+}
+
+static int cgps_reorder_match(const struct cgps_reorder *reorder, int kind, int fields, uint64_t names, uint64_t hash, const char *header)
+{
+	if(reorder->hash != hash || reorder->kind != kind || 
+	   reorder->fields != fields || reorder->names != names) {
+		return 0;
+	}
+	if(header) {
+		return reorder->header && strcmp(reorder->header, header) == 0;
+	}
+	return 1;
+}
+
+static const struct cgps_reorder * cgps_reorder_lookup(int kind, int fields, uint64_t names, uint64_t hash, const char *header)
+{
+	const struct cgps_reorder *reorder;
+	
+	for(reorder = buckets[hash % CGPS_REORDER_BUCKETS]; reorder; reorder = reorder->next) {
+		if(cgps_reorder_match(reorder, kind, fields, names, hash, header)) {
+			return reorder;
+		}
+	}
+	return NULL;
+}
+
+const struct cgps_reorder * cgps_reorder_find(int kind, int fields, uint64_t names, const char *header)
+{
+	const struct cgps_reorder *reorder;
+	uint64_t hash = cgps_reorder_key(kind, fields, names, header);
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_rdlock(&lock);
+#endif
+	reorder = cgps_reorder_lookup(kind, fields, names, hash, header);
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_unlock(&lock);
+#endif
+	return reorder;
+}
+
+struct cgps_reorder * cgps_reorder_alloc(int kind, int fields, uint64_t names, const char *header)
+{
+	struct cgps_reorder *reorder;
+	
+	if(!(reorder = malloc(sizeof(struct cgps_reorder)))) {
+		return NULL;
+	}
+	memset(reorder, 0, sizeof(struct cgps_reorder));
+	/*
+	 * One extra entry for the index shift of molecule id.
+	 */
+	if(!(reorder->table = malloc((fields + 1) * sizeof(int)))) {
+		free(reorder);
+		return NULL;
+	}
+	if(header && !(reorder->header = strdup(header))) {
+		free(reorder->table);
+		free(reorder);
+		return NULL;
+	}
+	reorder->kind = kind;
+	reorder->fields = fields;
+	reorder->names = names;
+	reorder->hash = cgps_reorder_key(kind, fields, names, header);
+	return reorder;
+}
+
+static void cgps_reorder_free(struct cgps_reorder *reorder)
+{
+	free(reorder->header);
+	free(reorder->table);
+	free(reorder);
+}
+
+const struct cgps_reorder * cgps_reorder_insert(struct cgps_reorder *reorder)
+{
+	const struct cgps_reorder *cached;
+	int bucket = reorder->hash % CGPS_REORDER_BUCKETS;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_wrlock(&lock);
+#endif
+	if((cached = cgps_reorder_lookup(reorder->kind, reorder->fields, reorder->names, 
+					 reorder->hash, reorder->header))) {
+		cgps_reorder_free(reorder);
+		reorder = (struct cgps_reorder *)cached;
+	} else if(entries < CGPS_REORDER_ENTRIES) {
+		reorder->shared = 1;
+		reorder->next = buckets[bucket];
+		buckets[bucket] = reorder;
+		entries++;
+	}
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_unlock(&lock);
+#endif
+	return reorder;
+}
+
+void cgps_reorder_release(const struct cgps_reorder *reorder)
+{
+	if(reorder && !reorder->shared) {
+		cgps_reorder_free((struct cgps_reorder *)reorder);
+	}
+}
+
+const struct cgps_schema * cgps_reorder_schema(void)
+{
+	const struct cgps_schema *result;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_rdlock(&lock);
+#endif
+	result = schema;
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_unlock(&lock);
+#endif
+	return result;
+}
+
+const struct cgps_schema * cgps_reorder_schema_set(uint64_t fingerprint, const char *names, int count)
+{
+	struct cgps_schema *result;
+	
+	if(!(result = malloc(sizeof(struct cgps_schema)))) {
+		return NULL;
+	}
+	if(!(result->names = strdup(names))) {
+		free(result);
+		return NULL;
+	}
+	result->fingerprint = fingerprint;
+	result->count = count;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_wrlock(&lock);
+#endif
+	if(schema) {
+		free(result->names);
+		free(result);
+	} else {
+		schema = result;
+	}
+	result = schema;
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_unlock(&lock);
+#endif
+	return result;
+}
+
+void cgps_reorder_cleanup(void)
+{
+	struct cgps_reorder *reorder, *next;
+	int i;
+	
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_wrlock(&lock);
+#endif
+	for(i = 0; i < CGPS_REORDER_BUCKETS; ++i) {
+		for(reorder = buckets[i]; reorder; reorder = next) {
+			next = reorder->next;
+			cgps_reorder_free(reorder);
+		}
+		buckets[i] = NULL;
+	}
+	entries = 0;
+	if(schema) {
+		free(schema->names);
+		free(schema);
+		schema = NULL;
+	}
+#ifdef HAVE_LIBPTHREAD
+	pthread_rwlock_unlock(&lock);
+#endif
+}
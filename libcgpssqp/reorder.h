@@ -0,0 +1,132 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Cache of the tables mapping input data fields to the project variables
+ * (reorder tables). Clients tends to send the same descriptor header with
+ * every request, so the tables are computed once and then shared by all
+ * requests with the same key:
+ * 
+ *   - the kind of input data (CGPS_REORDER_XXX)
+ *   - the number of fields
+ *   - the hash of the project variable names
+ *   - the header line (for CGPS_REORDER_HEADER only)
+ * 
+ * The cached tables are immutable and never evicted (until cleanup), so
+ * the table returned by lookup can be used without holding any lock. When
+ * the cache is full, new tables are owned by the caller instead.
+ */
+
+#ifndef __REORDER_H__
+#define __REORDER_H__
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#include <stddef.h>
+
+#define CGPS_REORDER_PLAIN  0   /* data only (already ordered) */
+#define CGPS_REORDER_MOLID  1   /* molecule id in first field */
+#define CGPS_REORDER_HEADER 2   /* descriptor header on first line */
+
+#define CGPS_REORDER_BUCKETS 64
+#define CGPS_REORDER_ENTRIES 256   /* maximum number of cached tables */
+
+struct cgps_reorder
+{
+	int kind;                   /* CGPS_REORDER_XXX */
+	int fields;                 /* number of fields (entries in table) */
+	uint64_t names;             /* hash of variable names */
+	uint64_t hash;              /* hash of header line (or 0) */
+	char *header;               /* the header line (or NULL) */
+	int *table;                 /* field -> variable index (-1 = ignored) */
+	int shared;                 /* owned by the cache */
+	struct cgps_reorder *next;  /* next in bucket */
+};
+
+/*
+ * Returns the 64-bit FNV-1a hash of size bytes in buff continued from hash
+ * (start with CGPS_REORDER_HASH_INIT).
+ */
+#define CGPS_REORDER_HASH_INIT 14695981039346656037ULL
+uint64_t cgps_reorder_hash(uint64_t hash, const char *buff, size_t size);
+
+/*
+ * Returns the cached table for this key or NULL.
+ */
+const struct cgps_reorder * cgps_reorder_find(int kind, int fields, uint64_t names, const char *header);
+
+/*
+ * Allocate a table for this key (the table has fields + 1 uninitilized entries).
+ * Returns NULL on failure.
+ */
+struct cgps_reorder * cgps_reorder_alloc(int kind, int fields, uint64_t names, const char *header);
+
+/*
+ * Insert filled in table in cache. Returns the cached table, that might
+ * be another one inserted by a concurrent request (in which case reorder
+ * is released). If the cache is full, then reorder is returned as is.
+ */
+const struct cgps_reorder * cgps_reorder_insert(struct cgps_reorder *reorder);
+
+/*
+ * Release a table returned by insert. Only tables not owned by the cache
+ * are freed.
+ */
+void cgps_reorder_release(const struct cgps_reorder *reorder);
+
+/*
+ * The project schema is the list of variable names passed to the indata
+ * callback and their hash (the fingerprint). The schema is advertised to 
+ * clients that can then send their data pre-ordered and without header.
+ */
+struct cgps_schema
+{
+	uint64_t fingerprint;       /* hash of variable names */
+	int count;                  /* number of variables */
+	char *names;                /* newline separated variable names */
+};
+
+/*
+ * Returns the project schema or NULL if not yet known.
+ */
+const struct cgps_schema * cgps_reorder_schema(void);
+
+/*
+ * Set the project schema from count newline separated names. The first
+ * schema set is kept until cleanup (the input data is only loaded for the
+ * first model). Returns the project schema or NULL on failure.
+ */
+const struct cgps_schema * cgps_reorder_schema_set(uint64_t fingerprint, const char *names, int count);
+
+/*
+ * Release all cached tables (and the schema). No tables returned from the cache must be 
+ * in use when calling this function.
+ */
+void cgps_reorder_cleanup(void);
+
+#endif /* __REORDER_H__ */
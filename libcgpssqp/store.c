@@ -0,0 +1,792 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The prediction store file (see store.h). The file is written in native
+ * byte order (checked by the byte order mark on open):
+ * 
+ *   header  (32 bytes, struct cgps_store_header)
+ *   records (struct cgps_store_record followed by the row text, padded to
+ *            8 bytes)
+ * 
+ * The checksum of a record is the 64-bit FNV-1a hash of the record (with 
+ * the checksum zeroed) and its text. Records with row hash 0 and without
+ * text marks results not produced by the model.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_SYS_FILE_H
+# include <sys/file.h>
+#endif
+#include <sys/stat.h>
+
+#include "cgpssqp.h"
+#include "store.h"
+#include "reorder.h"
+
+#define CGPS_STORE_MAGIC     "CGPSSTOR"
+#define CGPS_STORE_VERSION   2
+#define CGPS_STORE_BYTEORDER 0x01020304
+#define CGPS_STORE_RECORD    0x52535043   /* record magic */
+#define CGPS_STORE_TEXT      65536        /* maximum length of row text */
+#define CGPS_STORE_SLOTS     1024         /* initial index size */
+#define CGPS_STORE_MAPSIZE   (1 << 20)    /* initial mapping size */
+
+struct cgps_store_header
+{
+	char magic[8];        /* CGPS_STORE_MAGIC */
+	uint32_t version;     /* CGPS_STORE_VERSION */
+	uint32_t byteorder;   /* CGPS_STORE_BYTEORDER */
+	uint64_t reserved[2];
+};
+
+struct cgps_store_record
+{
+	uint32_t magic;       /* CGPS_STORE_RECORD */
+	uint32_t length;      /* length of row text */
+	uint64_t project;     /* project fingerprint */
+	uint64_t row;         /* row hash */
+	uint32_t model;       /* model index */
+	uint32_t result;      /* PREDICTED_XXX */
+	uint32_t format;      /* CGPS_OUTPUT_FORMAT_XXX */
+	uint32_t reserved;
+	uint64_t checksum;    /* hash of record and row text */
+};
+
+/*
+ * Records appended by one insert.
+ */
+struct cgps_store_buffer
+{
+	char *data;
+	size_t used;
+	size_t size;
+};
+
+#define cgps_store_padded(size) (((size) + 7) & ~(uint64_t)7)
+#define cgps_store_record_at(store, offset) \
+	((const struct cgps_store_record *)((store)->map + (offset)))
+
+/*
+ * Returns the hash of the project file content.
+ */
+static int cgps_store_fingerprint(const char *proj, uint64_t *hash)
+{
+	char buff[16384];
+	size_t bytes;
+	FILE *fs;
+
+	if(!(fs = fopen(proj, "r"))) {
+		logerr("failed open project %s", proj);
+		return -1;
+	}
+	*hash = CGPS_REORDER_HASH_INIT;
+	while((bytes = fread(buff, 1, sizeof(buff), fs)) > 0) {
+		*hash = cgps_reorder_hash(*hash, buff, bytes);
+	}
+	if(ferror(fs)) {
+		logerr("failed read project %s", proj);
+		fclose(fs);
+		return -1;
+	}
+	fclose(fs);
+	return 0;
+}
+
+static uint64_t cgps_store_checksum(const struct cgps_store_record *record, const char *text)
+{
+	struct cgps_store_record copy = *record;
+	
+	copy.checksum = 0;
+	return cgps_reorder_hash(cgps_reorder_hash(CGPS_REORDER_HASH_INIT, (const char *)&copy, sizeof(copy)), 
+				 text, record->length);
+}
+
+static size_t cgps_store_bucket(const struct cgps_store *store, uint64_t row, uint32_t model, uint32_t result, uint32_t format)
+{
+	uint64_t hash = row ^ (((uint64_t)model << 32 | result) * 0x9e3779b97f4a7c15ULL) ^ format;
+
+	hash ^= hash >> 31;
+	hash *= 0xbf58476d1ce4e5b9ULL;
+	hash ^= hash >> 29;
+	return hash & (store->capacity - 1);
+}
+
+/*
+ * Returns the offset of record for this key or 0 if missing.
+ */
+static uint64_t cgps_store_find(const struct cgps_store *store, uint64_t row, uint32_t model, uint32_t result, uint32_t format)
+{
+	const struct cgps_store_slot *slot;
+	size_t i;
+
+	if(!store->capacity) {
+		return 0;
+	}
+	for(i = cgps_store_bucket(store, row, model, result, format); store->slots[i].offset; i = (i + 1) & (store->capacity - 1)) {
+		slot = &store->slots[i];
+		if(slot->row == row && slot->model == model && slot->result == result && slot->format == format) {
+			return slot->offset;
+		}
+	}
+	return 0;
+}
+
+static int cgps_store_index(struct cgps_store *store, uint64_t row, uint32_t model, uint32_t result, uint32_t format, uint64_t offset);
+
+/*
+ * Double the index size. The index is left unchanged on failure.
+ */
+static int cgps_store_grow(struct cgps_store *store)
+{
+	struct cgps_store_slot *slots = store->slots, *grown;
+	size_t i, capacity = store->capacity;
+
+	if(!(grown = calloc(capacity ? capacity * 2 : CGPS_STORE_SLOTS, sizeof(struct cgps_store_slot)))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	store->slots = grown;
+	store->capacity = capacity ? capacity * 2 : CGPS_STORE_SLOTS;
+	store->used = 0;
+	for(i = 0; i < capacity; ++i) {
+		if(slots[i].offset) {
+			cgps_store_index(store, slots[i].row, slots[i].model, slots[i].result, slots[i].format, slots[i].offset);
+		}
+	}
+	free(slots);
+	return 0;
+}
+
+/*
+ * Add record at offset to the index (replacing any record with same key).
+ * Returns -1 if the index can't be grown.
+ */
+static int cgps_store_index(struct cgps_store *store, uint64_t row, uint32_t model, uint32_t result, uint32_t format, uint64_t offset)
+{
+	struct cgps_store_slot *slot;
+	size_t i;
+
+	if((store->used + 1) * 2 > store->capacity && cgps_store_grow(store) < 0) {
+		return -1;
+	}
+	for(i = cgps_store_bucket(store, row, model, result, format); store->slots[i].offset; i = (i + 1) & (store->capacity - 1)) {
+		slot = &store->slots[i];
+		if(slot->row == row && slot->model == model && slot->result == result && slot->format == format) {
+			slot->offset = offset;
+			++store->dead;
+			return 0;
+		}
+	}
+	slot = &store->slots[i];
+	slot->row = row;
+	slot->model = model;
+	slot->result = result;
+	slot->format = format;
+	slot->offset = offset;
+	++store->used;
+	return 0;
+}
+
+/*
+ * Make sure that size bytes of the file is mapped.
+ */
+static int cgps_store_map(struct cgps_store *store, uint64_t size)
+{
+	size_t mapsize = store->mapsize ? store->mapsize : CGPS_STORE_MAPSIZE;
+	void *map;
+
+	if(store->map && size <= store->mapsize) {
+		return 0;
+	}
+	while(mapsize < size) {
+		mapsize *= 2;
+	}
+	if(store->map) {
+		munmap(store->map, store->mapsize);
+		store->map = NULL;
+		store->mapsize = 0;
+	}
+	if((map = mmap(NULL, mapsize, PROT_READ, MAP_SHARED, store->fd, 0)) == MAP_FAILED) {
+		logerr("failed map store %s", store->path);
+		return -1;
+	}
+	store->map = map;
+	store->mapsize = mapsize;
+	return 0;
+}
+
+/*
+ * Validate the records of the mapped file (size bytes) and rebuild the 
+ * index. Returns the size of the valid records (including header) or 0 if
+ * the index can't be rebuilt.
+ */
+static uint64_t cgps_store_scan(struct cgps_store *store, uint64_t size)
+{
+	const struct cgps_store_record *record;
+	uint64_t offset = sizeof(struct cgps_store_header), next;
+
+	while(offset + sizeof(struct cgps_store_record) <= size) {
+		record = cgps_store_record_at(store, offset);
+		if(record->magic != CGPS_STORE_RECORD || record->length > CGPS_STORE_TEXT) {
+			break;
+		}
+		next = offset + cgps_store_padded(sizeof(struct cgps_store_record) + record->length);
+		if(next > size || record->checksum != cgps_store_checksum(record, (const char *)(record + 1))) {
+			break;
+		}
+		if(record->project != store->project) {
+			++store->dead;
+		} else if(cgps_store_index(store, record->row, record->model, record->result, record->format, offset) < 0) {
+			return 0;
+		}
+		offset = next;
+	}
+	return offset;
+}
+
+static int cgps_store_compare(const void *p1, const void *p2)
+{
+	uint64_t o1 = *(const uint64_t *)p1, o2 = *(const uint64_t *)p2;
+
+	return o1 < o2 ? -1 : o1 > o2;
+}
+
+/*
+ * Rewrite the store with the live records only. The new file is written 
+ * to path.tmp (locked), then renamed.
+ */
+static int cgps_store_compact(struct cgps_store *store)
+{
+	struct cgps_store_header header;
+	const struct cgps_store_record *record;
+	uint64_t *offsets;
+	size_t i, num = 0, dead = store->dead;
+	char *path;
+	FILE *fs = NULL;
+	int fd;
+
+	if(!(path = malloc(strlen(store->path) + 5))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	sprintf(path, "%s.tmp", store->path);
+	if(!(offsets = malloc(store->used * sizeof(uint64_t) + 1))) {
+		logerr("failed alloc memory");
+		free(path);
+		return -1;
+	}
+	for(i = 0; i < store->capacity; ++i) {
+		if(store->slots[i].offset) {
+			offsets[num++] = store->slots[i].offset;
+		}
+	}
+	qsort(offsets, num, sizeof(uint64_t), cgps_store_compare);
+
+	if((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		logerr("failed open %s", path);
+		goto error;
+	}
+	if(flock(fd, LOCK_EX | LOCK_NB) < 0 || !(fs = fdopen(dup(fd), "w"))) {
+		logerr("failed lock %s", path);
+		goto error;
+	}
+	memset(&header, 0, sizeof(struct cgps_store_header));
+	memcpy(header.magic, CGPS_STORE_MAGIC, sizeof(header.magic));
+	header.version = CGPS_STORE_VERSION;
+	header.byteorder = CGPS_STORE_BYTEORDER;
+	fwrite(&header, sizeof(struct cgps_store_header), 1, fs);
+	for(i = 0; i < num; ++i) {
+		record = cgps_store_record_at(store, offsets[i]);
+		fwrite(record, cgps_store_padded(sizeof(struct cgps_store_record) + record->length), 1, fs);
+	}
+	if(fflush(fs) != 0 || ferror(fs) || fsync(fd) < 0) {
+		logerr("failed write %s", path);
+		goto error;
+	}
+	fclose(fs);
+	fs = NULL;
+	if(rename(path, store->path) < 0) {
+		logerr("failed rename %s", path);
+		goto error;
+	}
+
+	/*
+	 * Switch to the new file and rebuild the index.
+	 */
+	munmap(store->map, store->mapsize);
+	close(store->fd);
+	store->fd = fd;
+	store->map = NULL;
+	store->mapsize = 0;
+	store->size = sizeof(struct cgps_store_header);
+	memset(store->slots, 0, store->capacity * sizeof(struct cgps_store_slot));
+	store->used = 0;
+	store->dead = 0;
+	if(num) {
+		uint64_t size = lseek(fd, 0, SEEK_END);
+
+		if(cgps_store_map(store, size) < 0 || !(store->size = cgps_store_scan(store, size))) {
+			store->size = sizeof(struct cgps_store_header);
+			store->writable = 0;
+		}
+	}
+	loginfo("compacted store %s (%lu records, %lu dropped)", store->path, (unsigned long)num, (unsigned long)dead);
+
+	free(offsets);
+	free(path);
+	return 0;
+
+ error:
+	if(fs) {
+		fclose(fs);
+	}
+	if(fd >= 0) {
+		unlink(path);
+		close(fd);
+	}
+	free(offsets);
+	free(path);
+	return -1;
+}
+
+struct cgps_store * cgps_store_open(const char *path, struct cgps_project *proj, const char *file)
+{
+	struct cgps_store *store;
+	struct cgps_store_header header;
+	struct stat st;
+
+	if(!(store = malloc(sizeof(struct cgps_store)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	memset(store, 0, sizeof(struct cgps_store));
+	store->fd = -1;
+	pthread_rwlock_init(&store->lock, NULL);
+	if(!(store->path = strdup(path))) {
+		logerr("failed alloc memory");
+		goto error;
+	}
+	if(cgps_store_fingerprint(file, &store->project) < 0) {
+		goto error;
+	}
+	if(cgps_predict_names(proj, &store->names) < 0) {
+		logerr("failed get variable names of project %s", file);
+		goto error;
+	}
+	
+	if((store->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		if((store->fd = open(path, O_RDONLY)) < 0) {
+			logerr("failed open store %s", path);
+			goto error;
+		}
+		logwarn("store %s is read-only", path);
+	} else if(flock(store->fd, LOCK_EX | LOCK_NB) == 0) {
+		store->writable = 1;
+	} else {
+		logwarn("store %s is locked by another process (opened read-only)", path);
+	}
+	if(fstat(store->fd, &st) < 0) {
+		logerr("failed stat store %s", path);
+		goto error;
+	}
+	
+	if(st.st_size == 0 && store->writable) {
+		memset(&header, 0, sizeof(struct cgps_store_header));
+		memcpy(header.magic, CGPS_STORE_MAGIC, sizeof(header.magic));
+		header.version = CGPS_STORE_VERSION;
+		header.byteorder = CGPS_STORE_BYTEORDER;
+		if(write(store->fd, &header, sizeof(struct cgps_store_header)) != sizeof(struct cgps_store_header)) {
+			logerr("failed write store %s", path);
+			goto error;
+		}
+		st.st_size = sizeof(struct cgps_store_header);
+	} else if(st.st_size < (off_t)sizeof(struct cgps_store_header) ||
+		  pread(store->fd, &header, sizeof(struct cgps_store_header), 0) != sizeof(struct cgps_store_header) ||
+		  memcmp(header.magic, CGPS_STORE_MAGIC, sizeof(header.magic)) != 0 ||
+		  header.version != CGPS_STORE_VERSION || 
+		  header.byteorder != CGPS_STORE_BYTEORDER) {
+		errno = 0;
+		logerr("invalid store file %s (wrong version or byte order?)", path);
+		goto error;
+	}
+
+	/*
+	 * Truncate records torn by a crash.
+	 */
+	if(cgps_store_map(store, st.st_size) < 0) {
+		goto error;
+	}
+	if(!(store->size = cgps_store_scan(store, st.st_size))) {
+		goto error;
+	}
+	if(store->size < (uint64_t)st.st_size && store->writable) {
+		logwarn("dropped %lu bytes of incomplete records in store %s", 
+			(unsigned long)(st.st_size - store->size), path);
+		if(ftruncate(store->fd, store->size) < 0) {
+			logerr("failed truncate store %s", path);
+			goto error;
+		}
+	}
+	debug("opened store %s (%lu records, %lu dead)", path, (unsigned long)store->used, (unsigned long)store->dead);
+	
+	if(store->writable && store->dead >= CGPS_STORE_COMPACT && store->dead > store->used) {
+		cgps_store_compact(store);
+	}
+	return store;
+
+ error:
+	cgps_store_close(store);
+	return NULL;
+}
+
+void cgps_store_close(struct cgps_store *store)
+{
+	if(!store) {
+		return;
+	}
+	if(store->map) {
+		munmap(store->map, store->mapsize);
+	}
+	if(store->fd >= 0) {
+		close(store->fd);
+	}
+	pthread_rwlock_destroy(&store->lock);
+	SQX_ClearStringVector(&store->names);
+	free(store->slots);
+	free(store->path);
+	free(store);
+}
+
+uint64_t * cgps_store_rows(const struct cgps_input *input)
+{
+	uint64_t *hash;
+	int i;
+
+	if(!(hash = malloc((input->rows + 1) * sizeof(uint64_t)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	for(i = 0; i < input->rows; ++i) {
+		hash[i] = cgps_reorder_hash(CGPS_REORDER_HASH_INIT, (const char *)(input->values + (size_t)i * input->cols), 
+					    input->cols * sizeof(float));
+		if(!hash[i]) {
+			hash[i] = 1;      /* reserved for markers */
+		}
+	}
+	return hash;
+}
+
+int cgps_store_lookup(struct cgps_store *store, int index, const uint64_t *rows, int count, int result, int format, char **buff, size_t *size)
+{
+	const struct cgps_result_entry *entry;
+	const struct cgps_store_record *record;
+	uint64_t offset;
+	FILE *fs;
+	int i, status = 0;
+
+	*buff = NULL;
+	if(!(fs = open_memstream(buff, size))) {
+		logerr("failed open memory stream");
+		return -1;
+	}
+	
+	pthread_rwlock_rdlock(&store->lock);
+	if(!store->map) {
+		status = -1;      /* lost mapping */
+	} else if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(fs, "<model index=\"%d\">\n", index);
+	}
+	for(entry = cgps_result_entry_list; entry->name && status == 0; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(result, entry->value)) {
+			continue;
+		}
+		if(cgps_store_find(store, 0, index, entry->value, format)) {
+			continue;     /* not produced by model */
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(fs, "  <result name=\"%s\" desc=\"%s\">\n", entry->name, entry->desc);
+		} else {
+			fprintf(fs, "%s (%s):\n", entry->desc, entry->name);
+		}
+		for(i = 0; i < count; ++i) {
+			if(!(offset = cgps_store_find(store, rows[i], index, entry->value, format))) {
+				status = -1;
+				break;
+			}
+			record = cgps_store_record_at(store, offset);
+			if(format == CGPS_OUTPUT_FORMAT_XML) {
+				fprintf(fs, "    <row>%.*s</row>\n", (int)record->length, (const char *)(record + 1));
+			} else {
+				fprintf(fs, "%.*s\n", (int)record->length, (const char *)(record + 1));
+			}
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(fs, "  </result>\n");
+		} else {
+			fprintf(fs, "\n");
+		}
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(fs, "</model>\n");
+	}
+	pthread_rwlock_unlock(&store->lock);
+	
+	fclose(fs);
+	if(status < 0) {
+		free(*buff);
+		*buff = NULL;
+	}
+	return status;
+}
+
+/*
+ * Add record to buffer. Returns -1 if the buffer can't be grown.
+ */
+static int cgps_store_append(struct cgps_store_buffer *buffer, const struct cgps_store *store,
+			      int index, uint64_t row, int result, int format, const char *text, size_t length)
+{
+	struct cgps_store_record record;
+	size_t size = cgps_store_padded(sizeof(struct cgps_store_record) + length);
+	char *data;
+
+	if(buffer->used + size > buffer->size) {
+		buffer->size = buffer->size ? buffer->size * 2 : 65536;
+		while(buffer->used + size > buffer->size) {
+			buffer->size *= 2;
+		}
+		if(!(data = realloc(buffer->data, buffer->size))) {
+			logerr("failed alloc memory");
+			return -1;
+		}
+		buffer->data = data;
+	}
+
+	record.magic = CGPS_STORE_RECORD;
+	record.length = length;
+	record.project = store->project;
+	record.row = row;
+	record.model = index;
+	record.result = result;
+	record.format = format;
+	record.reserved = 0;
+	record.checksum = cgps_store_checksum(&record, text);
+	
+	data = buffer->data + buffer->used;
+	memset(data, 0, size);
+	memcpy(data, &record, sizeof(struct cgps_store_record));
+	memcpy(data + sizeof(struct cgps_store_record), text, length);
+	buffer->used += size;
+	return 0;
+}
+
+/*
+ * Returns the requested result entry named name (len bytes) or NULL.
+ */
+static const struct cgps_result_entry * cgps_store_entry(const char *name, size_t len, int result)
+{
+	const struct cgps_result_entry *entry;
+
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(strlen(entry->name) == len && memcmp(entry->name, name, len) == 0) {
+			return cgps_result_isset(result, entry->value) ? entry : NULL;
+		}
+	}
+	return NULL;
+}
+
+int cgps_store_insert(struct cgps_store *store, int index, const uint64_t *rows, int count, int result, int format, const char *buff, size_t size)
+{
+	const struct cgps_result_entry *entry = NULL;
+	struct cgps_store_buffer buffer;
+	const char *line, *next, *end = buff + size, *eol, *ptr, *quote;
+	size_t section = 0, len, pos;
+	const struct cgps_store_record *record;
+	uint64_t offset;
+	ssize_t bytes;
+	int seen = 0, row = 0, appended = 0;
+
+	if(!store->writable) {
+		return 0;
+	}
+	memset(&buffer, 0, sizeof(struct cgps_store_buffer));
+	
+	pthread_rwlock_wrlock(&store->lock);
+	for(line = buff; line < end; line = next) {
+		if(!(eol = memchr(line, '\n', end - line))) {
+			eol = end;
+		}
+		next = eol + 1;
+		len = eol - line;
+		
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			for(ptr = line; ptr < eol && *ptr == ' '; ++ptr) {
+				;
+			}
+			len = eol - ptr;
+			if(len > 14 && strncmp(ptr, "<result name=\"", 14) == 0) {
+				ptr += 14;
+				if((quote = memchr(ptr, '"', eol - ptr))) {
+					entry = cgps_store_entry(ptr, quote - ptr, result);
+				}
+				section = buffer.used;
+				row = 0;
+				continue;
+			} else if(!entry) {
+				continue;
+			} else if(len >= 11 && strncmp(ptr, "<row>", 5) == 0 && strncmp(eol - 6, "</row>", 6) == 0) {
+				ptr += 5;
+				len -= 11;
+			} else {
+				if(strncmp(ptr, "</result>", 9) == 0) {
+					if(row == count) {
+						cgps_result_setopt(seen, entry->value);
+					} else {
+						buffer.used = section;
+					}
+					entry = NULL;
+				}
+				continue;
+			}
+		} else {
+			ptr = line;
+			if(!entry) {
+				if(len > 4 && strncmp(eol - 2, "):", 2) == 0) {
+					for(ptr = eol - 2; ptr > line && *ptr != '('; --ptr) {
+						;
+					}
+					entry = cgps_store_entry(ptr + 1, eol - ptr - 3, result);
+					section = buffer.used;
+					row = 0;
+				}
+				continue;
+			} else if(!len) {
+				if(row == count) {
+					cgps_result_setopt(seen, entry->value);
+				} else {
+					buffer.used = section;
+				}
+				entry = NULL;
+				continue;
+			}
+		}
+
+		/*
+		 * Row text in ptr (len bytes).
+		 */
+		if(row >= count || len > CGPS_STORE_TEXT) {
+			buffer.used = section;
+			entry = NULL;
+			continue;
+		}
+		if(!cgps_store_find(store, rows[row], index, entry->value, format) &&
+		   cgps_store_append(&buffer, store, index, rows[row], entry->value, format, ptr, len) < 0) {
+			goto error;
+		}
+		++row;
+	}
+	if(entry) {
+		buffer.used = section;   /* unterminated */
+	}
+
+	/*
+	 * Mark results not produced by this model.
+	 */
+	if(seen) {
+		for(entry = cgps_result_entry_list; entry->name; ++entry) {
+			if(entry->value != PREDICTED_RESULTS_ALL && 
+			   cgps_result_isset(result, entry->value) &&
+			   !cgps_result_isset(seen, entry->value) &&
+			   !cgps_store_find(store, 0, index, entry->value, format) &&
+			   cgps_store_append(&buffer, store, index, 0, entry->value, format, "", 0) < 0) {
+				goto error;
+			}
+		}
+	}
+
+	if(buffer.used) {
+		for(pos = 0; pos < buffer.used; pos += bytes) {
+			if((bytes = pwrite(store->fd, buffer.data + pos, buffer.used - pos, store->size + pos)) <= 0) {
+				logerr("failed write store %s", store->path);
+				if(ftruncate(store->fd, store->size) < 0) {
+					store->writable = 0;
+				}
+				goto error;
+			}
+		}
+		if(cgps_store_map(store, store->size + buffer.used) < 0) {
+			store->writable = 0;
+			goto error;
+		}
+		for(pos = 0; pos < buffer.used; pos += cgps_store_padded(sizeof(struct cgps_store_record) + record->length)) {
+			record = (const struct cgps_store_record *)(buffer.data + pos);
+			offset = store->size + pos;
+			if(cgps_store_index(store, record->row, record->model, record->result, record->format, offset) < 0) {
+				/*
+				 * The records are written, but can't be found until
+				 * the store is reopened.
+				 */
+				store->size += buffer.used;
+				goto error;
+			}
+			++appended;
+		}
+		store->size += buffer.used;
+	}
+	pthread_rwlock_unlock(&store->lock);
+	
+	free(buffer.data);
+	return appended;
+
+ error:
+	pthread_rwlock_unlock(&store->lock);
+	free(buffer.data);
+	return -1;
+}
@@ -0,0 +1,124 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Persistent prediction store. The results predicted by SIMCA-QP are saved
+ * per row in an append-only file keyed by:
+ * 
+ *   - the project fingerprint (hash of the project file)
+ *   - the model index
+ *   - the result (PREDICTED_XXX)
+ *   - the output format (CGPS_OUTPUT_FORMAT_XXX)
+ *   - the row hash (hash of the input values in project order)
+ * 
+ * The value is the text of the result row in that format, so output served 
+ * from the store is byte identical to the output of libchemgps. A model (and
+ * request) is served from the store when all its rows are found, otherwise 
+ * the model is predicted and the missing rows are appended. The input data 
+ * is loaded direct (using the project variable names saved when the store 
+ * is opened), so a model served from the store don't use SIMCA-QP at all.
+ * 
+ * The file is mapped read-only and indexed by an open addressing hash table
+ * that is rebuilt when the file is opened. Each record is checksummed, so a
+ * torn write (crash) is detected and truncated on open. Records of other
+ * project fingerprints (the project was updated) and superseded records are 
+ * dropped by compaction on open.
+ * 
+ * Only one process can append to the store at a time, other processes opens
+ * the store read-only.
+ * 
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#include <stddef.h>
+#include <pthread.h>
+
+#define CGPS_STORE_COMPACT 4096   /* minimum dead records for compaction */
+
+struct cgps_store_slot
+{
+	uint64_t row;         /* row hash (0 if result is not produced by model) */
+	uint32_t model;       /* model index */
+	uint32_t result;      /* PREDICTED_XXX */
+	uint32_t format;      /* CGPS_OUTPUT_FORMAT_XXX */
+	uint64_t offset;      /* record offset (0 if empty) */
+};
+
+struct cgps_store
+{
+	char *path;           /* the store file */
+	int fd;
+	int writable;         /* got the append lock */
+	uint64_t project;     /* project fingerprint */
+	char *map;            /* mapped file */
+	size_t mapsize;       /* size of mapping */
+	uint64_t size;        /* size of valid records */
+	struct cgps_store_slot *slots;
+	size_t capacity;      /* number of slots (power of two) */
+	size_t used;          /* used slots (live records) */
+	size_t dead;          /* stale and superseded records */
+	pthread_rwlock_t lock;
+	SQX_StringVector names;  /* project variable names (input data) */
+};
+
+/*
+ * Open the store file in path for predictions of project proj (loaded from 
+ * file). The file is created if missing. Returns NULL on failure.
+ */
+struct cgps_store * cgps_store_open(const char *path, struct cgps_project *proj, const char *file);
+
+/*
+ * Close the store.
+ */
+void cgps_store_close(struct cgps_store *store);
+
+/*
+ * Returns the row hashes of input (the caller should free the array). 
+ * Returns NULL on failure.
+ */
+uint64_t * cgps_store_rows(const struct cgps_input *input);
+
+/*
+ * Lookup the result of model index for all rows. The output (in the same 
+ * format as libchemgps) is returned in buff (size bytes), the caller should
+ * free it. Returns -1 if any row was missing in the store.
+ */
+int cgps_store_lookup(struct cgps_store *store, int index, const uint64_t *rows, int count, int result, int format, char **buff, size_t *size);
+
+/*
+ * Parse size bytes in buff (the result of model index in format) and append
+ * rows not in the store. Returns the number of appended records or -1 on failure.
+ */
+int cgps_store_insert(struct cgps_store *store, int index, const uint64_t *rows, int count, int result, int format, const char *buff, size_t size);
+
+#endif /* __STORE_H__ */
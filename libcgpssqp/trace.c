@@ -0,0 +1,208 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Reading and writing of request traces (see trace.h).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include "trace.h"
+
+#define CGPS_TRACE_FNV_OFFSET 14695981039346656037ULL
+#define CGPS_TRACE_FNV_PRIME  1099511628211ULL
+
+static void cgps_trace_put(unsigned char *buff, uint64_t value, int size)
+{
+	int i;
+
+	for(i = 0; i < size; ++i) {
+		buff[i] = (value >> (8 * i)) & 0xff;
+	}
+}
+
+static uint64_t cgps_trace_get(const unsigned char *buff, int size)
+{
+	uint64_t value = 0;
+	int i;
+
+	for(i = size - 1; i >= 0; --i) {
+		value = (value << 8) | buff[i];
+	}
+	return value;
+}
+
+uint64_t cgps_trace_clock(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void cgps_trace_init(struct cgps_trace_record *rec, uint64_t time, int flags)
+{
+	memset(rec, 0, sizeof(struct cgps_trace_record));
+	rec->time = time;
+	rec->hash = CGPS_TRACE_FNV_OFFSET;
+	rec->flags = flags;
+}
+
+void cgps_trace_append(struct cgps_trace_record *rec, const char *buff, size_t size)
+{
+	size_t i;
+
+	for(i = 0; i < size; ++i) {
+		rec->hash ^= (unsigned char)buff[i];
+		rec->hash *= CGPS_TRACE_FNV_PRIME;
+	}
+	if(!(rec->flags & CGPS_TRACE_PAYLOAD)) {
+		return;
+	}
+	if(rec->size + size > rec->capacity) {
+		size_t capacity = rec->capacity ? rec->capacity : 4096;
+		char *data;
+
+		while(capacity < rec->size + size) {
+			capacity *= 2;
+		}
+		if(!(data = realloc(rec->data, capacity))) {
+			/*
+			 * Keep the hash, but don't record the payload.
+			 */
+			rec->flags &= ~CGPS_TRACE_PAYLOAD;
+			rec->size = 0;
+			return;
+		}
+		rec->data = data;
+		rec->capacity = capacity;
+	}
+	memcpy(rec->data + rec->size, buff, size);
+	rec->size += size;
+}
+
+void cgps_trace_cleanup(struct cgps_trace_record *rec)
+{
+	if(rec->data) {
+		free(rec->data);
+		rec->data = NULL;
+	}
+	rec->size = 0;
+	rec->capacity = 0;
+}
+
+int cgps_trace_write_header(FILE *fs, int flags)
+{
+	unsigned char head[CGPS_TRACE_HEADER];
+
+	memcpy(head, CGPS_TRACE_MAGIC, 8);
+	cgps_trace_put(head + 8, CGPS_TRACE_VERSION, 4);
+	cgps_trace_put(head + 12, flags, 4);
+	if(fwrite(head, 1, sizeof(head), fs) != sizeof(head)) {
+		return -1;
+	}
+	return 0;
+}
+
+int cgps_trace_read_header(FILE *fs, int *flags)
+{
+	unsigned char head[CGPS_TRACE_HEADER];
+
+	if(fread(head, 1, sizeof(head), fs) != sizeof(head)) {
+		return -1;
+	}
+	if(memcmp(head, CGPS_TRACE_MAGIC, 8) != 0 || 
+	   cgps_trace_get(head + 8, 4) != CGPS_TRACE_VERSION) {
+		return -1;
+	}
+	*flags = cgps_trace_get(head + 12, 4);
+	return 0;
+}
+
+int cgps_trace_write(FILE *fs, const struct cgps_trace_record *rec)
+{
+	unsigned char head[CGPS_TRACE_RECORD];
+	
+	memset(head, 0, sizeof(head));
+	cgps_trace_put(head, rec->time, 8);
+	cgps_trace_put(head + 8, rec->hash, 8);
+	cgps_trace_put(head + 16, rec->result, 4);
+	cgps_trace_put(head + 20, rec->rows, 4);
+	cgps_trace_put(head + 24, rec->size, 4);
+	head[28] = rec->format;
+	
+	if(fwrite(head, 1, sizeof(head), fs) != sizeof(head)) {
+		return -1;
+	}
+	if(rec->size && fwrite(rec->data, 1, rec->size, fs) != rec->size) {
+		return -1;
+	}
+	return 0;
+}
+
+int cgps_trace_read(FILE *fs, struct cgps_trace_record *rec)
+{
+	unsigned char head[CGPS_TRACE_RECORD];
+	size_t bytes;
+	
+	if((bytes = fread(head, 1, sizeof(head), fs)) != sizeof(head)) {
+		return bytes ? -1 : 0;
+	}
+	rec->time = cgps_trace_get(head, 8);
+	rec->hash = cgps_trace_get(head + 8, 8);
+	rec->result = cgps_trace_get(head + 16, 4);
+	rec->rows = cgps_trace_get(head + 20, 4);
+	rec->size = cgps_trace_get(head + 24, 4);
+	rec->format = head[28];
+	
+	if(rec->size > rec->capacity) {
+		char *data;
+		
+		if(!(data = realloc(rec->data, rec->size))) {
+			return -1;
+		}
+		rec->data = data;
+		rec->capacity = rec->size;
+	}
+	if(rec->size && fread(rec->data, 1, rec->size, fs) != rec->size) {
+		return -1;
+	}
+	return 1;
+}
@@ -0,0 +1,122 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Request traces. The cgpsd daemon can record the requests it receives in a
+ * compact binary trace that is replayed by cgpsddos (preserving the time
+ * between arrivals). The trace starts with a file header followed by one 
+ * record for each request:
+ *
+ *   offset  size  field
+ *        0     8  magic (CGPS_TRACE_MAGIC)
+ *        8     4  version (CGPS_TRACE_VERSION)
+ *       12     4  flags (CGPS_TRACE_PAYLOAD if payload is recorded)
+ *
+ *   offset  size  field
+ *        0     8  arrival time (microseconds since the epoch)
+ *        8     8  hash of the input data (64-bit FNV-1a)
+ *       16     4  result mask
+ *       20     4  number of observations (the Load: value)
+ *       24     4  payload size (0 unless recorded)
+ *       28     1  output format (CGPS_OUTPUT_FORMAT_XXX)
+ *       29     3  reserved
+ *       32     -  payload (the input data, including any header line)
+ *
+ * All integers are stored in little endian byte order.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdio.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+
+#define CGPS_TRACE_MAGIC   "CGPSTRAC"
+#define CGPS_TRACE_VERSION 1
+#define CGPS_TRACE_HEADER  16    /* size of file header */
+#define CGPS_TRACE_RECORD  32    /* size of record (without payload) */
+
+#define CGPS_TRACE_PAYLOAD 1     /* input data is recorded */
+
+struct cgps_trace_record
+{
+	uint64_t time;        /* arrival time (us) */
+	uint64_t hash;        /* hash of input data */
+	uint32_t result;      /* result mask */
+	uint32_t rows;        /* number of observations */
+	uint32_t size;        /* payload size */
+	uint8_t format;       /* output format */
+	int flags;            /* record payload (not stored) */
+	char *data;           /* payload */
+	size_t capacity;      /* allocated payload buffer */
+};
+
+/*
+ * Returns the current time in microseconds since the epoch.
+ */
+uint64_t cgps_trace_clock(void);
+
+/*
+ * Initilize record for request arriving at time. If flags contains 
+ * CGPS_TRACE_PAYLOAD, then the input data is saved in the record (not 
+ * only its hash).
+ */
+void cgps_trace_init(struct cgps_trace_record *rec, uint64_t time, int flags);
+
+/*
+ * Add size bytes of input data from buff to record.
+ */
+void cgps_trace_append(struct cgps_trace_record *rec, const char *buff, size_t size);
+
+/*
+ * Release memory allocated for the payload.
+ */
+void cgps_trace_cleanup(struct cgps_trace_record *rec);
+
+/*
+ * Write and read the file header. The flags are stored in the header. Both
+ * functions returns -1 on failure (read also fails on bad magic/version).
+ */
+int cgps_trace_write_header(FILE *fs, int flags);
+int cgps_trace_read_header(FILE *fs, int *flags);
+
+/*
+ * Write record to trace file. Returns -1 on failure.
+ */
+int cgps_trace_write(FILE *fs, const struct cgps_trace_record *rec);
+
+/*
+ * Read next record from trace file. The payload (if any) is read into the
+ * records data buffer (reused between calls, release by calling 
+ * cgps_trace_cleanup()). Returns 1 if a record was read, 0 on end of 
+ * file and -1 on failure (i.e. a truncated record).
+ */
+int cgps_trace_read(FILE *fs, struct cgps_trace_record *rec);
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,409 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The numeric result writer (see writer.h).
+ * 
+ * Values are formatted with the shortest decimal that reads back as the
+ * same float. The candidates of each length are the two decimals closest
+ * to the value, found by scaling with a power of ten. A candidate is taken
+ * if it's inside the interval of reals rounding to the value (the halfway
+ * points to its neighbor floats). The scaled values are computed in double
+ * precision, so they are off by a few ULP of double at most. Candidates
+ * that close to the interval bounds are checked exactly with strtof().
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <math.h>
+
+#include "cgpssqp.h"
+#include "writer.h"
+
+#define CGPS_WRITER_PRECISION 6      /* minimum precision (as "%g") */
+#define CGPS_WRITER_DIGITS    9      /* max digits of a float */
+#define CGPS_WRITER_MARGIN    1.0e-15 /* exact check near bounds (relative) */
+
+static const double cgps_writer_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22, 1e23, 1e24, 
+	1e25, 1e26, 1e27, 1e28, 1e29, 1e30, 1e31, 1e32, 1e33, 1e34, 1e35, 1e36, 
+	1e37, 1e38, 1e39, 1e40, 1e41, 1e42, 1e43, 1e44, 1e45, 1e46, 1e47, 1e48, 
+	1e49, 1e50, 1e51, 1e52, 1e53, 1e54, 1e55, 1e56, 1e57, 1e58, 1e59, 1e60
+};
+
+/*
+ * Returns value scaled by 10^exp.
+ */
+static double cgps_writer_scale(double value, int exp)
+{
+	return exp >= 0 ? value * cgps_writer_pow10[exp] : value / cgps_writer_pow10[-exp];
+}
+
+/*
+ * Returns true if num * 10^exp reads back as value (exact).
+ */
+static int cgps_writer_exact(uint32_t num, int exp, float value)
+{
+	char buff[32];
+
+	sprintf(buff, "%ue%d", num, exp);
+	return strtof(buff, NULL) == value;
+}
+
+/*
+ * Returns true if candidate num * 10^-scale is inside the rounding interval
+ * (lo, hi) of value.
+ */
+static int cgps_writer_inside(uint32_t num, int scale, double lo, double hi, float value)
+{
+	double dec = cgps_writer_scale(num, -scale);
+	double margin = dec * CGPS_WRITER_MARGIN;
+
+	if(dec - lo > margin && hi - dec > margin) {
+		return 1;
+	}
+	if(lo - dec > margin || dec - hi > margin) {
+		return 0;
+	}
+	return cgps_writer_exact(num, -scale, value);
+}
+
+int cgps_writer_format(char *buff, float value)
+{
+	char digits[CGPS_WRITER_DIGITS], *ptr = buff;
+	double v, lo, hi, scaled;
+	float prev, next;
+	uint32_t num = 0, cand[2];
+	int exp, prec, len, i, j;
+
+	if(value == 0.0f) {
+		return sprintf(buff, signbit(value) ? "-0" : "0");
+	}
+	if(!isfinite(value)) {
+		return snprintf(buff, CGPS_WRITER_VALUE, "%g", value);
+	}
+	if(value < 0.0f) {
+		*ptr++ = '-';
+		value = -value;
+	}
+	
+	/*
+	 * The halfway points to the neighbor floats (exact in double).
+	 */
+	v = value;
+	prev = nextafterf(value, 0.0f);
+	next = nextafterf(value, INFINITY);
+	lo = (v + prev) / 2.0;
+	hi = isfinite(next) ? (v + next) / 2.0 : v + (v - prev) / 2.0;
+	frexpf(value, &exp);
+	
+	/*
+	 * The decimal exponent, estimated from the binary exponent.
+	 */
+	exp = (int)floor((exp - 1) * 0.30102999566398120);
+	if(cgps_writer_scale(v, -exp) >= 10.0) {
+		++exp;
+	}
+	
+	for(prec = 1; prec <= CGPS_WRITER_DIGITS; ++prec) {
+		scaled = cgps_writer_scale(v, prec - 1 - exp);
+		cand[0] = (uint32_t)scaled;
+		cand[1] = cand[0] + 1;
+		if(scaled - cand[0] > 0.5) {
+			cand[0] = cand[1]--;
+		}
+		for(j = 0; j < 2; ++j) {
+			if(cgps_writer_inside(cand[j], prec - 1 - exp, lo, hi, value)) {
+				num = cand[j];
+				break;
+			}
+		}
+		if(j < 2) {
+			break;
+		}
+	}
+	if(prec > CGPS_WRITER_DIGITS) {
+		return snprintf(buff, CGPS_WRITER_VALUE, "%.9g", ptr == buff ? value : -value);
+	}
+	if(num == (uint32_t)cgps_writer_pow10[prec]) {
+		num /= 10;
+		++exp;
+	}
+	
+	for(i = prec - 1; i >= 0; --i) {
+		digits[i] = '0' + num % 10;
+		num /= 10;
+	}
+	for(len = prec; len > 1 && digits[len - 1] == '0'; --len) {
+		;
+	}
+	if(prec < CGPS_WRITER_PRECISION) {
+		prec = CGPS_WRITER_PRECISION;
+	}
+	
+	if(exp < -4 || exp >= prec) {
+		*ptr++ = digits[0];
+		if(len > 1) {
+			*ptr++ = '.';
+			memcpy(ptr, digits + 1, len - 1);
+			ptr += len - 1;
+		}
+		*ptr++ = 'e';
+		if(exp < 0) {
+			*ptr++ = '-';
+			exp = -exp;
+		} else {
+			*ptr++ = '+';
+		}
+		*ptr++ = '0' + exp / 10;
+		*ptr++ = '0' + exp % 10;
+	} else if(exp >= 0) {
+		memcpy(ptr, digits, exp + 1 < len ? exp + 1 : len);
+		for(i = len; i < exp + 1; ++i) {
+			ptr[i] = '0';
+		}
+		ptr += exp + 1;
+		if(len > exp + 1) {
+			*ptr++ = '.';
+			memcpy(ptr, digits + exp + 1, len - exp - 1);
+			ptr += len - exp - 1;
+		}
+	} else {
+		*ptr++ = '0';
+		*ptr++ = '.';
+		for(i = -1; i > exp; --i) {
+			*ptr++ = '0';
+		}
+		memcpy(ptr, digits, len);
+		ptr += len;
+	}
+	return ptr - buff;
+}
+
+/*
+ * Reset all chunks to empty.
+ */
+static void cgps_writer_reset(struct cgps_writer *writer)
+{
+	int i;
+
+	for(i = 0; i < CGPS_WRITER_CHUNKS; ++i) {
+		writer->iov[i].iov_base = writer->buff + i * CGPS_WRITER_CHUNK;
+		writer->iov[i].iov_len = 0;
+	}
+	writer->chunk = 0;
+}
+
+int cgps_writer_open(struct cgps_writer *writer, FILE *out)
+{
+	memset(writer, 0, sizeof(struct cgps_writer));
+	writer->out = out;
+	if(fflush(out) != 0) {
+		logerr("failed flush output stream");
+		return -1;
+	}
+	if(!(writer->buff = malloc(CGPS_WRITER_CHUNKS * CGPS_WRITER_CHUNK))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	writer->fd = fileno(out);
+	cgps_writer_reset(writer);
+	return 0;
+}
+
+int cgps_writer_flush(struct cgps_writer *writer)
+{
+	struct iovec *iov = writer->iov;
+	int count = writer->chunk + 1;
+	ssize_t bytes;
+
+	if(writer->failed) {
+		count = 0;
+	} else if(writer->fd < 0) {
+		for(; count; ++iov, --count) {
+			if(fwrite(iov->iov_base, 1, iov->iov_len, writer->out) != iov->iov_len) {
+				writer->failed = 1;
+			}
+		}
+	}
+	
+	while(count) {
+		if((bytes = writev(writer->fd, iov, count)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			writer->failed = 1;
+			break;
+		}
+		for(; count && (size_t)bytes >= iov->iov_len; ++iov, --count) {
+			bytes -= iov->iov_len;
+		}
+		if(count) {
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
+	
+	cgps_writer_reset(writer);
+	return writer->failed ? -1 : 0;
+}
+
+/*
+ * Returns pointer to at least len free bytes in current chunk.
+ */
+static char * cgps_writer_reserve(struct cgps_writer *writer, size_t len)
+{
+	struct iovec *iov = &writer->iov[writer->chunk];
+
+	if(iov->iov_len + len > CGPS_WRITER_CHUNK) {
+		if(writer->chunk + 1 == CGPS_WRITER_CHUNKS) {
+			cgps_writer_flush(writer);
+		} else {
+			++writer->chunk;
+		}
+		iov = &writer->iov[writer->chunk];
+	}
+	return (char *)iov->iov_base + iov->iov_len;
+}
+
+void cgps_writer_write(struct cgps_writer *writer, const char *str, size_t len)
+{
+	size_t size;
+
+	while(len) {
+		size = len < CGPS_WRITER_CHUNK ? len : CGPS_WRITER_CHUNK;
+		memcpy(cgps_writer_reserve(writer, size), str, size);
+		writer->iov[writer->chunk].iov_len += size;
+		str += size;
+		len -= size;
+	}
+}
+
+void cgps_writer_row(struct cgps_writer *writer, const float *row, int num, int format)
+{
+	char *ptr;
+	int i;
+
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		cgps_writer_write(writer, "    <row>", 9);
+	}
+	for(i = 0; i < num; ++i) {
+		ptr = cgps_writer_reserve(writer, CGPS_WRITER_VALUE + 1);
+		if(i) {
+			*ptr++ = '\t';
+			writer->iov[writer->chunk].iov_len++;
+		}
+		writer->iov[writer->chunk].iov_len += cgps_writer_format(ptr, row[i]);
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		cgps_writer_write(writer, "</row>\n", 7);
+	} else {
+		cgps_writer_write(writer, "\n", 1);
+	}
+}
+
+int cgps_writer_close(struct cgps_writer *writer)
+{
+	cgps_writer_flush(writer);
+	free(writer->buff);
+	writer->buff = NULL;
+	return writer->failed ? -1 : 0;
+}
+
+#ifdef HAVE_FOPENCOOKIE
+
+static ssize_t cgps_writer_stream_write(void *cookie, const char *buff, size_t size)
+{
+	cgps_writer_write(cookie, buff, size);
+	return size;
+}
+
+static int cgps_writer_stream_close(void *cookie)
+{
+	int result = cgps_writer_close(cookie);
+
+	free(cookie);
+	return result;
+}
+
+FILE * cgps_writer_stream(FILE *out)
+{
+	cookie_io_functions_t funcs;
+	struct cgps_writer *cookie;
+	FILE *fs;
+
+	if(fileno(out) < 0) {
+		return NULL;
+	}
+	if(!(cookie = malloc(sizeof(struct cgps_writer)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	if(cgps_writer_open(cookie, out) < 0) {
+		free(cookie->buff);
+		free(cookie);
+		return NULL;
+	}
+
+	memset(&funcs, 0, sizeof(cookie_io_functions_t));
+	funcs.write = cgps_writer_stream_write;
+	funcs.close = cgps_writer_stream_close;
+	if(!(fs = fopencookie(cookie, "w", funcs))) {
+		logerr("failed open writer stream");
+		cgps_writer_close(cookie);
+		free(cookie);
+		return NULL;
+	}
+	setvbuf(fs, NULL, _IOFBF, CGPS_WRITER_CHUNK);
+	return fs;
+}
+
+#else  /* ! HAVE_FOPENCOOKIE */
+
+FILE * cgps_writer_stream(FILE *out)
+{
+	return NULL;
+}
+
+#endif  /* HAVE_FOPENCOOKIE */
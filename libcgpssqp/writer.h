@@ -0,0 +1,120 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Buffered writer for numeric results. Rows of values are formatted into
+ * large buffers, bypassing the per value locking and format parsing of
+ * stdio, and emitted on the descriptor of the output stream with writev().
+ * Each value is formatted with the shortest decimal that reads back as the
+ * same float (at most 9 digits). The notation follows "%g", so normal 
+ * values that round-trip with six digits are formatted exactly as "%g".
+ *
+ * The text output of libchemgps (cgps_result()) is passed thru the writer
+ * by a stream from cgps_writer_stream(). Its values are already formatted
+ * (by libchemgps) and are written unchanged.
+ *
+ * The buffer is split in CGPS_WRITER_CHUNKS chunks of CGPS_WRITER_CHUNK 
+ * bytes. A value or string is never split between chunks, the current
+ * chunk is ended when the next one doesn't fit. All chunks are written
+ * using a single writev() when the last chunk is full.
+ *
+ * The output stream is flushed when the writer is opened, and must not be
+ * written to until the writer is closed. Streams without descriptor (i.e.
+ * memory streams) are written using fwrite().
+ *
+ * Include cgpssqp.h before this header.
+ */
+
+#ifndef __WRITER_H__
+#define __WRITER_H__
+
+#include <stdio.h>
+#ifdef HAVE_SYS_UIO_H
+# include <sys/uio.h>
+#endif
+
+#define CGPS_WRITER_CHUNK  65536     /* bytes in each chunk */
+#define CGPS_WRITER_CHUNKS 8         /* chunks in buffer */
+#define CGPS_WRITER_VALUE  16        /* max size of formatted value */
+
+struct cgps_writer
+{
+	FILE *out;            /* output stream */
+	int fd;               /* descriptor of out (-1 if none) */
+	char *buff;           /* the chunks */
+	struct iovec iov[CGPS_WRITER_CHUNKS];
+	int chunk;            /* current chunk */
+	int failed;           /* write error */
+};
+
+/*
+ * Format value as the shortest round-trip decimal in buff (at least 
+ * CGPS_WRITER_VALUE bytes). Returns number of bytes written (not NUL
+ * terminated).
+ */
+int cgps_writer_format(char *buff, float value);
+
+/*
+ * Open writer on stream out. Returns -1 on failure.
+ */
+int cgps_writer_open(struct cgps_writer *writer, FILE *out);
+
+/*
+ * Append len bytes of str.
+ */
+void cgps_writer_write(struct cgps_writer *writer, const char *str, size_t len);
+
+/*
+ * Append the string str.
+ */
+#define cgps_writer_puts(writer, str) cgps_writer_write(writer, str, strlen(str))
+
+/*
+ * Append row of num values (tab separated) in format (see 
+ * CGPS_OUTPUT_FORMAT_XXX), including the row tags and newline.
+ */
+void cgps_writer_row(struct cgps_writer *writer, const float *row, int num, int format);
+
+/*
+ * Write the buffered output. Returns -1 on failure.
+ */
+int cgps_writer_flush(struct cgps_writer *writer);
+
+/*
+ * Flush and release the writer. Returns -1 if any write failed.
+ */
+int cgps_writer_close(struct cgps_writer *writer);
+
+/*
+ * Open a stream writing thru a writer on out (i.e. for cgps_result()). The
+ * writer is flushed and released when the stream is closed, and out must
+ * not be used until then. Returns NULL if not supported, if out has no
+ * descriptor (i.e. a memory stream) or on failure. Use out direct then.
+ */
+FILE * cgps_writer_stream(FILE *out);
+
+#endif /* __WRITER_H__ */
@@ -0,0 +1,245 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Stub of the libchemgps and SIMCA-QP interface. This header replaces
+ * the real chemgps.h when configured with --enable-stub, so that the
+ * daemon, client and utilities can be built, profiled and tested on
+ * systems without a SIMCA-QP license.
+ *
+ * The "project file" loaded by the stub is a plain text file describing
+ * a set of synthetic linear models (see libcgpsstub/README).
+ */
+
+#ifndef __CHEMGPS_H__
+#define __CHEMGPS_H__
+
+#include <stdio.h>
+
+#define CGPS_STUB_BACKEND 1
+
+/*
+ * Containers from the SIMCA-QP C interface (SQXCInterface.h). Indexes
+ * are one-based just like in the real library. The functions returns
+ * non-zero on success and zero on failure.
+ */
+typedef struct
+{
+	float *data;
+	int rows;
+	int cols;
+} SQX_FloatMatrix;
+
+typedef struct
+{
+	char **data;
+	int rows;
+	int cols;
+} SQX_StringMatrix;
+
+typedef struct
+{
+	char **data;
+	int size;
+} SQX_StringVector;
+
+typedef struct
+{
+	float *data;
+	int size;
+} SQX_FloatVector;
+
+int SQX_InitFloatMatrix(SQX_FloatMatrix *matrix, int rows, int cols);
+int SQX_SetDataInFloatMatrix(SQX_FloatMatrix *matrix, int row, int col, float value);
+int SQX_GetDataFromFloatMatrix(SQX_FloatMatrix *matrix, int row, int col, float *value);
+int SQX_GetNumRowsInFloatMatrix(SQX_FloatMatrix *matrix);
+int SQX_GetNumColumnsInFloatMatrix(SQX_FloatMatrix *matrix);
+void SQX_ClearFloatMatrix(SQX_FloatMatrix *matrix);
+
+int SQX_InitStringVector(SQX_StringVector *vector, int size);
+int SQX_SetStringInVector(SQX_StringVector *vector, int pos, const char *str);
+int SQX_GetStringFromVector(SQX_StringVector *vector, int pos, const char **str);
+int SQX_GetNumStringsInVector(SQX_StringVector *vector);
+void SQX_ClearStringVector(SQX_StringVector *vector);
+
+int SQX_InitFloatVector(SQX_FloatVector *vector, int size);
+int SQX_SetDataInFloatVector(SQX_FloatVector *vector, int pos, float value);
+int SQX_GetDataFromFloatVector(SQX_FloatVector *vector, int pos, float *value);
+void SQX_ClearFloatVector(SQX_FloatVector *vector);
+
+/*
+ * Output formats.
+ */
+#define CGPS_OUTPUT_FORMAT_PLAIN   1
+#define CGPS_OUTPUT_FORMAT_XML     2
+#define CGPS_OUTPUT_FORMAT_DEFAULT CGPS_OUTPUT_FORMAT_PLAIN
+
+/*
+ * Default number of observations (rows) in input data.
+ */
+#define DEFAULT_NUMBER_OBSERVATIONS 1
+
+/*
+ * Type of data requested from the indata callback.
+ */
+#define CGPS_GET_QUANTITATIVE_DATA 1
+#define CGPS_GET_QUALITATIVE_DATA  2
+#define CGPS_GET_QUAL_LAGGED_DATA  3
+#define CGPS_GET_LAG_PARENTS_DATA  4
+
+/*
+ * The prediction results.
+ */
+enum PREDICTED_RESULTS {
+	PREDICTED_RESULTS_NONE = 0,
+	PREDICTED_CONTRIB_SSW,
+	PREDICTED_CONTRIB_SSW_GROUP,
+	PREDICTED_CONTRIB_SMW,
+	PREDICTED_CONTRIB_SMW_GROUP,
+	PREDICTED_CONTRIB_DMOD_X,
+	PREDICTED_CONTRIB_DMOD_X_GROUP,
+	PREDICTED_DMOD_X_PS,
+	PREDICTED_DMOD_X_PS_COMB,
+	PREDICTED_PMOD_X_PS,
+	PREDICTED_PMOD_X_COMB_PS,
+	PREDICTED_TPS,
+	PREDICTED_TCV_PS,
+	PREDICTED_TCV_SEPS,
+	PREDICTED_TCV_SED_FPS,
+	PREDICTED_T2_RANGE_PS,
+	PREDICTED_X_OBS_RES_PS,
+	PREDICTED_X_OBS_PRED_PS,
+	PREDICTED_X_VAR_PS,
+	PREDICTED_X_VAR_RES_PS,
+	PREDICTED_SERR_LPS,
+	PREDICTED_SERR_UPS,
+	PREDICTED_Y_PRED_PS,
+	PREDICTED_Y_PRED_CV_CONF_INT_PS,
+	PREDICTED_Y_CV_PS,
+	PREDICTED_Y_CV_SEPS,
+	PREDICTED_Y_OBS_RES_PS,
+	PREDICTED_Y_VAR_PS,
+	PREDICTED_Y_VAR_RES_PS,
+	PREDICTED_RESULTS_ALL,
+	PREDICTED_RESULTS_LAST
+};
+
+#define cgps_result_setopt(mask, value) ((mask) |= (1 << (value)))
+#define cgps_result_isset(mask, value)  ((mask) & (1 << (value)))
+#define cgps_result_setall(mask)        ((mask) = ~(1 << PREDICTED_RESULTS_NONE))
+
+struct cgps_result_entry
+{
+	int value;
+	const char *name;
+	const char *desc;
+};
+
+extern const struct cgps_result_entry cgps_result_entry_list[];
+
+const struct cgps_result_entry * cgps_result_entry_value(const char *name);
+const struct cgps_result_entry * cgps_result_entry_name(int value);
+
+struct cgps_project;
+
+typedef void (*cgps_syslog_callback)(void *opts, int errcode, int level, const char *file, unsigned int line, const char *fmt, ...);
+typedef int (*cgps_indata_callback)(struct cgps_project *proj, void *data, SQX_FloatMatrix *fmx, SQX_StringMatrix *smx, SQX_StringVector *names, int type);
+
+/*
+ * Library options. The leading members should match struct options
+ * (see cgpssqp.h) as the logger callback is passed a pointer to this
+ * struct.
+ */
+struct cgps_options
+{
+	const char *prog;
+	int syslog;
+	int debug;
+	int verbose;
+	int batch;
+	int quiet;
+	char *logfile;
+	int result;
+	int format;
+	cgps_syslog_callback logger;
+	cgps_indata_callback indata;
+};
+
+/*
+ * A synthetic model (PCA when ycols is zero, otherwise PLS).
+ */
+struct cgps_stub_model
+{
+	int comps;            /* number of components */
+	int ycols;            /* number of responses */
+	float *mean;          /* centering (per variable) */
+	float *scale;         /* scaling weights (per variable) */
+	float *load;          /* loadings (comps x variables, row major) */
+	float *eigen;         /* score variance (per component) */
+	float *yload;         /* y-loadings (comps x ycols, row major) */
+};
+
+struct cgps_project
+{
+	const char *name;
+	void *handle;
+	int models;
+	struct cgps_options *opts;
+	SQX_StringVector names;          /* quantitative variable names */
+	struct cgps_stub_model *model;   /* synthetic models */
+	unsigned int latency;            /* simulated predict latency (us) */
+	unsigned int rowcost;            /* simulated per row latency (ns) */
+};
+
+struct cgps_predict
+{
+	void *handle;
+	void *data;                      /* indata callback argument */
+	SQX_FloatMatrix fmx;             /* observations */
+	SQX_FloatMatrix tps;             /* predicted scores */
+	int model;                       /* predicted model (index) */
+};
+
+struct cgps_result
+{
+	FILE *out;
+};
+
+int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_options *opts);
+void cgps_project_close(struct cgps_project *proj);
+
+int cgps_predict_init(struct cgps_project *proj, struct cgps_predict *pred, void *data);
+int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred);
+void cgps_predict_cleanup(struct cgps_project *proj, struct cgps_predict *pred);
+
+int cgps_result_init(struct cgps_project *proj, struct cgps_result *res);
+int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, FILE *out);
+void cgps_result_cleanup(struct cgps_project *proj, struct cgps_result *res);
+
+const char * cgps_simcaq_error(void);
+
+#endif /* __CHEMGPS_H__ */
@@ -0,0 +1,514 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Stub of the libchemgps prediction API. The models are synthetic linear
+ * projections generated from a seed, so results are deterministic for a
+ * given project file. See libcgpsstub/README for the project file format.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYSLOG_H
+# include <syslog.h>
+#endif
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "chemgps.h"
+
+#define STUB_DEFAULT_MODELS     1
+#define STUB_DEFAULT_VARIABLES  35
+#define STUB_DEFAULT_COMPONENTS 4
+#define STUB_DEFAULT_SEED       1
+
+static __thread const char *stub_error = "no error";
+
+#define stub_logerr(proj, fmt, args...) do { \
+	if((proj)->opts && (proj)->opts->logger) { \
+		(proj)->opts->logger((proj)->opts, 0, LOG_ERR, __FILE__, __LINE__, (fmt), ## args); \
+	} \
+} while(0)
+
+#define stub_debug(proj, fmt, args...) do { \
+	if((proj)->opts && (proj)->opts->logger && (proj)->opts->debug) { \
+		(proj)->opts->logger((proj)->opts, 0, LOG_DEBUG, __FILE__, __LINE__, (fmt), ## args); \
+	} \
+} while(0)
+
+const char * cgps_simcaq_error(void)
+{
+	return stub_error;
+}
+
+/*
+ * Deterministic pseudo random number in range [-1, 1).
+ */
+static float stub_random(unsigned long *state)
+{
+	*state = *state * 6364136223846793005UL + 1442695040888963407UL;
+	return (float)((*state >> 33) & 0xffffff) / (float)0x800000 - 1.0f;
+}
+
+/*
+ * Create synthetic model with orthonormal loadings (Gram-Schmidt).
+ */
+static int stub_model_create(struct cgps_stub_model *model, int vars, int comps, int ycols, unsigned long seed)
+{
+	int a, b, j;
+
+	memset(model, 0, sizeof(struct cgps_stub_model));
+	model->comps = comps;
+	model->ycols = ycols;
+	model->mean  = malloc(vars * sizeof(float));
+	model->scale = malloc(vars * sizeof(float));
+	model->load  = malloc(comps * vars * sizeof(float));
+	model->eigen = malloc(comps * sizeof(float));
+	model->yload = malloc((comps * ycols + 1) * sizeof(float));
+	if(!model->mean || !model->scale || !model->load || !model->eigen || !model->yload) {
+		return -1;
+	}
+
+	for(j = 0; j < vars; ++j) {
+		model->mean[j]  = 10.0f * stub_random(&seed);
+		model->scale[j] = 1.0f / (1.5f + stub_random(&seed));
+	}
+	for(a = 0; a < comps; ++a) {
+		float *p = model->load + a * vars;
+		double norm = 0.0;
+
+		for(j = 0; j < vars; ++j) {
+			p[j] = stub_random(&seed);
+		}
+		for(b = 0; b < a; ++b) {
+			const float *q = model->load + b * vars;
+			double dot = 0.0;
+			for(j = 0; j < vars; ++j) {
+				dot += p[j] * q[j];
+			}
+			for(j = 0; j < vars; ++j) {
+				p[j] -= dot * q[j];
+			}
+		}
+		for(j = 0; j < vars; ++j) {
+			norm += p[j] * p[j];
+		}
+		norm = sqrt(norm);
+		for(j = 0; j < vars; ++j) {
+			p[j] = norm > 0.0 ? p[j] / norm : 0.0f;
+		}
+		model->eigen[a] = (float)vars / (a + 1);
+	}
+	for(a = 0; a < comps * ycols; ++a) {
+		model->yload[a] = stub_random(&seed);
+	}
+	return 0;
+}
+
+static void stub_model_destroy(struct cgps_stub_model *model)
+{
+	free(model->mean);
+	free(model->scale);
+	free(model->load);
+	free(model->eigen);
+	free(model->yload);
+}
+
+/*
+ * Load synthetic project. The project file is a list of 'key: value' lines.
+ */
+int cgps_project_load(struct cgps_project *proj, const char *path, struct cgps_options *opts)
+{
+	FILE *fs;
+	char *buff = NULL, *names = NULL;
+	size_t size = 0;
+	int vars = STUB_DEFAULT_VARIABLES, comps = STUB_DEFAULT_COMPONENTS, ycols = 0;
+	unsigned long seed = STUB_DEFAULT_SEED;
+	int i;
+
+	memset(proj, 0, sizeof(struct cgps_project));
+	proj->name = path;
+	proj->opts = opts;
+	proj->models = STUB_DEFAULT_MODELS;
+
+	if(!(fs = fopen(path, "r"))) {
+		stub_error = "failed open project file";
+		stub_logerr(proj, "failed open project %s (%s)", path, strerror(errno));
+		return -1;
+	}
+	while(getline(&buff, &size, fs) != -1) {
+		char *key = buff, *val;
+
+		buff[strcspn(buff, "\r\n")] = '\0';
+		if(*key == '#' || !(val = strchr(key, ':'))) {
+			continue;
+		}
+		*val++ = '\0';
+		val += strspn(val, " \t");
+
+		if(strcmp(key, "models") == 0) {
+			proj->models = atoi(val);
+		} else if(strcmp(key, "variables") == 0) {
+			vars = atoi(val);
+		} else if(strcmp(key, "components") == 0) {
+			comps = atoi(val);
+		} else if(strcmp(key, "responses") == 0) {
+			ycols = atoi(val);
+		} else if(strcmp(key, "latency") == 0) {
+			proj->latency = strtoul(val, NULL, 10);
+		} else if(strcmp(key, "rowcost") == 0) {
+			proj->rowcost = strtoul(val, NULL, 10);
+		} else if(strcmp(key, "seed") == 0) {
+			seed = strtoul(val, NULL, 10);
+		} else if(strcmp(key, "names") == 0) {
+			free(names);
+			names = strdup(val);
+		}
+	}
+	free(buff);
+	fclose(fs);
+
+	if(names) {
+		char *save, *name;
+		vars = 0;
+		for(name = names; *name; ) {
+			name += strspn(name, " \t,");
+			if(*name) {
+				++vars;
+				name += strcspn(name, " \t,");
+			}
+		}
+		SQX_InitStringVector(&proj->names, vars);
+		for(i = 1, name = strtok_r(names, " \t,", &save); name; name = strtok_r(NULL, " \t,", &save)) {
+			SQX_SetStringInVector(&proj->names, i++, name);
+		}
+		free(names);
+	} else {
+		SQX_InitStringVector(&proj->names, vars);
+		for(i = 1; i <= vars; ++i) {
+			char name[32];
+			snprintf(name, sizeof(name), "var%d", i);
+			SQX_SetStringInVector(&proj->names, i, name);
+		}
+	}
+
+	if(proj->models < 1 || vars < 1 || comps < 1 || comps > vars || ycols < 0) {
+		stub_error = "invalid project parameters";
+		stub_logerr(proj, "invalid project %s (models=%d, variables=%d, components=%d)",
+			    path, proj->models, vars, comps);
+		SQX_ClearStringVector(&proj->names);
+		return -1;
+	}
+
+	proj->model = calloc(proj->models, sizeof(struct cgps_stub_model));
+	if(!proj->model) {
+		stub_error = "out of memory";
+		return -1;
+	}
+	for(i = 0; i < proj->models; ++i) {
+		if(stub_model_create(&proj->model[i], vars, comps, ycols, seed + i) < 0) {
+			stub_error = "out of memory";
+			return -1;
+		}
+	}
+	proj->handle = proj->model;
+
+	stub_debug(proj, "loaded stub project %s (models=%d, variables=%d, components=%d, responses=%d)",
+		   path, proj->models, vars, comps, ycols);
+	return 0;
+}
+
+void cgps_project_close(struct cgps_project *proj)
+{
+	int i;
+
+	if(proj->model) {
+		for(i = 0; i < proj->models; ++i) {
+			stub_model_destroy(&proj->model[i]);
+		}
+		free(proj->model);
+		proj->model = NULL;
+	}
+	SQX_ClearStringVector(&proj->names);
+	proj->handle = NULL;
+}
+
+/*
+ * Prepare for prediction. Loads the observations thru the indata callback.
+ */
+int cgps_predict_init(struct cgps_project *proj, struct cgps_predict *pred, void *data)
+{
+	memset(pred, 0, sizeof(struct cgps_predict));
+	pred->data = data;
+	pred->handle = proj->handle;
+
+	if(!proj->opts || !proj->opts->indata) {
+		stub_error = "no indata callback";
+		return -1;
+	}
+	if(proj->opts->indata(proj, data, &pred->fmx, NULL, &proj->names, CGPS_GET_QUANTITATIVE_DATA) < 0) {
+		stub_error = "failed load data";
+		SQX_ClearFloatMatrix(&pred->fmx);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Standardize observation i into z (length vars).
+ */
+static void stub_standardize(const struct cgps_stub_model *model, const SQX_FloatMatrix *fmx, int i, float *z)
+{
+	int j;
+
+	for(j = 0; j < fmx->cols; ++j) {
+		z[j] = (fmx->data[i * fmx->cols + j] - model->mean[j]) * model->scale[j];
+	}
+}
+
+/*
+ * Predict scores for model index (one-based). Returns the model number.
+ */
+int cgps_predict(struct cgps_project *proj, int index, struct cgps_predict *pred)
+{
+	const struct cgps_stub_model *model;
+	float *z;
+	int i, j, a;
+
+	if(index < 1 || index > proj->models) {
+		stub_error = "invalid model index";
+		return -1;
+	}
+	if(!pred->fmx.data) {
+		stub_error = "no data loaded";
+		return -1;
+	}
+	model = &proj->model[index - 1];
+
+	if(proj->latency || proj->rowcost) {
+		struct timespec ts;
+		unsigned long long ns = proj->latency * 1000ULL + (unsigned long long)proj->rowcost * pred->fmx.rows;
+		ts.tv_sec  = ns / 1000000000ULL;
+		ts.tv_nsec = ns % 1000000000ULL;
+		nanosleep(&ts, NULL);
+	}
+
+	SQX_ClearFloatMatrix(&pred->tps);
+	if(!SQX_InitFloatMatrix(&pred->tps, pred->fmx.rows, model->comps)) {
+		stub_error = "out of memory";
+		return -1;
+	}
+	if(!(z = malloc((pred->fmx.cols + 1) * sizeof(float)))) {
+		stub_error = "out of memory";
+		return -1;
+	}
+	for(i = 0; i < pred->fmx.rows; ++i) {
+		stub_standardize(model, &pred->fmx, i, z);
+		for(a = 0; a < model->comps; ++a) {
+			const float *p = model->load + a * pred->fmx.cols;
+			float t = 0.0f;
+			for(j = 0; j < pred->fmx.cols; ++j) {
+				t += z[j] * p[j];
+			}
+			pred->tps.data[i * model->comps + a] = t;
+		}
+	}
+	free(z);
+
+	pred->model = index;
+	return index;
+}
+
+void cgps_predict_cleanup(struct cgps_project *proj, struct cgps_predict *pred)
+{
+	SQX_ClearFloatMatrix(&pred->fmx);
+	SQX_ClearFloatMatrix(&pred->tps);
+	pred->handle = NULL;
+	if(proj) {}
+}
+
+int cgps_result_init(struct cgps_project *proj, struct cgps_result *res)
+{
+	if(!proj->handle) {
+		stub_error = "project not loaded";
+		return -1;
+	}
+	if(!res->out) {
+		res->out = stdout;
+	}
+	return 0;
+}
+
+/*
+ * Compute one result row (values stored in row, number of values returned).
+ */
+static int stub_result_row(const struct cgps_stub_model *model, const struct cgps_predict *pred, int i, int type, float *z, float *row)
+{
+	const float *t = pred->tps.data + i * model->comps;
+	int vars = pred->fmx.cols;
+	int a, j, k;
+	double sum;
+
+	switch(type) {
+	case PREDICTED_TPS:
+	case PREDICTED_TCV_PS:
+		memcpy(row, t, model->comps * sizeof(float));
+		return model->comps;
+	case PREDICTED_T2_RANGE_PS:
+		for(sum = 0.0, a = 0; a < model->comps; ++a) {
+			sum += t[a] * t[a] / model->eigen[a];
+		}
+		row[0] = sum;
+		return 1;
+	case PREDICTED_X_OBS_PRED_PS:
+	case PREDICTED_X_OBS_RES_PS:
+	case PREDICTED_DMOD_X_PS:
+	case PREDICTED_DMOD_X_PS_COMB:
+	case PREDICTED_PMOD_X_PS:
+	case PREDICTED_PMOD_X_COMB_PS:
+		stub_standardize(model, &pred->fmx, i, z);
+		for(sum = 0.0, j = 0; j < vars; ++j) {
+			float xhat = 0.0f;
+			for(a = 0; a < model->comps; ++a) {
+				xhat += t[a] * model->load[a * vars + j];
+			}
+			if(type == PREDICTED_X_OBS_PRED_PS) {
+				row[j] = xhat / model->scale[j] + model->mean[j];
+			} else {
+				row[j] = z[j] - xhat;
+			}
+			sum += (z[j] - xhat) * (z[j] - xhat);
+		}
+		if(type == PREDICTED_X_OBS_PRED_PS || type == PREDICTED_X_OBS_RES_PS) {
+			return vars;
+		}
+		row[0] = vars > model->comps ? sqrt(sum / (vars - model->comps)) : 0.0;
+		if(type == PREDICTED_PMOD_X_PS || type == PREDICTED_PMOD_X_COMB_PS) {
+			row[0] = exp(-row[0]);
+		}
+		return 1;
+	case PREDICTED_Y_PRED_PS:
+	case PREDICTED_Y_CV_PS:
+		for(k = 0; k < model->ycols; ++k) {
+			for(sum = 0.0, a = 0; a < model->comps; ++a) {
+				sum += t[a] * model->yload[a * model->ycols + k];
+			}
+			row[k] = sum;
+		}
+		return model->ycols;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Write the requested results for model.
+ */
+int cgps_result(struct cgps_project *proj, int model, struct cgps_predict *pred, struct cgps_result *res, FILE *out)
+{
+	const struct cgps_result_entry *entry;
+	const struct cgps_stub_model *mod;
+	float *row, *z;
+	int i, j, n, format;
+
+	if(model < 1 || model > proj->models || !pred->tps.data) {
+		stub_error = "no prediction";
+		return -1;
+	}
+	mod = &proj->model[model - 1];
+	format = proj->opts->format ? proj->opts->format : CGPS_OUTPUT_FORMAT_DEFAULT;
+	if(!out) {
+		out = res->out ? res->out : stdout;
+	}
+
+	row = malloc((pred->fmx.cols + mod->comps + mod->ycols + 1) * sizeof(float));
+	z   = malloc((pred->fmx.cols + 1) * sizeof(float));
+	if(!row || !z) {
+		free(row);
+		free(z);
+		stub_error = "out of memory";
+		return -1;
+	}
+
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(out, "<model index=\"%d\">\n", model);
+	}
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(entry->value == PREDICTED_RESULTS_ALL || !cgps_result_isset(proj->opts->result, entry->value)) {
+			continue;
+		}
+		if(stub_result_row(mod, pred, 0, entry->value, z, row) < 0) {
+			stub_debug(proj, "result %s is not supported by stub backend", entry->name);
+			continue;
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(out, "  <result name=\"%s\" desc=\"%s\">\n", entry->name, entry->desc);
+		} else {
+			fprintf(out, "%s (%s):\n", entry->desc, entry->name);
+		}
+		for(i = 0; i < pred->fmx.rows; ++i) {
+			n = stub_result_row(mod, pred, i, entry->value, z, row);
+			if(format == CGPS_OUTPUT_FORMAT_XML) {
+				fprintf(out, "    <row>");
+			}
+			for(j = 0; j < n; ++j) {
+				fprintf(out, j ? "\t%g" : "%g", row[j]);
+			}
+			fprintf(out, format == CGPS_OUTPUT_FORMAT_XML ? "</row>\n" : "\n");
+		}
+		if(format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(out, "  </result>\n");
+		} else {
+			fprintf(out, "\n");
+		}
+	}
+	if(format == CGPS_OUTPUT_FORMAT_XML) {
+		fprintf(out, "</model>\n");
+	}
+
+	free(row);
+	free(z);
+	return 0;
+}
+
+void cgps_result_cleanup(struct cgps_project *proj, struct cgps_result *res)
+{
+	if(proj && res) {}
+}
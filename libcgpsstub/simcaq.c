@@ -0,0 +1,194 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ *
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Stub of the SIMCA-QP containers (matrices and vectors).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
+#include "chemgps.h"
+
+int SQX_InitFloatMatrix(SQX_FloatMatrix *matrix, int rows, int cols)
+{
+	if(rows < 0 || cols < 0) {
+		return 0;
+	}
+	matrix->data = calloc((size_t)rows * cols + 1, sizeof(float));
+	if(!matrix->data) {
+		return 0;
+	}
+	matrix->rows = rows;
+	matrix->cols = cols;
+	return 1;
+}
+
+int SQX_SetDataInFloatMatrix(SQX_FloatMatrix *matrix, int row, int col, float value)
+{
+	if(row < 1 || row > matrix->rows || col < 1 || col > matrix->cols) {
+		return 0;
+	}
+	matrix->data[(row - 1) * matrix->cols + col - 1] = value;
+	return 1;
+}
+
+int SQX_GetDataFromFloatMatrix(SQX_FloatMatrix *matrix, int row, int col, float *value)
+{
+	if(row < 1 || row > matrix->rows || col < 1 || col > matrix->cols) {
+		return 0;
+	}
+	*value = matrix->data[(row - 1) * matrix->cols + col - 1];
+	return 1;
+}
+
+int SQX_GetNumRowsInFloatMatrix(SQX_FloatMatrix *matrix)
+{
+	return matrix->rows;
+}
+
+int SQX_GetNumColumnsInFloatMatrix(SQX_FloatMatrix *matrix)
+{
+	return matrix->cols;
+}
+
+void SQX_ClearFloatMatrix(SQX_FloatMatrix *matrix)
+{
+	if(matrix->data) {
+		free(matrix->data);
+	}
+	matrix->data = NULL;
+	matrix->rows = matrix->cols = 0;
+}
+
+int SQX_InitStringVector(SQX_StringVector *vector, int size)
+{
+	if(size < 0) {
+		return 0;
+	}
+	vector->data = calloc(size + 1, sizeof(char *));
+	if(!vector->data) {
+		return 0;
+	}
+	vector->size = size;
+	return 1;
+}
+
+int SQX_SetStringInVector(SQX_StringVector *vector, int pos, const char *str)
+{
+	char *copy;
+
+	if(pos < 1 || pos > vector->size) {
+		return 0;
+	}
+	if(!(copy = strdup(str))) {
+		return 0;
+	}
+	if(vector->data[pos - 1]) {
+		free(vector->data[pos - 1]);
+	}
+	vector->data[pos - 1] = copy;
+	return 1;
+}
+
+int SQX_GetStringFromVector(SQX_StringVector *vector, int pos, const char **str)
+{
+	if(pos < 1 || pos > vector->size) {
+		return 0;
+	}
+	*str = vector->data[pos - 1];
+	return 1;
+}
+
+int SQX_GetNumStringsInVector(SQX_StringVector *vector)
+{
+	return vector->size;
+}
+
+void SQX_ClearStringVector(SQX_StringVector *vector)
+{
+	int i;
+
+	if(vector->data) {
+		for(i = 0; i < vector->size; ++i) {
+			if(vector->data[i]) {
+				free(vector->data[i]);
+			}
+		}
+		free(vector->data);
+	}
+	vector->data = NULL;
+	vector->size = 0;
+}
+
+int SQX_InitFloatVector(SQX_FloatVector *vector, int size)
+{
+	if(size < 0) {
+		return 0;
+	}
+	vector->data = calloc(size + 1, sizeof(float));
+	if(!vector->data) {
+		return 0;
+	}
+	vector->size = size;
+	return 1;
+}
+
+int SQX_SetDataInFloatVector(SQX_FloatVector *vector, int pos, float value)
+{
+	if(pos < 1 || pos > vector->size) {
+		return 0;
+	}
+	vector->data[pos - 1] = value;
+	return 1;
+}
+
+int SQX_GetDataFromFloatVector(SQX_FloatVector *vector, int pos, float *value)
+{
+	if(pos < 1 || pos > vector->size) {
+		return 0;
+	}
+	*value = vector->data[pos - 1];
+	return 1;
+}
+
+void SQX_ClearFloatVector(SQX_FloatVector *vector)
+{
+	if(vector->data) {
+		free(vector->data);
+	}
+	vector->data = NULL;
+	vector->size = 0;
+}
@@ -0,0 +1,143 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef __CGPSBENCH_H__
+#define __CGPSBENCH_H__
+
+#include <stdio.h>
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+
+#define CGPS_NO_EXTERN_PROTOTYPE
+
+#include "hdr.h"
+
+#define CGPSBENCH_RATES     "100,500"    /* arrival rates (requests/sec) */
+#define CGPSBENCH_ROWS      "1,100"      /* rows in each request */
+#define CGPSBENCH_RESULTS   "tps"        /* result sets */
+#define CGPSBENCH_DURATION  10           /* seconds per scenario */
+#define CGPSBENCH_CONNS     64           /* connection slots */
+#define CGPSBENCH_VARIABLES 35           /* columns in synthetic data */
+#define CGPSBENCH_TIMEOUT   30           /* request timeout (seconds) */
+#define CGPSBENCH_STARTUP   100          /* wait for daemon (x 100ms) */
+#define CGPSBENCH_HOST      "127.0.0.1"  /* started daemon listen address */
+
+#define CGPSBENCH_HDR_LOWEST  1LL              /* 1 us */
+#define CGPSBENCH_HDR_HIGHEST 3600000000LL     /* 1 hour (us) */
+#define CGPSBENCH_HDR_SIGFIGS 3
+
+struct cgpsbench
+{
+	struct options *opts;
+	char *daemon;            /* start this cgpsd binary */
+	char *rates;             /* arrival rates (list) */
+	char *rows;              /* rows per request (list) */
+	char *results;           /* result sets (list) */
+	int duration;            /* seconds per scenario */
+	int conns;               /* connection slots */
+	int variables;           /* columns in synthetic data */
+	pid_t pid;               /* the started daemon */
+	char *header;            /* sample data header */
+	char **sample;           /* sample data rows */
+	int nsample;
+	FILE *report;            /* the report file */
+};
+
+/*
+ * One benchmark scenario (a transport, arrival rate, number of rows and 
+ * result set) and its outcome.
+ */
+struct scenario
+{
+	const char *transport;   /* unix or tcp */
+	const char *endpoint;    /* libcgpsclt endpoint */
+	double rate;             /* arrival rate (requests/sec) */
+	int rows;                /* rows in each request */
+	const char *result;      /* result set */
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	struct hdr_histogram hist;
+	unsigned long sent;      /* submitted requests */
+	unsigned long completed; /* successful requests */
+	unsigned long failed;    /* failed requests */
+	int pending;             /* outstanding requests */
+	long long start;         /* start of scenario (us) */
+	long long finish;        /* last completed request (us) */
+};
+
+/*
+ * Read command line options.
+ */
+void parse_options(int argc, char **argv, struct cgpsbench *bench);
+
+/*
+ * Start and stop the cgpsd daemon. The start function returns when the
+ * daemon accepts connections on all endpoints.
+ */
+int bench_daemon_start(struct cgpsbench *bench);
+int bench_daemon_exited(struct cgpsbench *bench);
+void bench_daemon_stop(struct cgpsbench *bench);
+
+/*
+ * Wait until the endpoint answers a prediction request.
+ */
+int bench_wait_ready(struct cgpsbench *bench, const char *endpoint);
+
+/*
+ * Load sample data rows from file (the --data option).
+ */
+int bench_load_sample(struct cgpsbench *bench, const char *path);
+
+/*
+ * Build request data with rows observations. The sample rows are repeated
+ * if needed, otherwise synthetic (but deterministic) data is generated.
+ */
+char * bench_data(struct cgpsbench *bench, int rows, size_t *size);
+
+/*
+ * Run scenario. The request are sent at fixed intervals (open loop) and
+ * their latency is measured from the time they were scheduled, so that
+ * the queueing delay of a saturated daemon is included.
+ */
+int bench_run(struct cgpsbench *bench, struct scenario *scen);
+
+/*
+ * Write scenario result to report file and summary to stdout.
+ */
+void bench_report_header(struct cgpsbench *bench);
+void bench_report(struct cgpsbench *bench, struct scenario *scen);
+
+/*
+ * Returns monotonic clock (us).
+ */
+long long bench_clock(void);
+
+#endif /* __CGPSBENCH_H__ */
@@ -0,0 +1,459 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Benchmark of the stream compression (libcgpssqp/compress.c) of the 
+ * CGPSP protocol. Each request sends the input data and receives a result
+ * over a socket pair, through the same streams as used by cgpsd and 
+ * cgpsclt (uncompressed or compressed with each supported method). The
+ * bytes on the wire in each direction and the CPU time per request (both
+ * ends) are reported. The data is compared after the round trip.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#include <sys/resource.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <time.h>
+#include <chemgps.h>
+
+#include "cgpssqp.h"
+#include "compress.h"
+
+#define COMPRESS_REQUESTS 100        /* requests for each method */
+#define COMPRESS_ROWS     1000       /* rows of input data */
+#define COMPRESS_COLUMNS  300        /* variables of input data */
+#define COMPRESS_RESULTS  5          /* values in each result row */
+
+struct options *opts;
+
+struct bench_compress
+{
+	int requests;
+	int rows;
+	int cols;
+	const char *data;
+	char *input;          /* input data (client -> server) */
+	size_t insize;
+	char *result;         /* result (server -> client) */
+	size_t ressize;
+};
+
+/*
+ * One end of the socket pair.
+ */
+struct bench_peer
+{
+	const struct bench_compress *bc;
+	int sock;
+	int method;
+	uint64_t wirein;
+	uint64_t wireout;
+	int failed;
+};
+
+static uint64_t bench_state = 0x9e3779b97f4a7c15ULL;
+
+/*
+ * The xorshift64* generator (deterministic for comparable runs).
+ */
+static uint64_t bench_random(void)
+{
+	bench_state ^= bench_state >> 12;
+	bench_state ^= bench_state << 25;
+	bench_state ^= bench_state >> 27;
+	return bench_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double bench_uniform(double min, double max)
+{
+	return min + (max - min) * ((double)(bench_random() >> 11) / (1ULL << 53));
+}
+
+static double bench_time(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/*
+ * Returns user and system CPU time of the process (both ends).
+ */
+static double bench_cpu(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1.0e6 + 
+		ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1.0e6;
+}
+
+/*
+ * Read input data from file or synthesize rows of descriptors (like the 
+ * text input sent by cgpsclt). The result is rows of plain result values.
+ */
+static void bench_data(struct bench_compress *bc)
+{
+	FILE *fs;
+	int i, j;
+
+	if(bc->data) {
+		if(!(fs = fopen(bc->data, "r"))) {
+			die("failed open data file %s", bc->data);
+		}
+		fseek(fs, 0, SEEK_END);
+		bc->insize = ftell(fs);
+		rewind(fs);
+		if(!(bc->input = malloc(bc->insize))) {
+			die("failed alloc memory");
+		}
+		if(fread(bc->input, 1, bc->insize, fs) != bc->insize) {
+			die("failed read data file %s", bc->data);
+		}
+		fclose(fs);
+		for(bc->rows = 0, i = 0; (size_t)i < bc->insize; ++i) {
+			if(bc->input[i] == '\n') {
+				++bc->rows;
+			}
+		}
+	} else {
+		if(!(fs = open_memstream(&bc->input, &bc->insize))) {
+			die("failed open memory stream");
+		}
+		for(i = 0; i < bc->rows; ++i) {
+			for(j = 0; j < bc->cols; ++j) {
+				fprintf(fs, j ? " %.3f" : "%.3f", bench_uniform(-5.0, 15.0));
+			}
+			fprintf(fs, "\n");
+		}
+		fclose(fs);
+	}
+
+	if(!(fs = open_memstream(&bc->result, &bc->ressize))) {
+		die("failed open memory stream");
+	}
+	fprintf(fs, "Predicted TPS (tps):\n");
+	for(i = 0; i < bc->rows; ++i) {
+		for(j = 0; j < COMPRESS_RESULTS; ++j) {
+			fprintf(fs, j ? "\t%g" : "%g", (float)bench_uniform(-10.0, 10.0));
+		}
+		fprintf(fs, "\n");
+	}
+	fclose(fs);
+}
+
+/*
+ * Open the stream of peer (plain or compressed).
+ */
+static FILE * bench_open(struct bench_peer *peer, struct cgps_compress **comp)
+{
+	FILE *fs;
+	int fd;
+
+	*comp = NULL;
+	if((fd = dup(peer->sock)) < 0) {
+		die("failed duplicate socket");
+	}
+	if(peer->method == CGPS_COMPRESS_NONE) {
+		fs = fdopen(fd, "r+");
+	} else {
+		fs = cgps_compress_open(fd, peer->method, comp);
+	}
+	if(!fs) {
+		die("failed open socket stream");
+	}
+	return fs;
+}
+
+/*
+ * Save the wire bytes of peer (the stream is closed next).
+ */
+static void bench_account(struct bench_peer *peer, const struct cgps_compress *comp, size_t sent, size_t received)
+{
+	if(comp) {
+		peer->wireout += comp->wireout;
+		peer->wirein += comp->wirein;
+	} else {
+		peer->wireout += sent;
+		peer->wirein += received;
+	}
+}
+
+/*
+ * The server end: receive input data and send the result.
+ */
+static void * bench_server(void *arg)
+{
+	struct bench_peer *peer = arg;
+	const struct bench_compress *bc = peer->bc;
+	struct cgps_compress *comp;
+	char *buff;
+	FILE *ss;
+
+	if(!(buff = malloc(bc->insize))) {
+		die("failed alloc memory");
+	}
+	ss = bench_open(peer, &comp);
+	if(fread(buff, 1, bc->insize, ss) != bc->insize || memcmp(buff, bc->input, bc->insize) != 0) {
+		peer->failed = 1;
+	}
+	fwrite(bc->result, 1, bc->ressize, ss);
+	fflush(ss);
+	bench_account(peer, comp, bc->ressize, bc->insize);
+	fclose(ss);
+	free(buff);
+	return NULL;
+}
+
+/*
+ * Run one request. Returns -1 if data was not received intact.
+ */
+static int bench_request(const struct bench_compress *bc, int method, struct bench_peer *client, struct bench_peer *server, char *buff)
+{
+	struct cgps_compress *comp;
+	pthread_t thread;
+	int sv[2];
+	FILE *ss;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		die("failed create socket pair");
+	}
+	client->sock = sv[0];
+	client->method = method;
+	server->sock = sv[1];
+	server->method = method;
+	if(pthread_create(&thread, NULL, bench_server, server) != 0) {
+		die("failed create server thread");
+	}
+
+	ss = bench_open(client, &comp);
+	fwrite(bc->input, 1, bc->insize, ss);
+	fflush(ss);
+	if(fread(buff, 1, bc->ressize, ss) != bc->ressize || memcmp(buff, bc->result, bc->ressize) != 0) {
+		client->failed = 1;
+	}
+	bench_account(client, comp, bc->insize, bc->ressize);
+	fclose(ss);
+
+	pthread_join(thread, NULL);
+	close(sv[0]);
+	close(sv[1]);
+	return client->failed || server->failed ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	printf("%s - benchmark of the stream compression.\n", prog);
+	printf("\n");
+	printf("Usage: %s [options...]\n", prog);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -n, --requests=num:   Requests for each method [%d]\n", COMPRESS_REQUESTS);
+	printf("  -i, --data=path:      Raw data input file (default=synthetic)\n");
+	printf("  -r, --rows=num:       Rows of synthetic input data [%d]\n", COMPRESS_ROWS);
+	printf("  -x, --columns=num:    Variables of synthetic input data [%d]\n", COMPRESS_COLUMNS);
+#if ! defined(NDEBUG)
+	printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+	printf("  -v, --verbose:        Be more verbose in output\n");
+	printf("  -h, --help:           This help\n");
+	printf("  -V, --version:        Print version info to stdout\n");
+	printf("\n");
+	printf("The input data and a result of %d values per row is sent over a socket pair\n", COMPRESS_RESULTS);
+	printf("uncompressed and with each compression method supported by this build\n");
+	printf("(%s). Exits with failure if the data differs after the round trip.\n", 
+	       *cgps_compress_methods() ? cgps_compress_methods() : "none");
+	printf("\n");
+	printf("This application is part of the ChemGPS project.\n");
+	printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Benchmark of the stream compression.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+static void bench_options(int argc, char **argv, struct bench_compress *bc)
+{
+	static struct option options[] = {
+		{ "requests",  1, 0, 'n' },
+		{ "data",      1, 0, 'i' },
+		{ "rows",      1, 0, 'r' },
+		{ "columns",   1, 0, 'x' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "help",      0, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "dhi:n:r:vVx:", options, &optindex)) != -1) {
+		switch(c) {
+#if ! defined(NDEBUG)
+		case 'd':
+			opts->debug++;
+			break;
+#endif
+		case 'h':
+			usage(opts->prog);
+			exit(0);
+		case 'i':
+			bc->data = optarg;
+			break;
+		case 'n':
+			if((bc->requests = atoi(optarg)) < 1) {
+				die("number of requests (-n) should be at least 1");
+			}
+			break;
+		case 'r':
+			if((bc->rows = atoi(optarg)) < 1) {
+				die("number of rows (-r) should be at least 1");
+			}
+			break;
+		case 'v':
+			opts->verbose++;
+			break;
+		case 'V':
+			version(opts->prog);
+			exit(0);
+		case 'x':
+			if((bc->cols = atoi(optarg)) < 1) {
+				die("number of columns (-x) should be at least 1");
+			}
+			break;
+		case '?':
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const int methods[] = { CGPS_COMPRESS_NONE, CGPS_COMPRESS_LZ4, CGPS_COMPRESS_ZSTD };
+	struct bench_compress bc;
+	struct bench_peer client, server;
+	double wall, cpu;
+	char *buff;
+	int i, j, failed = 0;
+
+	if(!(opts = malloc(sizeof(struct options)))) {
+		fprintf(stderr, "%s: failed alloc memory\n", argv[0]);
+		return 1;
+	}
+	memset(opts, 0, sizeof(struct options));
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+	memset(&bc, 0, sizeof(struct bench_compress));
+	bc.requests = COMPRESS_REQUESTS;
+	bc.rows = COMPRESS_ROWS;
+	bc.cols = COMPRESS_COLUMNS;
+	bench_options(argc, argv, &bc);
+	bench_data(&bc);
+	
+	if(!(buff = malloc(bc.ressize))) {
+		die("failed alloc memory");
+	}
+
+	printf("%d requests (%d rows, %lu bytes of input data, %lu bytes of result)\n\n", 
+	       bc.requests, bc.rows, (unsigned long)bc.insize, (unsigned long)bc.ressize);
+	printf("%-8s %12s %8s %12s %8s %12s %12s\n", "method:", "sent/req:", "ratio:", 
+	       "recv/req:", "ratio:", "cpu us/req:", "wall us/req:");
+	
+	for(i = 0; i < (int)(sizeof(methods) / sizeof(methods[0])); ++i) {
+		if(methods[i] != CGPS_COMPRESS_NONE && 
+		   cgps_compress_value(cgps_compress_name(methods[i])) < 0) {
+			debug("skipping %s (not supported by this build)", cgps_compress_name(methods[i]));
+			continue;
+		}
+		memset(&client, 0, sizeof(struct bench_peer));
+		memset(&server, 0, sizeof(struct bench_peer));
+		client.bc = server.bc = &bc;
+
+		wall = bench_time();
+		cpu = bench_cpu();
+		for(j = 0; j < bc.requests; ++j) {
+			if(bench_request(&bc, methods[i], &client, &server, buff) < 0) {
+				errno = 0;
+				logerr("data differs after round trip (%s, request %d)", cgps_compress_name(methods[i]), j);
+				failed = 1;
+				break;
+			}
+		}
+		cpu = bench_cpu() - cpu;
+		wall = bench_time() - wall;
+
+		printf("%-8s %12.0f %8.2f %12.0f %8.2f %12.1f %12.1f\n", cgps_compress_name(methods[i]), 
+		       (double)client.wireout / bc.requests, (double)bc.insize * bc.requests / client.wireout,
+		       (double)client.wirein / bc.requests, (double)bc.ressize * bc.requests / client.wirein,
+		       cpu * 1.0e6 / bc.requests, wall * 1.0e6 / bc.requests);
+	}
+	
+	free(buff);
+	free(bc.input);
+	free(bc.result);
+	free(opts);
+	return failed;
+}
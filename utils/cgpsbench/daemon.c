@@ -0,0 +1,116 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Start and stop the daemon under test.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#include <limits.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+
+/*
+ * Start the daemon listening on both the UNIX socket and TCP port.
+ */
+int bench_daemon_start(struct cgpsbench *bench)
+{
+	struct options *popt = bench->opts;
+	char proj[PATH_MAX + 8], unaddr[PATH_MAX + 8], ipaddr[128], port[16];
+	int fd;
+
+	snprintf(proj, sizeof(proj), "--proj=%s", popt->proj);
+	snprintf(unaddr, sizeof(unaddr), "--unix=%s", popt->unaddr);
+	snprintf(ipaddr, sizeof(ipaddr), "--tcp=%s", popt->ipaddr);
+	snprintf(port, sizeof(port), "--port=%d", popt->port);
+
+	debug("starting %s %s %s %s %s -i", bench->daemon, proj, unaddr, ipaddr, port);
+	
+	if((bench->pid = fork()) < 0) {
+		logerr("failed fork");
+		return -1;
+	}
+	if(bench->pid == 0) {
+		if(!popt->verbose) {
+			if((fd = open("/dev/null", O_RDWR)) >= 0) {
+				dup2(fd, 1);
+				dup2(fd, 2);
+				close(fd);
+			}
+		}
+		execl(bench->daemon, bench->daemon, proj, unaddr, ipaddr, port, "-i", (char *)NULL);
+		die("failed exec %s", bench->daemon);
+	}
+	
+	debug("started daemon (pid %d)", (int)bench->pid);
+	return 0;
+}
+
+/*
+ * Returns true if the daemon has exited.
+ */
+int bench_daemon_exited(struct cgpsbench *bench)
+{
+	int status;
+	
+	if(bench->pid && waitpid(bench->pid, &status, WNOHANG) == bench->pid) {
+		bench->pid = 0;
+		return 1;
+	}
+	return 0;
+}
+
+void bench_daemon_stop(struct cgpsbench *bench)
+{
+	int status;
+	
+	if(bench->pid) {
+		debug("stopping daemon (pid %d)", (int)bench->pid);
+		kill(bench->pid, SIGTERM);
+		waitpid(bench->pid, &status, 0);
+		bench->pid = 0;
+	}
+}
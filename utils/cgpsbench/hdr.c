@@ -0,0 +1,289 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * High dynamic range histogram. A simplified implementation of the
+ * HdrHistogram algorithm (without auto resize and concurrent recording).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <math.h>
+
+#include "hdr.h"
+
+/*
+ * Returns the index of the most significant bit set in value.
+ */
+static int hdr_msb(long long value)
+{
+	int bit = -1;
+
+	while(value) {
+		value >>= 1;
+		++bit;
+	}
+	return bit;
+}
+
+int hdr_init(struct hdr_histogram *hdr, long long lowest, long long highest, int sigfigs)
+{
+	long long largest, smallest;
+	int magnitude;
+
+	if(lowest < 1 || sigfigs < 1 || sigfigs > 5 || highest < 2 * lowest) {
+		return -1;
+	}
+	memset(hdr, 0, sizeof(struct hdr_histogram));
+	hdr->lowest  = lowest;
+	hdr->highest = highest;
+	hdr->sigfigs = sigfigs;
+
+	/*
+	 * Sub buckets needed for the requested precision (the single unit 
+	 * resolution range is 2 * 10^sigfigs).
+	 */
+	for(largest = 2; sigfigs--; ) {
+		largest *= 10;
+	}
+	magnitude = hdr_msb(largest - 1) + 1;
+	hdr->sub_bucket_half_count_magnitude = (magnitude > 1 ? magnitude : 1) - 1;
+	hdr->unit_magnitude = hdr_msb(lowest);
+	hdr->sub_bucket_count = 1 << (hdr->sub_bucket_half_count_magnitude + 1);
+	hdr->sub_bucket_half_count = hdr->sub_bucket_count / 2;
+	hdr->sub_bucket_mask = (long long)(hdr->sub_bucket_count - 1) << hdr->unit_magnitude;
+
+	smallest = (long long)hdr->sub_bucket_count << hdr->unit_magnitude;
+	for(hdr->bucket_count = 1; smallest <= highest; ++hdr->bucket_count) {
+		smallest <<= 1;
+	}
+	hdr->counts_len = (hdr->bucket_count + 1) * hdr->sub_bucket_half_count;
+	if(!(hdr->counts = calloc(hdr->counts_len, sizeof(long long)))) {
+		return -1;
+	}
+	hdr->min = -1;
+	return 0;
+}
+
+void hdr_free(struct hdr_histogram *hdr)
+{
+	free(hdr->counts);
+	hdr->counts = NULL;
+}
+
+static int hdr_bucket_index(const struct hdr_histogram *hdr, long long value)
+{
+	return hdr_msb(value | hdr->sub_bucket_mask) + 1 - hdr->unit_magnitude - (hdr->sub_bucket_half_count_magnitude + 1);
+}
+
+static int hdr_counts_index(const struct hdr_histogram *hdr, long long value)
+{
+	int bucket = hdr_bucket_index(hdr, value);
+	int sub = (int)(value >> (bucket + hdr->unit_magnitude));
+
+	return ((bucket + 1) << hdr->sub_bucket_half_count_magnitude) + (sub - hdr->sub_bucket_half_count);
+}
+
+/*
+ * Returns the lowest value and the size of the range of values that are
+ * equivalent to the value at index in counts.
+ */
+static long long hdr_index_value(const struct hdr_histogram *hdr, int index, long long *range)
+{
+	int bucket = (index >> hdr->sub_bucket_half_count_magnitude) - 1;
+	int sub = (index & (hdr->sub_bucket_half_count - 1)) + hdr->sub_bucket_half_count;
+
+	if(bucket < 0) {
+		sub -= hdr->sub_bucket_half_count;
+		bucket = 0;
+	}
+	if(range) {
+		*range = 1LL << (hdr->unit_magnitude + bucket);
+	}
+	return (long long)sub << (bucket + hdr->unit_magnitude);
+}
+
+void hdr_record(struct hdr_histogram *hdr, long long value)
+{
+	if(value < 0) {
+		value = 0;
+	}
+	if(value > hdr->highest) {
+		value = hdr->highest;
+	}
+	hdr->counts[hdr_counts_index(hdr, value)]++;
+	hdr->total++;
+	if(hdr->min < 0 || value < hdr->min) {
+		hdr->min = value;
+	}
+	if(value > hdr->max) {
+		hdr->max = value;
+	}
+}
+
+void hdr_record_index(struct hdr_histogram *hdr, int index, long long count)
+{
+	long long value, range;
+
+	if(index < 0 || index >= hdr->counts_len || count <= 0) {
+		return;
+	}
+	value = hdr_index_value(hdr, index, &range);
+	hdr->counts[index] += count;
+	hdr->total += count;
+	if(hdr->min < 0 || value < hdr->min) {
+		hdr->min = value;
+	}
+	if(value + range - 1 > hdr->max) {
+		hdr->max = value + range - 1;
+	}
+}
+
+void hdr_add(struct hdr_histogram *dst, const struct hdr_histogram *src)
+{
+	int i;
+
+	for(i = 0; i < src->counts_len && i < dst->counts_len; ++i) {
+		dst->counts[i] += src->counts[i];
+	}
+	dst->total += src->total;
+	if(src->min >= 0 && (dst->min < 0 || src->min < dst->min)) {
+		dst->min = src->min;
+	}
+	if(src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+long long hdr_value_at_percentile(const struct hdr_histogram *hdr, double percentile)
+{
+	long long count, total = 0, range, value;
+	int i;
+
+	if(!hdr->total) {
+		return 0;
+	}
+	if(percentile > 100.0) {
+		percentile = 100.0;
+	}
+	count = (long long)(percentile / 100.0 * hdr->total + 0.5);
+	if(count < 1) {
+		count = 1;
+	}
+	for(i = 0; i < hdr->counts_len; ++i) {
+		total += hdr->counts[i];
+		if(total >= count) {
+			value = hdr_index_value(hdr, i, &range);
+			value += range - 1;
+			return value < hdr->max ? value : hdr->max;
+		}
+	}
+	return hdr->max;
+}
+
+double hdr_mean(const struct hdr_histogram *hdr)
+{
+	long long range, value;
+	double sum = 0.0;
+	int i;
+
+	if(!hdr->total) {
+		return 0.0;
+	}
+	for(i = 0; i < hdr->counts_len; ++i) {
+		if(hdr->counts[i]) {
+			value = hdr_index_value(hdr, i, &range);
+			sum += (value + range / 2) * (double)hdr->counts[i];
+		}
+	}
+	return sum / hdr->total;
+}
+
+double hdr_stddev(const struct hdr_histogram *hdr)
+{
+	long long range, value;
+	double mean = hdr_mean(hdr), sum = 0.0, dev;
+	int i;
+
+	if(!hdr->total) {
+		return 0.0;
+	}
+	for(i = 0; i < hdr->counts_len; ++i) {
+		if(hdr->counts[i]) {
+			value = hdr_index_value(hdr, i, &range);
+			dev = value + range / 2 - mean;
+			sum += dev * dev * hdr->counts[i];
+		}
+	}
+	return sqrt(sum / hdr->total);
+}
+
+/*
+ * The percentile levels are reported with ticks per halving of the 
+ * distance to 100%, just like the HdrHistogram percentile iterator.
+ */
+void hdr_percentiles_print(const struct hdr_histogram *hdr, FILE *fs, int ticks, double scale)
+{
+	double percentile = 0.0, half;
+	long long value, total = 0, range;
+	int i;
+
+	fprintf(fs, "%12s %14s %10s %14s\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+	for(i = 0; i < hdr->counts_len && total < hdr->total; ++i) {
+		if(!hdr->counts[i]) {
+			continue;
+		}
+		total += hdr->counts[i];
+		value = hdr_index_value(hdr, i, &range) + range - 1;
+		if(value > hdr->max) {
+			value = hdr->max;
+		}
+		while(total < hdr->total && 100.0 * total / hdr->total >= percentile) {
+			fprintf(fs, "%12.3f %14.12f %10lld %14.2f\n", value / scale, percentile / 100.0, total, 
+				100.0 / (100.0 - percentile));
+			half = floor(log(100.0 / (100.0 - percentile)) / log(2.0)) + 1;
+			percentile += 100.0 / (ticks * pow(2.0, half));
+		}
+	}
+	if(hdr->total) {
+		fprintf(fs, "%12.3f %14.12f %10lld\n", hdr->max / scale, 1.0, hdr->total);
+	}
+
+	fprintf(fs, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n", hdr_mean(hdr) / scale, hdr_stddev(hdr) / scale);
+	fprintf(fs, "#[Max     = %12.3f, Total count    = %12lld]\n", hdr->max / scale, hdr->total);
+	fprintf(fs, "#[Buckets = %12d, SubBuckets     = %12d]\n", hdr->bucket_count, hdr->sub_bucket_count);
+}
@@ -0,0 +1,81 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifndef __HDR_H__
+#define __HDR_H__
+
+#include <stdio.h>
+
+/*
+ * High dynamic range histogram of latencies (us). The values are stored
+ * in buckets of sub buckets, with the precision given by the number of
+ * significant figures (see http://hdrhistogram.org/).
+ */
+struct hdr_histogram
+{
+	long long lowest;         /* lowest trackable value */
+	long long highest;        /* highest trackable value */
+	int sigfigs;              /* significant figures */
+	int unit_magnitude;
+	int sub_bucket_half_count_magnitude;
+	int sub_bucket_count;
+	int sub_bucket_half_count;
+	long long sub_bucket_mask;
+	int bucket_count;
+	int counts_len;
+	long long *counts;
+	long long total;          /* number of recorded values */
+	long long min;
+	long long max;
+};
+
+int hdr_init(struct hdr_histogram *hdr, long long lowest, long long highest, int sigfigs);
+void hdr_free(struct hdr_histogram *hdr);
+void hdr_record(struct hdr_histogram *hdr, long long value);
+
+/*
+ * Add count values equivalent to counts index (as read from another
+ * histogram with the same configuration).
+ */
+void hdr_record_index(struct hdr_histogram *hdr, int index, long long count);
+
+/*
+ * Add all values in src to dst (both must have the same configuration).
+ */
+void hdr_add(struct hdr_histogram *dst, const struct hdr_histogram *src);
+
+long long hdr_value_at_percentile(const struct hdr_histogram *hdr, double percentile);
+double hdr_mean(const struct hdr_histogram *hdr);
+double hdr_stddev(const struct hdr_histogram *hdr);
+
+/*
+ * Write the percentile distribution (the HdrHistogram .hgrm format). The
+ * values are divided by scale.
+ */
+void hdr_percentiles_print(const struct hdr_histogram *hdr, FILE *fs, int ticks, double scale);
+
+#endif /* __HDR_H__ */
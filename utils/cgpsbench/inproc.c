@@ -0,0 +1,786 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The in-process server benchmark. The worker pool and request processing
+ * of cgpsd (worker.c and client.c) are linked into this program and fed
+ * with sessions over socket pairs, without any accept(), network stack or
+ * daemon process involved. The request processing is compiled with phase
+ * marks (CGPSD_PHASE_TIMING) and the thread CPU time spent in each phase 
+ * of the request (greeting, options, load, predict and result) is recorded 
+ * per request, together with the wall clock latency seen by the client.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#include <sys/resource.h>
+#include <signal.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <poll.h>
+#include <time.h>
+#include <chemgps.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+#include "cgpsd.h"
+#include "dllist.h"
+#include "worker.h"
+
+#define INPROC_REQUESTS 10000        /* number of sessions */
+#define INPROC_CLIENTS  8            /* concurrent sessions */
+#define INPROC_ROWS     1            /* rows in each request */
+#define INPROC_RESULT   "tps"        /* result set */
+#define INPROC_KICK     100          /* wake workers after stall (ms) */
+#define INPROC_BUFFER   16384        /* client read buffer */
+
+#define INPROC_HDR_HIGHEST 60000000000LL   /* 1 minute (ns) */
+#define INPROC_REPORT_TICKS 5
+
+/*
+ * The phase costs of one session (thread CPU time in ns).
+ */
+struct inproc_session
+{
+	long long mark;                         /* last phase mark */
+	long long cost[CGPSD_PHASE_COUNT];
+};
+
+/*
+ * A client thread running sessions one after another.
+ */
+struct inproc_client
+{
+	pthread_t thread;
+	struct inproc_session session;
+	struct hdr_histogram phase[CGPSD_PHASE_COUNT];  /* per phase (START is the total) */
+	struct hdr_histogram latency;           /* wall clock (us) */
+	unsigned long completed;
+	unsigned long failed;
+	char buff[INPROC_BUFFER];               /* received data */
+	size_t start, end;
+};
+
+struct inproc
+{
+	struct cgpsbench *bench;
+	struct workers workers;
+	struct cgps_project proj;
+	char *head;                   /* client greeting and options */
+	char *load;                   /* load response */
+	size_t loadlen;
+	int rows;
+	int requests;
+	int clients;
+	const char *result;
+	const char *format;
+	pthread_mutex_t lock;
+	int next;                     /* next session number */
+	unsigned long kicks;          /* worker pool wakeups */
+	int pool;                     /* worker pool size (at end) */
+	struct inproc_session **map;  /* server socket -> session */
+	int nmap;
+};
+
+static const char *phase_names[CGPSD_PHASE_COUNT] = {
+	"total", "greeting", "options", "load", "predict", "result"
+};
+
+struct cgpsbench *bench;
+struct options *opts;
+static struct inproc *inproc;
+
+#ifdef HAVE_ATEXIT
+static void exit_handler(void)
+{
+	if(bench) {
+		int i;
+		
+		if(bench->report && bench->report != stdout) {
+			fclose(bench->report);
+		}
+		for(i = 0; i < bench->nsample; ++i) {
+			free(bench->sample[i]);
+		}
+		free(bench->sample);
+		free(bench->header);
+		free(bench);
+		bench = NULL;
+	}
+	if(opts) {
+		free(opts->cgps);
+		free(opts->proj);
+		free(opts->data);
+		free(opts->output);
+		free(opts);
+		opts = NULL;
+	}
+}
+#endif /* HAVE_ATEXIT */
+
+/*
+ * Called from process_request() in the worker threads. The session is
+ * found from the server end of the socket pair.
+ */
+void cgpsd_phase_mark(const struct client *peer, int phase)
+{
+	struct inproc_session *sess;
+	struct timespec ts;
+	long long now;
+
+	if(peer->sock >= inproc->nmap || !(sess = inproc->map[peer->sock])) {
+		return;
+	}
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	now = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	if(phase != CGPSD_PHASE_START) {
+		sess->cost[phase] += now - sess->mark;
+	}
+	sess->mark = now;
+}
+
+/*
+ * Wake up the worker threads. A request that makes no progress is either
+ * slow or queued without any worker waiting on the peer condition (the
+ * signal from worker_enqueue() is lost).
+ */
+static void inproc_kick(struct inproc *ip)
+{
+	pthread_mutex_lock(&ip->workers.peerlock);
+	pthread_cond_broadcast(&ip->workers.peercond);
+	pthread_mutex_unlock(&ip->workers.peerlock);
+	
+	pthread_mutex_lock(&ip->lock);
+	ip->kicks++;
+	pthread_mutex_unlock(&ip->lock);
+}
+
+static int inproc_send(int sock, const char *buff, size_t size)
+{
+	ssize_t bytes;
+
+	while(size) {
+		if((bytes = write(sock, buff, size)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		buff += bytes;
+		size -= bytes;
+	}
+	return 0;
+}
+
+/*
+ * Returns next line received on sock (without newline) or NULL on end of
+ * file or failure. Lines longer than the buffer are split.
+ */
+static char * inproc_readline(struct inproc *ip, struct inproc_client *clt, int sock)
+{
+	struct pollfd pfd;
+	ssize_t bytes;
+	char *line, *next;
+
+	while(1) {
+		if(clt->start < clt->end) {
+			line = clt->buff + clt->start;
+			if((next = memchr(line, '\n', clt->end - clt->start))) {
+				*next = '\0';
+				clt->start = next - clt->buff + 1;
+				return line;
+			}
+			if(clt->start == 0 && clt->end == sizeof(clt->buff)) {
+				clt->buff[clt->end - 1] = '\0';
+				clt->start = clt->end;
+				return line;
+			}
+			memmove(clt->buff, line, clt->end - clt->start);
+		}
+		clt->end -= clt->start;
+		clt->start = 0;
+		
+		pfd.fd = sock;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, INPROC_KICK) == 0) {
+			inproc_kick(ip);
+			continue;
+		}
+		if((bytes = read(sock, clt->buff + clt->end, sizeof(clt->buff) - clt->end)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed read from server");
+			return NULL;
+		}
+		if(bytes == 0) {
+			return NULL;
+		}
+		clt->end += bytes;
+	}
+}
+
+/*
+ * Run one session. The server end of the socket pair is enqueued on the
+ * worker pool, just like an accepted connection in cgpsd. Returns 0 if the
+ * result was received.
+ */
+static int inproc_session(struct inproc *ip, struct inproc_client *clt)
+{
+	const char *line;
+	long long start;
+	int sv[2], result = 0, error = 0, i;
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) {
+		logerr("failed create socket pair");
+		return -1;
+	}
+	if(sv[1] >= ip->nmap) {
+		logerr("socket %d exceeds the session map", sv[1]);
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+	memset(&clt->session, 0, sizeof(struct inproc_session));
+	ip->map[sv[1]] = &clt->session;
+	clt->start = clt->end = 0;
+	
+	start = bench_clock();
+	if(worker_enqueue(&ip->workers, sv[1], opts, &ip->proj) < 0) {
+		logerr("failed enqueue peer");
+		close(sv[0]);
+		close(sv[1]);
+		return -1;
+	}
+
+	/*
+	 * The worker thread owns the server end from here and closes it when
+	 * done, so the session is always read until end of file.
+	 */
+	if(!(line = inproc_readline(ip, clt, sv[0])) || strncmp(line, "CGPSP ", 6) != 0) {
+		logerr("unexpected greeting (%s)", line ? line : "connection closed");
+		error = 1;
+	} else if(inproc_send(sv[0], ip->head, strlen(ip->head)) < 0) {
+		logerr("failed send request");
+		error = 1;
+	}
+	while((line = inproc_readline(ip, clt, sv[0]))) {
+		if(error) {
+			continue;
+		} else if(strncmp(line, "Load:", 5) == 0) {
+			if(inproc_send(sv[0], ip->load, ip->loadlen) < 0) {
+				logerr("failed send data");
+				error = 1;
+			}
+		} else if(strcmp(line, "Result:") == 0) {
+			result = 1;
+		} else if(strncmp(line, "error:", 6) == 0) {
+			logerr("server response: %s", line + 7);
+			error = 1;
+		}
+	}
+	close(sv[0]);
+	
+	if(error || !result) {
+		clt->failed++;
+		return -1;
+	}
+	hdr_record(&clt->latency, bench_clock() - start);
+	for(i = 1; i < CGPSD_PHASE_COUNT; ++i) {
+		hdr_record(&clt->phase[i], clt->session.cost[i]);
+		clt->session.cost[CGPSD_PHASE_START] += clt->session.cost[i];
+	}
+	hdr_record(&clt->phase[CGPSD_PHASE_START], clt->session.cost[CGPSD_PHASE_START]);
+	clt->completed++;
+	return 0;
+}
+
+static void * inproc_client(void *arg)
+{
+	struct inproc_client *clt = (struct inproc_client *)arg;
+	int next;
+
+	while(1) {
+		pthread_mutex_lock(&inproc->lock);
+		next = inproc->next++;
+		pthread_mutex_unlock(&inproc->lock);
+		if(next >= inproc->requests) {
+			break;
+		}
+		inproc_session(inproc, clt);
+	}
+	return NULL;
+}
+
+static int inproc_histogram(struct hdr_histogram *hdr, long long highest)
+{
+	if(hdr_init(hdr, CGPSBENCH_HDR_LOWEST, highest, CGPSBENCH_HDR_SIGFIGS) < 0) {
+		logerr("failed initilize histogram");
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Build the request (client greeting and options) and the load response.
+ * The server reads one line past the last observation, so the data is
+ * followed by an empty line.
+ */
+static void inproc_request(struct inproc *ip)
+{
+	size_t size, len;
+	char *data;
+	
+	len = strlen(ip->result) + strlen(ip->format) + 128;
+	if(!(ip->head = malloc(len))) {
+		die("failed alloc memory");
+	}
+	snprintf(ip->head, len, "CGPSP %s (%s: client ready)\nPredict: %s\nFormat: %s\n",
+		 CGPSP_PROTO_VERSION, opts->prog, ip->result, ip->format);
+	
+	data = bench_data(ip->bench, ip->rows, &size);
+	if(!(ip->load = malloc(size + 32))) {
+		die("failed alloc memory");
+	}
+	ip->loadlen = sprintf(ip->load, "Load: %d\n", ip->rows);
+	memcpy(ip->load + ip->loadlen, data, size);
+	ip->loadlen += size;
+	ip->load[ip->loadlen++] = '\n';
+	free(data);
+}
+
+static void inproc_report(struct inproc *ip, struct inproc_client *clt, long long elapsed, double cpu)
+{
+	struct hdr_histogram phase[CGPSD_PHASE_COUNT], latency;
+	unsigned long completed = 0, failed = 0;
+	double total, throughput;
+	int i, j;
+
+	for(i = 0; i < CGPSD_PHASE_COUNT; ++i) {
+		if(inproc_histogram(&phase[i], INPROC_HDR_HIGHEST) < 0) {
+			return;
+		}
+	}
+	if(inproc_histogram(&latency, CGPSBENCH_HDR_HIGHEST) < 0) {
+		return;
+	}
+	for(j = 0; j < ip->clients; ++j) {
+		for(i = 0; i < CGPSD_PHASE_COUNT; ++i) {
+			hdr_add(&phase[i], &clt[j].phase[i]);
+		}
+		hdr_add(&latency, &clt[j].latency);
+		completed += clt[j].completed;
+		failed += clt[j].failed;
+	}
+	throughput = elapsed > 0 ? completed / (elapsed / 1000000.0) : 0.0;
+	total = hdr_mean(&phase[CGPSD_PHASE_START]);
+	
+	if(bench->report) {
+		fprintf(bench->report, "#[Benchmark package=%s version=%s mode=inproc requests=%d clients=%d workers=%d rows=%d result=%s format=%s]\n",
+			PACKAGE_NAME, PACKAGE_VERSION, ip->requests, ip->clients, ip->pool, ip->rows, ip->result, ip->format);
+		fprintf(bench->report, "#[Summary completed=%lu failed=%lu kicks=%lu throughput=%.2f cpu=%.3f]\n",
+			completed, failed, ip->kicks, throughput, completed ? cpu / completed : 0.0);
+		fprintf(bench->report, "#[Unit cpu=us latency=us throughput=req/s]\n\n");
+		for(i = 1; i <= CGPSD_PHASE_COUNT; ++i) {
+			j = i % CGPSD_PHASE_COUNT;
+			fprintf(bench->report, "#[Phase name=%s mean=%.3f]\n", phase_names[j], hdr_mean(&phase[j]) / 1000.0);
+			hdr_percentiles_print(&phase[j], bench->report, INPROC_REPORT_TICKS, 1000.0);
+			fprintf(bench->report, "\n");
+		}
+		fprintf(bench->report, "#[Latency mean=%.3f]\n", hdr_mean(&latency));
+		hdr_percentiles_print(&latency, bench->report, INPROC_REPORT_TICKS, 1.0);
+		fflush(bench->report);
+	}
+	if(!opts->quiet) {
+		printf("requests: %d (completed: %lu, failed: %lu), clients: %d, workers: %d, kicks: %lu\n",
+		       ip->requests, completed, failed, ip->clients, ip->pool, ip->kicks);
+		printf("elapsed: %.3f sec, throughput: %.2f req/s, process cpu: %.3f us/req\n",
+		       elapsed / 1000000.0, throughput, completed ? cpu / completed : 0.0);
+		printf("\n");
+		printf("%-10s %10s %10s %10s %10s %10s %7s\n", 
+		       "phase", "mean", "p50", "p99", "p99.9", "max", "share");
+		for(i = 1; i <= CGPSD_PHASE_COUNT; ++i) {
+			j = i % CGPSD_PHASE_COUNT;
+			printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f %6.1f%%\n", phase_names[j],
+			       hdr_mean(&phase[j]) / 1000.0,
+			       hdr_value_at_percentile(&phase[j], 50.0) / 1000.0,
+			       hdr_value_at_percentile(&phase[j], 99.0) / 1000.0,
+			       hdr_value_at_percentile(&phase[j], 99.9) / 1000.0,
+			       phase[j].max / 1000.0,
+			       total > 0 ? 100.0 * hdr_mean(&phase[j]) / total : 0.0);
+		}
+		printf("%-10s %10.3f %10.3f %10.3f %10.3f %10.3f\n", "latency",
+		       hdr_mean(&latency),
+		       (double)hdr_value_at_percentile(&latency, 50.0),
+		       (double)hdr_value_at_percentile(&latency, 99.0),
+		       (double)hdr_value_at_percentile(&latency, 99.9),
+		       (double)latency.max);
+		printf("\n");
+		printf("The phases are CPU time (us) in the worker thread, latency is wall clock time (us).\n");
+	}
+
+	for(i = 0; i < CGPSD_PHASE_COUNT; ++i) {
+		hdr_free(&phase[i]);
+	}
+	hdr_free(&latency);
+}
+
+/*
+ * Returns the CPU time (user and system) used by this process (us).
+ */
+static double inproc_cpu(void)
+{
+	struct rusage ru;
+
+	if(getrusage(RUSAGE_SELF, &ru) < 0) {
+		return 0.0;
+	}
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000.0 + 
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void usage(const char *prog)
+{
+	printf("%s - in-process benchmark of the cgpsd request processing.\n", prog);
+	printf("\n");
+	printf("Usage: %s -f proj [options...]\n", prog);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -f, --proj=path:      Project file\n");
+	printf("  -N, --requests=num:   Number of requests [%d]\n", INPROC_REQUESTS);
+	printf("  -c, --clients=num:    Concurrent requests [%d]\n", INPROC_CLIENTS);
+	printf("  -w, --workers=num:    Initial size of the worker pool [%d]\n", WORKER_POOL_SIZE);
+	printf("  -n, --rows=num:       Rows in each request [%d]\n", INPROC_ROWS);
+	printf("  -r, --result=str:     Result set (see cgpsbench -h result) [%s]\n", INPROC_RESULT);
+	printf("  -F, --format=str:     Output format (plain or xml) [plain]\n");
+	printf("  -i, --data=path:      Sample data (rows are repeated as needed)\n");
+	printf("  -x, --variables=num:  Columns of synthetic data (without -i) [%d]\n", CGPSBENCH_VARIABLES);
+	printf("  -o, --output=path:    Write report (HdrHistogram percentiles) to file\n");
+#if ! defined(NDEBUG)
+	printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+	printf("  -v, --verbose:        Be more verbose in output\n");
+	printf("  -q, --quiet:          Suppress some output\n");
+	printf("  -h, --help:           This help\n");
+	printf("  -V, --version:        Print version info to stdout\n");
+	printf("\n");
+	printf("The request processing of cgpsd is run in this process and fed with requests\n");
+	printf("over socket pairs. The CPU time of each request phase is reported.\n");
+	printf("\n");
+	printf("This application is part of the ChemGPS project.\n");
+	printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("In-process benchmark of the cgpsd request processing.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+static char * copy_option(const char *optarg)
+{
+	char *str = malloc(strlen(optarg) + 1);
+	
+	if(!str) {
+		die("failed alloc memory");
+	}
+	strcpy(str, optarg);
+	return str;
+}
+
+static void inproc_options(int argc, char **argv, struct inproc *ip)
+{
+	static struct option options[] = {
+		{ "proj",      1, 0, 'f' },
+		{ "requests",  1, 0, 'N' },
+		{ "clients",   1, 0, 'c' },
+		{ "workers",   1, 0, 'w' },
+		{ "rows",      1, 0, 'n' },
+		{ "result",    1, 0, 'r' },
+		{ "format",    1, 0, 'F' },
+		{ "data",      1, 0, 'i' },
+		{ "variables", 1, 0, 'x' },
+		{ "output",    1, 0, 'o' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "quiet",     0, 0, 'q' },
+		{ "help",      0, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "c:df:F:hi:n:N:o:qr:vVw:x:", options, &optindex)) != -1) {
+		switch(c) {
+		case 'c':
+			if((ip->clients = atoi(optarg)) < 1) {
+				die("number of clients (-c) should be at least 1");
+			}
+			break;
+#if ! defined(NDEBUG)
+		case 'd':
+			opts->debug++;
+			break;
+#endif
+		case 'f':
+			opts->proj = copy_option(optarg);
+			break;
+		case 'F':
+			if(strcmp(optarg, "plain") != 0 && strcmp(optarg, "xml") != 0) {
+				die("unknown format '%s' (-F), should be plain or xml", optarg);
+			}
+			ip->format = optarg;
+			break;
+		case 'h':
+			usage(opts->prog);
+			exit(0);
+		case 'i':
+			opts->data = copy_option(optarg);
+			break;
+		case 'n':
+			if((ip->rows = atoi(optarg)) < 1) {
+				die("number of rows (-n) should be at least 1");
+			}
+			break;
+		case 'N':
+			if((ip->requests = atoi(optarg)) < 1) {
+				die("number of requests (-N) should be at least 1");
+			}
+			break;
+		case 'o':
+			opts->output = copy_option(optarg);
+			break;
+		case 'q':
+			opts->quiet = 1;
+			break;
+		case 'r':
+			ip->result = optarg;
+			break;
+		case 'v':
+			opts->verbose++;
+			break;
+		case 'V':
+			version(opts->prog);
+			exit(0);
+		case 'w':
+			if((ip->workers.size = atoi(optarg)) < 1) {
+				die("number of workers (-w) should be at least 1");
+			}
+			break;
+		case 'x':
+			if((ip->bench->variables = atoi(optarg)) < 1) {
+				die("number of variables (-x) should be at least 1");
+			}
+			break;
+		case '?':
+			exit(1);
+		}
+	}
+	
+	if(!opts->proj) {
+		die("project file option (-f) is missing, see --help");
+	}
+	if(!ip->requests) {
+		ip->requests = INPROC_REQUESTS;
+	}
+	if(!ip->clients) {
+		ip->clients = INPROC_CLIENTS;
+	}
+	if(!ip->rows) {
+		ip->rows = INPROC_ROWS;
+	}
+	if(!ip->result) {
+		ip->result = INPROC_RESULT;
+	}
+	if(!ip->format) {
+		ip->format = "plain";
+	}
+	if(!ip->bench->variables) {
+		ip->bench->variables = CGPSBENCH_VARIABLES;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct inproc ip;
+	struct inproc_client *clt;
+	long long start, elapsed;
+	double cpu;
+	int i, j;
+	
+        opts = malloc(sizeof(struct options));
+	if(!opts) {
+		die("failed alloc memory");
+	}
+	memset(opts, 0, sizeof(struct options));	
+	
+	bench = malloc(sizeof(struct cgpsbench));
+	if(!bench) {
+		die("failed alloc memory");
+	}
+	memset(bench, 0, sizeof(struct cgpsbench));
+	bench->opts = opts;
+	
+        opts->cgps = malloc(sizeof(struct cgps_options));
+	if(!opts->cgps) {
+		die("failed alloc memory");
+	}
+	memset(opts->cgps, 0, sizeof(struct cgps_options));
+	
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+#ifdef HAVE_ATEXIT
+	if(atexit(exit_handler) != 0) {
+		logerr("failed register main exit handler");
+	}
+#endif
+	if(signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+		die("failed ignoring broken pipe signal (SIGPIPE)");
+	}
+
+	memset(&ip, 0, sizeof(struct inproc));
+	ip.bench = bench;
+	inproc = &ip;
+	inproc_options(argc, argv, &ip);
+
+	if(opts->data) {
+		if(bench_load_sample(bench, opts->data) < 0) {
+			die("failed load sample data");
+		}
+	}
+	if(opts->output) {
+		if(!(bench->report = fopen(opts->output, "w"))) {
+			die("failed open report file %s", opts->output);
+		}
+	}
+	
+	/*
+	 * Load the project the same way as cgpsd does.
+	 */
+	opts->cgps->logger = cgps_syslog;
+	opts->cgps->indata = cgps_predict_data;
+	if(opts->debug > 1) {
+		opts->cgps->debug = opts->debug;
+		opts->cgps->verbose = opts->verbose;
+	}
+	opts->cgps->batch = 1;
+	if(cgps_project_load(&ip.proj, opts->proj, opts->cgps) != 0) {
+		die("failed load project %s", opts->proj);
+	}
+	inproc_request(&ip);
+	
+	if((ip.nmap = sysconf(_SC_OPEN_MAX)) < 0) {
+		ip.nmap = 1024;
+	}
+	if(!(ip.map = calloc(ip.nmap, sizeof(struct inproc_session *)))) {
+		die("failed alloc memory");
+	}
+	if(!(clt = calloc(ip.clients, sizeof(struct inproc_client)))) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < ip.clients; ++i) {
+		for(j = 0; j < CGPSD_PHASE_COUNT; ++j) {
+			if(inproc_histogram(&clt[i].phase[j], INPROC_HDR_HIGHEST) < 0) {
+				die("failed initilize histograms");
+			}
+		}
+		if(inproc_histogram(&clt[i].latency, CGPSBENCH_HDR_HIGHEST) < 0) {
+			die("failed initilize histograms");
+		}
+	}
+	pthread_mutex_init(&ip.lock, NULL);
+	
+	if(worker_init(&ip.workers, NULL, process_request) < 0) {
+		die("failed initilize worker threads");
+	}
+	opts->state |= CGPSD_STATE_RUNNING;
+	
+	if(!opts->quiet && opts->verbose) {
+		loginfo("running %d requests (%d concurrent) against %s", ip.requests, ip.clients, opts->proj);
+	}
+	cpu = inproc_cpu();
+	start = bench_clock();
+	for(i = 0; i < ip.clients; ++i) {
+		if(pthread_create(&clt[i].thread, NULL, inproc_client, &clt[i]) != 0) {
+			die("failed create client thread");
+		}
+	}
+	for(i = 0; i < ip.clients; ++i) {
+		pthread_join(clt[i].thread, NULL);
+	}
+	elapsed = bench_clock() - start;
+	cpu = inproc_cpu() - cpu;
+	
+	ip.pool = ip.workers.size;
+	opts->state |= CGPSD_STATE_CLOSING;
+	worker_cleanup(&ip.workers);
+	
+	inproc_report(&ip, clt, elapsed, cpu);
+	
+	for(i = 0; i < ip.clients; ++i) {
+		for(j = 0; j < CGPSD_PHASE_COUNT; ++j) {
+			hdr_free(&clt[i].phase[j]);
+		}
+		hdr_free(&clt[i].latency);
+	}
+	free(clt);
+	free(ip.map);
+	free(ip.head);
+	free(ip.load);
+	pthread_mutex_destroy(&ip.lock);
+	cgps_project_close(&ip.proj);
+	
+	return 0;
+}
@@ -0,0 +1,328 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The open loop load generator. Requests are submitted to a libcgpsclt
+ * pool at fixed intervals no matter how fast the daemon answers. The
+ * latency is measured from the time the request was scheduled to be
+ * sent (not when it was actually sent), which avoids the coordinated 
+ * omission of closed loop benchmarks where a stalled daemon also stalls
+ * the load generator.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <ctype.h>
+#include <time.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+#include "libcgpsclt.h"
+
+/*
+ * A submitted request.
+ */
+struct bench_request
+{
+	struct scenario *scen;
+	long long scheduled;     /* intended send time (us) */
+};
+
+long long bench_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void bench_sleep(long long usec)
+{
+	struct timespec ts;
+
+	ts.tv_sec  = usec / 1000000;
+	ts.tv_nsec = (usec % 1000000) * 1000;
+	while(nanosleep(&ts, &ts) < 0 && errno == EINTR) {
+		continue;
+	}
+}
+
+int bench_load_sample(struct cgpsbench *bench, const char *path)
+{
+	FILE *fs;
+	char *buff = NULL, **ptr;
+	size_t size = 0;
+	ssize_t bytes;
+	const char *curr;
+
+	if(!(fs = fopen(path, "r"))) {
+		logerr("failed open data file %s", path);
+		return -1;
+	}
+	while((bytes = getline(&buff, &size, fs)) != -1) {
+		while(bytes && isspace((unsigned char)buff[bytes - 1])) {
+			buff[--bytes] = '\0';
+		}
+		if(!bytes) {
+			continue;
+		}
+		/*
+		 * The first line is a header of variable names unless numeric.
+		 */
+		for(curr = buff; isspace((unsigned char)*curr); ++curr) {
+			continue;
+		}
+		if(!bench->nsample && !bench->header && 
+		   !isdigit((unsigned char)*curr) && *curr != '-' && *curr != '.') {
+			if(!(bench->header = strdup(buff))) {
+				die("failed alloc memory");
+			}
+			continue;
+		}
+		if(!(ptr = realloc(bench->sample, (bench->nsample + 1) * sizeof(char *)))) {
+			die("failed alloc memory");
+		}
+		bench->sample = ptr;
+		if(!(bench->sample[bench->nsample++] = strdup(buff))) {
+			die("failed alloc memory");
+		}
+	}
+	free(buff);
+	fclose(fs);
+	
+	if(!bench->nsample) {
+		logerr("no data rows in %s", path);
+		return -1;
+	}
+	debug("loaded %d sample rows from %s", bench->nsample, path);
+	return 0;
+}
+
+char * bench_data(struct cgpsbench *bench, int rows, size_t *size)
+{
+	FILE *fs;
+	char *buff;
+	int i, j;
+
+	if(!(fs = open_memstream(&buff, size))) {
+		die("failed open memory stream");
+	}
+	if(bench->header) {
+		fprintf(fs, "%s\n", bench->header);
+	}
+	for(i = 0; i < rows; ++i) {
+		if(bench->nsample) {
+			fprintf(fs, "%s\n", bench->sample[i % bench->nsample]);
+		} else {
+			for(j = 0; j < bench->variables; ++j) {
+				fprintf(fs, j ? "\t%g" : "%g", ((i * 31 + j * 17) % 200 - 100) / 10.0);
+			}
+			fprintf(fs, "\n");
+		}
+	}
+	fclose(fs);
+	return buff;
+}
+
+static struct cgpsclt_pool * bench_open(const char *endpoint, int conns)
+{
+	struct cgpsclt_pool *pool;
+
+	if(!(pool = cgpsclt_pool_open(endpoint, conns))) {
+		logerr("failed open worker pool (%s)", endpoint);
+		return NULL;
+	}
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_TIMEOUT, CGPSBENCH_TIMEOUT * 1000);
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_RETRIES, 0);
+	cgpsclt_pool_setopt(pool, CGPSCLT_OPT_FAILOVER, 0);
+	return pool;
+}
+
+int bench_wait_ready(struct cgpsbench *bench, const char *endpoint)
+{
+	struct cgpsclt_pool *pool;
+	struct cgpsclt_request *req;
+	char *data, *result;
+	size_t size;
+	int i, status = CGPSCLT_STATUS_FAILED;
+
+	if(!(pool = bench_open(endpoint, 1))) {
+		return -1;
+	}
+	if(!(result = strdup(bench->results))) {
+		die("failed alloc memory");
+	}
+	result[strcspn(result, ",")] = '\0';
+	data = bench_data(bench, 1, &size);
+
+	for(i = 0; i < CGPSBENCH_STARTUP; ++i) {
+		if(bench_daemon_exited(bench)) {
+			logerr("the daemon %s exited during startup", bench->daemon);
+			break;
+		}
+		if(!(req = cgpsclt_submit(pool, result, CGPSCLT_FORMAT_PLAIN, data, size, NULL, NULL))) {
+			logerr("failed submit request");
+			break;
+		}
+		status = cgpsclt_wait(req);
+		if(status != CGPSCLT_STATUS_SUCCESS) {
+			debug("endpoint %s not ready (%s)", endpoint, cgpsclt_error(req));
+		}
+		cgpsclt_release(req);
+		if(status == CGPSCLT_STATUS_SUCCESS) {
+			break;
+		}
+		bench_sleep(100000);
+	}
+
+	cgpsclt_pool_close(pool);
+	free(result);
+	free(data);
+	
+	if(status != CGPSCLT_STATUS_SUCCESS) {
+		logerr("endpoint %s is not answering requests", endpoint);
+		return -1;
+	}
+	debug("endpoint %s is ready", endpoint);
+	return 0;
+}
+
+/*
+ * Called by pool thread when request is finished.
+ */
+static void bench_finished(struct cgpsclt_request *req, void *arg)
+{
+	struct bench_request *br = (struct bench_request *)arg;
+	struct scenario *scen = br->scen;
+	long long now = bench_clock();
+	int status = cgpsclt_status(req);
+
+	pthread_mutex_lock(&scen->lock);
+	if(status == CGPSCLT_STATUS_SUCCESS) {
+		hdr_record(&scen->hist, now - br->scheduled);
+		scen->completed++;
+		scen->finish = now;
+	} else {
+		if(!scen->failed) {
+			errno = 0;
+			logerr("request failed: %s", cgpsclt_error(req));
+		}
+		scen->failed++;
+	}
+	if(--scen->pending == 0) {
+		pthread_cond_signal(&scen->done);
+	}
+	pthread_mutex_unlock(&scen->lock);
+
+	cgpsclt_release(req);
+	free(br);
+}
+
+int bench_run(struct cgpsbench *bench, struct scenario *scen)
+{
+	struct cgpsclt_pool *pool;
+	struct bench_request *br;
+	long long interval, stop, now;
+	unsigned long i;
+	char *data;
+	size_t size;
+
+	if(hdr_init(&scen->hist, CGPSBENCH_HDR_LOWEST, CGPSBENCH_HDR_HIGHEST, CGPSBENCH_HDR_SIGFIGS) < 0) {
+		die("failed initilize histogram");
+	}
+	pthread_mutex_init(&scen->lock, NULL);
+	pthread_cond_init(&scen->done, NULL);
+
+	if(!(pool = bench_open(scen->endpoint, bench->conns))) {
+		return -1;
+	}
+	data = bench_data(bench, scen->rows, &size);
+	interval = (long long)(1000000.0 / scen->rate);
+	if(interval < 1) {
+		interval = 1;
+	}
+
+	debug("running scenario (%s, rate %g, rows %d, result %s)", 
+	      scen->transport, scen->rate, scen->rows, scen->result);
+	
+	scen->start = bench_clock();
+	stop = scen->start + bench->duration * 1000000LL;
+	
+	for(i = 0; ; ++i) {
+		long long scheduled = scen->start + i * interval;
+		
+		if(scheduled >= stop) {
+			break;
+		}
+		if((now = bench_clock()) < scheduled) {
+			bench_sleep(scheduled - now);
+		}
+		if(!(br = malloc(sizeof(struct bench_request)))) {
+			die("failed alloc memory");
+		}
+		br->scen = scen;
+		br->scheduled = scheduled;
+		
+		pthread_mutex_lock(&scen->lock);
+		scen->sent++;
+		scen->pending++;
+		pthread_mutex_unlock(&scen->lock);
+		
+		if(!cgpsclt_submit(pool, scen->result, CGPSCLT_FORMAT_PLAIN, data, size, bench_finished, br)) {
+			logerr("failed submit request");
+			pthread_mutex_lock(&scen->lock);
+			scen->failed++;
+			scen->pending--;
+			pthread_mutex_unlock(&scen->lock);
+			free(br);
+		}
+	}
+
+	debug("waiting for %d outstanding requests", scen->pending);
+	pthread_mutex_lock(&scen->lock);
+	while(scen->pending) {
+		pthread_cond_wait(&scen->done, &scen->lock);
+	}
+	pthread_mutex_unlock(&scen->lock);
+
+	cgpsclt_pool_close(pool);
+	free(data);
+	return 0;
+}
@@ -0,0 +1,223 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <signal.h>
+#include <libgen.h>
+#include <chemgps.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+
+struct cgpsbench *bench;
+struct options *opts;
+
+#ifdef HAVE_ATEXIT
+static void exit_handler(void)
+{
+	if(bench) {
+		int i;
+		
+		debug("cleaning up at exit...");
+		if(opts->parent != getpid()) {
+			return;   /* failed exec */
+		}
+		bench_daemon_stop(bench);
+		if(bench->report && bench->report != stdout) {
+			fclose(bench->report);
+		}
+		for(i = 0; i < bench->nsample; ++i) {
+			free(bench->sample[i]);
+		}
+		free(bench->sample);
+		free(bench->header);
+		free(bench->daemon);
+		free(bench->rates);
+		free(bench->rows);
+		free(bench->results);
+		free(bench);
+		bench = NULL;
+	}
+	if(opts) {
+		free(opts->cgps);
+		free(opts->proj);
+		free(opts->data);
+		free(opts->output);
+		free(opts->unaddr);
+		free(opts->ipaddr);
+		free(opts);
+		opts = NULL;
+	}
+}
+#endif /* HAVE_ATEXIT */
+
+/*
+ * Run all scenarios for this transport.
+ */
+static void run_transport(struct cgpsbench *pb, const char *transport, const char *endpoint)
+{
+	char *results, *rows, *rates, *result, *row, *rate;
+	char *rsave, *nsave, *asave;
+	
+	if(bench_wait_ready(pb, endpoint) < 0) {
+		die("failed benchmark %s endpoint %s", transport, endpoint);
+	}
+	
+	results = strdup(pb->results);
+	if(!results) {
+		die("failed alloc memory");
+	}
+	for(result = strtok_r(results, ",", &rsave); result; result = strtok_r(NULL, ",", &rsave)) {
+		rows = strdup(pb->rows);
+		if(!rows) {
+			die("failed alloc memory");
+		}
+		for(row = strtok_r(rows, ",", &nsave); row; row = strtok_r(NULL, ",", &nsave)) {
+			rates = strdup(pb->rates);
+			if(!rates) {
+				die("failed alloc memory");
+			}
+			for(rate = strtok_r(rates, ",", &asave); rate; rate = strtok_r(NULL, ",", &asave)) {
+				struct scenario scen;
+
+				memset(&scen, 0, sizeof(struct scenario));
+				scen.transport = transport;
+				scen.endpoint = endpoint;
+				scen.result = result;
+				if((scen.rows = atoi(row)) < 1) {
+					die("invalid number of rows '%s'", row);
+				}
+				if((scen.rate = strtod(rate, NULL)) <= 0.0) {
+					die("invalid arrival rate '%s'", rate);
+				}
+				if(bench_run(pb, &scen) == 0) {
+					bench_report(pb, &scen);
+				}
+				hdr_free(&scen.hist);
+				pthread_mutex_destroy(&scen.lock);
+				pthread_cond_destroy(&scen.done);
+			}
+			free(rates);
+		}
+		free(rows);
+	}
+	free(results);
+}
+
+int main(int argc, char **argv)
+{
+	char *endpoint;
+	
+        opts = malloc(sizeof(struct options));
+	if(!opts) {
+		die("failed alloc memory");
+	}
+	memset(opts, 0, sizeof(struct options));	
+	
+	bench = malloc(sizeof(struct cgpsbench));
+	if(!bench) {
+		die("failed alloc memory");
+	}
+	memset(bench, 0, sizeof(struct cgpsbench));
+	bench->opts = opts;
+	
+        opts->cgps = malloc(sizeof(struct cgps_options));
+	if(!opts->cgps) {
+		die("failed alloc memory");
+	}
+	memset(opts->cgps, 0, sizeof(struct cgps_options));
+	
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+#ifdef HAVE_ATEXIT
+	if(atexit(exit_handler) != 0) {
+		logerr("failed register main exit handler");
+	}
+#endif
+	if(signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+		die("failed ignoring broken pipe signal (SIGPIPE)");
+	}
+	
+	parse_options(argc, argv, bench);
+
+	if(opts->data) {
+		if(bench_load_sample(bench, opts->data) < 0) {
+			die("failed load sample data");
+		}
+	}
+	if(opts->output) {
+		if(!(bench->report = fopen(opts->output, "w"))) {
+			die("failed open report file %s", opts->output);
+		}
+	}
+	if(bench->daemon) {
+		if(bench_daemon_start(bench) < 0) {
+			die("failed start daemon %s", bench->daemon);
+		}
+	}
+
+	bench_report_header(bench);
+	
+	if(opts->unaddr) {
+		if(!(endpoint = malloc(strlen(opts->unaddr) + 6))) {
+			die("failed alloc memory");
+		}
+		sprintf(endpoint, "unix:%s", opts->unaddr);
+		run_transport(bench, "unix", endpoint);
+		free(endpoint);
+	}
+	if(opts->ipaddr) {
+		if(!(endpoint = malloc(strlen(opts->ipaddr) + 16))) {
+			die("failed alloc memory");
+		}
+		if(strchr(opts->ipaddr, ':') && opts->ipaddr[0] != '[') {
+			sprintf(endpoint, "[%s]:%d", opts->ipaddr, opts->port);
+		} else {
+			sprintf(endpoint, "%s:%d", opts->ipaddr, opts->port);
+		}
+		run_transport(bench, "tcp", endpoint);
+		free(endpoint);
+	}
+
+	bench_daemon_stop(bench);
+	
+	return 0;
+}
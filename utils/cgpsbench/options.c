@@ -0,0 +1,312 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <getopt.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+
+static void usage(const char *prog, const char *section)
+{
+	if(!section) {
+		printf("%s - latency and throughput benchmark of the cgpsd daemon.\n", prog);
+		printf("\n");
+		printf("Usage: %s -D path -f proj [options...]\n", prog);
+		printf("       %s -u sock|-H host [options...]\n", prog);
+		printf("\n");
+		printf("Daemon options:\n");
+		printf("  -D, --daemon=path:    Start daemon (the cgpsd binary) on UNIX and TCP socket\n");
+		printf("  -f, --proj=path:      Project file for started daemon\n");
+		printf("  -u, --sock=path:      UNIX socket path [/tmp/cgpsbench-pid.sock]\n");
+		printf("  -H, --host=addr:      TCP socket address [%s]\n", CGPSBENCH_HOST);
+		printf("  -p, --port=num:       TCP port [%d]\n", CGPSD_DEFAULT_PORT);
+		printf("\n");
+		printf("Load options:\n");
+		printf("  -R, --rates=list:     Arrival rates (requests/sec) [%s]\n", CGPSBENCH_RATES);
+		printf("  -n, --rows=list:      Rows in each request [%s]\n", CGPSBENCH_ROWS);
+		printf("  -r, --result=list:    Result sets (see -h result) [%s]\n", CGPSBENCH_RESULTS);
+		printf("  -T, --duration=sec:   Duration of each scenario [%d]\n", CGPSBENCH_DURATION);
+		printf("  -c, --conns=num:      Maximum concurrent connections [%d]\n", CGPSBENCH_CONNS);
+		printf("  -i, --data=path:      Sample data (rows are repeated as needed)\n");
+		printf("  -x, --variables=num:  Columns of synthetic data (without -i) [%d]\n", CGPSBENCH_VARIABLES);
+		printf("  -o, --output=path:    Write report (HdrHistogram percentiles) to file\n");
+		printf("\n");
+		printf("Common options:\n");
+#if ! defined(NDEBUG)
+		printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+		printf("  -v, --verbose:        Be more verbose in output (show daemon output)\n");
+		printf("  -q, --quiet:          Suppress some output\n");
+		printf("  -h, --help:           This help\n");
+		printf("  -V, --version:        Print version info to stdout\n");
+		printf("\n");
+		printf("One scenario is run for each combination of transport, result set, rows and\n");
+		printf("rate. The lists are comma separated. The requests are sent at fixed intervals\n");
+		printf("(open loop) and latency is measured from the time each request was scheduled.\n");
+		printf("\n");
+		printf("This application is part of the ChemGPS project.\n");
+		printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+	} else if(strcmp(section, "result") == 0) {
+		const struct cgps_result_entry *entry;
+		
+		printf("The --result option arguments is a comma separated list of result sets, where\n");
+		printf("each result set is a colon separated list of prediction results.\n");
+		printf("\n");
+		printf("The following names can be used in result sets:\n");
+		printf("\n");
+		printf("%10s   %-20s %s\n", "value:", "name:", "description:");
+		printf("%10s   %-20s %s\n", "------", "-----", "------------");
+		for(entry = cgps_result_entry_list; entry->name; ++entry) {
+			printf("%10d   %-20s %s\n", entry->value, entry->name, entry->desc);
+		}
+		printf("\n");
+		printf("Example:\n");
+		printf("  %s --result=tps,tps:dmodxps\n", prog);
+	} else {	
+		fprintf(stderr, "%s: no help avalible for '--help %s'\n", prog, section);
+	}
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Latency and throughput benchmark of the cgpsd daemon.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+static char * copy_option(const char *optarg)
+{
+	char *str = malloc(strlen(optarg) + 1);
+	
+	if(!str) {
+		die("failed alloc memory");
+	}
+	strcpy(str, optarg);
+	return str;
+}
+
+void parse_options(int argc, char **argv, struct cgpsbench *bench)
+{
+	static struct option options[] = {
+		{ "daemon",    1, 0, 'D' },
+		{ "proj",      1, 0, 'f' },
+		{ "sock",      1, 0, 'u' },
+		{ "host",      1, 0, 'H' },
+		{ "port",      1, 0, 'p' },
+		{ "rates",     1, 0, 'R' },
+		{ "rows",      1, 0, 'n' },
+		{ "result",    1, 0, 'r' },
+		{ "duration",  1, 0, 'T' },
+		{ "conns",     1, 0, 'c' },
+		{ "data",      1, 0, 'i' },
+		{ "variables", 1, 0, 'x' },
+		{ "output",    1, 0, 'o' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "quiet",     0, 0, 'q' },
+		{ "help",      2, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	struct options *popt = bench->opts;
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "c:dD:f:h::H:i:n:o:p:qr:R:T:u:vVx:", options, &optindex)) != -1) {
+		switch(c) {
+		case 'c':
+			bench->conns = atoi(optarg);
+			if(bench->conns < 1) {
+				die("number of connections (-c) should be at least 1");
+			}
+			break;
+#if ! defined(NDEBUG)
+		case 'd':
+			popt->debug++;
+			break;
+#endif
+		case 'D':
+			bench->daemon = copy_option(optarg);
+			break;
+		case 'f':
+			popt->proj = copy_option(optarg);
+			break;
+		case 'h':
+			usage(popt->prog, optarg);
+			exit(0);
+		case 'H':
+			popt->ipaddr = copy_option(optarg);
+			break;
+		case 'i':
+			popt->data = copy_option(optarg);
+			break;
+		case 'n':
+			bench->rows = copy_option(optarg);
+			break;
+		case 'o':
+			popt->output = copy_option(optarg);
+			break;
+		case 'p':
+			popt->port = strtol(optarg, NULL, 10);
+			if(!popt->port) {
+				die("failed convert port number %s", optarg);
+			}
+			break;
+		case 'q':
+			popt->quiet = 1;
+			break;
+		case 'r':
+			bench->results = copy_option(optarg);
+			break;
+		case 'R':
+			bench->rates = copy_option(optarg);
+			break;
+		case 'T':
+			bench->duration = atoi(optarg);
+			if(bench->duration < 1) {
+				die("the duration (-T) should be at least 1 second");
+			}
+			break;
+		case 'u':
+			popt->unaddr = copy_option(optarg);
+			break;
+		case 'v':
+			popt->verbose++;
+			break;
+		case 'V':
+			version(popt->prog);
+			exit(0);
+		case 'x':
+			bench->variables = atoi(optarg);
+			if(bench->variables < 1) {
+				die("number of variables (-x) should be at least 1");
+			}
+			break;
+		case '?':
+			exit(1);
+		}
+	}
+
+	/*
+	 * Check arguments and set defaults.
+	 */
+	if(bench->daemon) {
+		if(!popt->proj) {
+			die("project file option (-f) is missing, see --help");
+		}
+		if(!popt->unaddr) {
+			char path[64];
+			snprintf(path, sizeof(path), "/tmp/cgpsbench-%d.sock", (int)getpid());
+			popt->unaddr = copy_option(path);
+		}
+		if(!popt->ipaddr) {
+			popt->ipaddr = copy_option(CGPSBENCH_HOST);
+		}
+	} else {
+		if(popt->proj) {
+			die("the project file option (-f) is only valid with -D");
+		}
+		if(!popt->unaddr && !popt->ipaddr) {
+			die("either start daemon (-D) or connect to UNIX (-u) or TCP (-H) socket, see --help");
+		}
+	}
+	if(!popt->port) {
+		popt->port = CGPSD_DEFAULT_PORT;
+	}
+	if(!bench->rates) {
+		bench->rates = copy_option(CGPSBENCH_RATES);
+	}
+	if(!bench->rows) {
+		bench->rows = copy_option(CGPSBENCH_ROWS);
+	}
+	if(!bench->results) {
+		bench->results = copy_option(CGPSBENCH_RESULTS);
+	}
+	if(!bench->duration) {
+		bench->duration = CGPSBENCH_DURATION;
+	}
+	if(!bench->conns) {
+		bench->conns = CGPSBENCH_CONNS;
+	}
+	if(!bench->variables) {
+		bench->variables = CGPSBENCH_VARIABLES;
+	}
+
+	/*
+	 * Dump options for debugging purpose.
+	 */
+	if(popt->debug) {
+		debug("---------------------------------------------");
+		debug("options:");
+		if(bench->daemon) {
+			debug("  starting daemon %s (project %s)", bench->daemon, popt->proj);
+		}
+		if(popt->unaddr) {
+			debug("  unix socket = %s", popt->unaddr);
+		}
+		if(popt->ipaddr) {
+			debug("  tcp socket = %s port %d", popt->ipaddr, popt->port);
+		}
+		debug("  rates = %s, rows = %s, results = %s", bench->rates, bench->rows, bench->results);
+		debug("  duration = %ds, connections = %d", bench->duration, bench->conns);
+		if(popt->data) {
+			debug("  reading sample data from %s", popt->data);
+		} else {
+			debug("  using synthetic data (%d variables)", bench->variables);
+		}
+		if(popt->output) {
+			debug("  writing report to %s", popt->output);
+		}
+		debug("  flags: debug = %s, verbose = %s", 
+		      (popt->debug   ? "yes" : "no"), 
+		      (popt->verbose ? "yes" : "no"));
+		debug("---------------------------------------------");
+	}
+}
@@ -0,0 +1,90 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * The benchmark report. Each scenario is written to the report file as 
+ * a percentile distribution in the HdrHistogram text format (.hgrm),
+ * preceded by comment lines with the scenario and its summary as name=value
+ * pairs. A summary line is also written to stdout.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <time.h>
+
+#include "cgpsbench.h"
+#include "cgpssqp.h"
+
+#define CGPSBENCH_REPORT_TICKS 5         /* percentile ticks per half distance */
+#define CGPSBENCH_REPORT_SCALE 1000.0    /* report latency in ms */
+
+void bench_report_header(struct cgpsbench *bench)
+{
+	time_t now = time(NULL);
+	char date[64];
+
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	if(bench->report) {
+		fprintf(bench->report, "#[Benchmark package=%s version=%s date=%s duration=%d conns=%d]\n", 
+			PACKAGE_NAME, PACKAGE_VERSION, date, bench->duration, bench->conns);
+		fprintf(bench->report, "#[Unit latency=ms throughput=req/s]\n\n");
+	}
+	if(!bench->opts->quiet) {
+		printf("%-9s %8s %6s %-16s %8s %8s %6s %9s %9s %9s %9s %9s\n",
+		       "transport", "rate", "rows", "result", "sent", "ok", "failed",
+		       "req/s", "p50", "p99", "p99.9", "max");
+	}
+}
+
+void bench_report(struct cgpsbench *bench, struct scenario *scen)
+{
+	double elapsed = (scen->finish - scen->start) / 1000000.0;
+	double throughput = elapsed > 0 ? scen->completed / elapsed : 0.0;
+	double p50  = hdr_value_at_percentile(&scen->hist, 50.0) / CGPSBENCH_REPORT_SCALE;
+	double p99  = hdr_value_at_percentile(&scen->hist, 99.0) / CGPSBENCH_REPORT_SCALE;
+	double p999 = hdr_value_at_percentile(&scen->hist, 99.9) / CGPSBENCH_REPORT_SCALE;
+	double max  = scen->hist.max / CGPSBENCH_REPORT_SCALE;
+
+	if(bench->report) {
+		fprintf(bench->report, "#[Scenario transport=%s rate=%g rows=%d result=%s]\n",
+			scen->transport, scen->rate, scen->rows, scen->result);
+		fprintf(bench->report, "#[Summary sent=%lu completed=%lu failed=%lu throughput=%.2f p50=%.3f p99=%.3f p99.9=%.3f max=%.3f]\n",
+			scen->sent, scen->completed, scen->failed, throughput, p50, p99, p999, max);
+		hdr_percentiles_print(&scen->hist, bench->report, CGPSBENCH_REPORT_TICKS, CGPSBENCH_REPORT_SCALE);
+		fprintf(bench->report, "\n");
+		fflush(bench->report);
+	}
+	if(!bench->opts->quiet) {
+		printf("%-9s %8g %6d %-16s %8lu %8lu %6lu %9.2f %9.3f %9.3f %9.3f %9.3f\n",
+		       scen->transport, scen->rate, scen->rows, scen->result, 
+		       scen->sent, scen->completed, scen->failed, throughput, p50, p99, p999, max);
+		fflush(stdout);
+	}
+}
@@ -0,0 +1,378 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Benchmark of the numeric result writer (libcgpssqp/writer.c) against
+ * formatting with fprintf() as done by libchemgps. Synthetic result rows 
+ * are written using both methods and the output is compared byte by byte.
+ * The formatter is also checked against snprintf("%g") for random bit 
+ * patterns (all float classes).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <libgen.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <chemgps.h>
+
+#include "cgpssqp.h"
+#include "writer.h"
+
+#define WRITER_ROWS    1000000      /* rows of result */
+#define WRITER_COLUMNS 5            /* values in each row */
+#define WRITER_CHECKS  10000000     /* random bit patterns checked */
+
+struct options *opts;
+
+struct bench_writer
+{
+	int rows;
+	int cols;
+	int checks;
+	int format;
+	const char *output;
+	float *values;
+};
+
+static uint64_t bench_state = 0x9e3779b97f4a7c15ULL;
+
+/*
+ * The xorshift64* generator (deterministic for comparable runs).
+ */
+static uint64_t bench_random(void)
+{
+	bench_state ^= bench_state >> 12;
+	bench_state ^= bench_state << 25;
+	bench_state ^= bench_state >> 27;
+	return bench_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double bench_time(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/*
+ * Write result rows using fprintf() (the libchemgps way).
+ */
+static int bench_stdio(const struct bench_writer *bw, FILE *out)
+{
+	int i, j;
+
+	fprintf(out, "%s (%s):\n", "Predicted TPS", "tps");
+	for(i = 0; i < bw->rows; ++i) {
+		if(bw->format == CGPS_OUTPUT_FORMAT_XML) {
+			fprintf(out, "    <row>");
+		}
+		for(j = 0; j < bw->cols; ++j) {
+			fprintf(out, j ? "\t%g" : "%g", bw->values[i * bw->cols + j]);
+		}
+		fprintf(out, bw->format == CGPS_OUTPUT_FORMAT_XML ? "</row>\n" : "\n");
+	}
+	return fflush(out);
+}
+
+/*
+ * Write result rows using the result writer.
+ */
+static int bench_writer(const struct bench_writer *bw, FILE *out)
+{
+	struct cgps_writer writer;
+	int i;
+
+	if(cgps_writer_open(&writer, out) < 0) {
+		return -1;
+	}
+	cgps_writer_puts(&writer, "Predicted TPS (tps):\n");
+	for(i = 0; i < bw->rows; ++i) {
+		cgps_writer_row(&writer, bw->values + i * bw->cols, bw->cols, bw->format);
+	}
+	return cgps_writer_close(&writer);
+}
+
+/*
+ * Compare the formatter with snprintf() for random floats. Returns 
+ * number of mismatches.
+ */
+static int bench_check(const struct bench_writer *bw)
+{
+	char expect[64], actual[CGPS_WRITER_VALUE + 1];
+	uint32_t bits;
+	float value;
+	int i, len, failed = 0;
+
+	for(i = 0; i < bw->checks; ++i) {
+		bits = bench_random() >> 32;
+		memcpy(&value, &bits, sizeof(float));
+		snprintf(expect, sizeof(expect), "%g", value);
+		len = cgps_writer_format(actual, value);
+		actual[len] = '\0';
+		if(strcmp(expect, actual) != 0) {
+			if(failed++ < 10) {
+				logwarn("value %.9g (%08x) formatted as %s (expected %s)", value, bits, actual, expect);
+			}
+		}
+	}
+	return failed;
+}
+
+/*
+ * Run method, writing the result to path.
+ */
+static double bench_run(const struct bench_writer *bw, int (*method)(const struct bench_writer *, FILE *), const char *path)
+{
+	FILE *out;
+	double start;
+
+	if(!(out = fopen(path, "w"))) {
+		die("failed open output file %s", path);
+	}
+	start = bench_time();
+	if(method(bw, out) < 0) {
+		die("failed write output file %s", path);
+	}
+	fclose(out);
+	return bench_time() - start;
+}
+
+/*
+ * Capture output of method in memory.
+ */
+static char * bench_capture(const struct bench_writer *bw, int (*method)(const struct bench_writer *, FILE *), size_t *size)
+{
+	char *buff = NULL;
+	FILE *out;
+
+	if(!(out = open_memstream(&buff, size))) {
+		die("failed open memory stream");
+	}
+	if(method(bw, out) < 0) {
+		die("failed write memory stream");
+	}
+	fclose(out);
+	return buff;
+}
+
+static void usage(const char *prog)
+{
+	printf("%s - benchmark of the numeric result writer.\n", prog);
+	printf("\n");
+	printf("Usage: %s [options...]\n", prog);
+	printf("\n");
+	printf("Options:\n");
+	printf("  -n, --rows=num:       Rows of result [%d]\n", WRITER_ROWS);
+	printf("  -x, --columns=num:    Values in each row [%d]\n", WRITER_COLUMNS);
+	printf("  -c, --checks=num:     Random floats checked against snprintf() [%d]\n", WRITER_CHECKS);
+	printf("  -F, --format=str:     Output format (plain or xml) [plain]\n");
+	printf("  -o, --output=path:    Write output to file [/dev/null]\n");
+#if ! defined(NDEBUG)
+	printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+	printf("  -v, --verbose:        Be more verbose in output\n");
+	printf("  -h, --help:           This help\n");
+	printf("  -V, --version:        Print version info to stdout\n");
+	printf("\n");
+	printf("The result is written using fprintf() (as libchemgps) and the result writer\n");
+	printf("(as the native engine). Exits with failure if the outputs differ.\n");
+	printf("\n");
+	printf("This application is part of the ChemGPS project.\n");
+	printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Benchmark of the numeric result writer.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+static void bench_options(int argc, char **argv, struct bench_writer *bw)
+{
+	static struct option options[] = {
+		{ "rows",      1, 0, 'n' },
+		{ "columns",   1, 0, 'x' },
+		{ "checks",    1, 0, 'c' },
+		{ "format",    1, 0, 'F' },
+		{ "output",    1, 0, 'o' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "help",      0, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "c:dF:hn:o:vVx:", options, &optindex)) != -1) {
+		switch(c) {
+		case 'c':
+			if((bw->checks = atoi(optarg)) < 0) {
+				die("number of checks (-c) should be positive");
+			}
+			break;
+#if ! defined(NDEBUG)
+		case 'd':
+			opts->debug++;
+			break;
+#endif
+		case 'F':
+			if(strcmp(optarg, "plain") == 0) {
+				bw->format = CGPS_OUTPUT_FORMAT_PLAIN;
+			} else if(strcmp(optarg, "xml") == 0) {
+				bw->format = CGPS_OUTPUT_FORMAT_XML;
+			} else {
+				die("unknown format '%s' (-F), should be plain or xml", optarg);
+			}
+			break;
+		case 'h':
+			usage(opts->prog);
+			exit(0);
+		case 'n':
+			if((bw->rows = atoi(optarg)) < 1) {
+				die("number of rows (-n) should be at least 1");
+			}
+			break;
+		case 'o':
+			bw->output = optarg;
+			break;
+		case 'v':
+			opts->verbose++;
+			break;
+		case 'V':
+			version(opts->prog);
+			exit(0);
+		case 'x':
+			if((bw->cols = atoi(optarg)) < 1) {
+				die("number of columns (-x) should be at least 1");
+			}
+			break;
+		case '?':
+			exit(1);
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct bench_writer bw;
+	double elapsed[2];
+	char *expect, *actual;
+	size_t size[2];
+	int i, failed = 0;
+
+	if(!(opts = malloc(sizeof(struct options)))) {
+		fprintf(stderr, "%s: failed alloc memory\n", argv[0]);
+		return 1;
+	}
+	memset(opts, 0, sizeof(struct options));
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+	memset(&bw, 0, sizeof(struct bench_writer));
+	bw.rows = WRITER_ROWS;
+	bw.cols = WRITER_COLUMNS;
+	bw.checks = WRITER_CHECKS;
+	bw.format = CGPS_OUTPUT_FORMAT_PLAIN;
+	bw.output = "/dev/null";
+	bench_options(argc, argv, &bw);
+	
+	/*
+	 * Scores and distances spans a few orders of magnitude.
+	 */
+	if(!(bw.values = malloc((size_t)bw.rows * bw.cols * sizeof(float)))) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < bw.rows * bw.cols; ++i) {
+		bw.values[i] = ((double)(bench_random() >> 11) / (1ULL << 53) * 2.0 - 1.0) * 
+			pow(10.0, (int)(bench_random() % 9) - 4);
+	}
+	
+	expect = bench_capture(&bw, bench_stdio, &size[0]);
+	actual = bench_capture(&bw, bench_writer, &size[1]);
+	if(size[0] != size[1] || memcmp(expect, actual, size[0]) != 0) {
+		errno = 0;
+		logerr("output of result writer differs from fprintf()");
+		failed = 1;
+	}
+	free(expect);
+	free(actual);
+	
+	elapsed[0] = bench_run(&bw, bench_stdio, bw.output);
+	elapsed[1] = bench_run(&bw, bench_writer, bw.output);
+	
+	printf("%-10s %10s %10s %12s\n", "method:", "time (s):", "MB/s:", "ns/value:");
+	printf("%-10s %10.3f %10.1f %12.1f\n", "fprintf", elapsed[0], size[0] / elapsed[0] / 1.0e6, 
+	       elapsed[0] * 1.0e9 / ((double)bw.rows * bw.cols));
+	printf("%-10s %10.3f %10.1f %12.1f\n", "writer", elapsed[1], size[1] / elapsed[1] / 1.0e6, 
+	       elapsed[1] * 1.0e9 / ((double)bw.rows * bw.cols));
+	printf("speedup:   %10.1fx (%d rows, %d values, %lu bytes)\n", elapsed[0] / elapsed[1], 
+	       bw.rows, bw.rows * bw.cols, (unsigned long)size[0]);
+	
+	if(bw.checks) {
+		if((i = bench_check(&bw)) != 0) {
+			errno = 0;
+			logerr("%d of %d random floats formatted different from snprintf()", i, bw.checks);
+			failed = 1;
+		} else {
+			printf("checked:   %d random floats (same as snprintf)\n", bw.checks);
+		}
+	}
+	
+	free(bw.values);
+	free(opts);
+	return failed;
+}
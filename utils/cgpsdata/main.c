@@ -0,0 +1,569 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Convert text descriptor data to columnar descriptor files (.cgpsx) that
+ * are mapped by cgpsstd and cgpsclt without parsing (see libcgpssqp/datafile.c).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#include <sys/stat.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <chemgps.h>
+
+#include "cgpssqp.h"
+#include "datafile.h"
+
+/*
+ * The field delimiters (same as for text input data in libcgpssqp/data.c).
+ */
+#define CGPSDATA_DELIM " ,:;\t\r\n"
+
+struct options *opts;
+
+/*
+ * The text input and output file during conversion. The row groups are
+ * parsed concurrently by threads taking the next group from next.
+ */
+struct convert
+{
+	char *buff;                  /* input data (with lines NUL terminated) */
+	char **lines;                /* non-empty data lines */
+	uint64_t rows;               /* number of data lines */
+	int fields;                  /* number of fields per data line */
+	int molid;                   /* first field is molecule ID */
+	struct cgps_datafile_writer *writer;
+	pthread_mutex_t mutex;
+	int next;                    /* next row group to parse */
+	int failed;
+};
+
+static int type = CGPS_DATAFILE_FLOAT32;
+static int group = CGPS_DATAFILE_GROUP;
+
+static void usage(const char *prog)
+{
+	printf("%s - convert descriptor data to columnar descriptor files.\n", prog);
+	printf("\n");
+	printf("Usage: %s convert -i text -o file [options...]\n", prog);
+	printf("       %s info file [options...]\n", prog);
+	printf("       %s dump file [options...]\n", prog);
+	printf("\n");
+	printf("Commands:\n");
+	printf("  convert:              Convert text input data to columnar descriptor file\n");
+	printf("  info:                 Show the layout of columnar descriptor file\n");
+	printf("  dump:                 Write columnar descriptor file as text input data\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -i, --data=path:      Text input data (convert)\n");
+	printf("  -o, --output=path:    Descriptor file (convert) or text output (dump)\n");
+	printf("  -t, --threads=num:    Parse using num threads (0 = all CPU's) [0]\n");
+	printf("  -g, --group=rows:     Number of rows in each row group [%d]\n", CGPS_DATAFILE_GROUP);
+	printf("  -D, --double:         Store values as double precision (float64)\n");
+	printf("  -R, --rows=first[:count]: Dump row range only\n");
+#if ! defined(NDEBUG)
+	printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+	printf("  -v, --verbose:        Be more verbose in output\n");
+	printf("  -h, --help:           This help\n");
+	printf("  -V, --version:        Print version info to stdout\n");
+	printf("\n");
+	printf("The descriptor file is used in place of text input data by cgpsstd (-i) and\n");
+	printf("cgpsclt (-i). The columns are stored as float32 by default, the same precision\n");
+	printf("as used for predictions.\n");
+	printf("\n");
+	printf("This application is part of the ChemGPS project.\n");
+	printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Convert descriptor data to columnar descriptor files.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+void parse_options(int argc, char **argv, struct options *popt)
+{
+	static struct option options[] = {
+		{ "data",      1, 0, 'i' },
+		{ "output",    1, 0, 'o' },
+		{ "threads",   1, 0, 't' },
+		{ "group",     1, 0, 'g' },
+		{ "double",    0, 0, 'D' },
+		{ "rows",      1, 0, 'R' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "help",      0, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "dDg:hi:o:R:t:vV", options, &optindex)) != -1) {
+		switch(c) {
+#if ! defined(NDEBUG)
+		case 'd':
+			popt->debug++;
+			break;
+#endif
+		case 'D':
+			type = CGPS_DATAFILE_FLOAT64;
+			break;
+		case 'g':
+			if((group = atoi(optarg)) < 1) {
+				die("number of rows %s is invalid", optarg);
+			}
+			break;
+		case 'h':
+			usage(popt->prog);
+			exit(0);
+		case 'i':
+			popt->data = optarg;
+			break;
+		case 'o':
+			popt->output = optarg;
+			break;
+		case 'R':
+			if(sscanf(optarg, "%d:%d", &popt->firstobs, &popt->numobs) < 1 ||
+			   popt->firstobs < 0 || popt->numobs < 0) {
+				die("invalid row range '%s' argument for option -R", optarg);
+			}
+			break;
+		case 't':
+			if((popt->threads = atoi(optarg)) < 0) {
+				die("number of threads %s is invalid", optarg);
+			}
+			break;
+		case 'v':
+			popt->verbose++;
+			break;
+		case 'V':
+			version(popt->prog);
+			exit(0);
+		case '?':
+			exit(1);
+		}
+	}
+	if(popt->threads == 0 && (popt->threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+		popt->threads = 1;
+	}
+}
+
+/*
+ * Returns number of fields in line.
+ */
+static int count_fields(const char *line)
+{
+	int count = 0;
+	
+	for(line += strspn(line, CGPSDATA_DELIM); *line; line += strspn(line, CGPSDATA_DELIM)) {
+		line += strcspn(line, CGPSDATA_DELIM);
+		++count;
+	}
+	return count;
+}
+
+/*
+ * Returns true if field is not a number (same rule as in libcgpssqp/data.c).
+ */
+static int is_string(const char *field)
+{
+	char *ep;
+	
+	return !strtod(field, &ep) && ep == field;
+}
+
+/*
+ * Returns field num of line.
+ */
+static const char * get_field(const char *line, int num)
+{
+	for(line += strspn(line, CGPSDATA_DELIM); *line; line += strspn(line, CGPSDATA_DELIM)) {
+		if(!num--) {
+			return line;
+		}
+		line += strcspn(line, CGPSDATA_DELIM);
+	}
+	return NULL;
+}
+
+/*
+ * Parse the row groups of the input data.
+ */
+static void * convert_thread(void *arg)
+{
+	struct convert *conv = arg;
+	struct cgps_datafile_writer *writer = conv->writer;
+	double *values;
+	char **ids = NULL, *line, *ep;
+	uint64_t first;
+	int num, rows, row, col;
+
+	if(!(values = malloc((size_t)writer->group * writer->cols * sizeof(double)))) {
+		die("failed alloc memory");
+	}
+	if(conv->molid && !(ids = malloc(writer->group * sizeof(char *)))) {
+		die("failed alloc memory");
+	}
+
+	for(;;) {
+		pthread_mutex_lock(&conv->mutex);
+		num = conv->failed ? writer->groups : conv->next++;
+		pthread_mutex_unlock(&conv->mutex);
+		if(num >= writer->groups) {
+			break;
+		}
+		first = writer->index[num].first;
+		rows = writer->index[num].rows;
+		
+		for(row = 0; row < rows; ++row) {
+			line = conv->lines[first + row];
+			line += strspn(line, CGPSDATA_DELIM);
+			if(conv->molid) {
+				ids[row] = line;
+				line += strcspn(line, CGPSDATA_DELIM);
+				if(*line) {
+					*line++ = '\0';
+				}
+			}
+			for(col = 0; col < writer->cols; ++col) {
+				line += strspn(line, CGPSDATA_DELIM);
+				values[row * writer->cols + col] = strtod(line, &ep);
+				if(ep == line || (*ep && !strchr(CGPSDATA_DELIM, *ep))) {
+					break;
+				}
+				line = ep;
+			}
+			if(col != writer->cols || line[strspn(line, CGPSDATA_DELIM)]) {
+				errno = 0;
+				logerr("invalid field %d on data row %llu (expected %d numeric fields)", 
+				       col + 1 + conv->molid, (unsigned long long)(first + row + 1), writer->cols);
+				break;
+			}
+		}
+		if(row != rows || cgps_datafile_put(writer, num, values, ids) < 0) {
+			pthread_mutex_lock(&conv->mutex);
+			conv->failed = 1;
+			pthread_mutex_unlock(&conv->mutex);
+		}
+	}
+	
+	free(values);
+	free(ids);
+	return NULL;
+}
+
+/*
+ * Read whole file into memory (NUL terminated).
+ */
+static char * read_file(const char *path, size_t *size)
+{
+	struct stat st;
+	FILE *fs;
+	char *buff;
+
+	if(!(fs = fopen(path, "r"))) {
+		logerr("failed open data file %s", path);
+		return NULL;
+	}
+	if(fstat(fileno(fs), &st) < 0) {
+		logerr("failed stat data file %s", path);
+		fclose(fs);
+		return NULL;
+	}
+	if(!(buff = malloc(st.st_size + 1))) {
+		die("failed alloc memory");
+	}
+	if((*size = fread(buff, 1, st.st_size, fs)) != (size_t)st.st_size) {
+		logerr("failed read data file %s", path);
+		free(buff);
+		buff = NULL;
+	} else {
+		buff[*size] = '\0';
+	}
+	fclose(fs);
+	return buff;
+}
+
+static int convert_data(struct options *popt)
+{
+	struct convert conv;
+	pthread_t *threads;
+	char *line, *next, *header = NULL;
+	char **names = NULL;
+	const char *field;
+	size_t size, len, capacity = 0;
+	int i, skip, result = 0;
+
+	memset(&conv, 0, sizeof(struct convert));
+	if(!(conv.buff = read_file(popt->data, &size))) {
+		return -1;
+	}
+	
+	/*
+	 * Split input in lines and collect the lines with data.
+	 */
+	for(line = conv.buff; line < conv.buff + size; line = next) {
+		if((next = strchr(line, '\n'))) {
+			*next++ = '\0';
+		} else {
+			next = conv.buff + size;
+		}
+		if(!line[strspn(line, CGPSDATA_DELIM)]) {
+			continue;
+		}
+		if(!header && !conv.rows && (field = get_field(line, 1)) && is_string(field)) {
+			header = line;
+			continue;
+		}
+		if(conv.rows == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			if(!(conv.lines = realloc(conv.lines, capacity * sizeof(char *)))) {
+				die("failed alloc memory");
+			}
+		}
+		conv.lines[conv.rows++] = line;
+	}
+	if(!conv.rows) {
+		errno = 0;
+		logerr("no data in %s", popt->data);
+		free(conv.lines);
+		free(conv.buff);
+		return -1;
+	}
+	conv.fields = count_fields(conv.lines[0]);
+	conv.molid = is_string(get_field(conv.lines[0], 0));
+	debug("input data has %llu rows of %d fields (header: %s, molid: %s)", (unsigned long long)conv.rows,
+	      conv.fields, header ? "yes" : "no", conv.molid ? "yes" : "no");
+
+	/*
+	 * Column names from header (optional with the ID column).
+	 */
+	if(header) {
+		if((skip = count_fields(header) - (conv.fields - conv.molid)) < 0 || skip > 1) {
+			errno = 0;
+			logerr("header of %s don't match the data (%d fields, expected %d)", popt->data, 
+			       count_fields(header), conv.fields - conv.molid);
+			free(conv.lines);
+			free(conv.buff);
+			return -1;
+		}
+		if(!(names = malloc(conv.fields * sizeof(char *)))) {
+			die("failed alloc memory");
+		}
+		for(i = 0, field = header + strspn(header, CGPSDATA_DELIM); *field; ++i) {
+			len = strcspn(field, CGPSDATA_DELIM);
+			next = (char *)field + len;
+			if(*next) {
+				*next++ = '\0';
+			}
+			if(i >= skip) {
+				names[i - skip] = (char *)field;
+			}
+			field = next + strspn(next, CGPSDATA_DELIM);
+		}
+	}
+
+	if(!(conv.writer = cgps_datafile_create(popt->output, conv.rows, conv.fields - conv.molid, type, group, names, conv.molid))) {
+		free(names);
+		free(conv.lines);
+		free(conv.buff);
+		return -1;
+	}
+	if(popt->threads > conv.writer->groups) {
+		popt->threads = conv.writer->groups;
+	}
+	debug("converting %d row groups using %d threads", conv.writer->groups, popt->threads);
+	
+	if(!(threads = malloc(popt->threads * sizeof(pthread_t)))) {
+		die("failed alloc memory");
+	}
+	if(pthread_mutex_init(&conv.mutex, NULL) != 0) {
+		die("failed init mutex");
+	}
+	for(i = 0; i < popt->threads; ++i) {
+		if(pthread_create(&threads[i], NULL, convert_thread, &conv) != 0) {
+			die("failed create thread");
+		}
+	}
+	for(i = 0; i < popt->threads; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&conv.mutex);
+	
+	if(popt->verbose && !conv.failed) {
+		loginfo("converted %llu rows of %d columns from %s to %s", (unsigned long long)conv.rows, 
+			conv.writer->cols, popt->data, popt->output);
+	}
+	if(cgps_datafile_finish(conv.writer, conv.failed) < 0) {
+		result = -1;
+	}
+
+	free(threads);
+	free(names);
+	free(conv.lines);
+	free(conv.buff);
+	return result;
+}
+
+static int show_data(const char *path)
+{
+	struct cgps_datafile *file;
+	int i;
+
+	if(!(file = cgps_datafile_open(path))) {
+		return -1;
+	}
+	printf("file:        %s (%lu bytes)\n", path, (unsigned long)file->size);
+	printf("rows:        %llu\n", (unsigned long long)file->rows);
+	printf("columns:     %d (%s)\n", file->cols, file->type == CGPS_DATAFILE_FLOAT32 ? "float32" : "float64");
+	printf("row groups:  %d (%d rows)\n", file->groups, file->group);
+	printf("molecule ID: %s\n", file->molid ? "yes" : "no");
+	if(file->names) {
+		printf("schema:      %016llx\n", (unsigned long long)file->fingerprint);
+		if(opts->verbose) {
+			printf("\n");
+			for(i = 0; i < file->cols; ++i) {
+				printf("%6d   %s\n", i + 1, file->names[i]);
+			}
+		}
+	}
+	cgps_datafile_close(file);
+	return 0;
+}
+
+static int dump_data(const char *path, struct options *popt)
+{
+	struct cgps_datafile *file;
+	FILE *fsout = stdout;
+	uint64_t count;
+	int result;
+
+	if(!(file = cgps_datafile_open(path))) {
+		return -1;
+	}
+	if((uint64_t)popt->firstobs > file->rows) {
+		cgps_datafile_close(file);
+		die("first row %d is beyond end of data (%llu rows)", popt->firstobs, (unsigned long long)file->rows);
+	}
+	count = file->rows - popt->firstobs;
+	if(popt->numobs && (uint64_t)popt->numobs < count) {
+		count = popt->numobs;
+	}
+	if(popt->output && !(fsout = fopen(popt->output, "w"))) {
+		logerr("failed open output file %s", popt->output);
+		cgps_datafile_close(file);
+		return -1;
+	}
+	if((result = cgps_datafile_text(file, popt->firstobs, count, NULL, 0, fsout)) < 0) {
+		logerr("failed write text data");
+	}
+	if(fsout != stdout) {
+		fclose(fsout);
+	}
+	cgps_datafile_close(file);
+	return result;
+}
+
+int main(int argc, char **argv)
+{
+	const char *command;
+	int result;
+
+	if(!(opts = malloc(sizeof(struct options)))) {
+		fprintf(stderr, "%s: failed alloc memory\n", argv[0]);
+		return 1;
+	}
+	memset(opts, 0, sizeof(struct options));
+	if(!(opts->cgps = malloc(sizeof(struct cgps_options)))) {
+		die("failed alloc memory");
+	}
+	memset(opts->cgps, 0, sizeof(struct cgps_options));
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+	parse_options(argc, argv, opts);
+	if(optind >= argc) {
+		die("missing command, see --help");
+	}
+	command = argv[optind++];
+	
+	if(strcmp(command, "convert") == 0) {
+		if(!opts->data) {
+			die("input data option (-i) is missing, see --help");
+		}
+		if(!opts->output) {
+			die("output file option (-o) is missing, see --help");
+		}
+		result = convert_data(opts);
+	} else if(strcmp(command, "info") == 0) {
+		if(optind >= argc) {
+			die("missing descriptor file, see --help");
+		}
+		result = show_data(argv[optind]);
+	} else if(strcmp(command, "dump") == 0) {
+		if(optind >= argc) {
+			die("missing descriptor file, see --help");
+		}
+		result = dump_data(argv[optind], opts);
+	} else {
+		die("unknown command %s, see --help", command);
+	}
+	
+	free(opts->cgps);
+	free(opts);
+	return result == 0 ? 0 : 1;
+}
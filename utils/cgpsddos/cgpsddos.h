@@ -29,6 +29,9 @@
 #define __CGPSDDOS_H__
 
 #include <stdio.h>
+#ifdef HAVE_STDINT_H
+# include <stdint.h>
+#endif
 #ifdef HAVE_NETINET_IN_H
 # include <netinet/in.h>
 #endif
@@ -36,6 +39,7 @@
 #define CGPS_NO_EXTERN_PROTOTYPE
 
 #include "dllist.h"
+#include "hdr.h"
 
 #define CGPSDDOS_RESOLVE_RETRIES 5
 #define CGPSDDOS_RESOLVE_TIMEOUT 2
@@ -66,17 +70,82 @@
 
 #define CGPSDDOS_PEER_TIMEOUT (15 * 60)
 
-#define CGPSDDOS_THREAD_STACKSIZE  64 * 1024     /* thread minimum stacksize */
-#define CGPSDDOS_THREAD_WRSLEEP    1000000       /* wait before retry (microseconds) */
-#define CGPSDDOS_THREAD_WRLIMIT    100           /* retry limit before giving up */
-#define CGPSDDOS_THREAD_FILES_MAX  16 * 1024     /* maximum number of open files (only root) */
-#define CGPSDDOS_THREAD_SPAWN_MIN  200           /* minimum number of running threads */
-#define CGPSDDOS_THREAD_SPAWN_MAX  10000         /* maximum number of started threads (report) */
+#define CGPSDDOS_ENGINE_FILES_MAX 16 * 1024   /* maximum number of open files (only root) */
+#define CGPSDDOS_ENGINE_FILES_RESERVED 16    /* descriptors not used for sessions */
+#define CGPSDDOS_ENGINE_THREADS_MAX 64       /* maximum number of event threads */
+#define CGPSDDOS_ENGINE_EVENTS 256           /* events handled per epoll_wait() */
+#define CGPSDDOS_ENGINE_BUFFER 4096          /* session read buffer */
+#define CGPSDDOS_ENGINE_CONNECT_TIMEOUT 10   /* timeout waiting for greeting (seconds) */
 
 #define CGPSDDOS_ERRNO_MAX 256   /* guessing largest errno */
 
+#define CGPSDDOS_INTERVAL    1                 /* histogram window (seconds) */
+#define CGPSDDOS_HDR_LOWEST  1LL               /* 1 us */
+#define CGPSDDOS_HDR_HIGHEST 3600000000LL      /* 1 hour (us) */
+#define CGPSDDOS_HDR_SIGFIGS 2
+
+#define CGPSDDOS_CACHE_DIR "/tmp/cgpsddos"   /* fetched files (slave, uid is appended) */
+
+#define CGPSDDOS_FILE_DATA  0    /* the input data */
+#define CGPSDDOS_FILE_TRACE 1    /* the trace (replay) */
+#define CGPSDDOS_FILES      2
+
 #define cgpsddos_quit(state) ((state) & CGPSDDOS_STATE_QUIT)
 
+/*
+ * Trace of requests recorded by cgpsd (see libcgpssqp/trace.h) replayed by
+ * the slaves. The records are partitioned between the slaves, so that the
+ * slave with index part replays record part, part + parts, ... of the trace.
+ */
+struct cgpsddos_replay
+{
+	char *trace;             /* the trace (received from master) */
+	size_t size;
+	int part;                /* index of this slave */
+	int parts;               /* number of slaves */
+	double speedup;          /* time between arrivals is divided by speedup */
+};
+
+/*
+ * A request started at its arrival time (in replay mode).
+ */
+struct cgpsddos_arrival
+{
+	long long at;            /* offset from start of run (us) */
+	char *request;           /* greeting and request options */
+	size_t reqlen;
+	char *load;              /* the load response */
+	size_t loadlen;
+};
+
+/*
+ * A file served by the master (see transfer.c).
+ */
+struct cgpsddos_file
+{
+	const char *path;        /* NULL if not served */
+	off_t size;
+	uint64_t checksum;       /* 64-bit FNV-1a of content */
+};
+
+/*
+ * The master serves the data and trace on a TCP socket bound to the same 
+ * port number as its UDP socket. Each fetch connection is served by its
+ * own thread.
+ */
+struct cgpsddos_server
+{
+	int sock;                /* listening socket */
+	pthread_t thread;        /* accepting thread */
+	pthread_mutex_t lock;
+	pthread_cond_t idle;     /* signaled when no fetch is active */
+	int active;              /* active fetch connections */
+	int timeout;             /* socket I/O timeout (seconds) */
+	volatile int done;       /* stop accepting */
+	int started;
+	struct cgpsddos_file files[CGPSDDOS_FILES];
+};
+
 struct cgpsddos
 {
 	struct options *opts;
@@ -85,6 +154,14 @@ struct cgpsddos
 	int mode;                /* master, slave or local */
 	int family;              /* address family (IPv4 or IPV6) */
 	int timeout;             /* timeout waiting for peer (seconds) */
+	char *output;            /* latency distribution file (master) */
+	unsigned int rate;       /* arrival rate per slave (0 = closed loop) */
+	int poisson;             /* Poisson instead of constant arrivals */
+	int interval;            /* histogram window (seconds) */
+	char *trace;             /* request trace to replay (master) */
+	struct cgpsddos_replay replay;
+	struct cgpsddos_server server;   /* file transfer (master) */
+	char *cache;             /* cache directory for fetched files (slave) */
 };
 
 struct cgpspeer
@@ -97,6 +174,20 @@ struct cgpspeer
 	int stage;              /* protocol stage */
 };
 
+/*
+ * Counters for a run of predictions (merged from all event threads).
+ */
+struct cgpsddos_stats
+{
+	unsigned int finished;   /* successful predictions */
+	unsigned int failed;     /* failed predictions */
+	unsigned int dropped;    /* sessions dropped (out of descriptors) */
+	unsigned int errors[CGPSDDOS_ERRNO_MAX];
+	struct hdr_histogram *windows;   /* latency (us) in each time window */
+	int nwindows;
+	int interval;            /* window length (seconds) */
+};
+
 struct resolve_data
 {
 	struct cgpsddos *ddos;
@@ -116,6 +207,54 @@ void run_master(struct cgpsddos *ddos);
 void run_slave(struct cgpsddos *ddos);
 void run_local(struct cgpsddos *ddos);
 
+/*
+ * Run args->count predictions against args->ipaddr using a number of event
+ * threads, each driving its share of sessions (concurrent connections).
+ * The arrival rate and histogram window is taken from ddos. The counters
+ * and latency histograms are returned in stats (release the histograms
+ * by calling cgpsddos_stats_free()).
+ */
+int cgpsddos_engine_run(struct options *args, const struct cgpsddos *ddos, int sessions, int threads, struct cgpsddos_stats *stats);
+void cgpsddos_stats_free(struct cgpsddos_stats *stats);
+
+/*
+ * Build the greeting and request options and the load response (the data
+ * with rows number of observations) sent to cgpsd. The buffers are 
+ * allocated and its length is returned in size.
+ */
+char * cgpsddos_request(int result, int format, size_t *size);
+char * cgpsddos_load(const char *data, int rows, size_t *size);
+
+/*
+ * Returns number of requests in the trace replayed by this slave or -1 if
+ * the trace is invalid.
+ */
+int cgpsddos_replay_count(const struct cgpsddos_replay *replay);
+
+/*
+ * Returns the requests replayed by this slave, sorted on arrival time. The
+ * data (lines of observations) is used for records without payload. The
+ * number of requests is returned in count. Returns NULL on failure. Call 
+ * cgpsddos_replay_free() to release the requests.
+ */
+struct cgpsddos_arrival * cgpsddos_replay_arrivals(const struct cgpsddos_replay *replay, const char *data, int *count);
+void cgpsddos_replay_free(struct cgpsddos_arrival *arrivals, int count);
+
+/*
+ * Start and stop serving the data and trace files (master). The size and
+ * checksum of the files are computed by start. Stop waits for fetches in
+ * progress and is a no-op unless the server was started.
+ */
+int cgpsddos_server_start(struct cgpsddos *ddos);
+void cgpsddos_server_stop(struct cgpsddos *ddos);
+
+/*
+ * Returns the file of size bytes with checksum, either from the cache or
+ * fetched from the master at addr (the master UDP address). The buffer is
+ * nul-terminated. Returns NULL on failure.
+ */
+char * cgpsddos_fetch(const struct cgpsddos *ddos, const struct sockaddr *addr, socklen_t addrlen, size_t size, uint64_t checksum);
+
 /*
  * Read command line options.
  */
@@ -133,14 +272,14 @@ int open_named_socket(int family, int type, const char *addr, const char *port,
  * Send datagram message to (unconnected) socket sock. The destination host is
  * defined by the sockaddr argument or should be NULL if socket is connected.
  */
-int send_dgram(int sock, const char *buff, ssize_t size, const struct sockaddr *sockaddr, socklen_t addrlen);
+ssize_t send_dgram(int sock, const char *buff, ssize_t size, const struct sockaddr *sockaddr, socklen_t addrlen);
 
 /*
  * Receive datagram message from (unconnected) socket. The peer address is 
  * stored in the sockaddr argument of length socklen or should be NULL if 
  * the socket is connected.
  */
-int receive_dgram(int sock, char *buff, ssize_t size, struct sockaddr *sockaddr, socklen_t *addrlen);
+ssize_t receive_dgram(int sock, char *buff, ssize_t size, struct sockaddr *sockaddr, socklen_t *addrlen);
 
 /*
  * Split the address string into host/port components. The addr argument
@@ -27,6 +27,7 @@
 
 /*
  * Open connection to ChemGPS daemon (cgpsd) and run denial of service test.
+ * The predictions are run by the event engine (see engine.c).
  */
 
 #ifdef HAVE_CONFIG_H
@@ -45,8 +46,8 @@
 #ifdef HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
-#ifdef HAVE_LIBPTHREAD
-# include <pthread.h>
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
 #endif
 #include <sys/time.h>
 #include <sys/resource.h>
@@ -55,35 +56,10 @@
 
 #include "cgpsddos.h"
 #include "cgpssqp.h"
-#include "cgpsclt.h"
 
-pthread_mutex_t countlock;
-pthread_mutex_t blocklock;
-pthread_mutex_t droplock;
+int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args, const struct cgpsddos *ddos);
 
-pthread_mutex_t finishlock;
-pthread_mutex_t failedlock;
-pthread_mutex_t runninglock;
-
-pthread_cond_t  countcond;
-pthread_cond_t  blockcond;
-
-static unsigned int count = 0;          /* currently number of running threads */
-static unsigned int blocked = 0;        /* currently number of blocked threads */
-static unsigned int dropped = 0;        /* currently number of dropped threads */
-
-static unsigned int failed = 0;         /* counter for failed predictions */
-static unsigned int finish = 0;         /* total finished predictions */
-static unsigned int running = 0;        /* currently number of running predictions */
-
-static unsigned int maxthr = 0;         /* maximum number of running threads */
-static unsigned int minthr = 0;         /* minimum number of running threads */
-
-static unsigned int errors[CGPSDDOS_ERRNO_MAX];
-
-int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args);
-
-static char * cgpsddos_errors(void)
+static char * cgpsddos_errors(const struct cgpsddos_stats *stats)
 {
 	FILE *fs;
 	char *buff = NULL;
@@ -93,11 +69,11 @@ static char * cgpsddos_errors(void)
 	fs = open_memstream(&buff, &size);
 	if(fs) {
 		for(i = 0; i < CGPSDDOS_ERRNO_MAX; ++i) {
-			if(errors[i]) {
+			if(stats->errors[i]) {
 				if(del++) {
 					fprintf(fs, ", ");
 				}
-				fprintf(fs, "'%s (%d)'=%d", strerror(i), i, errors[i]);
+				fprintf(fs, "'%s (%d)'=%d", strerror(i), i, stats->errors[i]);
 			}
 		}
 		fclose(fs);
@@ -108,26 +84,68 @@ static char * cgpsddos_errors(void)
 	return buff;
 }
 
-static __inline__ void cgpsddos_print_stats(struct options *popt)
+/*
+ * Send the latency histograms to peer. The histogram of each window is sent
+ * as one or more messages with sparse counts (index=count pairs), i.e. 
+ * "histogram: 2 12=3 13=40 14=2". 
+ */
+static int cgpsddos_send_histograms(int sock, const struct sockaddr *sockaddr, socklen_t addrlen,
+				    const struct cgpsddos_stats *stats)
 {
-	debug("threads: { count=%d, running=%d, blocked=%d, dropped=%d }, requests: { finished=%d, failed=%d, total=%d }",
-	      count, running, blocked, dropped, finish, failed, popt->count);
+	char msg[CGPSDDOS_BUFF_LEN];
+	size_t len, used;
+	int i, j, start, sent = 0;
+
+	for(i = 0; i < stats->nwindows; ++i) {
+		const struct hdr_histogram *hdr = &stats->windows[i];
+		
+		if(!hdr->total) {
+			continue;
+		}
+		used = start = snprintf(msg, sizeof(msg), "histogram: %d", i);
+		for(j = 0; j < hdr->counts_len; ++j) {
+			if(!hdr->counts[j]) {
+				continue;
+			}
+			len = snprintf(msg + used, sizeof(msg) - used, " %d=%lld", j, hdr->counts[j]);
+			if(used + len >= sizeof(msg) - 1) {
+				if(send_dgram(sock, msg, used, sockaddr, addrlen) < 0) {
+					return -1;
+				}
+				++sent;
+				used = start;
+				len = snprintf(msg + used, sizeof(msg) - used, " %d=%lld", j, hdr->counts[j]);
+			}
+			used += len;
+		}
+		if(send_dgram(sock, msg, used, sockaddr, addrlen) < 0) {
+			return -1;
+		}
+		++sent;
+	}
+	return sent;
 }
 
 static void cgpsddos_send_result(int sock, const struct sockaddr *sockaddr, socklen_t addrlen,
-				 struct timeval *ts, struct timeval *te, struct options *args)
+				 struct timeval *ts, struct timeval *te, struct options *args,
+				 const struct cgpsddos_stats *stats, int threads, int sessions)
 {
 	char msg[CGPSDDOS_BUFF_LEN];	
 	char *errmsg;
 	char host[NI_MAXHOST];
-	int res;
+	int res, sent;
 	
-	errmsg = cgpsddos_errors();	
-	snprintf(msg, sizeof(msg), "predict: time: { start=%lu.%lu, finish=%lu.%lu }, threads: { max=%d, min=%d, dropped=%d }, requests: { finished=%d, failed=%d, total=%d }, errors: { %s }\n", 
+	if((sent = cgpsddos_send_histograms(sock, sockaddr, addrlen, stats)) < 0) {
+		logerr("failed send latency histograms");
+		sent = 0;
+	}
+	
+	errmsg = cgpsddos_errors(stats);
+	snprintf(msg, sizeof(msg), "predict: time: { start=%lu.%lu, finish=%lu.%lu }, engine: { threads=%d, sessions=%d, dropped=%d }, requests: { finished=%d, failed=%d, total=%d }, histograms: %d, errors: { %s }\n", 
 		 ts->tv_sec, ts->tv_usec,
-		 te->tv_sec, te->tv_usec, maxthr, minthr, dropped, finish, failed, args->count, errmsg ? errmsg : "" );
+		 te->tv_sec, te->tv_usec, threads, sessions, stats->dropped, stats->finished, stats->failed, args->count, sent, errmsg ? errmsg : "" );
 	if(send_dgram(sock, msg, strlen(msg), sockaddr, addrlen) < 0) {
-		if((res = getnameinfo((const struct sockaddr *)&sockaddr, addrlen,
+		if((res = getnameinfo(sockaddr, addrlen,
 				      host, sizeof(host), NULL, 0, NI_NUMERICHOST)) != 0) {
 			logerr("failed resolve peer address (%s)", gai_strerror(res));
 			snprintf(host, sizeof(host), "peer");
@@ -139,122 +157,13 @@ static void cgpsddos_send_result(int sock, const struct sockaddr *sockaddr, sock
 	}
 }
 
-static void * cgpsddos_connect(void *args)
-{	
-	struct client peer;
-	struct options mopt = *(struct options *)args;
-	struct linger solinger;
-	
-	int res;
-
-	if(!mopt.quiet) {
-		debug("connecting to %s:%d", mopt.ipaddr, mopt.port);
-	}
-
-	mopt.noretry = 1;
-	mopt.quiet = 1;
-
-	solinger.l_onoff = 1;
-	solinger.l_linger = CGPSDDOS_PEER_TIMEOUT;
-	
-	while(1) {
-		if(cgpsddos_quit(opts->state)) {
-			debug("stopping thread execution (exit flag set)");
-			break;
-		}
-		
-		pthread_mutex_lock(&finishlock);
-		pthread_mutex_lock(&runninglock);
-		if(finish + running >= mopt.count) {
-			pthread_mutex_unlock(&runninglock);
-			pthread_mutex_unlock(&finishlock);
-			break;
-		}
-		++running;
-		pthread_mutex_unlock(&runninglock);
-		pthread_mutex_unlock(&finishlock);
-		
-		cgpsddos_print_stats(&mopt);
-		errno = 0;
-		
-		if((res = init_socket(&mopt)) == CGPSCLT_CONN_SUCCESS) {
-			peer.type = CGPS_DDOS;
-			peer.sock = mopt.unsock ? mopt.unsock : mopt.ipsock;
-			peer.opts = &mopt;
-			
-			if(setsockopt(peer.sock, SOL_SOCKET, SO_LINGER, &solinger, sizeof(struct linger)) < 0) {
-				logwarn("failed set socket option SO_LINGER");
-			} 
-			res = request(&mopt, &peer);
-			close(peer.sock);
-		} 
-		pthread_mutex_lock(&runninglock);
-		--running;
-		pthread_mutex_unlock(&runninglock);
-		
-		if(res == CGPSCLT_CONN_SUCCESS) {
-			pthread_mutex_lock(&finishlock);
-			++finish;
-			pthread_mutex_unlock(&finishlock);
-			pthread_cond_signal(&blockcond);
-		} 
-		else {
-			pthread_mutex_lock(&failedlock);
-			++failed;
-			++errors[errno];
-			pthread_mutex_unlock(&failedlock);
-			if(errno == EMFILE) {
-				pthread_mutex_lock(&droplock);
-				++dropped;
-				pthread_mutex_unlock(&droplock);
-				break;
-			}
-		}
-		if(res != CGPSCLT_CONN_SUCCESS) {
-			pthread_mutex_lock(&blocklock);
-			++blocked;
-			pthread_mutex_unlock(&blocklock);
-			while(1) {
-				pthread_mutex_lock(&blocklock);
-				if(pthread_cond_wait(&blockcond, &blocklock) != 0) {
-					pthread_mutex_unlock(&blocklock);
-					continue;
-				}
-				--blocked;
-				pthread_mutex_unlock(&blocklock);
-				break;
-			}
-		}
-	}
-	debug("finished loop");
-
-	pthread_mutex_lock(&countlock);
-	--count;
-	pthread_mutex_unlock(&countlock);
-	pthread_cond_signal(&countcond);
-	
-	pthread_mutex_lock(&blocklock);
-	while(blocked > 0) {
-		pthread_mutex_unlock(&blocklock);
-		pthread_cond_signal(&blockcond);
-	}
-	pthread_mutex_unlock(&blocklock);
-	
-	pthread_exit(NULL);
-}
-
-int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args)
+int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args, const struct cgpsddos *ddos)
 {
 	struct timeval ts;      /* predict start */
 	struct timeval te;      /* predict finished */
-	pthread_t *threads;
-	pthread_attr_t attr;
-	size_t stacksize;
+	struct cgpsddos_stats stats;
 	struct rlimit rlim;
-	unsigned int i;
-	
-	count = blocked = failed = finish = running = maxthr = minthr = 0;
-	memset(errors, 0, sizeof(errors));
+	long sessions, threads;
 	
 	if(getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
 		debug("default maximum file descriptor number: %d (soft), %d (hard)", 
@@ -262,8 +171,8 @@ int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struc
 		if(args->count > rlim.rlim_cur) {
 			if(rlim.rlim_cur < rlim.rlim_max) {
 				if(getuid() == 0) {
-					if(rlim.rlim_cur < CGPSDDOS_THREAD_FILES_MAX) {
-						rlim.rlim_cur = CGPSDDOS_THREAD_FILES_MAX;
+					if(rlim.rlim_cur < CGPSDDOS_ENGINE_FILES_MAX) {
+						rlim.rlim_cur = CGPSDDOS_ENGINE_FILES_MAX;
 					}
 					rlim.rlim_max = rlim.rlim_cur;
 				} else {
@@ -283,44 +192,27 @@ int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struc
 	}
 	debug("maximum number of open files: %d (from sysconf)", sysconf(_SC_OPEN_MAX));
 	
-	maxthr = sysconf(_SC_OPEN_MAX) / 2 - 3;   /* account for socket dup() + stdin, stderr and stdout */
-	minthr = CGPSDDOS_THREAD_SPAWN_MIN;	
-	if(maxthr > args->count) {
-		maxthr = args->count;
+	/*
+	 * One session (socket) for each concurrent request and one event
+	 * thread per CPU.
+	 */
+	sessions = sysconf(_SC_OPEN_MAX) - CGPSDDOS_ENGINE_FILES_RESERVED;
+	if(sessions > (long)args->count) {
+		sessions = args->count;
 	}
-	if(minthr > maxthr) {
-		minthr = maxthr / 2;
-	}	
-	debug("thread pool: %d (max), %d (min)", maxthr, minthr);
-
-	debug("allocating %d threads pool", maxthr);
-	threads = malloc(sizeof(pthread_t) * maxthr);
-	if(!threads) {	
-		die("failed alloc memory");
+	if(sessions < 1) {
+		sessions = 1;
 	}
-	memset(threads, 0, maxthr * sizeof(pthread_t));
-	
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-
-	pthread_attr_getstacksize(&attr, &stacksize);
-	debug("default stack size: %d kB", stacksize / 1024);	
-	stacksize = CGPSDDOS_THREAD_STACKSIZE;
-	debug("wanted stack size: %d kB", stacksize / 1024);	
-	pthread_attr_setstacksize(&attr, stacksize);
-	pthread_attr_getstacksize(&attr, &stacksize);
-	debug("actual stack size: %d kB", stacksize / 1024);
-	
- 	pthread_cond_init(&countcond, NULL);
-	pthread_cond_init(&blockcond, NULL);
-	
-	pthread_mutex_init(&countlock, NULL);
-	pthread_mutex_init(&blocklock, NULL);
-	pthread_mutex_init(&droplock, NULL);
-	
-	pthread_mutex_init(&finishlock, NULL);
-	pthread_mutex_init(&runninglock, NULL);
-	pthread_mutex_init(&failedlock, NULL);
+	if((threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+		threads = 1;
+	}
+	if(threads > CGPSDDOS_ENGINE_THREADS_MAX) {
+		threads = CGPSDDOS_ENGINE_THREADS_MAX;
+	}
+	if(threads > sessions) {
+		threads = sessions;
+	}
+	debug("event engine: %ld threads, %ld sessions", threads, sessions);
 	
 	if(gettimeofday(&ts, NULL) < 0) {
 		logerr("failed calling gettimeofday()");
@@ -330,51 +222,23 @@ int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struc
 	if(args->verbose && !args->quiet) {
 		loginfo("start running %d predictions", args->count);
 	}
-	for(i = 0; i < maxthr; ++i) {
-		if(pthread_create(&threads[i], &attr, cgpsddos_connect, args) == 0) {
-			pthread_mutex_lock(&countlock);
-			++count;
-			pthread_mutex_unlock(&countlock);
-		}
-		debug("thread 0x%lu: started", threads[i]);
-	}
-	
-        while(1) {
-		pthread_mutex_lock(&countlock);
-		while(count > 0) {
-			debug("waiting for threads to finish (%d running)...", count);
-			if(pthread_cond_wait(&countcond, &countlock) != 0) {
-				continue;
-			}
-		}
-		pthread_mutex_unlock(&countlock);
-		break;
+	if(cgpsddos_engine_run(args, ddos, sessions, threads, &stats) < 0) {
+		logerr("failed run predictions");
 	}
-	debug("all threads has finished");	
 	if(args->verbose && !args->quiet) {
 		loginfo("finished running predictions");
 	}
+	debug("requests: { finished=%d, failed=%d, total=%d }, dropped=%d",
+	      stats.finished, stats.failed, args->count, stats.dropped);
 	
 	if(gettimeofday(&te, NULL) < 0) {
 		logerr("failed calling gettimeofday()");
 		return -1;
 	}
 
-	pthread_mutex_destroy(&failedlock);
-	pthread_mutex_destroy(&runninglock);
-	pthread_mutex_destroy(&finishlock);
-	
-	pthread_mutex_destroy(&droplock);
-	pthread_mutex_destroy(&blocklock);
-	pthread_mutex_destroy(&countlock);
-	
- 	pthread_cond_destroy(&countcond);
- 	pthread_cond_destroy(&blockcond);
-	
-	free(threads);
-	
 	debug("sending predict result to peer");
-	cgpsddos_send_result(sock, addr, addrlen, &ts, &te, args);
+	cgpsddos_send_result(sock, addr, addrlen, &ts, &te, args, &stats, threads, sessions);
+	cgpsddos_stats_free(&stats);
 	
 	return 0;
 }
@@ -0,0 +1,860 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Event driven load generator. A few threads (one per CPU) each runs an
+ * epoll loop driving many non-blocking CGPSP sessions against the target 
+ * daemon. Counters and latency histograms are kept per thread and merged 
+ * when all threads are finished, so no locking is done while running 
+ * predictions.
+ *
+ * Requests are either started as soon as a session is free (closed loop)
+ * or at scheduled arrival times (open loop, constant rate, Poisson or the
+ * arrival times from a replayed trace). In open loop mode, the latency is 
+ * measured from the scheduled time, so time spent waiting for a free 
+ * session is included.
+ *
+ * With stream compression (-z), the greeting is followed by the compress
+ * request only. Once acknowledged, the request options and load response
+ * are compressed per session and the input is decompressed into the read
+ * buffer before parsing.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+#ifdef HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_LIBPTHREAD
+# include <pthread.h>
+#endif
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <chemgps.h>
+
+#include "cgpsddos.h"
+#include "cgpssqp.h"
+#include "compress.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0
+#endif
+
+/*
+ * Session state:
+ */
+#define ENGINE_STATE_IDLE     0  /* not connected */
+#define ENGINE_STATE_CONNECT  1  /* connect in progress */
+#define ENGINE_STATE_GREETING 2  /* waiting for server greeting */
+#define ENGINE_STATE_SEND     3  /* sending request or data */
+#define ENGINE_STATE_EXCHANGE 4  /* waiting for load request or result */
+
+struct engine_session
+{
+	int sock;
+	int state;                       /* ENGINE_STATE_XXX */
+	int result;                      /* result section seen */
+	time_t stamp;                    /* last activity */
+	long long sched;                 /* scheduled start (us) */
+	const struct cgpsddos_arrival *request;
+	const char *wbuf;                /* pending output (shared) */
+	size_t wlen;
+	char rbuf[CGPSDDOS_ENGINE_BUFFER];
+	size_t rlen;
+	struct cgps_compress *comp;      /* compressed session (or NULL) */
+	char *zbuf;                      /* compressed input */
+	size_t zlen;
+};
+
+struct engine_worker
+{
+	const struct engine *engine;
+	struct engine_session *sessions;
+	int nsessions;
+	struct engine_session **idle;    /* stack of free sessions */
+	int nidle;
+	int active;                      /* connected sessions */
+	int epfd;
+	unsigned int quota;              /* requests left to start */
+	double gap;                      /* mean interarrival time (us) */
+	double next;                     /* next arrival (us) */
+	int arrival;                     /* next replayed request */
+	unsigned int seed;               /* for Poisson arrivals */
+	struct cgpsddos_stats stats;
+	pthread_t thread;
+};
+
+struct engine
+{
+	struct addrinfo *addr;           /* target address */
+	struct cgpsddos_arrival request; /* the request (unless replay) */
+	struct cgpsddos_arrival *arrivals;  /* replayed requests */
+	int narrivals;
+	int threads;
+	long long start;                 /* run started (us) */
+	long long interval;              /* histogram window (us) */
+	int poisson;                     /* Poisson arrivals */
+	int compress;                    /* stream compression method */
+	char *hello;                     /* greeting and compress request */
+	size_t hellolen;
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+
+/*
+ * Build the load response for the input data.
+ */
+static char * engine_load(struct options *args, size_t *size)
+{
+	const char *data = args->data ? args->data : "";
+	const char *curr;
+	size_t len = strlen(data);
+	int lines = 0;
+
+	for(curr = data; *curr; ++curr) {
+		if(*curr == '\n') {
+			++lines;
+		}
+	}
+	if(len && data[len - 1] != '\n') {
+		++lines;
+	}
+	if(len && !isdigit(*data) && *data != '-') {
+		debug("header detected in data");
+		--lines;
+	}
+	return cgpsddos_load(data, lines, size);
+}
+
+static int engine_watch(struct engine_worker *worker, struct engine_session *sess, int op, unsigned int events)
+{
+	struct epoll_event event;
+
+	memset(&event, 0, sizeof(struct epoll_event));
+	event.events = events;
+	event.data.ptr = sess;
+	return epoll_ctl(worker->epfd, op, sess->sock, &event);
+}
+
+/*
+ * Returns monotonic time in microseconds.
+ */
+static long long engine_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * Record latency of finished request in the histogram of current window.
+ */
+static void engine_record(struct engine_worker *worker, struct engine_session *sess, long long now)
+{
+	struct cgpsddos_stats *stats = &worker->stats;
+	int window = (now - worker->engine->start) / worker->engine->interval;
+
+	if(window >= stats->nwindows) {
+		struct hdr_histogram *windows;
+		
+		if(!(windows = realloc(stats->windows, (window + 1) * sizeof(struct hdr_histogram)))) {
+			die("failed alloc memory");
+		}
+		stats->windows = windows;
+		while(stats->nwindows <= window) {
+			if(hdr_init(&stats->windows[stats->nwindows++], CGPSDDOS_HDR_LOWEST,
+				    CGPSDDOS_HDR_HIGHEST, CGPSDDOS_HDR_SIGFIGS) < 0) {
+				die("failed alloc memory");
+			}
+		}
+	}
+	hdr_record(&stats->windows[window], now - sess->sched);
+}
+
+/*
+ * Account failed request.
+ */
+static void engine_failed(struct engine_worker *worker, int error)
+{
+	++worker->stats.failed;
+	++worker->stats.errors[error < CGPSDDOS_ERRNO_MAX ? error : 0];
+	if(error == EMFILE || error == ENFILE) {
+		++worker->stats.dropped;
+	}
+}
+
+/*
+ * Close session and account the request. The error argument is 0 on
+ * success, otherwise the errno value causing the failure. The session is
+ * put back on the idle stack unless we are out of descriptors.
+ */
+static void engine_session_close(struct engine_worker *worker, struct engine_session *sess, int error)
+{
+	close(sess->sock);
+	sess->sock = -1;
+	sess->state = ENGINE_STATE_IDLE;
+	--worker->active;
+
+	if(sess->comp) {
+		cgps_compress_free(sess->comp);
+		free(sess->zbuf);
+		sess->comp = NULL;
+		sess->zbuf = NULL;
+	}
+
+	if(!error) {
+		++worker->stats.finished;
+		engine_record(worker, sess, engine_clock());
+	} else {
+		engine_failed(worker, error);
+	}
+	if(error != EMFILE && error != ENFILE) {
+		worker->idle[worker->nidle++] = sess;
+	}
+}
+
+/*
+ * Connect idle session to target. Connect errors are accounted (and the
+ * session is put back on the idle stack).
+ */
+static void engine_session_start(struct engine_worker *worker, struct engine_session *sess)
+{
+	const struct addrinfo *addr = worker->engine->addr;
+
+	sess->rlen = 0;
+	sess->zlen = 0;
+	sess->result = 0;
+	sess->stamp = time(NULL);
+
+	if((sess->sock = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol)) < 0) {
+		engine_failed(worker, errno);
+		if(errno != EMFILE && errno != ENFILE) {
+			worker->idle[worker->nidle++] = sess;
+		}
+		return;
+	}
+	++worker->active;
+	
+	if(fcntl(sess->sock, F_SETFL, O_NONBLOCK) < 0) {
+		engine_session_close(worker, sess, errno);
+		return;
+	}
+	if(connect(sess->sock, addr->ai_addr, addr->ai_addrlen) < 0 && errno != EINPROGRESS) {
+		engine_session_close(worker, sess, errno);
+		return;
+	}
+	sess->state = ENGINE_STATE_CONNECT;
+	if(engine_watch(worker, sess, EPOLL_CTL_ADD, EPOLLOUT) < 0) {
+		engine_session_close(worker, sess, errno);
+	}
+}
+
+/*
+ * Returns true if requests are started at scheduled arrival times.
+ */
+static int engine_open_loop(const struct engine_worker *worker)
+{
+	return worker->gap > 0.0 || worker->engine->arrivals;
+}
+
+/*
+ * Start requests on idle sessions. In open loop mode, only arrivals that
+ * are due is started, with the arrival time as start time. Arrivals not
+ * started because all sessions are busy are queued implicit (next stays 
+ * in the past).
+ */
+static void engine_dispatch(struct engine_worker *worker)
+{
+	const struct engine *engine = worker->engine;
+	struct engine_session *sess;
+	long long now = engine_clock();
+
+	while(worker->nidle && worker->quota) {
+		if(engine_open_loop(worker) && engine->start + worker->next > now) {
+			break;
+		}
+		sess = worker->idle[--worker->nidle];
+		sess->request = &engine->request;
+		--worker->quota;
+		
+		if(engine->arrivals) {
+			/*
+			 * Each thread replays every threads:th request.
+			 */
+			sess->request = &engine->arrivals[worker->arrival];
+			sess->sched = engine->start + sess->request->at;
+			worker->arrival += engine->threads;
+			if(worker->quota) {
+				worker->next = engine->arrivals[worker->arrival].at;
+			}
+		} else if(worker->gap > 0.0) {
+			sess->sched = engine->start + (long long)worker->next;
+			if(engine->poisson) {
+				worker->next -= worker->gap * log(1.0 - rand_r(&worker->seed) / (RAND_MAX + 1.0));
+			} else {
+				worker->next += worker->gap;
+			}
+		} else {
+			sess->sched = now;
+		}
+		engine_session_start(worker, sess);
+	}
+}
+
+/*
+ * Returns milliseconds until next arrival is due (at most one second).
+ */
+static int engine_timeout(struct engine_worker *worker)
+{
+	long long wait;
+
+	if(!worker->quota || !worker->nidle || !engine_open_loop(worker)) {
+		return 1000;
+	}
+	wait = worker->engine->start + (long long)worker->next - engine_clock();
+	if(wait <= 0) {
+		return 0;
+	}
+	return wait < 1000000 ? (int)((wait + 999) / 1000) : 1000;
+}
+
+/*
+ * Send pending output. Returns 1 when done, 0 if socket would block and
+ * -1 on failure.
+ */
+static int engine_session_send(struct engine_worker *worker, struct engine_session *sess)
+{
+	ssize_t bytes;
+
+	while(sess->wlen) {
+		if((bytes = send(sess->sock, sess->wbuf, sess->wlen, MSG_NOSIGNAL)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				if(sess->state != ENGINE_STATE_SEND) {
+					sess->state = ENGINE_STATE_SEND;
+					if(engine_watch(worker, sess, EPOLL_CTL_MOD, EPOLLOUT) < 0) {
+						return -1;
+					}
+				}
+				return 0;
+			}
+			return -1;
+		}
+		sess->wbuf += bytes;
+		sess->wlen -= bytes;
+	}
+	if(sess->state == ENGINE_STATE_SEND) {
+		if(engine_watch(worker, sess, EPOLL_CTL_MOD, EPOLLIN) < 0) {
+			return -1;
+		}
+	}
+	sess->state = ENGINE_STATE_EXCHANGE;
+	return 1;
+}
+
+/*
+ * The server acknowledged the compress request, send the request options
+ * (following the greeting line) compressed. All input after the ack is
+ * compressed, so nothing should be buffered.
+ */
+static int engine_session_compress(struct engine_worker *worker, struct engine_session *sess, const char *rest)
+{
+	const char *request = strchr(sess->request->request, '\n') + 1;
+
+	if(rest != sess->rbuf + sess->rlen) {
+		return EPROTO;
+	}
+	if(!(sess->comp = cgps_compress_new(worker->engine->compress)) ||
+	   !(sess->zbuf = malloc(CGPSDDOS_ENGINE_BUFFER))) {
+		return ENOMEM;
+	}
+	if(!(sess->wbuf = cgps_compress_encode(sess->comp, request, 
+					       sess->request->reqlen - (request - sess->request->request), 
+					       &sess->wlen))) {
+		return EPROTO;
+	}
+	if(engine_session_send(worker, sess) < 0) {
+		return errno;
+	}
+	return 0;
+}
+
+/*
+ * Process all complete lines in the read buffer. Returns 0 if session 
+ * should continue and an errno value on failure.
+ */
+static int engine_session_parse(struct engine_worker *worker, struct engine_session *sess)
+{
+	char *line = sess->rbuf, *eol;
+
+	while(sess->state != ENGINE_STATE_SEND &&
+	      (eol = memchr(line, '\n', sess->rlen - (line - sess->rbuf)))) {
+		*eol = '\0';
+		if(eol > line && eol[-1] == '\r') {
+			eol[-1] = '\0';
+		}
+		if(strncmp(line, "error:", 6) == 0) {
+			return sess->state == ENGINE_STATE_GREETING ? EBUSY : EPROTO;
+		}
+		if(sess->state == ENGINE_STATE_GREETING) {
+			if(strncmp(line, "CGPSP ", 6) != 0) {
+				return EPROTO;
+			}
+			if(worker->engine->compress && cgps_compress_offered(line, worker->engine->compress)) {
+				sess->wbuf = worker->engine->hello;
+				sess->wlen = worker->engine->hellolen;
+			} else {
+				sess->wbuf = sess->request->request;
+				sess->wlen = sess->request->reqlen;
+			}
+			if(engine_session_send(worker, sess) < 0) {
+				return errno;
+			}
+		} else if(strncmp(line, "Compress:", 9) == 0 && !sess->comp) {
+			int error;
+			
+			line = eol + 1;
+			if((error = engine_session_compress(worker, sess, line)) != 0) {
+				return error;
+			}
+			continue;
+		} else if(strncmp(line, "Load:", 5) == 0) {
+			if(!sess->comp) {
+				sess->wbuf = sess->request->load;
+				sess->wlen = sess->request->loadlen;
+			} else if(!(sess->wbuf = cgps_compress_encode(sess->comp, sess->request->load, 
+								      sess->request->loadlen, &sess->wlen))) {
+				return EPROTO;
+			}
+			if(engine_session_send(worker, sess) < 0) {
+				return errno;
+			}
+		} else if(strcmp(line, "Result:") == 0) {
+			sess->result = 1;
+		} else if(!sess->result) {
+			return EPROTO;
+		}
+		line = eol + 1;
+	}
+	sess->rlen -= line - sess->rbuf;
+	memmove(sess->rbuf, line, sess->rlen);
+	
+	if(sess->rlen == sizeof(sess->rbuf)) {
+		if(!sess->result) {
+			return EPROTO;
+		}
+		sess->rlen = 0;         /* discard long result line */
+	}
+	return 0;
+}
+
+/*
+ * Decompress received input to the read buffer and parse it. The decoder
+ * is called until no more output is produced, as the read buffer might
+ * be filled before all input is consumed.
+ */
+static int engine_session_inflate(struct engine_worker *worker, struct engine_session *sess)
+{
+	ssize_t bytes;
+	size_t used;
+	int error;
+
+	do {
+		if((bytes = cgps_compress_decode(sess->comp, sess->zbuf, sess->zlen, &used, 
+						 sess->rbuf + sess->rlen, sizeof(sess->rbuf) - sess->rlen)) < 0) {
+			return EPROTO;
+		}
+		sess->zlen -= used;
+		memmove(sess->zbuf, sess->zbuf + used, sess->zlen);
+		sess->rlen += bytes;
+		if((error = engine_session_parse(worker, sess)) != 0) {
+			return error;
+		}
+	} while((bytes > 0 || sess->comp->pending) && sess->state != ENGINE_STATE_SEND);
+
+	return 0;
+}
+
+/*
+ * Handle ready event on session. Returns 0 if session should continue, -1
+ * when the request is finished and an errno value on failure.
+ */
+static int engine_session_event(struct engine_worker *worker, struct engine_session *sess, unsigned int events)
+{
+	ssize_t bytes;
+	socklen_t len;
+	int error = 0;
+
+	sess->stamp = time(NULL);
+
+	switch(sess->state) {
+	case ENGINE_STATE_CONNECT:
+		len = sizeof(error);
+		if(getsockopt(sess->sock, SOL_SOCKET, SO_ERROR, &error, &len) < 0) {
+			return errno;
+		}
+		if(error) {
+			return error;
+		}
+		sess->state = ENGINE_STATE_GREETING;
+		if(engine_watch(worker, sess, EPOLL_CTL_MOD, EPOLLIN) < 0) {
+			return errno;
+		}
+		return 0;
+	case ENGINE_STATE_SEND:
+		if(events & (EPOLLERR | EPOLLHUP) && !(events & EPOLLOUT)) {
+			return EPIPE;
+		}
+		if(engine_session_send(worker, sess) < 0) {
+			return errno;
+		}
+		if(sess->state != ENGINE_STATE_SEND) {
+			return engine_session_parse(worker, sess);
+		}
+		return 0;
+	default:
+		while(1) {
+			if(sess->comp) {
+				bytes = recv(sess->sock, sess->zbuf + sess->zlen, CGPSDDOS_ENGINE_BUFFER - sess->zlen, 0);
+			} else {
+				bytes = recv(sess->sock, sess->rbuf + sess->rlen, sizeof(sess->rbuf) - sess->rlen, 0);
+			}
+			if(bytes < 0) {
+				if(errno == EINTR) {
+					continue;
+				}
+				if(errno == EAGAIN || errno == EWOULDBLOCK) {
+					return 0;
+				}
+				return errno;
+			}
+			if(bytes == 0) {
+				return sess->result ? -1 : ECONNRESET;
+			}
+			if(sess->comp) {
+				sess->zlen += bytes;
+				error = engine_session_inflate(worker, sess);
+			} else {
+				sess->rlen += bytes;
+				error = engine_session_parse(worker, sess);
+			}
+			if(error) {
+				return error;
+			}
+			if(sess->state == ENGINE_STATE_SEND) {
+				return 0;
+			}
+		}
+	}
+}
+
+static void * engine_worker_run(void *arg)
+{
+	struct engine_worker *worker = arg;
+	struct epoll_event events[CGPSDDOS_ENGINE_EVENTS];
+	time_t swept = time(NULL), now;
+	int i, res;
+
+	engine_dispatch(worker);
+
+	while(!cgpsddos_quit(opts->state)) {
+		if(!worker->active && (!worker->quota || !worker->nidle)) {
+			break;
+		}
+		if((res = epoll_wait(worker->epfd, events, CGPSDDOS_ENGINE_EVENTS, engine_timeout(worker))) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed wait for events");
+			break;
+		}
+		for(i = 0; i < res; ++i) {
+			struct engine_session *sess = events[i].data.ptr;
+			int status = engine_session_event(worker, sess, events[i].events);
+
+			if(status) {
+				engine_session_close(worker, sess, status < 0 ? 0 : status);
+			}
+		}
+
+		/*
+		 * Fail sessions stalled on an unresponsive server. Connections
+		 * dropped from a full listen queue are never greeted, so these
+		 * gets a shorter timeout.
+		 */
+		if((now = time(NULL)) != swept) {
+			for(i = 0; i < worker->nsessions; ++i) {
+				struct engine_session *sess = &worker->sessions[i];
+				time_t timeout = sess->state < ENGINE_STATE_SEND ? 
+					CGPSDDOS_ENGINE_CONNECT_TIMEOUT : CGPSDDOS_PEER_TIMEOUT;
+				if(sess->sock != -1 && now - sess->stamp > timeout) {
+					engine_session_close(worker, sess, ETIMEDOUT);
+				}
+			}
+			swept = now;
+		}
+		engine_dispatch(worker);
+	}
+
+	for(i = 0; i < worker->nsessions; ++i) {
+		if(worker->sessions[i].sock != -1) {
+			close(worker->sessions[i].sock);
+			worker->sessions[i].sock = -1;
+		}
+		if(worker->sessions[i].comp) {
+			cgps_compress_free(worker->sessions[i].comp);
+			free(worker->sessions[i].zbuf);
+		}
+	}
+	return NULL;
+}
+
+static int engine_init(struct engine *engine, struct options *args, const struct cgpsddos *ddos)
+{
+	struct addrinfo hints;
+	char port[NI_MAXSERV];
+	int res;
+
+	memset(engine, 0, sizeof(struct engine));
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	snprintf(port, sizeof(port), "%d", args->port);
+
+	if((res = getaddrinfo(args->ipaddr, port, &hints, &engine->addr)) != 0) {
+		logerr("failed resolve %s (%s)", args->ipaddr, gai_strerror(res));
+		return -1;
+	}
+	if(args->compress) {
+		FILE *fs;
+		
+		if(!(fs = open_memstream(&engine->hello, &engine->hellolen))) {
+			logerr("failed open memory stream");
+			return -1;
+		}
+		fprintf(fs, "CGPSP %s (%s: client ready)\nCompress: %s\n", 
+			CGPSP_PROTO_VERSION, opts->prog, cgps_compress_name(args->compress));
+		fclose(fs);
+		engine->compress = args->compress;
+	}
+	if(ddos->replay.trace) {
+		if(!(engine->arrivals = cgpsddos_replay_arrivals(&ddos->replay, args->data, &engine->narrivals))) {
+			logerr("failed load requests from trace");
+			return -1;
+		}
+		return 0;
+	}
+	if(!(engine->request.request = cgpsddos_request(args->cgps->result, args->cgps->format, &engine->request.reqlen)) ||
+	   !(engine->request.load = engine_load(args, &engine->request.loadlen))) {
+		logerr("failed alloc memory");
+		return -1;
+	}
+	return 0;
+}
+
+static void engine_cleanup(struct engine *engine)
+{
+	if(engine->addr) {
+		freeaddrinfo(engine->addr);
+	}
+	if(engine->request.request) {
+		free(engine->request.request);
+	}
+	if(engine->request.load) {
+		free(engine->request.load);
+	}
+	if(engine->hello) {
+		free(engine->hello);
+	}
+	if(engine->arrivals) {
+		cgpsddos_replay_free(engine->arrivals, engine->narrivals);
+	}
+}
+
+int cgpsddos_engine_run(struct options *args, const struct cgpsddos *ddos, int sessions, int threads, struct cgpsddos_stats *stats)
+{
+	struct engine engine;
+	struct engine_worker *workers;
+	struct engine_session *pool, **idle;
+	int i, j, used = 0;
+
+	memset(stats, 0, sizeof(struct cgpsddos_stats));
+	stats->interval = ddos->interval > 0 ? ddos->interval : CGPSDDOS_INTERVAL;
+	if(sessions < 1 || !args->count) {
+		return 0;
+	}
+	if(threads > sessions) {
+		threads = sessions;
+	}
+	if(engine_init(&engine, args, ddos) < 0) {
+		engine_cleanup(&engine);
+		return -1;
+	}
+	if(engine.arrivals && (unsigned int)engine.narrivals < args->count) {
+		args->count = engine.narrivals;
+	}
+	engine.interval = stats->interval * 1000000LL;
+	engine.poisson = ddos->poisson;
+
+	if(!(workers = malloc(threads * sizeof(struct engine_worker))) ||
+	   !(pool = malloc(sessions * sizeof(struct engine_session))) ||
+	   !(idle = malloc(sessions * sizeof(struct engine_session *)))) {
+		die("failed alloc memory");
+	}
+	memset(workers, 0, threads * sizeof(struct engine_worker));
+	
+	engine.threads = threads;
+	
+	if(engine.arrivals) {
+		debug("starting %d event threads with %d sessions (replaying %d requests, speedup %.2f)",
+		      threads, sessions, engine.narrivals, ddos->replay.speedup);
+	} else if(ddos->rate) {
+		debug("starting %d event threads with %d sessions (%u requests/sec, %s arrivals)", 
+		      threads, sessions, ddos->rate, ddos->poisson ? "poisson" : "constant");
+	} else {
+		debug("starting %d event threads with %d sessions", threads, sessions);
+	}
+	engine.start = engine_clock();
+	
+	for(i = 0; i < threads; ++i) {
+		struct engine_worker *worker = &workers[i];
+
+		worker->engine = &engine;
+		worker->sessions = pool + used;
+		worker->idle = idle + used;
+		worker->nsessions = sessions / threads + (i < sessions % threads);
+		worker->quota = args->count / threads + ((unsigned int)i < args->count % threads);
+		worker->seed = getpid() + i;
+		if(engine.arrivals) {
+			worker->arrival = i;
+			worker->next = worker->quota ? engine.arrivals[i].at : 0.0;
+		} else if(ddos->rate) {
+			worker->gap = 1000000.0 * threads / ddos->rate;
+			worker->next = worker->gap * i / threads;
+		}
+		used += worker->nsessions;
+		for(j = 0; j < worker->nsessions; ++j) {
+			worker->sessions[j].sock = -1;
+			worker->sessions[j].state = ENGINE_STATE_IDLE;
+			worker->sessions[j].comp = NULL;
+			worker->sessions[j].zbuf = NULL;
+			worker->idle[worker->nidle++] = &worker->sessions[worker->nsessions - j - 1];
+		}
+		if((worker->epfd = epoll_create(worker->nsessions)) < 0) {
+			die("failed create epoll instance");
+		}
+		if(pthread_create(&worker->thread, NULL, engine_worker_run, worker) != 0) {
+			die("failed create event thread");
+		}
+	}
+
+	for(i = 0; i < threads; ++i) {
+		struct cgpsddos_stats *ws = &workers[i].stats;
+		
+		pthread_join(workers[i].thread, NULL);
+		close(workers[i].epfd);
+		
+		stats->finished += ws->finished;
+		stats->failed += ws->failed;
+		stats->dropped += ws->dropped;
+		for(j = 0; j < CGPSDDOS_ERRNO_MAX; ++j) {
+			stats->errors[j] += ws->errors[j];
+		}
+		
+		if(ws->nwindows > stats->nwindows) {
+			if(!(stats->windows = realloc(stats->windows, ws->nwindows * sizeof(struct hdr_histogram)))) {
+				die("failed alloc memory");
+			}
+			while(stats->nwindows < ws->nwindows) {
+				if(hdr_init(&stats->windows[stats->nwindows++], CGPSDDOS_HDR_LOWEST,
+					    CGPSDDOS_HDR_HIGHEST, CGPSDDOS_HDR_SIGFIGS) < 0) {
+					die("failed alloc memory");
+				}
+			}
+		}
+		for(j = 0; j < ws->nwindows; ++j) {
+			hdr_add(&stats->windows[j], &ws->windows[j]);
+		}
+		cgpsddos_stats_free(ws);
+	}
+	debug("all event threads has finished");
+
+	free(idle);
+	free(pool);
+	free(workers);
+	engine_cleanup(&engine);
+	return 0;
+}
+
+#else
+
+int cgpsddos_engine_run(struct options *args, const struct cgpsddos *ddos, int sessions, int threads, struct cgpsddos_stats *stats)
+{
+	memset(stats, 0, sizeof(struct cgpsddos_stats));
+	if(args && ddos && sessions && threads) {
+		logerr("epoll support not compiled in");
+	}
+	return -1;
+}
+
+#endif /* HAVE_SYS_EPOLL_H */
+
+void cgpsddos_stats_free(struct cgpsddos_stats *stats)
+{
+	int i;
+
+	for(i = 0; i < stats->nwindows; ++i) {
+		hdr_free(&stats->windows[i]);
+	}
+	free(stats->windows);
+	stats->windows = NULL;
+	stats->nwindows = 0;
+}
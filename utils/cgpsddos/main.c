@@ -73,6 +73,18 @@ static void exit_handler(void)
 		if(ddos->slaves) {
 			free(ddos->slaves);
 		}
+		if(ddos->output) {
+			free(ddos->output);
+		}
+		if(ddos->trace) {
+			free(ddos->trace);
+		}
+		if(ddos->cache) {
+			free(ddos->cache);
+		}
+		if(ddos->replay.trace) {
+			free(ddos->replay.trace);
+		}
 		free(ddos);
 		ddos = NULL;
 	}
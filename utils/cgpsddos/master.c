@@ -42,7 +42,6 @@
 # include <fcntl.h>
 #endif
 #include <poll.h>
-#include <sys/sendfile.h>
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
@@ -53,6 +52,12 @@
 #include "cgpsddos.h"
 #include "cgpssqp.h"
 
+/*
+ * Time to wait for late messages (histograms) after all slaves reported.
+ */
+#define CGPSDDOS_DRAIN_TIMEOUT 500       /* milliseconds */
+#define CGPSDDOS_MASTER_RCVBUF 1048576   /* socket receive buffer */
+
 /*
  * Cleanup slave data.
  */
@@ -83,6 +88,7 @@ static int slave_compare(void *data1, void *data2)
 static void create_master_socket(struct cgpsddos *ddos)
 {
 	char port[6];
+	int rcvbuf = CGPSDDOS_MASTER_RCVBUF;
 
 	if(!ddos->family) {
 		ddos->family = AF_UNSPEC;
@@ -97,6 +103,9 @@ static void create_master_socket(struct cgpsddos *ddos)
 	if(ddos->opts->ipsock < 0) {
 		die("failed create master socket");
 	}
+	if(setsockopt(ddos->opts->ipsock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0) {
+		logwarn("failed set socket receive buffer size");
+	}
 	debug("master socket created");
 }
 
@@ -124,29 +133,151 @@ static int send_message(struct cgpsddos *ddos, struct cgpspeer *peer, const char
 }
 
 /*
- * Try send file.
+ * Log failed send to slave.
+ */
+static void send_failed(const struct sockaddr *sockaddr, socklen_t addrlen, const char *what)
+{
+	char host[NI_MAXHOST];
+	int res;
+	
+	if((res = getnameinfo(sockaddr, addrlen, host, sizeof(host), NULL, 0, NI_NUMERICHOST)) != 0) {
+		logerr("failed resolve peer address (%s)", gai_strerror(res));
+		snprintf(host, sizeof(host), "peer");
+	}
+	logerr("failed send %s to %s", what, host);
+}
+
+/*
+ * Announce the input data (if any) to slave. The slave fetches the data
+ * from our file server (unless cached).
  */
-static int send_file(int sock, const struct sockaddr *addr, socklen_t addrlen, const char *path, off_t size)
+static void send_data(struct cgpsddos *ddos, const struct sockaddr *sockaddr, socklen_t addrlen)
 {
-	int fd;
+	const struct cgpsddos_file *file = &ddos->server.files[CGPSDDOS_FILE_DATA];
+	char msg[CGPSDDOS_BUFF_LEN];
 	
-	if((fd = open(path, 0, O_RDONLY)) < 0) {
-		logerr("failed open %s for reading", path);
-		return -1;
+	debug("sending data option (%s)", file->path ? file->path : "none");
+	
+	snprintf(msg, sizeof(msg), "data: %lu %016llx\n", (unsigned long)file->size, 
+		 (unsigned long long)file->checksum);
+	if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), sockaddr, addrlen) < 0) {
+		send_failed(sockaddr, addrlen, "data option");
+	}
+}
+
+/*
+ * Announce the trace to slave. The slave replays records part, part + parts,
+ * ... of the trace.
+ */
+static void send_trace(struct cgpsddos *ddos, const struct sockaddr *sockaddr, socklen_t addrlen, int part, int parts)
+{
+	const struct cgpsddos_file *file = &ddos->server.files[CGPSDDOS_FILE_TRACE];
+	char msg[CGPSDDOS_BUFF_LEN];
+	
+	debug("sending replay option %s (part %d of %d)", file->path, part + 1, parts);
+	
+	snprintf(msg, sizeof(msg), "replay: %d %d %f %lu %016llx\n", part, parts, ddos->replay.speedup, 
+		 (unsigned long)file->size, (unsigned long long)file->checksum);
+	if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), sockaddr, addrlen) < 0) {
+		send_failed(sockaddr, addrlen, "replay option");
+	}
+}
+
+/*
+ * Add histogram message from slave to window histograms.
+ */
+static void master_histogram(char *value, struct hdr_histogram **windows, int *nwindows)
+{
+	char *token, *saveptr = NULL;
+	int window, index;
+	long long count;
+
+	if(!value || !(token = strtok_r(value, " ", &saveptr))) {
+		return;
+	}
+	window = strtol(token, NULL, 10);
+	if(window < 0) {
+		return;
+	}
+	if(window >= *nwindows) {
+		struct hdr_histogram *ptr;
+		
+		if(!(ptr = realloc(*windows, (window + 1) * sizeof(struct hdr_histogram)))) {
+			die("failed alloc memory");
+		}
+		*windows = ptr;
+		while(*nwindows <= window) {
+			if(hdr_init(&(*windows)[(*nwindows)++], CGPSDDOS_HDR_LOWEST, 
+				    CGPSDDOS_HDR_HIGHEST, CGPSDDOS_HDR_SIGFIGS) < 0) {
+				die("failed alloc memory");
+			}
+		}
 	}
+	while((token = strtok_r(NULL, " ", &saveptr))) {
+		if(sscanf(token, "%d=%lld", &index, &count) == 2) {
+			hdr_record_index(&(*windows)[window], index, count);
+		}
+	}
+}
+
+static void master_report_line(FILE *fs, const char *label, const struct hdr_histogram *hdr, double seconds)
+{
+	fprintf(fs, "%8s %9lld %9.1f %9.3f %9.3f %9.3f %9.3f %9.3f\n", label, hdr->total, 
+		seconds > 0.0 ? hdr->total / seconds : 0.0,
+		hdr_value_at_percentile(hdr, 50.0) / 1000.0,
+		hdr_value_at_percentile(hdr, 90.0) / 1000.0,
+		hdr_value_at_percentile(hdr, 99.0) / 1000.0,
+		hdr_value_at_percentile(hdr, 99.9) / 1000.0,
+		hdr->max / 1000.0);
+}
+
+/*
+ * Print cluster-wide latency percentiles (ms) for each time window and for 
+ * the whole run. The percentile distribution of the whole run is written 
+ * to the output file (if requested).
+ */
+static void master_report(struct cgpsddos *ddos, struct hdr_histogram *windows, int nwindows)
+{
+	struct hdr_histogram total;
+	char label[16];
+	FILE *fs;
+	int i;
 
-	if(connect(sock, addr, addrlen) < 0) {
-		logerr("failed connect to peer");
-		close(fd);
-		return -1;
+	if(hdr_init(&total, CGPSDDOS_HDR_LOWEST, CGPSDDOS_HDR_HIGHEST, CGPSDDOS_HDR_SIGFIGS) < 0) {
+		die("failed alloc memory");
+	}
+	for(i = 0; i < nwindows; ++i) {
+		hdr_add(&total, &windows[i]);
 	}
-	if(sendfile(sock, fd, NULL, size) < 0) {
-		logerr("failed send file to slave");
-		close(fd);
-		return -1;
+	if(!ddos->opts->quiet) {
+		printf("%8s %9s %9s %9s %9s %9s %9s %9s\n", "window", "requests", "req/s", 
+		       "p50", "p90", "p99", "p99.9", "max");
+		for(i = 0; i < nwindows; ++i) {
+			snprintf(label, sizeof(label), "%ds", i * ddos->interval);
+			master_report_line(stdout, label, &windows[i], ddos->interval);
+		}
+		master_report_line(stdout, "total", &total, nwindows * ddos->interval);
+		printf("(latency in milliseconds, %s)\n", ddos->rate || ddos->trace ? 
+		       "measured from scheduled arrival" : "closed loop");
 	}
-	close(fd);
-	return 0;
+	if(ddos->output) {
+		if(!(fs = fopen(ddos->output, "w"))) {
+			logerr("failed open output file %s", ddos->output);
+		} else {
+			if(ddos->trace) {
+				fprintf(fs, "#[Cgpsddos target=%s replay=%s speedup=%.2f interval=%d windows=%d]\n",
+					ddos->opts->ipaddr, ddos->trace, ddos->replay.speedup,
+					ddos->interval, nwindows);
+			} else {
+				fprintf(fs, "#[Cgpsddos target=%s rate=%u arrival=%s interval=%d windows=%d]\n",
+					ddos->opts->ipaddr, ddos->rate, ddos->poisson ? "poisson" : "constant",
+					ddos->interval, nwindows);
+			}
+			hdr_percentiles_print(&total, fs, 5, 1000.0);
+			fclose(fs);
+		}
+	}
+	hdr_free(&total);
 }
 
 /*
@@ -159,12 +290,17 @@ void run_master(struct cgpsddos *ddos)
 	FILE *fs;	
 	struct cgpspeer *peer;
 	struct dllist slaves;
+	struct hdr_histogram *windows = NULL;
 	char msg[CGPSDDOS_BUFF_LEN];
+	int nwindows = 0, reported = 0, replayed = 0, expected, i;
 	
 	if(ddos->opts->verbose) {
 		loginfo("running in master mode");
 	}
 	create_master_socket(ddos);
+	if(cgpsddos_server_start(ddos) < 0) {
+		die("failed start file server");
+	}
 	
 	if(ddos->slaves) {
 		fs = fopen(ddos->slaves, "r");
@@ -202,13 +338,14 @@ void run_master(struct cgpsddos *ddos)
 		}
 	}
 
+	expected = dllist_count(&slaves);
+
 	ddos->opts->state = CGPSDDOS_STATE_LOOP;
 	while(!cgpsddos_quit(ddos->opts->state)) {
 		char host[NI_MAXHOST];
 		struct sockaddr_storage sockaddr;
 		socklen_t addrlen;
 		struct request_option req;
-		struct stat st;
 		struct pollfd fds;
 		nfds_t nfds = 1;
 		int res;
@@ -216,7 +353,7 @@ void run_master(struct cgpsddos *ddos)
 		fds.events = POLLIN;
 		fds.fd = ddos->opts->ipsock;
 		
-		res = poll(&fds, nfds, ddos->timeout * 1000);
+		res = poll(&fds, nfds, reported < expected ? ddos->timeout * 1000 : CGPSDDOS_DRAIN_TIMEOUT);
 		switch(res) {
 		case -1:
 			if(cgpsddos_quit(ddos->opts->state)) {
@@ -226,7 +363,9 @@ void run_master(struct cgpsddos *ddos)
 			}
 			break;
 		case 0:
-			logerr("no client response within %d seconds, exiting", ddos->timeout);
+			if(reported < expected) {
+				logerr("no client response within %d seconds, exiting", ddos->timeout);
+			}
 			ddos->opts->state = CGPSDDOS_STATE_QUIT;
 			break;
 		default:
@@ -296,9 +435,9 @@ void run_master(struct cgpsddos *ddos)
 				break;
 			case CGPSP_PROTO_COUNT:
 				debug("received count ack");
-				debug("sending format option (%d)", ddos->opts->cgps->format);
+				debug("sending format option (%d, compress %d)", ddos->opts->cgps->format, ddos->opts->compress);
 				
-				snprintf(msg, sizeof(msg), "format: %d\n", ddos->opts->cgps->format);
+				snprintf(msg, sizeof(msg), "format: %d %d\n", ddos->opts->cgps->format, ddos->opts->compress);
 				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), 
 					      (const struct sockaddr *)&sockaddr, 
 					      addrlen) < 0) {
@@ -313,14 +452,10 @@ void run_master(struct cgpsddos *ddos)
 				break;
 			case CGPSP_PROTO_FORMAT:
 				debug("received format ack");
-				debug("sending data (%s)", ddos->opts->data);
-
-				if(stat(ddos->opts->data, &st) < 0) {
-					logerr("failed stat %s", ddos->opts->data);
-					continue;
-				}
+				debug("sending rate option (%u)", ddos->rate);
 				
-				snprintf(msg, sizeof(msg), "data: %lu\n", st.st_size);
+				snprintf(msg, sizeof(msg), "rate: %u %s %d\n", ddos->rate, 
+					 ddos->poisson ? "poisson" : "constant", ddos->interval);
 				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), 
 					      (const struct sockaddr *)&sockaddr, 
 					      addrlen) < 0) {
@@ -332,21 +467,19 @@ void run_master(struct cgpsddos *ddos)
 					}
 					logerr("failed send to %s", host);
 				}
-				
-				if(send_file(ddos->opts->ipsock, 
-					     (const struct sockaddr *)&sockaddr,
-					     addrlen,
-					     ddos->opts->data, 
-					     st.st_size) < 0) {
-					if((res = getnameinfo((const struct sockaddr *)&sockaddr, addrlen,
-							      host, sizeof(host), 
-							      NULL, 0, NI_NUMERICHOST)) != 0) {
-						logerr("failed resolve peer address (%s)", gai_strerror(res));
-						snprintf(host, sizeof(host), "peer");
-					}
-					logerr("failed send data file to %s", host);
+				break;
+			case CGPSP_PROTO_RATE:
+				debug("received rate ack");
+				if(ddos->trace) {
+					send_trace(ddos, (const struct sockaddr *)&sockaddr, addrlen, replayed++, expected);
+				} else {
+					send_data(ddos, (const struct sockaddr *)&sockaddr, addrlen);
 				}
 				break;
+			case CGPSP_PROTO_REPLAY:
+				debug("received replay ack");
+				send_data(ddos, (const struct sockaddr *)&sockaddr, addrlen);
+				break;
 			case CGPSP_PROTO_LOAD:
 				debug("received data ack");
 				debug("sending start command");
@@ -376,9 +509,13 @@ void run_master(struct cgpsddos *ddos)
 					loginfo("slave %s has started (waiting for result)", host);
 				}
 				break;
+			case CGPSP_PROTO_HISTOGRAM:
+				master_histogram(req.value, &windows, &nwindows);
+				break;
 			case CGPSP_PROTO_PREDICT:
 				debug("recived predict result");
 				loginfo("predict: %s", req.value);
+				++reported;
 				break;
 			case CGPSP_PROTO_ERROR:
 				logerr("slave: %s", req.value);
@@ -394,5 +531,15 @@ void run_master(struct cgpsddos *ddos)
 		}
 	}
 	
+	cgpsddos_server_stop(ddos);
+	
+	if(reported) {
+		master_report(ddos, windows, nwindows);
+	}
+	for(i = 0; i < nwindows; ++i) {
+		hdr_free(&windows[i]);
+	}
+	free(windows);
+	
 	debug("finished run_master()");
 }
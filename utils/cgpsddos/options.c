@@ -42,10 +42,14 @@
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 #include <getopt.h>
 
 #include "cgpsddos.h"
 #include "cgpssqp.h"
+#include "compress.h"
 
 static void usage(const char *prog, const char *section)
 {
@@ -65,13 +69,21 @@ static void usage(const char *prog, const char *section)
 		printf("  -i, --data=path:    Raw data input file\n");
 		printf("  -r, --result=str:   Colon separated list of results to show (see -h result)\n");
 		printf("  -f, --format=str:   Set ouput format (either plain or xml)\n");
+		printf("  -z, --compress=str: Compress the streams (either lz4 or zstd)\n");
 		printf("  -w, --timeout=num:  Timeout waiting for peer response [%d]\n", CGPSDDOS_PEER_TIMEOUT);
 		printf("  -n, --count=num:    Repeate prediction num times\n");
+		printf("  -R, --rate=num:     Requests per second on each slave (0 = closed loop) [0]\n");
+		printf("  -P, --poisson:      Use Poisson instead of constant arrivals (with -R)\n");
+		printf("  -I, --interval=sec: Latency histogram window [%d]\n", CGPSDDOS_INTERVAL);
+		printf("  -o, --output=path:  Write latency distribution (hgrm format) to file\n");
+		printf("  -T, --trace=path:   Replay requests recorded by cgpsd --trace\n");
+		printf("  -S, --speedup=num:  Divide time between replayed requests by num [1.0]\n");
 		printf("\n");
 		printf("Slave options:\n");
 		printf("  -s, --slave:        Run as DDOS slave\n");
 		printf("  -a, --accept=host:  Only accept connections from this master host\n");
 		printf("  -p, --port=num:     Listen on port [%d]\n", CGPSDDOS_SLAVE_PORT);
+		printf("  -C, --cache=dir:    Cache data and traces from master [%s-uid]\n", CGPSDDOS_CACHE_DIR);
 		printf("\n");
 		printf("Local options:\n");
 		printf("  -u, --sock[=path]:  Connect to UNIX socket [%s]\n", CGPSD_DEFAULT_SOCK);
@@ -147,6 +159,14 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 		{ "sock",    2, 0, 'u' },
 		{ "timeout", 1, 0, 'w' },
 		{ "count",   1, 0, 'n' },
+		{ "rate",    1, 0, 'R' },
+		{ "poisson", 0, 0, 'P' },
+		{ "interval", 1, 0, 'I' },
+		{ "output",  1, 0, 'o' },
+		{ "trace",   1, 0, 'T' },
+		{ "speedup", 1, 0, 'S' },
+		{ "cache",   1, 0, 'C' },
+		{ "compress", 1, 0, 'z' },
 #if ! defined(NDEBUG)
 		{ "debug",   0, 0, 'd' },
 #endif
@@ -157,7 +177,7 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 	};
 	int optindex, c;
 
-	while((c = getopt_long(argc, argv, "46a:c:df:h::t:i:mn:p:qr:su:w:vV", options, &optindex)) != -1) {
+	while((c = getopt_long(argc, argv, "46a:c:C:df:h::t:i:I:mn:o:p:Pqr:R:sS:T:u:w:vVz:", options, &optindex)) != -1) {
 		switch(c) {
 		case '4':
 			ddos->family = AF_INET;
@@ -179,6 +199,13 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 			}
 			strcpy(ddos->slaves, optarg);
 			break;
+		case 'C':
+			ddos->cache = malloc(strlen(optarg) + 1);
+			if(!ddos->cache) {
+				die("failed alloc memory");
+			}
+			strcpy(ddos->cache, optarg);
+			break;
 #if ! defined(NDEBUG)
 		case 'd':
 			ddos->opts->debug++;
@@ -203,12 +230,28 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 			}
 			strcpy(ddos->opts->data, optarg);
 			break;
+		case 'I':
+			ddos->interval = strtoul(optarg, NULL, 10);
+			if(ddos->interval < 1) {
+				die("the interval (-I) must be at least one second");
+			}
+			break;
 		case 'm':
 			ddos->mode = CGPSDDOS_MASTER;
 			break;
 		case 'n':
 			ddos->opts->count = strtoul(optarg, NULL, 10);
 			break;
+		case 'o':
+			ddos->output = malloc(strlen(optarg) + 1);
+			if(!ddos->output) {
+				die("failed alloc memory");
+			}
+			strcpy(ddos->output, optarg);
+			break;
+		case 'P':
+			ddos->poisson = 1;
+			break;
 		case 'p':
 #ifdef HAVE_STRTOL
 			ddos->opts->port = strtol(optarg, NULL, 10);
@@ -225,9 +268,24 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 		case 'r':
 			ddos->opts->cgps->result = cgps_get_predict_mask(optarg);
 			break;
+		case 'R':
+			ddos->rate = strtoul(optarg, NULL, 10);
+			break;
 		case 's':
 			ddos->mode = CGPSDDOS_SLAVE;
 			break;
+		case 'S':
+			if((ddos->replay.speedup = strtod(optarg, NULL)) <= 0.0) {
+				die("the speedup (-S) must be a positive number");
+			}
+			break;
+		case 'T':
+			ddos->trace = malloc(strlen(optarg) + 1);
+			if(!ddos->trace) {
+				die("failed alloc memory");
+			}
+			strcpy(ddos->trace, optarg);
+			break;
 		case 't':
 			ddos->opts->ipaddr = malloc(strlen(optarg) + 1);
 			if(!ddos->opts->ipaddr) {
@@ -256,6 +314,11 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 		case 'w':
 			ddos->timeout = strtoul(optarg, NULL, 10);
 			break;
+		case 'z':
+			if((ddos->opts->compress = cgps_compress_value(optarg)) < 0) {
+				die("compression method '%s' is unknown or not supported by this build", optarg);
+			}
+			break;
 		case '?':
 			exit(1);
 		}
@@ -267,12 +330,33 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 	if(ddos->accept && ddos->mode != CGPSDDOS_SLAVE) {
 		die("the accept connections option (-a) is only valid in slave mode");
 	}
+	if(ddos->cache && ddos->mode != CGPSDDOS_SLAVE) {
+		die("the cache option (-C) is only valid in slave mode");
+	}
 	if(ddos->slaves && ddos->mode != CGPSDDOS_MASTER) {
 		die("the slaves file option (-c) is only valid in master mode");
 	}
 	if(ddos->opts->cgps->format && ddos->mode == CGPSDDOS_SLAVE) {
 		die("the format option (-f) is only valid in master or local mode");
 	}
+	if(ddos->opts->compress && ddos->mode != CGPSDDOS_MASTER) {
+		die("the compress option (-z) is only valid in master mode");
+	}
+	if((ddos->rate || ddos->poisson || ddos->interval || ddos->output) && ddos->mode != CGPSDDOS_MASTER) {
+		die("the rate, poisson, interval and output options (-R, -P, -I and -o) are only valid in master mode");
+	}
+	if((ddos->trace || ddos->replay.speedup) && ddos->mode != CGPSDDOS_MASTER) {
+		die("the trace and speedup options (-T and -S) are only valid in master mode");
+	}
+	if(ddos->replay.speedup && !ddos->trace) {
+		die("the speedup option (-S) requires a trace (-T)");
+	}
+	if(ddos->trace && ddos->rate) {
+		die("the rate option (-R) can't be used when replaying a trace (-T)");
+	}
+	if(ddos->poisson && !ddos->rate) {
+		die("the poisson option (-P) requires an arrival rate (-R)");
+	}
 	if(ddos->opts->ipaddr && ddos->mode != CGPSDDOS_MASTER) {
 		die("the target host option (-t) is only valid in master mode");
 	}
@@ -292,13 +376,13 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 		die("the address family option (-4 or -6) is not valid in local mode");
 	}
 	if(ddos->mode == CGPSDDOS_MASTER) {
-		if(!ddos->opts->data) {
+		if(!ddos->opts->data && !ddos->trace) {
 			die("input data option (-i) is missing, see --help");
 		}
 		if(!ddos->opts->ipaddr) {
 			die("target host option (-t) is missing, see --help");
 		}
-		if(!ddos->opts->cgps->result) {
+		if(!ddos->opts->cgps->result && !ddos->trace) {
 			die("result set option (-r) is missing, see --help");
 		}
 	}
@@ -307,6 +391,13 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 			logwarn("no master host defined (-a), see --help");
 			logwarn("will accept connections from any host!");
 		}
+		if(!ddos->cache) {
+			ddos->cache = malloc(strlen(CGPSDDOS_CACHE_DIR) + 16);
+			if(!ddos->cache) {
+				die("failed alloc memory");
+			}
+			sprintf(ddos->cache, "%s-%d", CGPSDDOS_CACHE_DIR, (int)getuid());
+		}
 	}
 	if(ddos->mode == CGPSDDOS_LOCAL) {
 		if(!ddos->opts->unaddr) {
@@ -340,6 +431,12 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 	if(!ddos->timeout) {
 		ddos->timeout = CGPSDDOS_PEER_TIMEOUT;
 	}
+	if(!ddos->interval) {
+		ddos->interval = CGPSDDOS_INTERVAL;
+	}
+	if(!ddos->replay.speedup) {
+		ddos->replay.speedup = 1.0;
+	}
 	if(!ddos->opts->count) {
 		ddos->opts->count = 1;
 	}
@@ -372,16 +469,28 @@ void parse_options(int argc, char **argv, struct cgpsddos *ddos)
 		if(ddos->slaves) {
 			debug("  reading slaves from file %s", ddos->slaves);
 		}
+		if(ddos->cache) {
+			debug("  caching fetched files in %s", ddos->cache);
+		}
 		if(ddos->opts->cgps->format) {
 			debug("  requested %s as output format", 
 			      ddos->opts->cgps->format == CGPS_OUTPUT_FORMAT_PLAIN ? "plain" : "xml");
 		}
+		if(ddos->opts->compress) {
+			debug("  requested %s compressed streams", cgps_compress_name(ddos->opts->compress));
+		}
 		if(ddos->opts->data) {
 			debug("  reading prediction data from %s", ddos->opts->data);
 		}
 		if(ddos->timeout) {
 			debug("  timeout waiting for peer %ds", ddos->timeout);
 		}
+		if(ddos->rate) {
+			debug("  arrival rate %u requests/sec (%s)", ddos->rate, ddos->poisson ? "poisson" : "constant");
+		}
+		if(ddos->trace) {
+			debug("  replay trace %s (speedup %.2f)", ddos->trace, ddos->replay.speedup);
+		}
 		debug("  flags: debug = %s, verbose = %s", 
 		      (ddos->opts->debug   ? "yes" : "no"), 
 		      (ddos->opts->verbose ? "yes" : "no"));
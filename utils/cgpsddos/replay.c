@@ -0,0 +1,274 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Requests sent by the event engine. In replay mode, the requests are read
+ * from a trace recorded by cgpsd (cgpsd --trace) and started at the time
+ * they arrived to cgpsd (relative to the first request in the trace and
+ * divided by the speedup factor).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#include <ctype.h>
+#include <chemgps.h>
+
+#include "cgpsddos.h"
+#include "cgpssqp.h"
+#include "trace.h"
+#include "binary.h"
+
+char * cgpsddos_request(int result, int format, size_t *size)
+{
+	const struct cgps_result_entry *entry;
+	char *buff = NULL;
+	FILE *fs;
+	int delim = 0;
+
+	if(!(fs = open_memstream(&buff, size))) {
+		return NULL;
+	}
+	fprintf(fs, "CGPSP %s (%s: client ready)\nPredict: ", CGPSP_PROTO_VERSION, opts->prog);
+	for(entry = cgps_result_entry_list; entry->name; ++entry) {
+		if(cgps_result_isset(result, entry->value)) {
+			fprintf(fs, "%s%s", delim++ ? ":" : "", entry->name);
+		}
+	}
+	fprintf(fs, "\nFormat: %s\n", format == CGPS_OUTPUT_FORMAT_PLAIN ? "plain" : 
+		format == CGPS_OUTPUT_FORMAT_BINARY ? "binary" : "xml");
+	fclose(fs);
+	return buff;
+}
+
+/*
+ * The data is followed by an empty line (the server reads one line past
+ * the last observation).
+ */
+char * cgpsddos_load(const char *data, int rows, size_t *size)
+{
+	char *buff = NULL;
+	FILE *fs;
+	size_t len = strlen(data);
+
+	if(!(fs = open_memstream(&buff, size))) {
+		return NULL;
+	}
+	fprintf(fs, "Load: %d\n%s%s\n", rows, data, len && data[len - 1] != '\n' ? "\n" : "");
+	fclose(fs);
+	return buff;
+}
+
+/*
+ * Synthesize input data with rows number of observations for a record
+ * recorded without payload. The observations (and header) are taken from
+ * data, repeated as needed.
+ */
+static char * cgpsddos_replay_data(const char *data, int rows)
+{
+	const char *first = data, *curr, *next;
+	char *buff = NULL;
+	size_t size = 0;
+	FILE *fs;
+	int i;
+
+	if(*data && !isdigit(*data) && *data != '-') {
+		if(!(first = strchr(data, '\n'))) {
+			return NULL;
+		}
+		++first;
+	}
+	if(!*first) {
+		return NULL;
+	}
+	if(!(fs = open_memstream(&buff, &size))) {
+		return NULL;
+	}
+	fwrite(data, 1, first - data, fs);
+	for(i = 0, curr = first; i < rows; ++i, curr = next) {
+		if(!*curr) {
+			curr = first;
+		}
+		if((next = strchr(curr, '\n'))) {
+			fwrite(curr, 1, ++next - curr, fs);
+		} else {
+			next = curr + strlen(curr);
+			fprintf(fs, "%s\n", curr);
+		}
+	}
+	fclose(fs);
+	return buff;
+}
+
+/*
+ * Call func for each record replayed by this slave. Returns number of
+ * records or -1 on failure.
+ */
+static int cgpsddos_replay_scan(const struct cgpsddos_replay *replay, 
+				int (*func)(const struct cgps_trace_record *, long long, void *), void *arg)
+{
+	struct cgps_trace_record rec;
+	uint64_t first = 0;
+	FILE *fs;
+	int flags, res, index = 0, count = 0;
+
+	if(!replay->size || !(fs = fmemopen(replay->trace, replay->size, "r"))) {
+		return -1;
+	}
+	if(cgps_trace_read_header(fs, &flags) < 0) {
+		logerr("invalid trace file (bad header)");
+		fclose(fs);
+		return -1;
+	}
+	memset(&rec, 0, sizeof(struct cgps_trace_record));
+	while((res = cgps_trace_read(fs, &rec)) > 0) {
+		if(!index || rec.time < first) {
+			first = rec.time;
+		}
+		if(index++ % replay->parts == replay->part) {
+			++count;
+		}
+	}
+	if(res == 0 && func) {
+		rewind(fs);
+		cgps_trace_read_header(fs, &flags);
+		for(index = 0; (res = cgps_trace_read(fs, &rec)) > 0; ++index) {
+			if(index % replay->parts != replay->part) {
+				continue;
+			}
+			if(func(&rec, (rec.time - first) / replay->speedup, arg) < 0) {
+				res = -1;
+				break;
+			}
+		}
+	}
+	cgps_trace_cleanup(&rec);
+	fclose(fs);
+	
+	if(res < 0) {
+		logerr("failed read trace file (truncated record)");
+		return -1;
+	}
+	return count;
+}
+
+int cgpsddos_replay_count(const struct cgpsddos_replay *replay)
+{
+	return cgpsddos_replay_scan(replay, NULL, NULL);
+}
+
+struct replay_build
+{
+	struct cgpsddos_arrival *arrivals;
+	int count;
+	const char *data;
+};
+
+static int cgpsddos_replay_add(const struct cgps_trace_record *rec, long long at, void *arg)
+{
+	struct replay_build *build = arg;
+	struct cgpsddos_arrival *arrival = &build->arrivals[build->count];
+	char *data;
+	
+	arrival->at = at;
+	if(!(arrival->request = cgpsddos_request(rec->result, rec->format, &arrival->reqlen))) {
+		return -1;
+	}
+	if(rec->size) {
+		if(!(data = malloc(rec->size + 1))) {
+			free(arrival->request);
+			return -1;
+		}
+		memcpy(data, rec->data, rec->size);
+		data[rec->size] = '\0';
+	} else if(!(data = cgpsddos_replay_data(build->data, rec->rows))) {
+		logerr("the trace has no payload (and no input data available)");
+		free(arrival->request);
+		return -1;
+	}
+	arrival->load = cgpsddos_load(data, rec->rows, &arrival->loadlen);
+	free(data);
+	if(!arrival->load) {
+		free(arrival->request);
+		return -1;
+	}
+	++build->count;
+	return 0;
+}
+
+static int cgpsddos_replay_compare(const void *p1, const void *p2)
+{
+	const struct cgpsddos_arrival *a1 = p1, *a2 = p2;
+	
+	return a1->at < a2->at ? -1 : a1->at > a2->at;
+}
+
+struct cgpsddos_arrival * cgpsddos_replay_arrivals(const struct cgpsddos_replay *replay, const char *data, int *count)
+{
+	struct replay_build build;
+	int total;
+
+	if((total = cgpsddos_replay_count(replay)) < 0) {
+		return NULL;
+	}
+	memset(&build, 0, sizeof(struct replay_build));
+	build.data = data ? data : "";
+	if(!(build.arrivals = malloc((total + 1) * sizeof(struct cgpsddos_arrival)))) {
+		logerr("failed alloc memory");
+		return NULL;
+	}
+	if(cgpsddos_replay_scan(replay, cgpsddos_replay_add, &build) < 0) {
+		cgpsddos_replay_free(build.arrivals, build.count);
+		return NULL;
+	}
+	
+	/*
+	 * The records are written when finished, not in arrival order.
+	 */
+	qsort(build.arrivals, build.count, sizeof(struct cgpsddos_arrival), cgpsddos_replay_compare);
+	*count = build.count;
+	return build.arrivals;
+}
+
+void cgpsddos_replay_free(struct cgpsddos_arrival *arrivals, int count)
+{
+	int i;
+	
+	for(i = 0; i < count; ++i) {
+		free(arrivals[i].request);
+		free(arrivals[i].load);
+	}
+	free(arrivals);
+}
@@ -59,8 +59,8 @@ static int hostname_compare(void *data1, void *data2)
 	int res;
 	
 	res = strcmp(peer1->host, peer2->host);
-	if(!res) {
-		return 0;
+	if(res) {
+		return res;
 	}
 	return strcmp(peer1->serv, peer2->serv);
 }
@@ -206,7 +206,7 @@ void resolve_slaves(struct cgpsddos *ddos, struct dllist *slaves, FILE *fs)
 			} else {
 				debug("thread 0x%x: joined resolve thread", res->thread);				
 				if(addr) {
-					if(dllist_find(slaves, res->data->peer, hostname_compare, DLL_SEEK_HEAD)) {
+					if(dllist_find(slaves, res->data->peer, hostname_compare, DLL_SEEK_START)) {
 						logwarn("skipped duplicate hostname %s:%s (%s:%s) (already in the hosts list)",
 							res->data->peer->host, res->data->peer->serv,
 							res->data->peer->addr, res->data->peer->port);
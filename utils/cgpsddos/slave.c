@@ -41,26 +41,12 @@
 #ifdef HAVE_NETDB_H
 # include <netdb.h>
 #endif
-#include <poll.h>
-
-#ifdef HAVE_SYS_IOCTL_H
-# include <sys/ioctl.h>
-#endif
-#define LINUX_SIOCINQ 1
-#if defined(HAVE_LINUX_SOCKIOS_H) && defined(LINUX_SIOCINQ)
-# include <linux/sockios.h>    
-# define USE_IOCTL_SIOCINQ
-#elif defined(HAVE_FCNTL_H)
-# include <fcntl.h>
-# define USE_FCNTL_FIONREAD
-#else
-# error "No usable ioctl/fcntl found!"
-#endif
 
 #include "cgpsddos.h"
 #include "cgpssqp.h"
+#include "compress.h"
 
-extern int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args);
+extern int cgpsddos_run(int sock, const struct sockaddr *addr, socklen_t addrlen, struct options *args, const struct cgpsddos *ddos);
 
 /*
  * Creates a named UDP socket.
@@ -86,66 +72,6 @@ static void create_slave_socket(struct cgpsddos *ddos)
 	debug("slave socket created");
 }
 
-/*
- * Read size data from socket sock into buffer buff. Perhaps this code
- * belongs in receive_dgram() instead.
- */
-static int read_data(struct cgpsddos *ddos, int sock, char *buff, off_t size, struct sockaddr *addr, socklen_t *addrlen)
-{
-	off_t total = 0;
-	ssize_t bytes;
-	int res, avail;
-	struct pollfd fds;
-	nfds_t nfds = 1;
-	
-	while(total < size) {
-		avail = 0;
-		
-		fds.events = POLLIN;
-		fds.fd = ddos->opts->ipsock;
-		
-		res = poll(&fds, nfds, ddos->timeout * 1000);
-		if(res < 0) {
-			logerr("failed poll peer socket");
-			break;
-		} else if(res == 0) {
-			logerr("timeout waiting for peer data");
-			break;
-		} else {
-#if defined(USE_IOCTL_SIOCINQ)
-			if(ioctl(sock, SIOCINQ, &avail) < 0) {
-				logerr("failed SIOCINQ ioctl() call on socket");
-				break;
-			}
-#elif defined(USE_FCNTL_FIONREAD)
-			if(fcntl(sock, FIONREAD, &avail) < 0) {
-				logerr("failed FIONREAD fcntl() call on socket");
-				break;
-			}
-#endif
-			if(avail > (size - total)) {
-				avail = size - total;
-			}
-			if(ddos->opts->debug > 1) {
-				debug("going to read %d bytes of data from peer", avail);
-			}
-			bytes = receive_dgram(sock, buff + total, avail, addr, addrlen);
-			if(bytes < 0) {
-				break;
-			}
-			total += bytes;
-		}
-	}
-	
-	if(total < size) {
-		logerr("failed receive data (wanted: %d, got: %d bytes)", size, total);
-		return -1;
-	}
-	
-	debug("read %d bytes of data from peer", total);
-	return 0;
-}
-
 static void cleanup_args(struct options *args)
 {
 	debug("cleanup options...");
@@ -166,6 +92,14 @@ static void cleanup_args(struct options *args)
 	}
 }
 
+static void cleanup_replay(struct cgpsddos_replay *replay)
+{
+	if(replay->trace) {
+		free(replay->trace);
+	}
+	memset(replay, 0, sizeof(struct cgpsddos_replay));
+}
+
 /*
  * We should use dllist to store a new structure (A) for each new master
  * connection created at greeting time. Then we should call cgpsddos_run()
@@ -175,7 +109,8 @@ static void cleanup_args(struct options *args)
 void run_slave(struct cgpsddos *ddos)
 {	
 	struct options *args = NULL;
-	off_t size;
+	unsigned long long checksum;
+	unsigned long size;
 	
 	if(ddos->opts->verbose) {
 		loginfo("running in slave mode");
@@ -281,6 +216,10 @@ void run_slave(struct cgpsddos *ddos)
 					      addrlen) < 0) {
 					logerr("failed send to %s", host);
 				}
+				ddos->rate = 0;
+				ddos->poisson = 0;
+				ddos->interval = CGPSDDOS_INTERVAL;
+				cleanup_replay(&ddos->replay);
 				ddos->opts->state = CGPSDDOS_STATE_BUSY;
 			}
 			break;
@@ -329,6 +268,14 @@ void run_slave(struct cgpsddos *ddos)
 			debug("received format option");
 			
 			args->cgps->format = strtoul(req.value, NULL, 10);
+			if(sscanf(req.value, "%*d %d", &args->compress) != 1) {
+				args->compress = CGPS_COMPRESS_NONE;
+			}
+			if(args->compress && cgps_compress_value(cgps_compress_name(args->compress)) < 0) {
+				logwarn("compression method %s not supported by this build, using uncompressed streams", 
+					cgps_compress_name(args->compress));
+				args->compress = CGPS_COMPRESS_NONE;
+			}
 			
 			debug("sending format ack");
 			snprintf(msg, sizeof(msg), "format: ok");
@@ -351,22 +298,94 @@ void run_slave(struct cgpsddos *ddos)
 				logerr("failed send to %s", host);
 			}
 			break;
-		case CGPSP_PROTO_LOAD:
-			size = strtoul(req.value, NULL, 10);
-			debug("received data option (for %lu bytes)", size);
+		case CGPSP_PROTO_RATE:
+			debug("received rate option");
 			
-			args->data = malloc(size);
-			if(!args->data) {
-				snprintf(msg, sizeof(msg), "error: failed alloc memory");
+			/*
+			 * The value is "rate arrival interval" (i.e. "500 poisson 1").
+			 */
+			if(req.value) {
+				char arrival[16];
+				int interval;
+				
+				if(sscanf(req.value, "%u %15s %d", &ddos->rate, arrival, &interval) == 3) {
+					ddos->poisson = strcmp(arrival, "poisson") == 0;
+					ddos->interval = interval > 0 ? interval : CGPSDDOS_INTERVAL;
+				}
+			}
+			
+			debug("sending rate ack");
+			snprintf(msg, sizeof(msg), "rate: ok");
+			if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), 
+				      (const struct sockaddr *)&sockaddr, 
+				      addrlen) < 0) {
+				logerr("failed send to %s", host);
+			}
+			break;
+		case CGPSP_PROTO_REPLAY:
+			debug("received replay option");
+			
+			/*
+			 * The value is "part parts speedup size checksum" (i.e. "0 2 1.5
+			 * 40960 84c3...") and the trace is fetched from master.
+			 */
+			if(!req.value || sscanf(req.value, "%d %d %lf %lu %llx", &ddos->replay.part, &ddos->replay.parts, 
+						&ddos->replay.speedup, &size, &checksum) != 5 || 
+			   ddos->replay.parts < 1 || ddos->replay.speedup <= 0.0) {
+				snprintf(msg, sizeof(msg), "error: invalid replay option");
 				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg),
 					      (const struct sockaddr *)&sockaddr,
 					      addrlen) < 0) {
 					logerr("failed send to %s", host);
 				}
-				die("failed alloc memory");
+				continue;
 			}
-			if(read_data(ddos, ddos->opts->ipsock, args->data, size,
-				     (struct sockaddr *)&sockaddr, &addrlen) < 0) {
+			debug("fetching trace (%lu bytes, part %d of %d)", size, ddos->replay.part + 1, ddos->replay.parts);
+			
+			ddos->replay.trace = cgpsddos_fetch(ddos, (const struct sockaddr *)&sockaddr, addrlen, size, checksum);
+			ddos->replay.size = size;
+			if(!ddos->replay.trace || (res = cgpsddos_replay_count(&ddos->replay)) < 0) {
+				snprintf(msg, sizeof(msg), "error: failed read %lu bytes of trace", size);
+				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg),
+					      (const struct sockaddr *)&sockaddr,
+					      addrlen) < 0) {
+					logerr("failed send to %s", host);
+				}
+				cleanup_replay(&ddos->replay);
+				continue;
+			}
+			args->count = res;
+			
+			debug("sending replay ack (%d requests)", res);
+			snprintf(msg, sizeof(msg), "replay: ok");
+			if(send_dgram(ddos->opts->ipsock, msg, strlen(msg), 
+				      (const struct sockaddr *)&sockaddr, 
+				      addrlen) < 0) {
+				logerr("failed send to %s", host);
+			}
+			break;
+		case CGPSP_PROTO_LOAD:
+			/*
+			 * The value is "size checksum" and the data is fetched from
+			 * master (unless empty).
+			 */
+			if(!req.value || sscanf(req.value, "%lu %llx", &size, &checksum) != 2) {
+				snprintf(msg, sizeof(msg), "error: invalid data option");
+				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg),
+					      (const struct sockaddr *)&sockaddr,
+					      addrlen) < 0) {
+					logerr("failed send to %s", host);
+				}
+				continue;
+			}
+			debug("received data option (for %lu bytes)", size);
+			
+			if(!size) {
+				args->data = strdup("");
+			} else {
+				args->data = cgpsddos_fetch(ddos, (const struct sockaddr *)&sockaddr, addrlen, size, checksum);
+			}
+			if(!args->data) {
 				snprintf(msg, sizeof(msg), "error: failed read %lu bytes of data", size);
 				if(send_dgram(ddos->opts->ipsock, msg, strlen(msg),
 					      (const struct sockaddr *)&sockaddr,
@@ -399,7 +418,7 @@ void run_slave(struct cgpsddos *ddos)
 			debug("starting cgpsd session");
 			if(cgpsddos_run(ddos->opts->ipsock, 
 					(const struct sockaddr *)&sockaddr, 
-					addrlen, args) < 0) {
+					addrlen, args, ddos) < 0) {
 				logerr("the cgpsd session failed");
 			} else {
 				debug("finished cgpsd session");
@@ -408,6 +427,7 @@ void run_slave(struct cgpsddos *ddos)
 				loginfo("finished run of %d predictions from %s", args->count, host);
 			}
 			cleanup_args(args);
+			cleanup_replay(&ddos->replay);
 			args = NULL;
 			if(!cgpsddos_quit(opts->state)) {
 				ddos->opts->state = CGPSDDOS_STATE_FREE;
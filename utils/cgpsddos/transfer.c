@@ -0,0 +1,476 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Bulk transfer of the data and trace files from master to slaves. The 
+ * master serves the files on a TCP socket bound to the same port number 
+ * as its UDP socket. The files are announced by size and checksum in the 
+ * data and replay options, and fetched by the slaves (concurrently) with
+ * a "fetch: checksum" request. The slaves keeps fetched files in a cache 
+ * directory named by checksum, so unchanged files are only transfered 
+ * once between runs.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+#ifdef HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#ifdef HAVE_NETDB_H
+# include <netdb.h>
+#endif
+#include <sys/sendfile.h>
+#include <sys/time.h>
+#include <poll.h>
+
+#include "cgpsddos.h"
+#include "cgpssqp.h"
+
+#define CGPSDDOS_FNV_OFFSET 14695981039346656037ULL
+#define CGPSDDOS_FNV_PRIME  1099511628211ULL
+
+#define CGPSDDOS_TRANSFER_BACKLOG 64     /* pending fetch connections */
+#define CGPSDDOS_TRANSFER_POLL    500    /* check for quit (ms) */
+#define CGPSDDOS_TRANSFER_BUFFER  65536
+
+/*
+ * A fetch connection served by its own thread.
+ */
+struct transfer_peer
+{
+	struct cgpsddos_server *server;
+	int sock;
+};
+
+/*
+ * Returns the 64-bit FNV-1a checksum of buff continued from sum.
+ */
+static uint64_t transfer_checksum(const char *buff, size_t size, uint64_t sum)
+{
+	size_t i;
+	
+	for(i = 0; i < size; ++i) {
+		sum ^= (unsigned char)buff[i];
+		sum *= CGPSDDOS_FNV_PRIME;
+	}
+	return sum;
+}
+
+/*
+ * Compute size and checksum of file.
+ */
+static int transfer_checksum_file(const char *path, struct cgpsddos_file *file)
+{
+	char *buff;
+	ssize_t bytes;
+	int fd;
+	
+	if((fd = open(path, O_RDONLY)) < 0) {
+		logerr("failed open %s for reading", path);
+		return -1;
+	}
+	if(!(buff = malloc(CGPSDDOS_TRANSFER_BUFFER))) {
+		die("failed alloc memory");
+	}
+	file->path = path;
+	file->size = 0;
+	file->checksum = CGPSDDOS_FNV_OFFSET;
+	while((bytes = read(fd, buff, CGPSDDOS_TRANSFER_BUFFER)) != 0) {
+		if(bytes < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed read %s", path);
+			break;
+		}
+		file->checksum = transfer_checksum(buff, bytes, file->checksum);
+		file->size += bytes;
+	}
+	free(buff);
+	close(fd);
+	
+	return bytes < 0 ? -1 : 0;
+}
+
+static void transfer_timeout(int sock, int timeout)
+{
+	struct timeval tv;
+	
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	if(setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+	   setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0) {
+		logwarn("failed set socket timeout");
+	}
+}
+
+/*
+ * Send the requested file to slave. The connection is closed by the slave
+ * when the whole file is received (leaving TIME_WAIT on its side), so we 
+ * wait for end of file before closing.
+ */
+static void * transfer_serve(void *args)
+{
+	struct transfer_peer *peer = (struct transfer_peer *)args;
+	struct cgpsddos_server *server = peer->server;
+	const struct cgpsddos_file *file = NULL;
+	char buff[CGPSDDOS_BUFF_LEN];
+	unsigned long long checksum;
+	size_t used = 0;
+	ssize_t bytes;
+	off_t offset = 0;
+	int fd, i;
+	
+	transfer_timeout(peer->sock, server->timeout);
+	while(used < sizeof(buff) - 1 && !memchr(buff, '\n', used)) {
+		if((bytes = read(peer->sock, buff + used, sizeof(buff) - 1 - used)) <= 0) {
+			if(bytes < 0 && errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		used += bytes;
+	}
+	buff[used] = '\0';
+	
+	if(sscanf(buff, "fetch: %llx", &checksum) == 1) {
+		for(i = 0; i < CGPSDDOS_FILES; ++i) {
+			if(server->files[i].path && server->files[i].checksum == checksum) {
+				file = &server->files[i];
+			}
+		}
+	}
+	if(!file) {
+		logerr("invalid fetch request (%s)", buff);
+	} else if((fd = open(file->path, O_RDONLY)) < 0) {
+		logerr("failed open %s for reading", file->path);
+	} else {
+		debug("sending %s (%lu bytes)", file->path, (unsigned long)file->size);
+		while(offset < file->size) {
+			if((bytes = sendfile(peer->sock, fd, &offset, file->size - offset)) < 0 && errno == EINTR) {
+				continue;
+			}
+			if(bytes <= 0) {
+				logerr("failed send %s", file->path);
+				break;
+			}
+		}
+		close(fd);
+		while((bytes = read(peer->sock, buff, sizeof(buff))) > 0 || (bytes < 0 && errno == EINTR)) {
+			continue;
+		}
+	}
+	close(peer->sock);
+	free(peer);
+	
+	pthread_mutex_lock(&server->lock);
+	if(--server->active == 0) {
+		pthread_cond_signal(&server->idle);
+	}
+	pthread_mutex_unlock(&server->lock);
+	
+	return NULL;
+}
+
+/*
+ * Accept fetch connections until stopped.
+ */
+static void * transfer_accept(void *args)
+{
+	struct cgpsddos_server *server = (struct cgpsddos_server *)args;
+	struct transfer_peer *peer;
+	pthread_attr_t attr;
+	pthread_t thread;
+	struct pollfd fds;
+	int sock;
+	
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	
+	while(!server->done) {
+		fds.fd = server->sock;
+		fds.events = POLLIN;
+		if(poll(&fds, 1, CGPSDDOS_TRANSFER_POLL) <= 0) {
+			continue;
+		}
+		if((sock = accept(server->sock, NULL, NULL)) < 0) {
+			if(errno != EINTR && errno != EAGAIN) {
+				logerr("failed accept fetch connection");
+			}
+			continue;
+		}
+		if(!(peer = malloc(sizeof(struct transfer_peer)))) {
+			die("failed alloc memory");
+		}
+		peer->server = server;
+		peer->sock = sock;
+		
+		pthread_mutex_lock(&server->lock);
+		server->active++;
+		pthread_mutex_unlock(&server->lock);
+		if(pthread_create(&thread, &attr, transfer_serve, peer) != 0) {
+			logerr("failed create transfer thread");
+			close(sock);
+			free(peer);
+			pthread_mutex_lock(&server->lock);
+			server->active--;
+			pthread_mutex_unlock(&server->lock);
+		}
+	}
+	pthread_attr_destroy(&attr);
+	return NULL;
+}
+
+int cgpsddos_server_start(struct cgpsddos *ddos)
+{
+	struct cgpsddos_server *server = &ddos->server;
+	char port[6];
+	
+	if(ddos->opts->data) {
+		if(transfer_checksum_file(ddos->opts->data, &server->files[CGPSDDOS_FILE_DATA]) < 0) {
+			return -1;
+		}
+	}
+	if(ddos->trace) {
+		if(transfer_checksum_file(ddos->trace, &server->files[CGPSDDOS_FILE_TRACE]) < 0) {
+			return -1;
+		}
+	}
+	
+	snprintf(port, sizeof(port), "%d", ddos->opts->port);
+	if((server->sock = open_named_socket(ddos->family, SOCK_STREAM, NULL, port, AI_ADDRCONFIG | AI_PASSIVE)) < 0) {
+		logerr("failed create transfer socket (port %s)", port);
+		return -1;
+	}
+	if(listen(server->sock, CGPSDDOS_TRANSFER_BACKLOG) < 0) {
+		logerr("failed listen on transfer socket");
+		close(server->sock);
+		return -1;
+	}
+	
+	server->timeout = ddos->timeout;
+	server->active = 0;
+	server->done = 0;
+	pthread_mutex_init(&server->lock, NULL);
+	pthread_cond_init(&server->idle, NULL);
+	if(pthread_create(&server->thread, NULL, transfer_accept, server) != 0) {
+		logerr("failed create transfer thread");
+		close(server->sock);
+		return -1;
+	}
+	server->started = 1;
+	
+	debug("serving files on TCP port %s", port);
+	return 0;
+}
+
+void cgpsddos_server_stop(struct cgpsddos *ddos)
+{
+	struct cgpsddos_server *server = &ddos->server;
+	
+	if(!server->started) {
+		return;
+	}
+	server->done = 1;
+	pthread_join(server->thread, NULL);
+	close(server->sock);
+	
+	pthread_mutex_lock(&server->lock);
+	while(server->active) {
+		pthread_cond_wait(&server->idle, &server->lock);
+	}
+	pthread_mutex_unlock(&server->lock);
+	pthread_mutex_destroy(&server->lock);
+	pthread_cond_destroy(&server->idle);
+	server->started = 0;
+}
+
+/*
+ * Read cached file (if it exists and is valid).
+ */
+static char * transfer_cache_read(const char *path, size_t size, uint64_t checksum)
+{
+	struct stat st;
+	char *buff;
+	FILE *fs;
+	
+	if(stat(path, &st) < 0 || (size_t)st.st_size != size) {
+		return NULL;
+	}
+	if(!(fs = fopen(path, "r"))) {
+		return NULL;
+	}
+	if(!(buff = malloc(size + 1))) {
+		die("failed alloc memory");
+	}
+	if(fread(buff, 1, size, fs) != size || 
+	   transfer_checksum(buff, size, CGPSDDOS_FNV_OFFSET) != checksum) {
+		logwarn("ignoring invalid cache file %s", path);
+		free(buff);
+		buff = NULL;
+	}
+	fclose(fs);
+	return buff;
+}
+
+/*
+ * Save fetched file in cache. The file is written to a temporary file that
+ * is renamed, so a concurrent reader never sees a partial file.
+ */
+static void transfer_cache_write(const char *cache, const char *path, const char *buff, size_t size)
+{
+	char *temp;
+	FILE *fs;
+	
+	if(mkdir(cache, 0700) < 0 && errno != EEXIST) {
+		logwarn("failed create cache directory %s", cache);
+		return;
+	}
+	if(!(temp = malloc(strlen(path) + 16))) {
+		die("failed alloc memory");
+	}
+	sprintf(temp, "%s.%d", path, (int)getpid());
+	if(!(fs = fopen(temp, "w"))) {
+		logwarn("failed open cache file %s", temp);
+	} else {
+		if(fwrite(buff, 1, size, fs) != size || fclose(fs) != 0) {
+			logwarn("failed write cache file %s", temp);
+			unlink(temp);
+		} else if(rename(temp, path) < 0) {
+			logwarn("failed rename cache file %s", temp);
+			unlink(temp);
+		}
+	}
+	free(temp);
+}
+
+/*
+ * Fetch file from master over TCP.
+ */
+static char * transfer_fetch(const struct cgpsddos *ddos, const struct sockaddr *addr, socklen_t addrlen, size_t size, uint64_t checksum)
+{
+	char msg[CGPSDDOS_BUFF_LEN];
+	size_t total = 0;
+	ssize_t bytes;
+	char *buff;
+	int sock;
+	
+	if((sock = socket(addr->sa_family, SOCK_STREAM, 0)) < 0) {
+		logerr("failed create socket");
+		return NULL;
+	}
+	transfer_timeout(sock, ddos->timeout);
+	if(connect(sock, addr, addrlen) < 0) {
+		logerr("failed connect to master");
+		close(sock);
+		return NULL;
+	}
+	snprintf(msg, sizeof(msg), "fetch: %016llx\n", (unsigned long long)checksum);
+	if(write(sock, msg, strlen(msg)) < 0) {
+		logerr("failed send fetch request");
+		close(sock);
+		return NULL;
+	}
+	
+	if(!(buff = malloc(size + 1))) {
+		die("failed alloc memory");
+	}
+	while(total < size) {
+		if((bytes = read(sock, buff + total, size - total)) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			logerr("failed receive file");
+			break;
+		}
+		if(bytes == 0) {
+			break;
+		}
+		total += bytes;
+	}
+	close(sock);
+	
+	if(total < size) {
+		logerr("failed receive file (wanted: %lu, got: %lu bytes)", (unsigned long)size, (unsigned long)total);
+		free(buff);
+		return NULL;
+	}
+	if(transfer_checksum(buff, size, CGPSDDOS_FNV_OFFSET) != checksum) {
+		logerr("checksum mismatch for received file");
+		free(buff);
+		return NULL;
+	}
+	debug("received %lu bytes from master", (unsigned long)size);
+	return buff;
+}
+
+char * cgpsddos_fetch(const struct cgpsddos *ddos, const struct sockaddr *addr, socklen_t addrlen, size_t size, uint64_t checksum)
+{
+	char *path = NULL, *buff = NULL;
+	
+	if(ddos->cache) {
+		if(!(path = malloc(strlen(ddos->cache) + 20))) {
+			die("failed alloc memory");
+		}
+		sprintf(path, "%s/%016llx", ddos->cache, (unsigned long long)checksum);
+		if((buff = transfer_cache_read(path, size, checksum))) {
+			debug("using cached file %s", path);
+		}
+	}
+	if(!buff && (buff = transfer_fetch(ddos, addr, addrlen, size, checksum))) {
+		if(path) {
+			transfer_cache_write(ddos->cache, path, buff, size);
+		}
+	}
+	if(buff) {
+		buff[size] = '\0';
+	}
+	free(path);
+	return buff;
+}
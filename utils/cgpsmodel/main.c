@@ -0,0 +1,246 @@
+/* SIMCA-QP predictions for the ChemGPS project.
+ *
+ * Copyright (C) 2007-2018 Anders Lövgren and the Computing Department,
+ * Uppsala Biomedical Centre, Uppsala University.
+ * 
+ * Copyright (C) 2018-2019 Anders Lövgren, Nowise Systems
+ * ----------------------------------------------------------------------
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ * 
+ * ----------------------------------------------------------------------
+ *  Contact: Anders Lövgren <andlov@nowise.se>
+ * ----------------------------------------------------------------------
+ */
+
+/*
+ * Compile the numeric content of a project to a model file that is mapped
+ * by cgpsd and cgpsstd (see libcgpssqp/modelfile.c).
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#include <getopt.h>
+#include <libgen.h>
+#include <chemgps.h>
+
+#include "cgpssqp.h"
+#include "native.h"
+
+struct options *opts;
+
+static void usage(const char *prog)
+{
+	printf("%s - compile projects for the native prediction engine.\n", prog);
+	printf("\n");
+	printf("Usage: %s compile -f proj -o file [options...]\n", prog);
+	printf("       %s info file [options...]\n", prog);
+	printf("\n");
+	printf("Commands:\n");
+	printf("  compile:              Export the models of project to compiled model file\n");
+	printf("  info:                 Show the models of compiled model file\n");
+	printf("\n");
+	printf("Options:\n");
+	printf("  -f, --proj=path:      Project file (compile)\n");
+	printf("  -o, --output=path:    Compiled model file (compile)\n");
+#if ! defined(NDEBUG)
+	printf("  -d, --debug:          Enable debug output (allowed multiple times)\n");
+#endif
+	printf("  -v, --verbose:        Be more verbose in output\n");
+	printf("  -h, --help:           This help\n");
+	printf("  -V, --version:        Print version info to stdout\n");
+	printf("\n");
+	printf("The compiled model file is used in place of the project by cgpsd and cgpsstd,\n");
+	printf("that maps it without loading the project. All models must be supported by the\n");
+	printf("native engine (PCA or PLS) and only tps, t2rangeps, dmodxps and ypredps can be\n");
+	printf("predicted. Recompile after updating the project.\n");
+	printf("\n");
+	printf("This application is part of the ChemGPS project.\n");
+	printf("Send bug reports to %s\n", PACKAGE_BUGREPORT);
+}
+
+static void version(const char *prog)
+{
+	printf("%s - package %s %s\n", prog, PACKAGE_NAME, PACKAGE_VERSION);
+	printf("Compile projects for the native prediction engine.\n");
+	printf("\n");
+	printf(" * This program is distributed in the hope that it will be useful,\n");
+	printf(" * but WITHOUT ANY WARRANTY; without even the implied warranty of\n");
+	printf(" * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the\n");
+	printf(" * GNU General Public License for more details.\n");
+	printf("\n");
+	printf("The %s software is copyright (C) 2007-2018 by Anders Lövgren and BMC-IT, Uppsala University\n", PACKAGE_NAME);
+	printf("The %s software is copyright (C) 2018-2019 by Anders Lövgren, Nowise Systems\n", PACKAGE_NAME);
+	printf("This application is part of the ChemGPS project.\n");
+}
+
+void parse_options(int argc, char **argv, struct options *popt)
+{
+	static struct option options[] = {
+		{ "proj",      1, 0, 'f' },
+		{ "output",    1, 0, 'o' },
+#if ! defined(NDEBUG)
+		{ "debug",     0, 0, 'd' },
+#endif
+		{ "verbose",   0, 0, 'v' },
+		{ "help",      0, 0, 'h' },
+		{ "version",   0, 0, 'V' },
+		{ 0, 0, 0, 0 }
+	};
+	int optindex, c;
+
+	while((c = getopt_long(argc, argv, "df:ho:vV", options, &optindex)) != -1) {
+		switch(c) {
+#if ! defined(NDEBUG)
+		case 'd':
+			popt->debug++;
+			break;
+#endif
+		case 'f':
+			popt->proj = optarg;
+			break;
+		case 'h':
+			usage(popt->prog);
+			exit(0);
+		case 'o':
+			popt->output = optarg;
+			break;
+		case 'v':
+			popt->verbose++;
+			break;
+		case 'V':
+			version(popt->prog);
+			exit(0);
+		case '?':
+			exit(1);
+		}
+	}
+}
+
+static int compile_model(struct options *popt)
+{
+	struct cgps_project proj;
+	struct cgps_native *native;
+	int result;
+
+	popt->cgps->logger = cgps_syslog;
+	popt->cgps->indata = cgps_predict_data;
+	if(popt->debug > 1) {
+		popt->cgps->debug = popt->debug;
+		popt->cgps->verbose = popt->verbose;
+	}
+	
+	if(cgps_project_load(&proj, popt->proj, popt->cgps) != 0) {
+		die("failed load project %s", popt->proj);
+	}
+	debug("project got %d models", proj.models);
+	if(!(native = cgps_native_open(&proj, CGPS_NATIVE_ON))) {
+		cgps_project_close(&proj);
+		die("native prediction not supported by project %s", popt->proj);
+	}
+	if((result = cgps_native_save(native, popt->output)) == 0 && popt->verbose) {
+		loginfo("compiled %d models of %s to %s", native->models, popt->proj, popt->output);
+	}
+	cgps_native_close(native);
+	cgps_project_close(&proj);
+	return result;
+}
+
+static int show_model(const char *path)
+{
+	struct cgps_native *native;
+	const struct cgps_native_model *model;
+	const struct cgps_result_entry *entry;
+	int i;
+
+	if(!(native = cgps_native_load(path, CGPS_NATIVE_ON))) {
+		return -1;
+	}
+	printf("file:       %s (%lu bytes)\n", path, (unsigned long)native->size);
+	printf("models:     %d\n", native->models);
+	printf("variables:  %d\n", SQX_GetNumStringsInVector(&native->names));
+	printf("\n");
+	printf("%6s   %-5s %10s %11s %10s   %s\n", "model:", "type:", "variables:", "components:", "responses:", "results:");
+	for(i = 0; i < native->models; ++i) {
+		model = native->model[i];
+		printf("%6d   %-5s %10d %11d %10d  ", i + 1, model->ycols ? "PLS" : "PCA", 
+		       model->vars, model->comps, model->ycols);
+		for(entry = cgps_result_entry_list; entry->name; ++entry) {
+			if(entry->value != PREDICTED_RESULTS_ALL && cgps_result_isset(model->results, entry->value)) {
+				printf(" %s", entry->name);
+			}
+		}
+		printf("\n");
+	}
+	cgps_native_close(native);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *command;
+	int result;
+
+	if(!(opts = malloc(sizeof(struct options)))) {
+		fprintf(stderr, "%s: failed alloc memory\n", argv[0]);
+		return 1;
+	}
+	memset(opts, 0, sizeof(struct options));
+	if(!(opts->cgps = malloc(sizeof(struct cgps_options)))) {
+		die("failed alloc memory");
+	}
+	memset(opts->cgps, 0, sizeof(struct cgps_options));
+	opts->prog = basename(argv[0]);
+	opts->parent = getpid();
+	
+	parse_options(argc, argv, opts);
+	if(optind >= argc) {
+		die("missing command, see --help");
+	}
+	command = argv[optind++];
+	
+	if(strcmp(command, "compile") == 0) {
+		if(!opts->proj) {
+			die("project file option (-f) is missing, see --help");
+		}
+		if(!opts->output) {
+			die("output file option (-o) is missing, see --help");
+		}
+		result = compile_model(opts);
+	} else if(strcmp(command, "info") == 0) {
+		if(optind >= argc) {
+			die("missing compiled model file, see --help");
+		}
+		result = show_model(argv[optind]);
+	} else {
+		die("unknown command %s, see --help", command);
+	}
+	
+	free(opts->cgps);
+	free(opts);
+	return result == 0 ? 0 : 1;
+}